@@ -57,6 +57,11 @@ std::ostream& operator<<(std::ostream& os, const blk_access_mode_t buffered)
 
 void IOContext::aio_wait()
 {
+  if (reap_bdev) {
+    // our aios went to a queue nobody else reaps; poll it here rather
+    // than bouncing the completion through another thread
+    reap_bdev->aio_reap(this);
+  }
   std::unique_lock l(lock);
   // see _aio_thread for waker logic
   while (num_running.load() > 0) {
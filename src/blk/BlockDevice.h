@@ -75,6 +75,8 @@ enum struct blk_access_mode_t {
 blk_access_mode_t buffermode(bool buffered);
 std::ostream& operator<<(std::ostream& os, const blk_access_mode_t buffered);
 
+class BlockDevice;
+
 /// track in-flight io
 struct IOContext {
   enum {
@@ -98,7 +100,9 @@ public:
 #if defined(HAVE_LIBAIO) || defined(HAVE_POSIXAIO)
   std::list<aio_t> pending_aios;    ///< not yet submitted
   std::list<aio_t> running_aios;    ///< submitting or submitted
+  io_queue_t *reap_queue = nullptr; ///< per-thread queue reaped in aio_wait()
 #endif
+  BlockDevice *reap_bdev = nullptr; ///< set if aio_wait() must reap inline
   std::atomic_int num_pending = {0};
   std::atomic_int num_running = {0};
   bool allow_eio;
@@ -232,6 +236,8 @@ public:
   }
 
   virtual void aio_submit(IOContext *ioc) = 0;
+  /// reap completions for ioc from the calling thread, see IOContext::reap_bdev
+  virtual void aio_reap(IOContext *ioc) {}
 
   void set_no_exclusive_lock() {
     lock_exclusive = false;
@@ -303,6 +309,8 @@ public:
   virtual void swap_discard_queued(interval_set<uint64_t>& other)  { other.clear(); }
   // for managing buffered readers/writers
   virtual int invalidate_cache(uint64_t off, uint64_t len) = 0;
+  /// start pulling the range into the cache without waiting for it
+  virtual int prefetch_cache(uint64_t off, uint64_t len) { return 0; }
   virtual int open(const std::string& path) = 0;
   virtual void close() = 0;
 
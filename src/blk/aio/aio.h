@@ -34,6 +34,7 @@ struct aio_t {
   boost::container::small_vector<iovec,4> iov;
   uint64_t offset, length;
   long rval;
+  int buf_index = -1;     ///< io_uring registered buffer backing iov[0], if any
   ceph::buffer::list bl;  ///< write payload (so that it remains stable for duration)
 
   boost::intrusive::list_member_hook<> queue_item;
@@ -104,6 +105,13 @@ struct io_queue_t {
   virtual int submit_batch(aio_iter begin, aio_iter end,
 			   void *priv, int *retries, int submit_retries, int initial_delay_us) = 0;
   virtual int get_next_completed(int timeout_ms, aio_t **paio, int max) = 0;
+
+  /// get a buffer registered with the queue (if supported), nullptr otherwise.
+  /// an aio whose single iov points into it may be submitted with buf_index.
+  virtual ceph::unique_leakable_ptr<ceph::buffer::raw>
+  try_create_fixed_buffer(size_t len, int *buf_index) {
+    return nullptr;
+  }
 };
 
 struct aio_queue_t final : public io_queue_t {
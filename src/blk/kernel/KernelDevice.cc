@@ -72,6 +72,11 @@ using ceph::make_timespan;
 using ceph::mono_clock;
 using ceph::operator <<;
 
+// devices with aio running, by sync_queues_epoch
+static ceph::mutex sync_devs_lock =
+  ceph::make_mutex("KernelDevice::sync_devs_lock");
+static std::map<uint64_t, KernelDevice*> sync_devs;
+
 KernelDevice::KernelDevice(CephContext* cct, aio_callback_t cb, void *cbpriv, aio_callback_t d_cb, void *d_cbpriv, const char* dev_name)
   : BlockDevice(cct, cb, cbpriv),
     aio(false), dio(false),
@@ -91,7 +96,11 @@ KernelDevice::KernelDevice(CephContext* cct, aio_callback_t cb, void *cbpriv, ai
   if (use_ioring && ioring_queue_t::supported()) {
     bool use_ioring_hipri = cct->_conf.get_val<bool>("bdev_ioring_hipri");
     bool use_ioring_sqthread_poll = cct->_conf.get_val<bool>("bdev_ioring_sqthread_poll");
-    io_queue = std::make_unique<ioring_queue_t>(iodepth, use_ioring_hipri, use_ioring_sqthread_poll);
+    unsigned fixed_buffers = cct->_conf.get_val<uint64_t>("bdev_ioring_fixed_buffers");
+    size_t fixed_buffer_size = cct->_conf.get_val<Option::size_t>("bdev_ioring_fixed_buffer_size");
+    io_queue = std::make_unique<ioring_queue_t>(iodepth, use_ioring_hipri, use_ioring_sqthread_poll,
+                                                fixed_buffers, fixed_buffer_size);
+    max_sync_queues = cct->_conf.get_val<uint64_t>("bdev_ioring_sync_rings");
   } else {
     static bool once;
     if (use_ioring && !once) {
@@ -591,6 +600,12 @@ int KernelDevice::_aio_start()
       }
       return r;
     }
+    static std::atomic<uint64_t> last_epoch = {0};
+    sync_queues_epoch = ++last_epoch;
+    {
+      std::lock_guard l(sync_devs_lock);
+      sync_devs[sync_queues_epoch] = this;
+    }
     aio_thread.create("bstore_aio");
   }
   return 0;
@@ -617,6 +632,18 @@ void KernelDevice::_aio_stop()
 
     aio_stop = false;
     io_queue->shutdown();
+
+    {
+      // exiting threads no longer hand their rings back to us
+      std::lock_guard l(sync_devs_lock);
+      sync_devs.erase(sync_queues_epoch);
+    }
+    std::lock_guard l(sync_queues_lock);
+    for (auto& q : sync_queues) {
+      q->shutdown();
+    }
+    sync_queues.clear();
+    free_sync_queues.clear();
   }
 }
 
@@ -703,6 +730,195 @@ static bool is_expected_ioerr(const int r)
 	  );
 }
 
+void KernelDevice::_aio_complete(aio_t **aio, int r)
+{
+  for (int i = 0; i < r; ++i) {
+    IOContext *ioc = static_cast<IOContext*>(aio[i]->priv);
+    _aio_log_finish(ioc, aio[i]->offset, aio[i]->length);
+    if (aio[i]->queue_item.is_linked()) {
+      std::lock_guard l(debug_queue_lock);
+      debug_aio_unlink(*aio[i]);
+    }
+
+    // set flag indicating new ios have completed.  we do this *before*
+    // any completion or notifications so that any user flush() that
+    // follows the observed io completion will include this io.  Note
+    // that an earlier, racing flush() could observe and clear this
+    // flag, but that also ensures that the IO will be stable before the
+    // later flush() occurs.
+    io_since_flush.store(true);
+
+    long r = aio[i]->get_return_value();
+    if (r < 0) {
+      derr << __func__ << " got r=" << r << " (" << cpp_strerror(r) << ")"
+	   << dendl;
+      if (ioc->allow_eio && is_expected_ioerr(r)) {
+        derr << __func__ << " translating the error to EIO for upper layer"
+	     << dendl;
+        ioc->set_return_value(-EIO);
+      } else {
+	if (is_expected_ioerr(r)) {
+	  note_io_error_event(
+	    devname.c_str(),
+	    path.c_str(),
+	    r,
+#if defined(HAVE_POSIXAIO)
+            aio[i]->aio.aiocb.aio_lio_opcode,
+#else
+            aio[i]->iocb.aio_lio_opcode,
+#endif
+	    aio[i]->offset,
+	    aio[i]->length);
+	  ceph_abort_msg(
+	    "Unexpected IO error. "
+	    "This may suggest a hardware issue. "
+	    "Please check your kernel log!");
+	}
+	ceph_abort_msg(
+	  "Unexpected IO error. "
+	  "This may suggest HW issue. Please check your dmesg!");
+      }
+    } else if (aio[i]->length != (uint64_t)r) {
+      derr << "aio to 0x" << std::hex << aio[i]->offset
+	   << "~" << aio[i]->length << std::dec
+           << " but returned: " << r << dendl;
+      ceph_abort_msg("unexpected aio return value: does not match length");
+    }
+
+    dout(10) << __func__ << " finished aio " << aio[i] << " r " << r
+             << " ioc " << ioc
+             << " with " << (ioc->num_running.load() - 1)
+             << " aios left" << dendl;
+
+    // NOTE: once num_running and we either call the callback or
+    // call aio_wake we cannot touch ioc or aio[] as the caller
+    // may free it.
+    if (ioc->priv) {
+      if (--ioc->num_running == 0) {
+	aio_callback(aio_callback_priv, ioc->priv);
+      }
+    } else {
+      ioc->try_aio_wake();
+    }
+  }
+}
+
+// a thread's per-thread rings, by the epoch of the device they belong to.
+// they go back to their device when the thread exits.
+struct KernelDevice::sync_queue_owner_t {
+  std::map<uint64_t, io_queue_t*> owned;
+
+  ~sync_queue_owner_t() {
+    std::lock_guard l(sync_devs_lock);
+    for (auto [epoch, q] : owned) {
+      if (auto p = sync_devs.find(epoch); q && p != sync_devs.end()) {
+        p->second->_put_sync_queue(q);
+      }
+    }
+  }
+
+  /// forget the rings of devices closed since
+  void trim() {
+    std::lock_guard l(sync_devs_lock);
+    std::erase_if(owned, [](const auto& p) {
+      return !sync_devs.contains(p.first);
+    });
+  }
+};
+
+void KernelDevice::_put_sync_queue(io_queue_t *q)
+{
+  std::lock_guard l(sync_queues_lock);
+  free_sync_queues.push_back(q);
+}
+
+io_queue_t *KernelDevice::_get_sync_queue()
+{
+  // as with NVMEDevice's per-thread queues, a thread sticks to the ring it
+  // was given first.  the epoch tells apart rings of an earlier open.
+  thread_local sync_queue_owner_t owner;
+  if (auto p = owner.owned.find(sync_queues_epoch); p != owner.owned.end()) {
+    return p->second;
+  }
+  owner.trim();
+
+  io_queue_t *q = nullptr;
+  {
+    std::lock_guard l(sync_queues_lock);
+    if (!free_sync_queues.empty()) {
+      q = free_sync_queues.back();
+      free_sync_queues.pop_back();
+      dout(10) << __func__ << " reusing the ring of an exited thread" << dendl;
+    } else if (sync_queues.size() < max_sync_queues) {
+      auto nq = std::make_unique<ioring_queue_t>(
+        cct->_conf->bdev_aio_max_queue_depth,
+        cct->_conf.get_val<bool>("bdev_ioring_hipri"),
+        cct->_conf.get_val<bool>("bdev_ioring_sqthread_poll"));
+      // buffers from try_create_fixed_buffer() come from the shared ring's
+      // pool, whichever ring the IO ends up on
+      nq->share_fixed_buffers(*static_cast<ioring_queue_t*>(io_queue.get()));
+      int r = nq->init(fd_directs);
+      if (r < 0) {
+        derr << __func__ << " failed to set up ring: " << cpp_strerror(r)
+             << ", using the shared one" << dendl;
+      } else {
+        q = nq.get();
+        sync_queues.push_back(std::move(nq));
+        dout(10) << __func__ << " ring " << sync_queues.size()
+                 << "/" << max_sync_queues << " for this thread" << dendl;
+      }
+    }
+  }
+  owner.owned[sync_queues_epoch] = q;
+  return q;
+}
+
+io_queue_t *KernelDevice::_choose_queue(IOContext *ioc)
+{
+  if (ioc->reap_queue) {
+    if (ioc->reap_bdev == this) {
+      return ioc->reap_queue;
+    }
+    // the ioc already reaps another device's ring, whose fixed files do
+    // not include ours.  our aio thread completes this IO, and aio_reap()
+    // on the other device stops once num_running drops to zero.
+    return io_queue.get();
+  }
+  // synchronous IO (no completion callback) goes to the submitting
+  // thread's own ring and is reaped by the same thread in aio_wait().
+  // the wakeup IO sent from _aio_stop() must reach the aio thread though.
+  if (!ioc->priv && max_sync_queues && !aio_stop) {
+    if (auto q = _get_sync_queue(); q) {
+      ioc->reap_queue = q;
+      ioc->reap_bdev = this;
+      return q;
+    }
+  }
+  return io_queue.get();
+}
+
+void KernelDevice::aio_reap(IOContext *ioc)
+{
+  ceph_assert(ioc->reap_queue);
+  int max = cct->_conf->bdev_aio_reap_max;
+  aio_t *aio[max];
+  while (ioc->num_running.load() > 0) {
+    int r = ioc->reap_queue->get_next_completed(
+      cct->_conf->bdev_aio_poll_ms, aio, max);
+    if (r < 0) {
+      derr << __func__ << " got " << cpp_strerror(r) << dendl;
+      ceph_abort_msg("got unexpected error from io_getevents");
+    }
+    if (r > 0) {
+      dout(30) << __func__ << " got " << r << " completed aios" << dendl;
+      _aio_complete(aio, r);
+    }
+  }
+  // the ioc may be reused by another thread; let it pick its own ring
+  ioc->reap_queue = nullptr;
+  ioc->reap_bdev = nullptr;
+}
+
 void KernelDevice::_aio_thread()
 {
   dout(10) << __func__ << " start" << dendl;
@@ -719,75 +935,7 @@ void KernelDevice::_aio_thread()
     }
     if (r > 0) {
       dout(30) << __func__ << " got " << r << " completed aios" << dendl;
-      for (int i = 0; i < r; ++i) {
-	IOContext *ioc = static_cast<IOContext*>(aio[i]->priv);
-	_aio_log_finish(ioc, aio[i]->offset, aio[i]->length);
-	if (aio[i]->queue_item.is_linked()) {
-	  std::lock_guard l(debug_queue_lock);
-	  debug_aio_unlink(*aio[i]);
-	}
-
-	// set flag indicating new ios have completed.  we do this *before*
-	// any completion or notifications so that any user flush() that
-	// follows the observed io completion will include this io.  Note
-	// that an earlier, racing flush() could observe and clear this
-	// flag, but that also ensures that the IO will be stable before the
-	// later flush() occurs.
-	io_since_flush.store(true);
-
-	long r = aio[i]->get_return_value();
-        if (r < 0) {
-          derr << __func__ << " got r=" << r << " (" << cpp_strerror(r) << ")"
-	       << dendl;
-          if (ioc->allow_eio && is_expected_ioerr(r)) {
-            derr << __func__ << " translating the error to EIO for upper layer"
-		 << dendl;
-            ioc->set_return_value(-EIO);
-          } else {
-	    if (is_expected_ioerr(r)) {
-	      note_io_error_event(
-		devname.c_str(),
-		path.c_str(),
-		r,
-#if defined(HAVE_POSIXAIO)
-                aio[i]->aio.aiocb.aio_lio_opcode,
-#else
-                aio[i]->iocb.aio_lio_opcode,
-#endif
-		aio[i]->offset,
-		aio[i]->length);
-	      ceph_abort_msg(
-		"Unexpected IO error. "
-		"This may suggest a hardware issue. "
-		"Please check your kernel log!");
-	    }
-	    ceph_abort_msg(
-	      "Unexpected IO error. "
-	      "This may suggest HW issue. Please check your dmesg!");
-          }
-        } else if (aio[i]->length != (uint64_t)r) {
-          derr << "aio to 0x" << std::hex << aio[i]->offset
-	       << "~" << aio[i]->length << std::dec
-               << " but returned: " << r << dendl;
-          ceph_abort_msg("unexpected aio return value: does not match length");
-        }
-
-        dout(10) << __func__ << " finished aio " << aio[i] << " r " << r
-                 << " ioc " << ioc
-                 << " with " << (ioc->num_running.load() - 1)
-                 << " aios left" << dendl;
-
-	// NOTE: once num_running and we either call the callback or
-	// call aio_wake we cannot touch ioc or aio[] as the caller
-	// may free it.
-	if (ioc->priv) {
-	  if (--ioc->num_running == 0) {
-	    aio_callback(aio_callback_priv, ioc->priv);
-	  }
-	} else {
-          ioc->try_aio_wake();
-	}
-      }
+      _aio_complete(aio, r);
     }
     if (cct->_conf->bdev_debug_aio) {
       utime_t now = ceph_clock_now();
@@ -1071,8 +1219,8 @@ void KernelDevice::aio_submit(IOContext *ioc)
 	   << " bdev_aio_submit_retry_initial_delay_us " << initial_delay_us
 	   << dendl;
   int r, retries = 0;
-  r = io_queue->submit_batch(ioc->running_aios.begin(), e,
-			     priv, &retries, retry_max, initial_delay_us);
+  r = _choose_queue(ioc)->submit_batch(ioc->running_aios.begin(), e,
+				       priv, &retries, retry_max, initial_delay_us);
 
   if (retries)
     derr << __func__ << " retries " << retries << dendl;
@@ -1224,8 +1372,20 @@ int KernelDevice::aio_write(
 	ioc->pending_aios.push_back(aio_t(ioc, choose_fd(false, write_hint)));
 	++ioc->num_pending;
 	auto& aio = ioc->pending_aios.back();
-	bl.prepare_iov(&aio.iov);
-	aio.bl.claim_append(bl);
+	int buf_index = -1;
+	if (auto raw = _choose_queue(ioc)->try_create_fixed_buffer(len, &buf_index);
+	    raw) {
+	  // copying a small payload into a registered buffer is cheaper
+	  // than having the kernel pin the user pages for every write
+	  bl.begin().copy(len, raw->get_data());
+	  bl.clear();
+	  aio.bl.push_back(ceph::buffer::ptr_node::create(std::move(raw)));
+	  aio.bl.prepare_iov(&aio.iov);
+	  aio.buf_index = buf_index;
+	} else {
+	  bl.prepare_iov(&aio.iov);
+	  aio.bl.claim_append(bl);
+	}
 	aio.pwritev(off, len);
 	dout(30) << aio << dendl;
 	dout(5) << __func__ << " 0x" << std::hex << off << "~" << len
@@ -1523,8 +1683,18 @@ int KernelDevice::aio_read(
     ioc->pending_aios.push_back(aio_t(ioc, fd_directs[WRITE_LIFE_NOT_SET]));
     ++ioc->num_pending;
     aio_t& aio = ioc->pending_aios.back();
-    aio.bl.push_back(
-      ceph::buffer::ptr_node::create(create_custom_aligned(len, ioc)));
+    int buf_index = -1;
+    if (auto raw = _choose_queue(ioc)->try_create_fixed_buffer(len, &buf_index);
+        raw) {
+      // the registered buffer is handed up as is.  like the huge page
+      // pool, keep it out of the buffer cache so it gets recycled.
+      ioc->flags |= IOContext::FLAG_DONT_CACHE;
+      aio.bl.push_back(ceph::buffer::ptr_node::create(std::move(raw)));
+      aio.buf_index = buf_index;
+    } else {
+      aio.bl.push_back(
+        ceph::buffer::ptr_node::create(create_custom_aligned(len, ioc)));
+    }
     aio.bl.prepare_iov(&aio.iov);
     aio.preadv(off, len);
     dout(30) << aio << dendl;
@@ -1668,6 +1838,20 @@ int KernelDevice::invalidate_cache(uint64_t off, uint64_t len)
   return r;
 }
 
+int KernelDevice::prefetch_cache(uint64_t off, uint64_t len)
+{
+  dout(20) << __func__ << " 0x" << std::hex << off << "~" << len << std::dec
+	   << dendl;
+  // the page cache reads are queued, not waited for
+  int r = posix_fadvise(fd_buffereds[WRITE_LIFE_NOT_SET], off, len, POSIX_FADV_WILLNEED);
+  if (r) {
+    r = -r;
+    derr << __func__ << " 0x" << std::hex << off << "~" << len << std::dec
+	 << " error: " << cpp_strerror(r) << dendl;
+  }
+  return r;
+}
+
 std::vector<std::string> KernelDevice::get_tracked_keys()
     const noexcept
 {
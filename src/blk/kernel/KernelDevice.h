@@ -57,6 +57,13 @@ private:
   ceph::mutex flush_mutex = ceph::make_mutex("KernelDevice::flush_mutex");
 
   std::unique_ptr<io_queue_t> io_queue;
+  // per-thread io_uring rings for synchronous IO, reaped by their waiters
+  unsigned max_sync_queues = 0;
+  uint64_t sync_queues_epoch = 0;
+  ceph::mutex sync_queues_lock = ceph::make_mutex("KernelDevice::sync_queues_lock");
+  std::vector<std::unique_ptr<io_queue_t>> sync_queues;
+  std::vector<io_queue_t*> free_sync_queues;  ///< left by exited threads
+  struct sync_queue_owner_t;
   aio_callback_t discard_callback;
   void *discard_callback_priv;
   bool aio_stop;
@@ -95,6 +102,10 @@ private:
   virtual void  _pre_close() { }  // hook for child implementations
 
   void _aio_thread();
+  void _aio_complete(aio_t **aio, int r);
+  io_queue_t *_get_sync_queue();
+  void _put_sync_queue(io_queue_t *q);
+  io_queue_t *_choose_queue(IOContext *ioc);
   void _discard_thread(DiscardThread* thr);
   bool _queue_discard(interval_set<uint64_t> &to_release);
   bool try_discard(interval_set<uint64_t> &to_release,
@@ -137,6 +148,7 @@ public:
   ~KernelDevice();
 
   void aio_submit(IOContext *ioc) override;
+  void aio_reap(IOContext *ioc) override;
   void discard_drain() override;
   void swap_discard_queued(interval_set<uint64_t>& other) override;
   int collect_metadata(const std::string& prefix, std::map<std::string,std::string> *pm) const override;
@@ -170,6 +182,7 @@ public:
 
   // for managing buffered readers/writers
   int invalidate_cache(uint64_t off, uint64_t len) override;
+  int prefetch_cache(uint64_t off, uint64_t len) override;
   int open(const std::string& path) override;
   void close() override;
 
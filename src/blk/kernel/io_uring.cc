@@ -7,17 +7,82 @@
 
 #include "liburing.h"
 #include <sys/epoll.h>
+#include <sys/mman.h>
 #include <map>
 
+#include <boost/lockfree/queue.hpp>
+
+#include "include/buffer_raw.h"
+#include "include/intarith.h"
+
 using std::list;
 using std::make_unique;
 
+/*
+ * Buffers registered with the ring by io_uring_register_buffers().
+ * They are handed out as buffer::raw so that read results can be passed
+ * up without a copy.  Each raw holds a reference to the pool, so the
+ * memory stays mapped until the last buffer is released even if the
+ * ring itself has been shut down already.
+ */
+struct ioring_buffer_pool {
+  using index_queue_t = boost::lockfree::queue<unsigned>;
+
+  const size_t buffer_size;
+  char *base = nullptr;
+  std::vector<struct iovec> iovs;
+  index_queue_t free_q;
+
+  ioring_buffer_pool(unsigned count, size_t size)
+    : buffer_size(size), iovs(count), free_q(count) {
+  }
+  ~ioring_buffer_pool() {
+    if (base) {
+      ::munmap(base, iovs.size() * buffer_size);
+    }
+  }
+
+  int init() {
+    void *p = ::mmap(nullptr, iovs.size() * buffer_size,
+		     PROT_READ | PROT_WRITE,
+		     MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE,
+		     -1, 0);
+    if (p == MAP_FAILED) {
+      return -errno;
+    }
+    base = static_cast<char*>(p);
+    for (unsigned i = 0; i < iovs.size(); i++) {
+      iovs[i].iov_base = base + i * buffer_size;
+      iovs[i].iov_len = buffer_size;
+      free_q.push(i);
+    }
+    return 0;
+  }
+};
+
+struct ioring_fixed_raw : public ceph::buffer::raw {
+  std::shared_ptr<ioring_buffer_pool> pool;
+  const unsigned index;
+
+  ioring_fixed_raw(std::shared_ptr<ioring_buffer_pool> p, unsigned i,
+		   unsigned l)
+    : raw(static_cast<char*>(p->iovs[i].iov_base), l),
+      pool(std::move(p)),
+      index(i) {
+  }
+  ~ioring_fixed_raw() override {
+    // don't free; recycle the registered buffer instead
+    pool->free_q.push(index);
+  }
+};
+
 struct ioring_data {
   struct io_uring io_uring;
   pthread_mutex_t cq_mutex;
   pthread_mutex_t sq_mutex;
   int epoll_fd = -1;
   std::map<int, int> fixed_fds_map;
+  std::shared_ptr<ioring_buffer_pool> buffer_pool;  ///< registered, if any
 };
 
 static int ioring_get_cqe(struct ioring_data *d, unsigned int max,
@@ -58,7 +123,19 @@ static void init_sqe(struct ioring_data *d, struct io_uring_sqe *sqe,
 
   ceph_assert(fixed_fd != -1);
 
-  if (io->iocb.aio_lio_opcode == IO_CMD_PWRITEV)
+  if (io->buf_index >= 0) {
+    ceph_assert(io->iov.size() == 1);
+    if (io->iocb.aio_lio_opcode == IO_CMD_PWRITEV)
+      io_uring_prep_write_fixed(sqe, fixed_fd, io->iov[0].iov_base,
+				io->iov[0].iov_len, io->offset,
+				io->buf_index);
+    else if (io->iocb.aio_lio_opcode == IO_CMD_PREADV)
+      io_uring_prep_read_fixed(sqe, fixed_fd, io->iov[0].iov_base,
+			       io->iov[0].iov_len, io->offset,
+			       io->buf_index);
+    else
+      ceph_assert(0);
+  } else if (io->iocb.aio_lio_opcode == IO_CMD_PWRITEV)
     io_uring_prep_writev(sqe, fixed_fd, &io->iov[0],
 			 io->iov.size(), io->offset);
   else if (io->iocb.aio_lio_opcode == IO_CMD_PREADV)
@@ -107,11 +184,31 @@ static void build_fixed_fds_map(struct ioring_data *d,
   }
 }
 
-ioring_queue_t::ioring_queue_t(unsigned iodepth_, bool hipri_, bool sq_thread_) :
+static int register_fixed_buffers(struct ioring_data *d,
+				  unsigned count, size_t size)
+{
+  auto pool = std::make_shared<ioring_buffer_pool>(count, size);
+  int ret = pool->init();
+  if (ret < 0)
+    return ret;
+
+  ret = io_uring_register_buffers(&d->io_uring,
+				  pool->iovs.data(), pool->iovs.size());
+  if (ret < 0)
+    return ret;
+
+  d->buffer_pool = std::move(pool);
+  return 0;
+}
+
+ioring_queue_t::ioring_queue_t(unsigned iodepth_, bool hipri_, bool sq_thread_,
+			       unsigned fixed_buffers_, size_t fixed_buffer_size_) :
   d(make_unique<ioring_data>()),
   iodepth(iodepth_),
   hipri(hipri_),
-  sq_thread(sq_thread_)
+  sq_thread(sq_thread_),
+  fixed_buffers(fixed_buffers_),
+  fixed_buffer_size(p2roundup<size_t>(fixed_buffer_size_, CEPH_PAGE_SIZE))
 {
 }
 
@@ -144,6 +241,17 @@ int ioring_queue_t::init(std::vector<int> &fds)
 
   build_fixed_fds_map(d.get(), fds);
 
+  if (d->buffer_pool) {
+    // shared with another ring; same buffers, so the same indexes
+    if (io_uring_register_buffers(&d->io_uring, d->buffer_pool->iovs.data(),
+				  d->buffer_pool->iovs.size()) < 0)
+      d->buffer_pool.reset();
+  } else if (fixed_buffers && fixed_buffer_size) {
+    // not fatal: without registered buffers we just do regular readv/writev
+    if (register_fixed_buffers(d.get(), fixed_buffers, fixed_buffer_size) < 0)
+      fixed_buffers = 0;
+  }
+
   d->epoll_fd = epoll_create1(0);
   if (d->epoll_fd < 0) {
     ret = -errno;
@@ -163,6 +271,10 @@ int ioring_queue_t::init(std::vector<int> &fds)
 close_epoll_fd:
   close(d->epoll_fd);
 unregister_files:
+  if (d->buffer_pool) {
+    io_uring_unregister_buffers(&d->io_uring);
+    d->buffer_pool.reset();
+  }
   io_uring_unregister_files(&d->io_uring);
 close_ring_fd:
   io_uring_queue_exit(&d->io_uring);
@@ -175,6 +287,11 @@ void ioring_queue_t::shutdown()
   d->fixed_fds_map.clear();
   close(d->epoll_fd);
   d->epoll_fd = -1;
+  if (d->buffer_pool) {
+    // buffers still referenced by callers keep the pool mapped
+    io_uring_unregister_buffers(&d->io_uring);
+    d->buffer_pool.reset();
+  }
   io_uring_unregister_files(&d->io_uring);
   io_uring_queue_exit(&d->io_uring);
 }
@@ -212,6 +329,29 @@ get_cqe:
   return events;
 }
 
+void ioring_queue_t::share_fixed_buffers(const ioring_queue_t& other)
+{
+  d->buffer_pool = other.d->buffer_pool;
+}
+
+ceph::unique_leakable_ptr<ceph::buffer::raw>
+ioring_queue_t::try_create_fixed_buffer(size_t len, int *buf_index)
+{
+  auto& pool = d->buffer_pool;
+  if (!pool || len > pool->buffer_size)
+    return nullptr;
+
+  unsigned index;
+  if (!pool->free_q.pop(index))
+    /* All buffers in flight, caller falls back to regular IO */
+    return nullptr;
+
+  *buf_index = index;
+  return ceph::unique_leakable_ptr<ceph::buffer::raw>{
+    new ioring_fixed_raw(pool, index, len)
+  };
+}
+
 bool ioring_queue_t::supported()
 {
   struct io_uring ring;
@@ -227,7 +367,8 @@ bool ioring_queue_t::supported()
 
 struct ioring_data {};
 
-ioring_queue_t::ioring_queue_t(unsigned iodepth_, bool hipri_, bool sq_thread_)
+ioring_queue_t::ioring_queue_t(unsigned iodepth_, bool hipri_, bool sq_thread_,
+			       unsigned fixed_buffers_, size_t fixed_buffer_size_)
 {
   ceph_assert(0);
 }
@@ -259,6 +400,17 @@ int ioring_queue_t::get_next_completed(int timeout_ms, aio_t **paio, int max)
   ceph_assert(0);
 }
 
+void ioring_queue_t::share_fixed_buffers(const ioring_queue_t& other)
+{
+  ceph_assert(0);
+}
+
+ceph::unique_leakable_ptr<ceph::buffer::raw>
+ioring_queue_t::try_create_fixed_buffer(size_t len, int *buf_index)
+{
+  ceph_assert(0);
+}
+
 bool ioring_queue_t::supported()
 {
   return false;
@@ -0,0 +1,247 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:nil -*-
+// vim: ts=8 sw=2 sts=2 expandtab
+
+#include "common/Checksummer.h"
+
+#include <cstring>
+
+#include "common/cpu_dispatch.h"
+#include "include/crc32c.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define CHECKSUMMER_HAVE_X86_KERNELS
+#endif
+
+/*
+ * Kernels computing the checksums of a run of equally sized, contiguous
+ * blocks.  The blocks are independent, so instead of hashing them one
+ * after another the vector ones keep several of them in flight, hiding
+ * the latency of the crc32 instruction and of the xxhash64 multiplies.
+ */
+
+static void crc32c_blocks_scalar(uint32_t init, size_t block_size,
+                                 const char* data, size_t blocks,
+                                 uint32_t* out)
+{
+  for (size_t i = 0; i < blocks; ++i) {
+    out[i] = ceph_crc32c(init, (const unsigned char*)data + i * block_size,
+                         block_size);
+  }
+}
+
+static void xxhash64_blocks_scalar(uint64_t seed, size_t block_size,
+                                   const char* data, size_t blocks,
+                                   uint64_t* out)
+{
+  for (size_t i = 0; i < blocks; ++i) {
+    out[i] = XXH64(data + i * block_size, block_size, seed);
+  }
+}
+
+#ifdef CHECKSUMMER_HAVE_X86_KERNELS
+
+__attribute__((target("sse4.2")))
+static inline uint32_t crc32c_one_sse42(uint64_t c, const char* b,
+                                        size_t block_size)
+{
+  size_t off = 0;
+  for (; off + 8 <= block_size; off += 8) {
+    uint64_t v;
+    memcpy(&v, b + off, 8);
+    c = _mm_crc32_u64(c, v);
+  }
+  for (; off < block_size; ++off) {
+    c = _mm_crc32_u8(c, b[off]);
+  }
+  return c;
+}
+
+// four blocks interleaved
+__attribute__((target("sse4.2")))
+static void crc32c_blocks_sse42(uint32_t init, size_t block_size,
+                                const char* data, size_t blocks,
+                                uint32_t* out)
+{
+  size_t i = 0;
+  for (; i + 4 <= blocks; i += 4) {
+    const char* b0 = data + i * block_size;
+    const char* b1 = b0 + block_size;
+    const char* b2 = b1 + block_size;
+    const char* b3 = b2 + block_size;
+    uint64_t c0 = init, c1 = init, c2 = init, c3 = init;
+    size_t off = 0;
+    for (; off + 8 <= block_size; off += 8) {
+      uint64_t v0, v1, v2, v3;
+      memcpy(&v0, b0 + off, 8);
+      memcpy(&v1, b1 + off, 8);
+      memcpy(&v2, b2 + off, 8);
+      memcpy(&v3, b3 + off, 8);
+      c0 = _mm_crc32_u64(c0, v0);
+      c1 = _mm_crc32_u64(c1, v1);
+      c2 = _mm_crc32_u64(c2, v2);
+      c3 = _mm_crc32_u64(c3, v3);
+    }
+    for (; off < block_size; ++off) {
+      c0 = _mm_crc32_u8(c0, b0[off]);
+      c1 = _mm_crc32_u8(c1, b1[off]);
+      c2 = _mm_crc32_u8(c2, b2[off]);
+      c3 = _mm_crc32_u8(c3, b3[off]);
+    }
+    out[i] = c0;
+    out[i + 1] = c1;
+    out[i + 2] = c2;
+    out[i + 3] = c3;
+  }
+  for (; i < blocks; ++i) {
+    out[i] = crc32c_one_sse42(init, data + i * block_size, block_size);
+  }
+}
+
+static constexpr uint64_t XXH_P64_1 = 0x9E3779B185EBCA87ULL;
+static constexpr uint64_t XXH_P64_2 = 0xC2B2AE3D27D4EB4FULL;
+static constexpr uint64_t XXH_P64_3 = 0x165667B19E3779F9ULL;
+static constexpr uint64_t XXH_P64_4 = 0x85EBCA77C2B2AE63ULL;
+
+static inline uint64_t xxh64_rotl(uint64_t x, int r)
+{
+  return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t xxh64_merge(uint64_t h, uint64_t v)
+{
+  v *= XXH_P64_2;
+  v = xxh64_rotl(v, 31);
+  v *= XXH_P64_1;
+  h ^= v;
+  return h * XXH_P64_1 + XXH_P64_4;
+}
+
+// XXH64 tail for an input that is a non-zero multiple of 32 bytes long,
+// so nothing is left over after the stripes
+static inline uint64_t xxh64_finish_stripes(const uint64_t v[4], uint64_t len)
+{
+  uint64_t h = xxh64_rotl(v[0], 1) + xxh64_rotl(v[1], 7) +
+               xxh64_rotl(v[2], 12) + xxh64_rotl(v[3], 18);
+  for (int i = 0; i < 4; ++i) {
+    h = xxh64_merge(h, v[i]);
+  }
+  h += len;
+  h ^= h >> 33;
+  h *= XXH_P64_2;
+  h ^= h >> 29;
+  h *= XXH_P64_3;
+  h ^= h >> 32;
+  return h;
+}
+
+// AVX2 has no 64 bit multiply, build it from 32x32->64 ones
+__attribute__((target("avx2")))
+static inline __m256i mul64_avx2(__m256i a, __m256i b_lo, __m256i b_hi)
+{
+  __m256i lo = _mm256_mul_epu32(a, b_lo);
+  __m256i c1 = _mm256_mul_epu32(_mm256_srli_epi64(a, 32), b_lo);
+  __m256i c2 = _mm256_mul_epu32(a, b_hi);
+  return _mm256_add_epi64(
+    lo, _mm256_slli_epi64(_mm256_add_epi64(c1, c2), 32));
+}
+
+// the four XXH64 accumulators of a block live in one vector, N blocks
+// are processed side by side
+template <int N>
+__attribute__((target("avx2")))
+static inline void xxhash64_lanes_avx2(uint64_t seed, size_t block_size,
+                                       const char* data, uint64_t* out)
+{
+  const __m256i p1_lo = _mm256_set1_epi64x(XXH_P64_1 & 0xffffffff);
+  const __m256i p1_hi = _mm256_set1_epi64x(XXH_P64_1 >> 32);
+  const __m256i p2_lo = _mm256_set1_epi64x(XXH_P64_2 & 0xffffffff);
+  const __m256i p2_hi = _mm256_set1_epi64x(XXH_P64_2 >> 32);
+  const __m256i init = _mm256_set_epi64x(seed - XXH_P64_1,
+                                         seed,
+                                         seed + XXH_P64_2,
+                                         seed + XXH_P64_1 + XXH_P64_2);
+  __m256i acc[N];
+  for (int k = 0; k < N; ++k) {
+    acc[k] = init;
+  }
+  for (size_t off = 0; off < block_size; off += 32) {
+    for (int k = 0; k < N; ++k) {
+      __m256i in = _mm256_loadu_si256(
+        (const __m256i*)(data + k * block_size + off));
+      __m256i a = _mm256_add_epi64(acc[k], mul64_avx2(in, p2_lo, p2_hi));
+      a = _mm256_or_si256(_mm256_slli_epi64(a, 31), _mm256_srli_epi64(a, 33));
+      acc[k] = mul64_avx2(a, p1_lo, p1_hi);
+    }
+  }
+  for (int k = 0; k < N; ++k) {
+    alignas(32) uint64_t v[4];
+    _mm256_store_si256((__m256i*)v, acc[k]);
+    out[k] = xxh64_finish_stripes(v, block_size);
+  }
+}
+
+__attribute__((target("avx2")))
+static void xxhash64_blocks_avx2(uint64_t seed, size_t block_size,
+                                 const char* data, size_t blocks,
+                                 uint64_t* out)
+{
+  if (block_size % 32 != 0) {
+    xxhash64_blocks_scalar(seed, block_size, data, blocks, out);
+    return;
+  }
+  size_t i = 0;
+  for (; i + 4 <= blocks; i += 4) {
+    xxhash64_lanes_avx2<4>(seed, block_size, data + i * block_size, out + i);
+  }
+  for (; i < blocks; ++i) {
+    xxhash64_lanes_avx2<1>(seed, block_size, data + i * block_size, out + i);
+  }
+}
+
+#endif // CHECKSUMMER_HAVE_X86_KERNELS
+
+struct csum_blocks_ops_t {
+  const char* name;
+  void (*crc32c)(uint32_t, size_t, const char*, size_t, uint32_t*);
+  void (*xxhash64)(uint64_t, size_t, const char*, size_t, uint64_t*);
+  bool (*supported)();
+};
+
+static const csum_blocks_ops_t csum_blocks_ops[] = {
+#ifdef CHECKSUMMER_HAVE_X86_KERNELS
+  { "avx2", crc32c_blocks_sse42, xxhash64_blocks_avx2,
+    [] { return __builtin_cpu_supports("avx2") &&
+                __builtin_cpu_supports("sse4.2"); } },
+  { "sse42", crc32c_blocks_sse42, xxhash64_blocks_scalar,
+    [] { return bool(__builtin_cpu_supports("sse4.2")); } },
+#endif
+  { "scalar", crc32c_blocks_scalar, xxhash64_blocks_scalar,
+    [] { return true; } },
+};
+
+static ceph::cpu_dispatch_t<csum_blocks_ops_t> csum_blocks{csum_blocks_ops};
+
+void Checksummer::crc32c_blocks(uint32_t init_value, size_t block_size,
+                                const char* data, size_t blocks,
+                                uint32_t* out)
+{
+  csum_blocks.get().crc32c(init_value, block_size, data, blocks, out);
+}
+
+void Checksummer::xxhash64_blocks(uint64_t init_value, size_t block_size,
+                                  const char* data, size_t blocks,
+                                  uint64_t* out)
+{
+  csum_blocks.get().xxhash64(init_value, block_size, data, blocks, out);
+}
+
+const char* Checksummer::get_blocks_impl()
+{
+  return csum_blocks.name();
+}
+
+bool Checksummer::set_blocks_impl(std::string_view name)
+{
+  return csum_blocks.set(name);
+}
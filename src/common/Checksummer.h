@@ -4,6 +4,9 @@
 #ifndef CEPH_OS_BLUESTORE_CHECKSUMMER
 #define CEPH_OS_BLUESTORE_CHECKSUMMER
 
+#include <algorithm>
+#include <string_view>
+
 #include "include/buffer.h"
 #include "include/byteorder.h"
 #include "include/ceph_assert.h"
@@ -90,6 +93,15 @@ public:
       ) {
       return p.crc32c(len, init_value);
     }
+    static void calc_blocks(
+      init_value_t init_value,
+      size_t len,
+      const char *data,
+      size_t blocks,
+      init_value_t *out
+      ) {
+      crc32c_blocks(init_value, len, data, blocks, out);
+    }
   };
 
   struct crc32c_16 {
@@ -111,6 +123,18 @@ public:
       ) {
       return p.crc32c(len, init_value) & 0xffff;
     }
+    static void calc_blocks(
+      init_value_t init_value,
+      size_t len,
+      const char *data,
+      size_t blocks,
+      init_value_t *out
+      ) {
+      crc32c_blocks(init_value, len, data, blocks, out);
+      for (size_t i = 0; i < blocks; ++i) {
+	out[i] &= 0xffff;
+      }
+    }
   };
 
   struct crc32c_8 {
@@ -132,6 +156,18 @@ public:
       ) {
       return p.crc32c(len, init_value) & 0xff;
     }
+    static void calc_blocks(
+      init_value_t init_value,
+      size_t len,
+      const char *data,
+      size_t blocks,
+      init_value_t *out
+      ) {
+      crc32c_blocks(init_value, len, data, blocks, out);
+      for (size_t i = 0; i < blocks; ++i) {
+	out[i] &= 0xff;
+      }
+    }
   };
 
   struct xxhash32 {
@@ -161,6 +197,17 @@ public:
       }
       return XXH32_digest(state);
     }
+    static void calc_blocks(
+      init_value_t init_value,
+      size_t len,
+      const char *data,
+      size_t blocks,
+      init_value_t *out
+      ) {
+      for (size_t i = 0; i < blocks; ++i) {
+	out[i] = XXH32(data + i * len, len, init_value);
+      }
+    }
   };
 
   struct xxhash64 {
@@ -190,8 +237,54 @@ public:
       }
       return XXH64_digest(state);
     }
+    static void calc_blocks(
+      init_value_t init_value,
+      size_t len,
+      const char *data,
+      size_t blocks,
+      init_value_t *out
+      ) {
+      xxhash64_blocks(init_value, len, data, blocks, out);
+    }
   };
 
+  // checksums of `blocks` contiguous blocks of `block_size` bytes each,
+  // several of them computed side by side when the CPU allows
+  static void crc32c_blocks(uint32_t init_value, size_t block_size,
+                            const char *data, size_t blocks, uint32_t *out);
+  static void xxhash64_blocks(uint64_t init_value, size_t block_size,
+                              const char *data, size_t blocks, uint64_t *out);
+  static const char *get_blocks_impl();
+  /// "auto" or one of the implementations, false if unknown/unsupported
+  static bool set_blocks_impl(std::string_view name);
+
+  static constexpr size_t BLOCKS_BATCH = 64;
+
+  // checksums of the next blocks of p.  Blocks that sit whole in
+  // the current buffer are done in one go, a block straddling two
+  // buffers goes through the iterator.
+  template<class Alg>
+  static size_t calc_next_blocks(
+    typename Alg::state_t state,
+    typename Alg::init_value_t init_value,
+    size_t csum_block_size,
+    size_t blocks,
+    ceph::buffer::list::const_iterator& p,
+    typename Alg::init_value_t *out) {
+    blocks = std::min(blocks, BLOCKS_BATCH);
+    const char *data;
+    auto q = p;
+    size_t n = q.get_ptr_and_advance(blocks * csum_block_size, &data) /
+      csum_block_size;
+    if (n == 0) {
+      out[0] = Alg::calc(state, init_value, csum_block_size, p);
+      return 1;
+    }
+    Alg::calc_blocks(init_value, csum_block_size, data, n, out);
+    p += n * csum_block_size;
+    return n;
+  }
+
   template<class Alg>
   static int calculate(
     size_t csum_block_size,
@@ -225,9 +318,15 @@ public:
     typename Alg::value_t *pv =
       reinterpret_cast<typename Alg::value_t*>(csum_data->c_str());
     pv += offset / csum_block_size;
-    while (blocks--) {
-      *pv = Alg::calc(state, init_value, csum_block_size, p);
-      ++pv;
+    typename Alg::init_value_t v[BLOCKS_BATCH];
+    while (blocks) {
+      size_t n = calc_next_blocks<Alg>(state, init_value, csum_block_size,
+				       blocks, p, v);
+      for (size_t i = 0; i < n; ++i) {
+	*pv = v[i];
+	++pv;
+      }
+      blocks -= n;
     }
     Alg::fini(&state);
     return 0;
@@ -253,18 +352,22 @@ public:
       reinterpret_cast<const typename Alg::value_t*>(csum_data.c_str());
     pv += offset / csum_block_size;
     size_t pos = offset;
+    typename Alg::init_value_t v[BLOCKS_BATCH];
     while (length > 0) {
-      typename Alg::init_value_t v = Alg::calc(state, -1, csum_block_size, p);
-      if (*pv != v) {
-	if (bad_csum) {
-	  *bad_csum = v;
+      size_t n = calc_next_blocks<Alg>(state, -1, csum_block_size,
+				       length / csum_block_size, p, v);
+      for (size_t i = 0; i < n; ++i) {
+	if (*pv != v[i]) {
+	  if (bad_csum) {
+	    *bad_csum = v[i];
+	  }
+	  Alg::fini(&state);
+	  return pos;
 	}
-	Alg::fini(&state);
-	return pos;
+	++pv;
+	pos += csum_block_size;
+	length -= csum_block_size;
       }
-      ++pv;
-      pos += csum_block_size;
-      length -= csum_block_size;
     }
     Alg::fini(&state);
     return -1;  // no errors
@@ -0,0 +1,88 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:nil -*-
+// vim: ts=8 sw=2 sts=2 expandtab
+
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <string_view>
+
+namespace ceph {
+
+/*
+ * Runtime choice between implementations of a set of kernels.
+ *
+ * Ops is a struct of function pointers which also has a `name` and a
+ * `bool (*supported)()` probe.  The table lists the implementations best
+ * first and ends with one that is always supported.  The choice is made
+ * on first use rather than during static initialization, which may run
+ * before the compiler runtime has read the CPU features that
+ * __builtin_cpu_supports() reports.
+ */
+template <typename Ops>
+class cpu_dispatch_t {
+  const Ops* const table;
+  const size_t table_size;
+  std::atomic<const Ops*> cur = nullptr;
+
+  const Ops* pick_best() const {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+#endif
+    for (size_t i = 0; i + 1 < table_size; ++i) {
+      if (table[i].supported()) {
+        return &table[i];
+      }
+    }
+    return &table[table_size - 1];
+  }
+
+public:
+  template <size_t N>
+  constexpr cpu_dispatch_t(const Ops (&ops)[N])
+    : table(ops), table_size(N) {}
+
+  const Ops& get() {
+    auto p = cur.load(std::memory_order_relaxed);
+    if (!p) {
+      // racing threads pick the same
+      p = pick_best();
+      cur.store(p, std::memory_order_relaxed);
+    }
+    return *p;
+  }
+
+  const char* name() {
+    return get().name;
+  }
+
+  /// "auto" or one of the implementations, false if unknown/unsupported
+  bool set(std::string_view name) {
+    if (name == "auto") {
+      cur = pick_best();
+      return true;
+    }
+    for (size_t i = 0; i < table_size; ++i) {
+      if (name == table[i].name) {
+        if (!table[i].supported()) {
+          return false;
+        }
+        cur = &table[i];
+        return true;
+      }
+    }
+    return false;
+  }
+};
+
+} // namespace ceph
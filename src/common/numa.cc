@@ -8,7 +8,13 @@
 #include <fcntl.h> // for open()
 #include <unistd.h> // for close(), getpid()
 #include <errno.h>
+#include <climits>
 #include <iostream>
+#include <vector>
+#if defined(__linux__)
+#include <linux/mempolicy.h>
+#include <sys/syscall.h>
+#endif
 
 #include "include/stringify.h"
 #include "common/safe_io.h"
@@ -227,6 +233,23 @@ int set_cpu_affinity_all_threads(size_t cpu_set_size, cpu_set_t *cpu_set)
   return 0;
 }
 
+int bind_memory_to_numa_node(void *addr, size_t len, int node)
+{
+  if (node < 0) {
+    return -EINVAL;
+  }
+  // glibc has no mbind() wrapper, and libnuma is not worth pulling in for it
+  constexpr size_t bits = sizeof(unsigned long) * CHAR_BIT;
+  std::vector<unsigned long> nodemask(node / bits + 1);
+  nodemask[node / bits] |= 1ul << (node % bits);
+  // the kernel drops the last bit of maxnode, hence the + 1
+  if (syscall(SYS_mbind, addr, len, MPOL_PREFERRED, nodemask.data(),
+	      nodemask.size() * bits + 1, MPOL_MF_MOVE) < 0) {
+    return -errno;
+  }
+  return 0;
+}
+
 #else
 int parse_cpu_set_list(const char *s,
 		       size_t *cpu_set_size,
@@ -260,4 +283,9 @@ int set_cpu_affinity_all_threads(size_t cpu_set_size,
   return -ENOTSUP;
 }
 
+int bind_memory_to_numa_node(void *addr, size_t len, int node)
+{
+  return -ENOTSUP;
+}
+
 #endif
@@ -26,3 +26,7 @@ int get_numa_node_cpu_set(int node,
 
 int set_cpu_affinity_all_threads(size_t cpu_set_size,
 				 cpu_set_t *cpu_set);
+
+// prefer numa node @p node for the pages of [addr, addr+len), migrating
+// those already faulted in. addr must be page aligned.
+int bind_memory_to_numa_node(void *addr, size_t len, int node);
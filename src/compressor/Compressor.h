@@ -88,6 +88,11 @@ public:
   // this is a bit weird but we need non-const iterator to be in
   // alignment with decode methods
   virtual int decompress(ceph::bufferlist::const_iterator &p, size_t compressed_len, ceph::bufferlist &out, std::optional<int32_t> compressor_message) = 0;
+  // an instance of the same codec working at the given level instead of
+  // the configured one; null if the codec has no levels
+  virtual CompressorRef with_level(int level) const {
+    return nullptr;
+  }
 
   static CompressorRef create(CephContext *cct, const std::string &type);
   static CompressorRef create(CephContext *cct, int alg);
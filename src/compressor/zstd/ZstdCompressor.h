@@ -26,6 +26,12 @@
 class ZstdCompressor : public Compressor {
  public:
   ZstdCompressor(CephContext *cct) : Compressor(COMP_ALG_ZSTD, "zstd"), cct(cct) {}
+  ZstdCompressor(CephContext *cct, int level)
+    : Compressor(COMP_ALG_ZSTD, "zstd"), cct(cct), level(level) {}
+
+  CompressorRef with_level(int l) const override {
+    return std::make_shared<ZstdCompressor>(cct, l);
+  }
 
   int compress(const ceph::buffer::list &src, ceph::buffer::list &dst, std::optional<int32_t> &compressor_message) override {
     ZSTD_CCtx *s = ZSTD_createCCtx();
@@ -37,7 +43,8 @@ class ZstdCompressor : public Compressor {
       ZSTD_freeCCtx(s);
       return -EINVAL;
     }
-    res = ZSTD_CCtx_setParameter(s, ZSTD_c_compressionLevel, cct->_conf->compressor_zstd_level);
+    res = ZSTD_CCtx_setParameter(s, ZSTD_c_compressionLevel,
+				 level ? *level : cct->_conf->compressor_zstd_level);
     if (ZSTD_isError(res)) {
       ZSTD_freeCCtx(s);
       return -EINVAL;
@@ -121,6 +128,7 @@ class ZstdCompressor : public Compressor {
   }
  private:
   CephContext *const cct;
+  const std::optional<int> level;
 };
 
 #endif
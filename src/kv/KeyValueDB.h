@@ -384,6 +384,8 @@ protected:
 public:
   typedef uint32_t IteratorOpts;
   static const uint32_t ITERATOR_NOCACHE = 1;
+  /// the caller is going to walk a long range, read ahead of it
+  static const uint32_t ITERATOR_PREFETCH = 2;
 
   struct IteratorBounds {
     std::optional<std::string> lower_bound;
@@ -730,6 +730,22 @@ rocksdb::ColumnFamilyHandle *RocksDBStore::check_cf_handle_bounds(const cf_handl
   }
 }
 
+rocksdb::ReadOptions RocksDBStore::make_iterator_options(IteratorOpts opts) const
+{
+  auto options = rocksdb::ReadOptions();
+  if (opts & ITERATOR_NOCACHE) {
+    options.fill_cache = false;
+  }
+  if (opts & ITERATOR_PREFETCH) {
+    options.readahead_size = cct->_conf->rocksdb_iterator_readahead_size;
+#if ROCKSDB_MAJOR > 7 || (ROCKSDB_MAJOR == 7 && ROCKSDB_MINOR >= 2)
+    // let the block prefetch run in the background while keys are consumed
+    options.async_io = cct->_conf->rocksdb_iterator_async_io;
+#endif
+  }
+  return options;
+}
+
 /**
  * Definition of sharding:
  * space-separated list of: column_def [ '=' options ]
@@ -2670,12 +2686,13 @@ public:
   explicit CFIteratorImpl(const RocksDBStore* db,
                           const std::string& p,
                           rocksdb::ColumnFamilyHandle* cf,
-                          KeyValueDB::IteratorBounds bounds_)
+                          KeyValueDB::IteratorBounds bounds_,
+                          KeyValueDB::IteratorOpts opts = 0)
     : prefix(p), bounds(std::move(bounds_)),
       iterate_lower_bound(make_slice(bounds.lower_bound)),
       iterate_upper_bound(make_slice(bounds.upper_bound))
       {
-      auto options = rocksdb::ReadOptions();
+      auto options = db->make_iterator_options(opts);
       if (db->cct->_conf->osd_rocksdb_iterator_bounds_enabled) {
         if (bounds.lower_bound) {
           options.iterate_lower_bound = &iterate_lower_bound;
@@ -3262,13 +3279,14 @@ public:
   explicit ShardMergeIteratorImpl(const RocksDBStore* db,
 				  const std::string& prefix,
 				  const std::vector<rocksdb::ColumnFamilyHandle*>& shards,
-                  KeyValueDB::IteratorBounds bounds_)
+                  KeyValueDB::IteratorBounds bounds_,
+                  KeyValueDB::IteratorOpts opts = 0)
     : db(db), keyless(db->comparator), prefix(prefix), bounds(std::move(bounds_)),
       iterate_lower_bound(make_slice(bounds.lower_bound)),
       iterate_upper_bound(make_slice(bounds.upper_bound))
   {
     iters.reserve(shards.size());
-    auto options = rocksdb::ReadOptions();
+    auto options = db->make_iterator_options(opts);
     if (db->cct->_conf->osd_rocksdb_iterator_bounds_enabled) {
       if (bounds.lower_bound) {
         options.iterate_lower_bound = &iterate_lower_bound;
@@ -3474,13 +3492,15 @@ KeyValueDB::Iterator RocksDBStore::get_iterator(const std::string& prefix, Itera
               this,
               prefix,
               cf,
-              std::move(bounds));
+              std::move(bounds),
+              opts);
     } else {
       return std::make_shared<ShardMergeIteratorImpl>(
         this,
         prefix,
         cf_it->second.handles,
-        std::move(bounds));
+        std::move(bounds),
+        opts);
     }
   } else {
     // use wholespace engine if no cfs are configured
@@ -145,6 +145,7 @@ private:
   rocksdb::ColumnFamilyHandle *get_cf_handle(const std::string& prefix, const std::string& key);
   rocksdb::ColumnFamilyHandle *get_cf_handle(const std::string& prefix, const char* key, size_t keylen);
   rocksdb::ColumnFamilyHandle *check_cf_handle_bounds(const cf_handles_iterator& it, const IteratorBounds& bounds);
+  rocksdb::ReadOptions make_iterator_options(IteratorOpts opts) const;
 
   int submit_common(rocksdb::WriteOptions& woptions, KeyValueDB::Transaction t);
   int install_cf_mergeop(const std::string &cf_name, rocksdb::ColumnFamilyOptions *cf_opt);
@@ -402,9 +403,7 @@ public:
                                            rocksdb::ColumnFamilyHandle* cf,
                                            const KeyValueDB::IteratorOpts opts)
       {
-        rocksdb::ReadOptions options = rocksdb::ReadOptions();
-        if (opts & ITERATOR_NOCACHE)
-          options.fill_cache=false;
+        rocksdb::ReadOptions options = db->make_iterator_options(opts);
         dbiter = db->db->NewIterator(options, cf);
     }
     ~RocksDBWholeSpaceIteratorImpl() override;
@@ -16,6 +16,7 @@
 
 #include "BinnedLRUCache.h"
 
+#include <algorithm>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string>
@@ -133,18 +134,32 @@ bool BinnedLRUCacheShard::Unref(BinnedLRUHandle* e) {
   return e->refs == 0;
 }
 
+void BinnedLRUCacheShard::PinShared(BinnedLRUHandle* e) {
+  if (e->refs.fetch_add(1) == 1 && e->next != nullptr) {
+    lru_pinned_usage_ += e->charge;
+  }
+}
+
+size_t BinnedLRUCacheShard::PinnedUsage() const {
+  ceph_assert(usage_ >= lru_usage_);
+  size_t on_lru = std::max<int64_t>(0, lru_pinned_usage_);
+  return std::min(usage_, usage_ - lru_usage_ + on_lru);
+}
+
 // Call deleter and free
 
 void BinnedLRUCacheShard::EraseUnRefEntries() {
   BinnedLRUHandle* deleted = nullptr;
   {
-    std::lock_guard<std::mutex> l(mutex_);
+    std::lock_guard l(mutex_);
     while (lru_.next != &lru_) {
       BinnedLRUHandle* old = lru_.next;
       ceph_assert(old->InCache());
-      ceph_assert(old->refs ==
-             1);  // LRU list contains elements which may be evicted
       LRU_Remove(old);
+      if (old->refs > 1) {
+        // pinned by a lookup since it was put on the list
+        continue;
+      }
       table_.Remove(old->key(), old->hash);
       old->SetInCache(false);
       Unref(old);
@@ -193,12 +208,12 @@ size_t BinnedLRUCacheShard::TEST_GetLRUSize() {
 }
 
 double BinnedLRUCacheShard::GetHighPriPoolRatio() const {
-  std::lock_guard<std::mutex> l(mutex_);
+  std::shared_lock l(mutex_);
   return high_pri_pool_ratio_;
 }
 
 size_t BinnedLRUCacheShard::GetHighPriPoolUsage() const {
-  std::lock_guard<std::mutex> l(mutex_);
+  std::shared_lock l(mutex_);
   return high_pri_pool_usage_;
 }
 
@@ -212,6 +227,9 @@ void BinnedLRUCacheShard::LRU_Remove(BinnedLRUHandle* e) {
   e->prev->next = e->next;
   e->prev = e->next = nullptr;
   lru_usage_ -= e->charge;
+  if (e->refs > 1) {
+    lru_pinned_usage_ -= e->charge;
+  }
   if (e->InHighPriPool()) {
     ceph_assert(high_pri_pool_usage_ >= e->charge);
     high_pri_pool_usage_ -= e->charge;
@@ -225,6 +243,7 @@ void BinnedLRUCacheShard::LRU_Insert(BinnedLRUHandle* e) {
   ceph_assert(e->next == nullptr);
   ceph_assert(e->prev == nullptr);
   e->age_bin = age_bins.front();
+  e->recently_used = false;
 
   if (high_pri_pool_ratio_ > 0 && e->IsHighPri()) {
     // Inset "e" to head of LRU list.
@@ -247,10 +266,13 @@ void BinnedLRUCacheShard::LRU_Insert(BinnedLRUHandle* e) {
     *(e->age_bin) += e->charge;
   }
   lru_usage_ += e->charge;
+  if (e->refs > 1) {
+    lru_pinned_usage_ += e->charge;
+  }
 }
 
 uint64_t BinnedLRUCacheShard::sum_bins(uint32_t start, uint32_t end) const {
-  std::lock_guard<std::mutex> l(mutex_);
+  std::shared_lock l(mutex_);
   auto size = age_bins.size();
   if (size < start) {
     return 0;
@@ -280,7 +302,17 @@ void BinnedLRUCacheShard::EvictFromLRU(size_t charge,
   while (usage_ + charge > capacity_ && lru_.next != &lru_) {
     BinnedLRUHandle* old = lru_.next;
     ceph_assert(old->InCache());
-    ceph_assert(old->refs == 1);  // LRU list contains elements which may be evicted
+    if (old->refs > 1) {
+      // pinned by a lookup under the shared lock, Release() puts it back
+      LRU_Remove(old);
+      continue;
+    }
+    if (old->recently_used.exchange(false)) {
+      // hit since it was put on the list, give it another round
+      LRU_Remove(old);
+      LRU_Insert(old);
+      continue;
+    }
     stats[l_elems]--;
     LRU_Remove(old);
     table_.Remove(old->key(), old->hash);
@@ -307,7 +339,7 @@ int BinnedLRUCacheShard::FreeDeleted(BinnedLRUHandle* deleted) {
 void BinnedLRUCacheShard::SetCapacity(size_t capacity) {
   BinnedLRUHandle* deleted = nullptr;
   {
-    std::lock_guard<std::mutex> l(mutex_);
+    std::lock_guard l(mutex_);
     capacity_ = capacity;
     high_pri_pool_capacity_ = capacity_ * high_pri_pool_ratio_;
     EvictFromLRU(0, deleted);
@@ -318,19 +350,27 @@ void BinnedLRUCacheShard::SetCapacity(size_t capacity) {
 }
 
 ShardStats BinnedLRUCacheShard::GetStats() {
-  std::lock_guard<std::mutex> l(mutex_);
-  stats[l_capacity] = capacity_;
-  stats[l_usage] = usage_;
-  stats[l_pinned] = usage_ - lru_usage_;
-  stats[l_misses] = stats[l_lookups] - stats[l_hits];
-  return stats;
+  std::shared_lock l(mutex_);
+  ShardStats s = stats;
+  s[l_capacity] = capacity_;
+  s[l_usage] = usage_;
+  s[l_pinned] = PinnedUsage();
+  // hits first, a lookup counts before its hit
+  s[l_fast_hits] = fast_hits_;
+  s[l_hits] = hits_;
+  s[l_lookups] = lookups_;
+  s[l_misses] = s[l_lookups] > s[l_hits] ? s[l_lookups] - s[l_hits] : 0;
+  return s;
 }
 
 void BinnedLRUCacheShard::ClearStats() {
-  std::lock_guard<std::mutex> l(mutex_);
-  for (int i = l_inserts; i <= l_misses; i++) {
+  std::lock_guard l(mutex_);
+  for (int i = l_inserts; i < stat_cnt; i++) {
     stats[i] = 0;
   }
+  lookups_ = 0;
+  hits_ = 0;
+  fast_hits_ = 0;
 }
 
 void BinnedLRUCacheShard::print_bins(std::stringstream& out) const
@@ -342,38 +382,56 @@ void BinnedLRUCacheShard::print_bins(std::stringstream& out) const
 }
 
 void BinnedLRUCacheShard::SetStrictCapacityLimit(bool strict_capacity_limit) {
-  std::lock_guard<std::mutex> l(mutex_);
+  std::lock_guard l(mutex_);
   strict_capacity_limit_ = strict_capacity_limit;
 }
 
 rocksdb::Cache::Handle* BinnedLRUCacheShard::Lookup(const rocksdb::Slice& key, uint32_t hash) {
-  std::lock_guard<std::mutex> l(mutex_);
-  stats[l_lookups]++;
+  lookups_.fetch_add(1, std::memory_order_relaxed);
+  {
+    std::shared_lock l(mutex_);
+    BinnedLRUHandle* e = table_.Lookup(key, hash);
+    if (e == nullptr) {
+      return nullptr;
+    }
+    ceph_assert(e->InCache());
+    // Pinned entries are off the list already. Unpinned ones may stay on
+    // it while they are in the current age bin, otherwise the age binning
+    // the PriorityCache balancer relies on would drift.
+    if (e->next == nullptr || e->age_bin == age_bins.front()) {
+      PinShared(e);
+      e->recently_used = true;
+      e->SetHit();
+      hits_.fetch_add(1, std::memory_order_relaxed);
+      fast_hits_.fetch_add(1, std::memory_order_relaxed);
+      return e;
+    }
+  }
+  std::lock_guard l(mutex_);
+  // looked up again, it might have gone in between
   BinnedLRUHandle* e = table_.Lookup(key, hash);
   if (e != nullptr) {
     ceph_assert(e->InCache());
-    if (e->refs == 1) {
+    if (e->next != nullptr) {
       LRU_Remove(e);
     }
     e->refs++;
     e->SetHit();
-    stats[l_hits]++;
+    hits_.fetch_add(1, std::memory_order_relaxed);
   }
   return e;
 }
 
 bool BinnedLRUCacheShard::Ref(rocksdb::Cache::Handle* h) {
   BinnedLRUHandle* handle = static_cast<BinnedLRUHandle*>(h);
-  std::lock_guard<std::mutex> l(mutex_);
-  if (handle->InCache() && handle->refs == 1) {
-    LRU_Remove(handle);
-  }
-  handle->refs++;
+  // pinned entries may stay on the LRU list, so nothing to move
+  std::shared_lock l(mutex_);
+  PinShared(handle);
   return true;
 }
 
 void BinnedLRUCacheShard::SetHighPriPoolRatio(double high_pri_pool_ratio) {
-  std::lock_guard<std::mutex> l(mutex_);
+  std::lock_guard l(mutex_);
   high_pri_pool_ratio_ = high_pri_pool_ratio;
   high_pri_pool_capacity_ = capacity_ * high_pri_pool_ratio_;
   MaintainPoolSize();
@@ -384,9 +442,29 @@ bool BinnedLRUCacheShard::Release(rocksdb::Cache::Handle* handle, bool force_era
     return false;
   }
   BinnedLRUHandle* e = static_cast<BinnedLRUHandle*>(handle);
+  if (!force_erase) {
+    std::shared_lock l(mutex_);
+    // Dropping a reference that leaves the entry pinned, or unpinning one
+    // which is still on the LRU list, is just a count change.
+    uint32_t r = e->refs;
+    while (r > 2 ||
+           (r == 2 && e->InCache() && e->next != nullptr &&
+            usage_ <= capacity_)) {
+      if (e->refs.compare_exchange_weak(r, r - 1)) {
+        if (r == 2) {
+          lru_pinned_usage_ -= e->charge;
+        }
+        return false;
+      }
+    }
+  }
   bool last_reference = false;
   {
-    std::lock_guard<std::mutex> l(mutex_);
+    std::lock_guard l(mutex_);
+    if (e->refs == 2 && e->next != nullptr) {
+      // unpinned while on the LRU list
+      lru_pinned_usage_ -= e->charge;
+    }
     last_reference = Unref(e);
     if (last_reference) {
       usage_ -= e->charge;
@@ -399,6 +477,9 @@ bool BinnedLRUCacheShard::Release(rocksdb::Cache::Handle* handle, bool force_era
         // The LRU list must be empty since the cache is full
         ceph_assert(!(usage_ > capacity_) || lru_.next == &lru_);
         // take this opportunity and remove the item
+        if (e->next != nullptr) {
+          LRU_Remove(e);
+        }
         table_.Remove(e->key(), e->hash);
         e->SetInCache(false);
         Unref(e);
@@ -406,7 +487,11 @@ bool BinnedLRUCacheShard::Release(rocksdb::Cache::Handle* handle, bool force_era
         last_reference = true;
         stats[l_elems]--;
       } else {
-        // put the item on the list to be potentially freed
+        // put the item on the list to be potentially freed, it may be
+        // there already if pinned by a shared lookup
+        if (e->next != nullptr) {
+          LRU_Remove(e);
+        }
         LRU_Insert(e);
       }
     }
@@ -444,7 +529,7 @@ rocksdb::Status BinnedLRUCacheShard::Insert(const rocksdb::Slice& key, uint32_t
   std::copy_n(key.data(), e->key_length, e->key_data);
 
   {
-    std::lock_guard<std::mutex> l(mutex_);
+    std::lock_guard l(mutex_);
     stats[l_elems]++;
     stats[l_inserts]++;
     // Free the space following strict LRU policy until enough space
@@ -472,11 +557,12 @@ rocksdb::Status BinnedLRUCacheShard::Insert(const rocksdb::Slice& key, uint32_t
       usage_ += e->charge;
       if (old != nullptr) {
         old->SetInCache(false);
+        if (old->next != nullptr) {
+          // unpinned, or pinned by a shared lookup while on the list
+          LRU_Remove(old);
+        }
         if (Unref(old)) {
           usage_ -= old->charge;
-          // old is on LRU because it's in cache and its reference count
-          // was just 1 (Unref returned 0)
-          LRU_Remove(old);
           ceph_assert(!old->next);
           old->next = deleted;
           deleted = old;
@@ -556,17 +642,17 @@ void BinnedLRUCacheShard::Erase(const rocksdb::Slice& key, uint32_t hash) {
   BinnedLRUHandle* e;
   bool last_reference = false;
   {
-    std::lock_guard<std::mutex> l(mutex_);
+    std::lock_guard l(mutex_);
     stats[l_elems]--;
     e = table_.Remove(key, hash);
     if (e != nullptr) {
+      if (e->next != nullptr) {
+        LRU_Remove(e);
+      }
       last_reference = Unref(e);
       if (last_reference) {
         usage_ -= e->charge;
       }
-      if (last_reference && e->InCache()) {
-        LRU_Remove(e);
-      }
       e->SetInCache(false);
     }
   }
@@ -579,28 +665,27 @@ void BinnedLRUCacheShard::Erase(const rocksdb::Slice& key, uint32_t hash) {
 }
 
 size_t BinnedLRUCacheShard::GetUsage() const {
-  std::lock_guard<std::mutex> l(mutex_);
+  std::shared_lock l(mutex_);
   return usage_;
 }
 
 size_t BinnedLRUCacheShard::GetPinnedUsage() const {
-  std::lock_guard<std::mutex> l(mutex_);
-  ceph_assert(usage_ >= lru_usage_);
-  return usage_ - lru_usage_;
+  std::shared_lock l(mutex_);
+  return PinnedUsage();
 }
 
 void BinnedLRUCacheShard::shift_bins() {
-  std::lock_guard<std::mutex> l(mutex_);
+  std::lock_guard l(mutex_);
   age_bins.push_front(std::make_shared<uint64_t>(0));
 }
 
 uint32_t BinnedLRUCacheShard::get_bin_count() const {
-  std::lock_guard<std::mutex> l(mutex_);
+  std::shared_lock l(mutex_);
   return age_bins.capacity();
 }
 
 void BinnedLRUCacheShard::set_bin_count(uint32_t count) {
-  std::lock_guard<std::mutex> l(mutex_);
+  std::lock_guard l(mutex_);
   age_bins.set_capacity(count);
 }
 
@@ -608,7 +693,7 @@ std::string BinnedLRUCacheShard::GetPrintableOptions() const {
   const int kBufferSize = 200;
   char buffer[kBufferSize];
   {
-    std::lock_guard<std::mutex> l(mutex_);
+    std::shared_lock l(mutex_);
     snprintf(buffer, kBufferSize, "    high_pri_pool_ratio: %.3lf\n",
              high_pri_pool_ratio_);
   }
@@ -730,7 +815,7 @@ void BinnedLRUCache::SetupPerfCounters()
   int l_first = 0;
   int l_last = l_first + 1 + stat_cnt;
   PerfCountersBuilder b(cct, std::string("rocksdb-cache-") + name, l_first, l_last);
-  for (uint32_t j = l_capacity; j <= l_misses; j++) {
+  for (uint32_t j = l_capacity; j < stat_cnt; j++) {
     b.add_u64(1 + j, ShardStats::stat_name[j], ShardStats::stat_descr[j],
       nullptr, PerfCountersBuilder::PRIO_USEFUL);
   }
@@ -904,7 +989,7 @@ void BinnedLRUCache::UpdatePerfCounters() {
   //increment these, so one can reset perf counters
   ShardStats tmp = stats;
   tmp.sub(prev_stats);
-  for (int j = l_inserts; j <= l_misses; j++) {
+  for (int j = l_inserts; j < stat_cnt; j++) {
     perfstats->inc(1 + j, tmp[j]);
   }
   prev_stats = stats;
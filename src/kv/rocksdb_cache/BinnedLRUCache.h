@@ -10,8 +10,10 @@
 #ifndef ROCKSDB_BINNED_LRU_CACHE
 #define ROCKSDB_BINNED_LRU_CACHE
 
+#include <atomic>
 #include <string>
 #include <mutex>
+#include <shared_mutex>
 #include <boost/circular_buffer.hpp>
 
 #include "ShardedCache.h"
@@ -47,6 +49,13 @@ namespace rocksdb_cache {
 // that any successful BinnedLRUCacheShard::Lookup/BinnedLRUCacheShard::Insert have a
 // matching
 // RUCache::Release (to move into state 2) or BinnedLRUCacheShard::Erase (for state 3)
+//
+// Lookups of entries that don't need to move on the LRU list only take the
+// shard lock shared, so an entry in state 1 may still sit on the LRU list
+// until eviction or the next exclusive operation on it takes it off. Those
+// lookups also mark the entry recently used, and eviction gives such
+// entries another round instead of the LRU order being updated on every
+// hit (CLOCK style).
 
 std::shared_ptr<rocksdb::Cache> NewBinnedLRUCache(
     CephContext *c,
@@ -68,14 +77,18 @@ struct BinnedLRUHandle : public rocksdb::Cache::Handle {
   BinnedLRUHandle* prev;
   size_t charge;  // TODO(opt): Only allow uint32_t?
   size_t key_length;
-  uint32_t refs;     // a number of refs to this entry
-                     // cache itself is counted as 1
+  std::atomic<uint32_t> refs;  // a number of refs to this entry
+                               // cache itself is counted as 1
+  std::atomic<bool> recently_used = false;  // hit since put on the LRU list
 
   // Include the following flags:
   //   in_cache:    whether this entry is referenced by the hash table.
   //   is_high_pri: whether this entry is high priority entry.
   //   in_high_pri_pool: whether this entry is in high-pri pool.
-  char flags;
+  //   has_hit:     whether this entry has been looked up.
+  // has_hit is set by lookups holding the shard lock shared, the others
+  // only change under the exclusive lock.
+  std::atomic<char> flags;
 
   uint32_t hash;     // Hash of key(); used for fast sharding and comparisons
 
@@ -183,6 +196,7 @@ enum stat_e : int {
   l_lookups,      // increased when trying to find element in shard
   l_hits,         // increased when lookup successful
   l_misses,       // calculated from lookups - hits
+  l_fast_hits,    // hits served under the shared lock
   stat_cnt
 };
 
@@ -201,6 +215,7 @@ struct ShardStats {
     "lookups",
     "hits",
     "misses",
+    "fast_hits",
   };
   static constexpr char const* stat_descr[stat_cnt] = {
     "capacity assigned",
@@ -211,6 +226,7 @@ struct ShardStats {
     "lookups for an element",
     "lookup successful",
     "lookup failure",
+    "lookup successful without exclusive lock",
   };
   void add(const ShardStats& other) {
     for (int j = 0; j < stat_cnt; j++) {
@@ -324,6 +340,14 @@ class alignas(CACHE_LINE_SIZE) BinnedLRUCacheShard : public CacheShard {
   // Return true if last reference
   bool Unref(BinnedLRUHandle* e);
 
+  // Take a reference holding the mutex_ shared, the entry may be on the
+  // LRU list
+  void PinShared(BinnedLRUHandle* e);
+
+  // Memory size for pinned entries, as usage_ - lru_usage_ misses the
+  // ones still on the LRU list. Needs the mutex_, shared at least.
+  size_t PinnedUsage() const;
+
   // Free some space following strict LRU policy until enough space
   // to hold (usage_ + charge) is freed or the lru list is empty
   // This function is not thread safe - it needs to be executed while
@@ -358,6 +382,10 @@ class alignas(CACHE_LINE_SIZE) BinnedLRUCacheShard : public CacheShard {
 
   // Info about the shard
   ShardStats stats;
+  // lookups only hold the lock shared, count them apart
+  std::atomic<uint64_t> lookups_ = 0;
+  std::atomic<uint64_t> hits_ = 0;
+  std::atomic<uint64_t> fast_hits_ = 0;
   // ------------^^^^^^^^^^^^^-----------
   // Not frequently modified data members
   // ------------------------------------
@@ -377,10 +405,18 @@ class alignas(CACHE_LINE_SIZE) BinnedLRUCacheShard : public CacheShard {
   // Memory size for entries residing only in the LRU list
   size_t lru_usage_;
 
-  // mutex_ protects the following state.
+  // Memory size for entries on the LRU list which are pinned nonetheless,
+  // see Lookup(). They are taken off the list by the next exclusive pass
+  // over it and counted as pinned until then.
+  // Updated under the shared lock apart from the ref count, so it may
+  // briefly go negative.
+  std::atomic<int64_t> lru_pinned_usage_ = 0;
+
+  // mutex_ protects the following state. Held shared it allows lookups and
+  // ref count changes which leave the table and the LRU list alone.
   // We don't count mutex_ as the cache's internal state so semantically we
   // don't mind mutex_ invoking the non-const actions.
-  mutable std::mutex mutex_;
+  mutable std::shared_mutex mutex_;
 
   // Circular buffer of byte counters for age binning
   boost::circular_buffer<std::shared_ptr<uint64_t>> age_bins;
@@ -119,6 +119,16 @@ class C_tick_wakeup : public EventCallback {
   }
 };
 
+class C_flush_coalesced : public EventCallback {
+  AsyncConnectionRef conn;
+
+ public:
+  explicit C_flush_coalesced(AsyncConnectionRef c): conn(c) {}
+  void do_request(uint64_t fd_or_id) override {
+    conn->flush_coalesced(fd_or_id);
+  }
+};
+
 
 AsyncConnection::AsyncConnection(CephContext *cct, AsyncMessenger *m, DispatchQueue *q,
                                  Worker *w, bool m2, bool local)
@@ -127,7 +137,10 @@ AsyncConnection::AsyncConnection(CephContext *cct, AsyncMessenger *m, DispatchQu
     logger(w->get_perf_counter()),
     labeled_logger(w->get_labeled_perf_counter()),
     state(STATE_NONE), port(-1),
-    dispatch_queue(q), recv_buf(NULL),
+    dispatch_queue(q),
+    coalesce_bytes(cct->_conf.get_val<Option::size_t>("ms_async_send_coalesce_bytes")),
+    coalesce_delay_us(cct->_conf.get_val<uint64_t>("ms_async_send_coalesce_delay_us")),
+    recv_buf(NULL),
     recv_max_prefetch(std::max<int64_t>(msgr->cct->_conf->ms_tcp_prefetch_max_size, TCP_PREFETCH_MIN_SIZE)),
     recv_start(0), recv_end(0),
     last_active(ceph::coarse_mono_clock::now()),
@@ -144,6 +157,7 @@ AsyncConnection::AsyncConnection(CephContext *cct, AsyncMessenger *m, DispatchQu
   write_callback_handler = new C_handle_write_callback(this);
   wakeup_handler = new C_time_wakeup(this);
   tick_handler = new C_tick_wakeup(this);
+  coalesce_handler = new C_flush_coalesced(this);
   // double recv_max_prefetch see "read_until"
   recv_buf = new char[2*recv_max_prefetch];
   if (local) {
@@ -340,6 +354,21 @@ ssize_t AsyncConnection::_try_send(bool more)
   ceph_assert(center->in_thread());
   ldout(async_msgr->cct, 25) << __func__ << " cs.send " << outgoing_bl.length()
                              << " bytes" << dendl;
+  if (outgoing_frames) {
+    logger->inc(l_msgr_send_frames_per_write, outgoing_frames);
+    outgoing_frames = 0;
+  }
+  if (coalesce_start != ceph::mono_time()) {
+    logger->tinc(l_msgr_send_coalesce_lat,
+                 ceph::mono_clock::now() - coalesce_start);
+    coalesce_start = ceph::mono_time();
+  }
+  if (coalesce_flush_id) {
+    center->delete_time_event(coalesce_flush_id);
+    coalesce_flush_id = 0;
+  }
+  coalesce_expired = false;
+
   // network block would make ::send return EAGAIN, that would make here looks
   // like do not call cs.send() and r = 0
   ssize_t r = 0;
@@ -370,6 +399,31 @@ ssize_t AsyncConnection::_try_send(bool more)
   return outgoing_bl.length();
 }
 
+// Whether the frames in outgoing_bl may wait for more rather than go out
+// now (must hold write_lock). They wait while more frames are known to
+// follow in this event loop iteration, and with ms_async_send_coalesce_delay_us
+// also for the frames queued by later iterations, until either the byte or
+// the time bound is hit. Nothing is held while the socket is backed up:
+// EVENT_WRITABLE drives the sends then and the kernel batches anyway.
+bool AsyncConnection::_hold_send(bool more)
+{
+  if (!coalesce_bytes || coalesce_expired || open_write ||
+      !outgoing_bl.length() || outgoing_bl.length() >= coalesce_bytes) {
+    return false;
+  }
+  if (!more && !coalesce_delay_us) {
+    return false;
+  }
+  if (coalesce_start == ceph::mono_time()) {
+    coalesce_start = ceph::mono_clock::now();
+  }
+  if (!more && !coalesce_flush_id) {
+    coalesce_flush_id = center->create_time_event(coalesce_delay_us,
+                                                  coalesce_handler);
+  }
+  return true;
+}
+
 void AsyncConnection::inject_delay() {
   if (async_msgr->cct->_conf->ms_inject_internal_delays) {
     ldout(async_msgr->cct, 10) << __func__ << " sleep for " <<
@@ -425,6 +479,10 @@ void AsyncConnection::process() {
             opts.priority = SOCKET_PRIORITY_MIN_DELAY;
           }
       }
+      if (async_msgr->cct->_conf.get_val<bool>("ms_tcp_zerocopy")) {
+        opts.zerocopy_threshold = async_msgr->cct->_conf.get_val<Option::size_t>(
+          "ms_tcp_zerocopy_threshold");
+      }
       opts.connect_bind_addr = msgr->get_myaddrs().front();
       ssize_t r = worker->connect(target_addr, opts, &cs);
       if (r < 0) {
@@ -633,6 +691,9 @@ void AsyncConnection::fault()
   recv_start = recv_end = 0;
   state_offset = 0;
   outgoing_bl.clear();
+  outgoing_frames = 0;
+  coalesce_start = ceph::mono_time();
+  coalesce_expired = false;
 }
 
 void AsyncConnection::_stop() {
@@ -660,6 +721,10 @@ void AsyncConnection::shutdown_socket() {
     center->delete_time_event(last_tick_id);
     last_tick_id = 0;
   }
+  if (coalesce_flush_id) {
+    center->delete_time_event(coalesce_flush_id);
+    coalesce_flush_id = 0;
+  }
   if (cs) {
     center->delete_file_event(cs.fd(), EVENT_READABLE | EVENT_WRITABLE);
     cs.shutdown();
@@ -819,6 +884,7 @@ void AsyncConnection::cleanup() {
   delete write_callback_handler;
   delete wakeup_handler;
   delete tick_handler;
+  delete coalesce_handler;
   if (delay_state) {
     delete delay_state;
     delay_state = NULL;
@@ -833,6 +899,20 @@ void AsyncConnection::wakeup_from(uint64_t id)
   process();
 }
 
+void AsyncConnection::flush_coalesced(uint64_t id)
+{
+  {
+    std::lock_guard<std::mutex> l(write_lock);
+    if (id != coalesce_flush_id) {
+      return;
+    }
+    coalesce_flush_id = 0;
+    coalesce_expired = true;
+  }
+  ldout(async_msgr->cct, 20) << __func__ << dendl;
+  handle_write();
+}
+
 void AsyncConnection::tick(uint64_t id)
 {
   auto now = ceph::coarse_mono_clock::now();
@@ -60,6 +60,7 @@ class AsyncConnection : public Connection {
   ssize_t write(ceph::buffer::list &bl, std::function<void(ssize_t)> callback,
                 bool more=false);
   ssize_t _try_send(bool more=false);
+  bool _hold_send(bool more);
 
   void _connect();
   void _stop();
@@ -190,6 +191,14 @@ private:
   // lockfree, only used in own thread
   ceph::buffer::list outgoing_bl;
   bool open_write = false;
+  unsigned outgoing_frames = 0;  ///< frames appended since the last send
+
+  // send coalescing, see _hold_send()
+  const uint64_t coalesce_bytes;
+  const uint64_t coalesce_delay_us;
+  ceph::mono_clock::time_point coalesce_start;  ///< first frame held back
+  uint64_t coalesce_flush_id = 0;
+  bool coalesce_expired = false;
 
   std::mutex write_lock;
 
@@ -199,6 +208,7 @@ private:
   EventCallbackRef write_callback_handler;
   EventCallbackRef wakeup_handler;
   EventCallbackRef tick_handler;
+  EventCallbackRef coalesce_handler;
   char *recv_buf;
   uint32_t recv_max_prefetch;
   uint32_t recv_start;
@@ -240,6 +250,7 @@ private:
   void process();
   void wakeup_from(uint64_t id);
   void tick(uint64_t id);
+  void flush_coalesced(uint64_t id);
   void shutdown() override;
   void stop(bool queue_reset);
   void cleanup();
@@ -32,6 +32,7 @@
 #include "common/config.h"
 #include "common/Timer.h"
 #include "common/errno.h"
+#include "common/pick_address.h"
 
 #include "messages/MOSDOp.h"
 #include "messages/MOSDOpReply.h"
@@ -183,6 +184,10 @@ void Processor::accept()
   opts.nodelay = msgr->cct->_conf->ms_tcp_nodelay;
   opts.rcbuf_size = msgr->cct->_conf->ms_tcp_rcvbuf;
   opts.priority = msgr->get_socket_priority();
+  if (msgr->cct->_conf.get_val<bool>("ms_tcp_zerocopy")) {
+    opts.zerocopy_threshold =
+      msgr->cct->_conf.get_val<Option::size_t>("ms_tcp_zerocopy_threshold");
+  }
 
   for (auto& listen_socket : listen_sockets) {
     ldout(msgr->cct, 10) << __func__ << " listen_fd=" << listen_socket.fd()
@@ -377,6 +382,8 @@ AsyncMessenger::AsyncMessenger(CephContext *cct, entity_name_t name,
     transport_type = "dpdk";
   else if (type.find("smc") != std::string::npos)
     transport_type = "smc";
+  else if (type.find("uring") != std::string::npos)
+    transport_type = "uring";
 
   auto single = &cct->lookup_or_create_singleton_object<StackSingleton>(
     "AsyncMessenger::NetworkStack::" + transport_type, true, cct);
@@ -753,6 +760,31 @@ void AsyncMessenger::_finish_bind(const entity_addrvec_t& bind_addrs,
 
   ldout(cct,1) << __func__ << " bind my_addrs is " << get_myaddrs() << dendl;
   did_bind = true;
+
+  if (cct->_conf.get_val<bool>("ms_async_numa_auto_affinity")) {
+    _set_numa_affinity();
+  }
+}
+
+void AsyncMessenger::_set_numa_affinity()
+{
+  const entity_addr_t addr = get_myaddrs().front();
+  if (!addr.is_ip() || addr.is_blank_ip()) {
+    ldout(cct, 10) << __func__ << " no interface to go by in " << addr << dendl;
+    return;
+  }
+  std::string iface = pick_iface(cct, addr.get_sockaddr_storage());
+  int node = -1;
+  int r = get_iface_numa_node(iface, &node);
+  if (r < 0 || node < 0) {
+    // node -2 is a bond whose ports sit on different nodes
+    ldout(cct, 1) << __func__ << " unable to identify numa node of '" << iface
+                  << "' (" << addr << "): r=" << r << " node=" << node << dendl;
+    return;
+  }
+  ldout(cct, 1) << __func__ << " " << iface << " is on numa node " << node
+                << dendl;
+  stack->add_numa_affinity(node);
 }
 
 int AsyncMessenger::client_reset()
@@ -237,6 +237,7 @@ private:
 
   void _finish_bind(const entity_addrvec_t& bind_addrs,
 		    const entity_addrvec_t& listen_addrs);
+  void _set_numa_affinity();
 
   entity_addrvec_t _filter_addrs(const entity_addrvec_t& addrs);
 
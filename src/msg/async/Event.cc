@@ -25,6 +25,10 @@
 #include "dpdk/EventDPDK.h"
 #endif
 
+#ifdef HAVE_LIBURING
+#include "EventUring.h"
+#endif
+
 #ifdef HAVE_EPOLL
 #include "EventEpoll.h"
 #else
@@ -131,6 +135,10 @@ int EventCenter::init(int nevent, unsigned center_id, const std::string &type)
   if (type == "dpdk") {
 #ifdef HAVE_DPDK
     driver = new DPDKDriver(cct);
+#endif
+  } else if (type == "uring") {
+#ifdef HAVE_LIBURING
+    driver = new UringDriver(cct);
 #endif
   } else {
 #ifdef HAVE_EPOLL
@@ -0,0 +1,451 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:nil -*-
+// vim: ts=8 sw=2 sts=2 expandtab
+
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include <poll.h>
+#include <limits.h>
+
+#include <algorithm>
+#include <bit>
+#include <cstdlib>
+
+#include "common/errno.h"
+#include "common/numa.h"
+#include "include/intarith.h"
+#include "include/page.h"
+#include "EventUring.h"
+
+#define dout_subsys ceph_subsys_ms
+
+#undef dout_prefix
+#define dout_prefix *_dout << "UringDriver."
+
+UringDriver::~UringDriver()
+{
+  if (rx_ring)
+    io_uring_free_buf_ring(&ring, rx_ring, rx_count, RX_GROUP);
+  if (ring_inited)
+    io_uring_queue_exit(&ring);
+  free(rx_mem);
+}
+
+int UringDriver::init(EventCenter *c, int nevent)
+{
+  unsigned entries = cct->_conf.get_val<uint64_t>("ms_async_uring_entries");
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  // multishot poll and recv can complete many times per SQE
+  params.flags = IORING_SETUP_CQSIZE;
+  params.cq_entries = entries * 4;
+  int r = io_uring_queue_init_params(entries, &ring, &params);
+  if (r < 0) {
+    lderr(cct) << __func__ << " unable to set up io_uring: "
+               << cpp_strerror(r) << dendl;
+    return r;
+  }
+  ring_inited = true;
+
+  rx_count = std::bit_ceil(std::max<uint64_t>(
+    cct->_conf.get_val<uint64_t>("ms_async_uring_rx_buffers"), 2));
+  rx_size = p2roundup<uint64_t>(
+    cct->_conf.get_val<Option::size_t>("ms_async_uring_rx_buffer_size"),
+    CEPH_PAGE_SIZE);
+  rx_mem = static_cast<char*>(
+    aligned_alloc(CEPH_PAGE_SIZE, (size_t)rx_count * rx_size));
+  if (!rx_mem) {
+    lderr(cct) << __func__ << " unable to allocate " << rx_count
+               << " receive buffers of " << rx_size << " bytes" << dendl;
+    return -ENOMEM;
+  }
+  rx_ring = io_uring_setup_buf_ring(&ring, rx_count, RX_GROUP, 0, &r);
+  if (!rx_ring) {
+    lderr(cct) << __func__ << " unable to register provided buffer ring "
+               << "(needs Linux 5.19): " << cpp_strerror(r) << dendl;
+    return r;
+  }
+  int mask = io_uring_buf_ring_mask(rx_count);
+  for (unsigned bid = 0; bid < rx_count; ++bid) {
+    io_uring_buf_ring_add(rx_ring, rx_mem + (size_t)bid * rx_size, rx_size,
+                          bid, mask, bid);
+  }
+  io_uring_buf_ring_advance(rx_ring, rx_count);
+  // enough for the recvs of the next few batches of completions
+  rx_reserve = std::max(1u, rx_count / 4);
+
+  resize_events(nevent);
+  return 0;
+}
+
+void UringDriver::bind_rx_buffers(int node)
+{
+  // the kernel writes into these from whatever cpu handles the socket, so
+  // first touch would not place them
+  int r = bind_memory_to_numa_node(rx_mem, (size_t)rx_count * rx_size, node);
+  if (r < 0) {
+    lderr(cct) << __func__ << " unable to move receive buffers to numa node "
+               << node << ": " << cpp_strerror(r) << dendl;
+  }
+}
+
+struct io_uring_sqe *UringDriver::get_sqe()
+{
+  auto sqe = io_uring_get_sqe(&ring);
+  if (!sqe) {
+    // the SQ is full; hand what we have to the kernel to make room
+    io_uring_submit(&ring);
+    sqe = io_uring_get_sqe(&ring);
+    ceph_assert(sqe);
+  }
+  return sqe;
+}
+
+void UringDriver::arm_poll(int fd, int mask)
+{
+  auto &st = fds[fd];
+  if (st.poll_mask != EVENT_NONE) {
+    auto sqe = get_sqe();
+    io_uring_prep_poll_remove(sqe, fd_data(OP_POLL, fd, st.gen));
+    io_uring_sqe_set_data64(sqe, make_data(OP_CANCEL, 0));
+  }
+  ++st.gen;
+  st.poll_mask = mask;
+  if (mask == EVENT_NONE)
+    return;
+
+  unsigned events = 0;
+  if (mask & EVENT_READABLE)
+    events |= POLLIN;
+  if (mask & EVENT_WRITABLE)
+    events |= POLLOUT;
+  auto sqe = get_sqe();
+  io_uring_prep_poll_multishot(sqe, fd, events);
+  io_uring_sqe_set_data64(sqe, fd_data(OP_POLL, fd, st.gen));
+}
+
+void UringDriver::arm_recv(int fd)
+{
+  auto &st = fds[fd];
+  auto sqe = get_sqe();
+  io_uring_prep_recv_multishot(sqe, fd, nullptr, 0, 0);
+  sqe->flags |= IOSQE_BUFFER_SELECT;
+  sqe->buf_group = RX_GROUP;
+  io_uring_sqe_set_data64(sqe, fd_data(OP_RECV, fd, st.gen));
+  st.recv_armed = true;
+}
+
+void UringDriver::prep_send(uint64_t id, send_t &s)
+{
+  s.iov.clear();
+  for (auto& p : s.bl.buffers()) {
+    if (s.iov.size() == IOV_MAX)
+      break;
+    s.iov.push_back({(void*)p.c_str(), p.length()});
+  }
+  // FIPS zeroization audit 20191115: this memset is not security related.
+  memset(&s.msg, 0, sizeof(s.msg));
+  s.msg.msg_iov = s.iov.data();
+  s.msg.msg_iovlen = s.iov.size();
+  auto sqe = get_sqe();
+  io_uring_prep_sendmsg(sqe, s.fd, &s.msg, MSG_NOSIGNAL);
+  io_uring_sqe_set_data64(sqe, make_data(OP_SEND, id));
+}
+
+void UringDriver::fire(int fd, int mask)
+{
+  if (!mask)
+    return;
+  if (fired_masks[fd] == EVENT_NONE)
+    fired_fds.push_back(fd);
+  fired_masks[fd] |= mask;
+}
+
+void UringDriver::handle_cqe(const struct io_uring_cqe *cqe)
+{
+  uint64_t data = io_uring_cqe_get_data64(cqe);
+  int res = cqe->res;
+  bool more = cqe->flags & IORING_CQE_F_MORE;
+  int fd = (int)(uint32_t)data;
+  uint32_t gen = (data >> 32) & 0xffffff;
+
+  switch (data >> 56) {
+  case OP_POLL: {
+    auto &st = fds[fd];
+    if ((st.gen & 0xffffff) != gen || st.stream)
+      break;
+    if (!more && st.poll_mask != EVENT_NONE) {
+      // the kernel may drop a multishot poll at any time; put it back
+      int mask = st.poll_mask;
+      st.poll_mask = EVENT_NONE;
+      arm_poll(fd, mask);
+    }
+    if (res < 0) {
+      if (res != -ECANCELED) {
+        ldout(cct, 1) << __func__ << " poll on fd=" << fd << " failed: "
+                      << cpp_strerror(res) << dendl;
+      }
+      break;
+    }
+    int mask = 0;
+    if (res & POLLIN) mask |= EVENT_READABLE;
+    if (res & POLLOUT) mask |= EVENT_WRITABLE;
+    if (res & (POLLERR | POLLHUP)) mask |= EVENT_READABLE | EVENT_WRITABLE;
+    fire(fd, mask);
+    break;
+  }
+  case OP_RECV: {
+    int bid = -1;
+    if (cqe->flags & IORING_CQE_F_BUFFER) {
+      bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+      ++rx_out;
+    }
+    auto &st = fds[fd];
+    if ((st.gen & 0xffffff) != gen || !st.stream) {
+      // detached while the completion was in flight
+      if (bid >= 0)
+        recycle(bid);
+      break;
+    }
+    if (!more)
+      st.recv_armed = false;
+    if (res == -ENOBUFS) {
+      // the buffer ring ran dry; resume once readers give buffers back
+      ldout(cct, 10) << __func__ << " out of receive buffers, fd=" << fd
+                     << " stalled" << dendl;
+      rx_stalled.push_back(fd);
+      break;
+    }
+    fire(fd, st.stream->handle_recv(res, bid));
+    // a recv cancelled by pause_recv() is put back if it was resumed meanwhile
+    if ((res > 0 || res == -ECANCELED) && !st.recv_armed && !st.recv_paused &&
+        st.stream)
+      arm_recv(fd);
+    break;
+  }
+  case OP_SEND: {
+    uint64_t id = data & ((1ull << 56) - 1);
+    auto p = sends.find(id);
+    ceph_assert(p != sends.end());
+    // the stream may queue its next send below, so hold on to the
+    // (node-stable) reference rather than the iterator
+    auto &s = p->second;
+    auto &st = fds[s.fd];
+    bool live = st.gen == s.gen && st.stream;
+    if (res == 0 && s.bl.length())
+      res = -EPIPE;
+    if (live && res > 0 && (unsigned)res < s.bl.length()) {
+      // short send: keep the rest in flight so the stream stays in order
+      s.bl.splice(0, res);
+      prep_send(id, s);
+      break;
+    }
+    if (live)
+      fire(s.fd, st.stream->handle_send(res < 0 ? res : 0));
+    sends.erase(id);
+    break;
+  }
+  case OP_CANCEL:
+    break;
+  default:
+    ceph_abort_msg("unknown io_uring completion");
+  }
+}
+
+int UringDriver::add_event(int fd, int cur_mask, int add_mask)
+{
+  ldout(cct, 20) << __func__ << " add event fd=" << fd << " cur_mask=" << cur_mask
+                 << " add_mask=" << add_mask << dendl;
+  resize_events(fd + 1);
+  auto &st = fds[fd];
+  st.mask = cur_mask | add_mask;
+  if (st.stream) {
+    // edge triggered: report what is already there, like EPOLL_CTL_MOD would
+    int ready = st.stream->ready_mask() & add_mask;
+    if (ready)
+      deferred.push_back(FiredFileEvent{fd, ready});
+    return 0;
+  }
+  arm_poll(fd, st.mask);
+  return 0;
+}
+
+int UringDriver::del_event(int fd, int cur_mask, int delmask)
+{
+  ldout(cct, 20) << __func__ << " del event fd=" << fd << " cur_mask=" << cur_mask
+                 << " delmask=" << delmask << dendl;
+  resize_events(fd + 1);
+  auto &st = fds[fd];
+  st.mask = cur_mask & ~delmask;
+  if (!st.stream) {
+    arm_poll(fd, st.mask);
+    if (st.mask == EVENT_NONE) {
+      // the fd is likely closed next; don't let a queued SQE outlive it
+      flush();
+    }
+  }
+  return 0;
+}
+
+int UringDriver::resize_events(int newsize)
+{
+  if ((size_t)newsize > fds.size()) {
+    fds.resize(newsize);
+    fired_masks.resize(newsize, EVENT_NONE);
+  }
+  return 0;
+}
+
+int UringDriver::event_wait(std::vector<FiredFileEvent> &fired_events,
+			    struct timeval *tvp)
+{
+  if (rx_recycled) {
+    io_uring_buf_ring_advance(rx_ring, rx_recycled);
+    rx_recycled = 0;
+    for (int fd : rx_stalled) {
+      auto &st = fds[fd];
+      if (st.stream && !st.recv_armed && !st.recv_paused)
+        arm_recv(fd);
+    }
+    rx_stalled.clear();
+  }
+  for (int fd : corked) {
+    auto &st = fds[fd];
+    if (st.stream)
+      st.stream->uncork();
+  }
+  corked.clear();
+
+  // one io_uring_enter() submits everything queued since the last call and
+  // waits for the next completions
+  struct io_uring_cqe *cqe = nullptr;
+  int r;
+  if (!deferred.empty()) {
+    r = io_uring_submit(&ring);
+  } else if (tvp) {
+    struct __kernel_timespec ts;
+    ts.tv_sec = tvp->tv_sec;
+    ts.tv_nsec = tvp->tv_usec * 1000;
+    r = io_uring_submit_and_wait_timeout(&ring, &cqe, 1, &ts, nullptr);
+  } else {
+    r = io_uring_submit_and_wait(&ring, 1);
+  }
+  if (r < 0 && r != -ETIME && r != -EINTR) {
+    lderr(cct) << __func__ << " io_uring_enter failed: " << cpp_strerror(r)
+               << dendl;
+  }
+
+  for (auto &e : deferred)
+    fire(e.fd, e.mask);
+  deferred.clear();
+
+  unsigned head, n = 0;
+  io_uring_for_each_cqe(&ring, head, cqe) {
+    handle_cqe(cqe);
+    ++n;
+  }
+  io_uring_cq_advance(&ring, n);
+
+  for (int fd : fired_fds) {
+    // nothing registered yet; add_event() will pick it up from ready_mask()
+    if (fds[fd].mask != EVENT_NONE)
+      fired_events.push_back(FiredFileEvent{fd, fired_masks[fd]});
+    fired_masks[fd] = EVENT_NONE;
+  }
+  fired_fds.clear();
+  return fired_events.size();
+}
+
+void UringDriver::attach(int fd, Stream *s)
+{
+  ldout(cct, 20) << __func__ << " fd=" << fd << dendl;
+  resize_events(fd + 1);
+  auto &st = fds[fd];
+  ceph_assert(!st.stream);
+  arm_poll(fd, EVENT_NONE);
+  st.stream = s;
+  st.recv_paused = false;
+  arm_recv(fd);
+}
+
+void UringDriver::detach(int fd)
+{
+  ldout(cct, 20) << __func__ << " fd=" << fd << dendl;
+  auto &st = fds[fd];
+  ceph_assert(st.stream);
+  if (st.recv_armed) {
+    auto sqe = get_sqe();
+    io_uring_prep_cancel64(sqe, fd_data(OP_RECV, fd, st.gen), 0);
+    io_uring_sqe_set_data64(sqe, make_data(OP_CANCEL, 0));
+    st.recv_armed = false;
+  }
+  ++st.gen;
+  st.stream = nullptr;
+  st.mask = EVENT_NONE;
+  rx_stalled.erase(std::remove(rx_stalled.begin(), rx_stalled.end(), fd),
+                   rx_stalled.end());
+  corked.erase(std::remove(corked.begin(), corked.end(), fd), corked.end());
+  // the caller closes the fd next and the number may be reused right away
+  flush();
+}
+
+void UringDriver::pause_recv(int fd)
+{
+  ldout(cct, 20) << __func__ << " fd=" << fd << dendl;
+  auto &st = fds[fd];
+  ceph_assert(st.stream);
+  if (st.recv_paused)
+    return;
+  st.recv_paused = true;
+  if (st.recv_armed) {
+    // recv_armed stays set until the final CQE, so a resume in between
+    // does not put a second recv on the socket
+    auto sqe = get_sqe();
+    io_uring_prep_cancel64(sqe, fd_data(OP_RECV, fd, st.gen), 0);
+    io_uring_sqe_set_data64(sqe, make_data(OP_CANCEL, 0));
+  }
+}
+
+void UringDriver::resume_recv(int fd)
+{
+  ldout(cct, 20) << __func__ << " fd=" << fd << dendl;
+  auto &st = fds[fd];
+  ceph_assert(st.stream);
+  st.recv_paused = false;
+  if (!st.recv_armed)
+    arm_recv(fd);
+}
+
+void UringDriver::submit_send(int fd, ceph::buffer::list &&bl)
+{
+  uint64_t id = next_send++;
+  auto &s = sends[id];
+  s.fd = fd;
+  s.gen = fds[fd].gen;
+  s.bl = std::move(bl);
+  prep_send(id, s);
+}
+
+void UringDriver::flush()
+{
+  int r = io_uring_submit(&ring);
+  if (r < 0) {
+    lderr(cct) << __func__ << " io_uring_submit failed: " << cpp_strerror(r)
+               << dendl;
+  }
+}
+
+void UringDriver::recycle(int bid)
+{
+  // made visible to the kernel in one go by the next event_wait()
+  --rx_out;
+  io_uring_buf_ring_add(rx_ring, (void*)rx_buffer(bid), rx_size, bid,
+                        io_uring_buf_ring_mask(rx_count), rx_recycled++);
+}
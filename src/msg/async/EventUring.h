@@ -0,0 +1,165 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:nil -*-
+// vim: ts=8 sw=2 sts=2 expandtab
+
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_MSG_EVENTURING_H
+#define CEPH_MSG_EVENTURING_H
+
+#include <sys/socket.h>
+#include <liburing.h>
+
+#include <unordered_map>
+#include <vector>
+
+#include "include/buffer.h"
+#include "Event.h"
+
+/*
+ * EventDriver on top of io_uring.
+ *
+ * Plain fds (listen sockets, the notify eventfd, sockets that are still
+ * connecting) are watched with multishot poll, which replaces epoll_ctl() and
+ * epoll_wait() with SQEs and CQEs on the worker's ring.
+ *
+ * Connected sockets of the uring stack attach a Stream instead: they are fed
+ * by a multishot recv that picks buffers from a per-worker provided buffer
+ * ring, and their sends are queued as sendmsg SQEs. Readiness for those fds
+ * is derived from completions. All SQEs prepared while handling one batch of
+ * events go to the kernel together with the wait for the next batch, in a
+ * single io_uring_enter().
+ *
+ * Not thread safe; everything runs on the owning EventCenter's thread.
+ */
+class UringDriver : public EventDriver {
+ public:
+  class Stream {
+   public:
+    virtual ~Stream() {}
+    /// multishot recv result: bytes in provided buffer @p bid, 0 on EOF or
+    /// -errno. returns the EVENT_* mask to fire
+    virtual int handle_recv(int res, int bid) = 0;
+    /// result of a whole submit_send(): 0 once all of it went out, or -errno
+    virtual int handle_send(int res) = 0;
+    /// EVENT_* mask that is ready right now, checked when an event is added
+    virtual int ready_mask() const = 0;
+    /// called once per loop iteration after cork(): submit what was queued
+    virtual void uncork() = 0;
+  };
+
+ private:
+  enum : uint8_t {
+    OP_POLL = 1,
+    OP_RECV,
+    OP_SEND,
+    OP_CANCEL,
+  };
+  static constexpr uint16_t RX_GROUP = 0;
+
+  struct fd_state_t {
+    int mask = EVENT_NONE;	///< events the center wants
+    int poll_mask = EVENT_NONE;	///< mask of the armed poll, if any
+    uint32_t gen = 0;		///< bumped on every re-arm; stale CQEs mismatch
+    bool recv_armed = false;
+    bool recv_paused = false;	///< don't re-arm until resume_recv()
+    Stream *stream = nullptr;
+  };
+  struct send_t {
+    int fd;
+    uint32_t gen;
+    ceph::buffer::list bl;
+    std::vector<struct iovec> iov;
+    struct msghdr msg;
+  };
+
+  CephContext *cct;
+  struct io_uring ring;
+  bool ring_inited = false;
+  std::vector<fd_state_t> fds;
+
+  struct io_uring_buf_ring *rx_ring = nullptr;
+  char *rx_mem = nullptr;
+  unsigned rx_count = 0;
+  unsigned rx_size = 0;
+  unsigned rx_recycled = 0;	///< buffers returned since the last advance
+  unsigned rx_out = 0;		///< buffers the kernel filled, not recycled yet
+  unsigned rx_reserve = 0;	///< see rx_low()
+  std::vector<int> rx_stalled;	///< fds whose recv ran out of buffers
+  std::vector<int> corked;	///< fds with sends queued in their stream
+
+  std::unordered_map<uint64_t, send_t> sends;
+  uint64_t next_send = 0;
+
+  std::vector<FiredFileEvent> deferred;
+  std::vector<int> fired_masks;	///< per-fd scratch used by event_wait
+  std::vector<int> fired_fds;
+
+  static uint64_t make_data(uint8_t op, uint64_t v) {
+    return (uint64_t)op << 56 | v;
+  }
+  static uint64_t fd_data(uint8_t op, int fd, uint32_t gen) {
+    return make_data(op, (uint64_t)(gen & 0xffffff) << 32 | (uint32_t)fd);
+  }
+
+  struct io_uring_sqe *get_sqe();
+  void arm_poll(int fd, int mask);
+  void arm_recv(int fd);
+  void prep_send(uint64_t id, send_t &s);
+  void fire(int fd, int mask);
+  void handle_cqe(const struct io_uring_cqe *cqe);
+
+ public:
+  explicit UringDriver(CephContext *c): cct(c) {}
+  ~UringDriver() override;
+
+  int init(EventCenter *c, int nevent) override;
+  int add_event(int fd, int cur_mask, int add_mask) override;
+  int del_event(int fd, int cur_mask, int del_mask) override;
+  int resize_events(int newsize) override;
+  int event_wait(std::vector<FiredFileEvent> &fired_events,
+		 struct timeval *tp) override;
+
+  /// switch @p fd from poll to completion driven I/O
+  void attach(int fd, Stream *s);
+  /// stop delivering completions for @p fd to its stream; call before close()
+  void detach(int fd);
+  /// have Stream::uncork() run before the next submission, so everything a
+  /// connection sends in one loop iteration goes out in a single sendmsg
+  void cork(int fd) {
+    corked.push_back(fd);
+  }
+  /// stop receiving on @p fd; completions already queued are still delivered
+  void pause_recv(int fd);
+  void resume_recv(int fd);
+  /// queue @p bl on @p fd; Stream::handle_send() runs once all of it is sent
+  void submit_send(int fd, ceph::buffer::list &&bl);
+  /// push every prepared SQE to the kernel now
+  void flush();
+
+  const char *rx_buffer(int bid) const {
+    return rx_mem + (size_t)bid * rx_size;
+  }
+  unsigned rx_buffers() const {
+    return rx_count;
+  }
+  /// fewer than rx_reserve buffers are left in the ring. streams copy what
+  /// they receive out of the provided buffer then, so connections that stop
+  /// reading cannot take the buffers the others need to make progress
+  bool rx_low() const {
+    return rx_count - rx_out < rx_reserve;
+  }
+  /// hand provided buffer @p bid back to the kernel
+  void recycle(int bid);
+  /// move the provided buffers to numa node @p node
+  void bind_rx_buffers(int node);
+};
+
+#endif
@@ -20,8 +20,12 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <errno.h>
+#ifdef __linux__
+#include <linux/errqueue.h>
+#endif
 
 #include <algorithm>
+#include <deque>
 
 #include "PosixStack.h"
 
@@ -38,16 +42,117 @@
 #undef dout_prefix
 #define dout_prefix *_dout << "PosixStack "
 
+#if defined(__linux__) && defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY) && \
+    defined(SO_EE_ORIGIN_ZEROCOPY)
+#define HAVE_MSG_ZEROCOPY
+#endif
+
+void PosixZerocopySends::add(unsigned calls, ceph::buffer::list&& bl)
+{
+  send_t z;
+  z.first = next;
+  z.last = next + calls - 1;
+  z.outstanding = calls;
+  z.bl = std::move(bl);
+  next += calls;
+  sends.push_back(std::move(z));
+}
+
+static bool seq_before(uint32_t a, uint32_t b) {
+  return static_cast<int32_t>(a - b) < 0;
+}
+
+void PosixZerocopySends::complete(uint32_t lo, uint32_t hi)
+{
+  // completions may arrive out of order; only release from the front
+  for (auto& z : sends) {
+    if (seq_before(hi, z.first)) {
+      break;
+    }
+    uint32_t b = seq_before(lo, z.first) ? z.first : lo;
+    uint32_t e = seq_before(z.last, hi) ? z.last : hi;
+    if (!seq_before(e, b)) {
+      z.outstanding -= e - b + 1;
+    }
+  }
+  while (!sends.empty() && sends.front().outstanding == 0) {
+    sends.pop_front();
+  }
+}
+
+bool PosixZerocopySends::reap(int fd)
+{
+  bool copied = false;
+#ifdef HAVE_MSG_ZEROCOPY
+  while (!sends.empty()) {
+    char control[CMSG_SPACE(sizeof(struct sock_extended_err)) +
+		 CMSG_SPACE(sizeof(struct sockaddr_in6))];
+    struct msghdr msg;
+    // FIPS zeroization audit 20191115: this memset is not security related.
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    if (::recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+      // EAGAIN: nothing more to reap for now
+      break;
+    }
+    for (auto cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+      if (!(cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) &&
+	  !(cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR)) {
+	continue;
+      }
+      auto serr = reinterpret_cast<struct sock_extended_err*>(CMSG_DATA(cm));
+      if (serr->ee_errno != 0 || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+	continue;
+      }
+      complete(serr->ee_info, serr->ee_data);
+      if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+	copied = true;
+      }
+    }
+  }
+#endif
+  return copied;
+}
+
 class PosixConnectedSocketImpl final : public ConnectedSocketImpl {
   ceph::NetHandler &handler;
   int _fd;
   entity_addr_t sa;
   bool connected;
+  PerfCounters *logger;
+  PosixWorker *worker;
+
+#ifdef HAVE_MSG_ZEROCOPY
+  // sends of at least this many bytes go out with MSG_ZEROCOPY; 0 disables
+  uint64_t zerocopy_threshold = 0;
+  PosixZerocopySends zerocopy_sends;
+
+  void reap_zerocopy() {
+    if (zerocopy_sends.reap(_fd)) {
+      // the device (or loopback) could not transmit from our pages, so the
+      // kernel copied after all; stop paying for pinning on this socket.
+      logger->inc(l_msgr_send_zerocopy_copied);
+      zerocopy_threshold = 0;
+    }
+  }
+#endif
 
  public:
   explicit PosixConnectedSocketImpl(ceph::NetHandler &h, const entity_addr_t &sa,
-				    int f, bool connected)
-      : handler(h), _fd(f), sa(sa), connected(connected) {}
+				    int f, bool connected, PosixWorker *worker,
+				    uint64_t zerocopy_threshold)
+      : handler(h), _fd(f), sa(sa), connected(connected),
+	logger(worker->perf_logger), worker(worker) {
+#ifdef HAVE_MSG_ZEROCOPY
+    if (zerocopy_threshold) {
+      int on = 1;
+      if (::setsockopt(_fd, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on)) == 0) {
+	this->zerocopy_threshold = zerocopy_threshold;
+      }
+    }
+#endif
+  }
 
   int is_connected() override {
     if (connected)
@@ -68,6 +173,10 @@ class PosixConnectedSocketImpl final : public ConnectedSocketImpl {
     #ifdef _WIN32
     ssize_t r = ::recv(_fd, buf, len, 0);
     #else
+#ifdef HAVE_MSG_ZEROCOPY
+    // completions raise EPOLLERR, which wakes us up as readable
+    reap_zerocopy();
+#endif
     ssize_t r = ::read(_fd, buf, len);
     #endif
     if (r < 0)
@@ -75,26 +184,42 @@ class PosixConnectedSocketImpl final : public ConnectedSocketImpl {
     return r;
   }
 
+  #ifndef _WIN32
   // return the sent length
   // < 0 means error occurred
-  #ifndef _WIN32
-  static ssize_t do_sendmsg(int fd, struct msghdr &msg, unsigned len, bool more)
+  // with zerocopy set, *zerocopy_calls is bumped for every sendmsg() that
+  // consumed a MSG_ZEROCOPY sequence number
+  static ssize_t do_sendmsg(int fd, struct msghdr &msg, unsigned len, bool more,
+			    bool zerocopy = false, unsigned *zerocopy_calls = nullptr)
   {
     size_t sent = 0;
     while (1) {
       MSGR_SIGPIPE_STOPPER;
       ssize_t r;
-      r = ::sendmsg(fd, &msg, MSG_NOSIGNAL | (more ? MSG_MORE : 0));
+      int flags = MSG_NOSIGNAL | (more ? MSG_MORE : 0);
+#ifdef HAVE_MSG_ZEROCOPY
+      if (zerocopy) {
+	flags |= MSG_ZEROCOPY;
+      }
+#endif
+      r = ::sendmsg(fd, &msg, flags);
       if (r < 0) {
         int err = ceph_sock_errno();
         if (err == EINTR) {
           continue;
         } else if (err == EAGAIN) {
           break;
+        } else if (err == ENOBUFS && zerocopy) {
+          // out of optmem for completion notifications; copy this one
+          zerocopy = false;
+          continue;
         }
         return -err;
       }
 
+      if (zerocopy && r > 0) {
+        ++*zerocopy_calls;
+      }
       sent += r;
       if (len == sent) break;
 
@@ -115,6 +240,9 @@ class PosixConnectedSocketImpl final : public ConnectedSocketImpl {
   }
 
   ssize_t send(ceph::buffer::list &bl, bool more) override {
+#ifdef HAVE_MSG_ZEROCOPY
+    reap_zerocopy();
+#endif
     size_t sent_bytes = 0;
     auto pb = std::cbegin(bl.buffers());
     uint64_t left_pbrs = bl.get_num_buffers();
@@ -134,7 +262,26 @@ class PosixConnectedSocketImpl final : public ConnectedSocketImpl {
 	msglen += pb->length();
 	++pb;
       }
+#ifdef HAVE_MSG_ZEROCOPY
+      // small frames are cheaper to copy than to pin and reap
+      bool zerocopy = zerocopy_threshold && msglen >= zerocopy_threshold;
+      unsigned zerocopy_calls = 0;
+      ssize_t r = do_sendmsg(_fd, msg, msglen, left_pbrs || more,
+			     zerocopy, &zerocopy_calls);
+      if (zerocopy_calls) {
+        // hold the pages until the kernel reports it is done with them.
+        // an error after some of the calls went through loses how much
+        // they sent, so then all of this batch is held
+        ceph::buffer::list sent;
+        sent.substr_of(bl, sent_bytes, r > 0 ? r : msglen);
+        if (r > 0) {
+          logger->inc(l_msgr_send_zerocopy_bytes, r);
+        }
+        zerocopy_sends.add(zerocopy_calls, std::move(sent));
+      }
+#else
       ssize_t r = do_sendmsg(_fd, msg, msglen, left_pbrs || more);
+#endif
       if (r < 0)
         return r;
 
@@ -205,6 +352,16 @@ class PosixConnectedSocketImpl final : public ConnectedSocketImpl {
     ::shutdown(_fd, SHUT_RDWR);
   }
   void close() override {
+#ifdef HAVE_MSG_ZEROCOPY
+    reap_zerocopy();
+    if (!zerocopy_sends.empty()) {
+      // the kernel may still (re)transmit from our pages, and their memory
+      // must not be reused until it says so; the worker closes the fd then
+      worker->linger_zerocopy(_fd, std::move(zerocopy_sends));
+      zerocopy_sends = PosixZerocopySends();
+      return;
+    }
+#endif
     compat_closesocket(_fd);
   }
   void set_priority(int sd, int prio, int domain) override {
@@ -263,7 +420,10 @@ int PosixServerSocketImpl::accept(ConnectedSocket *sock, const SocketOptions &op
   out->set_sockaddr((sockaddr*)&ss);
   handler.set_priority(sd, opt.priority, out->get_family());
 
-  std::unique_ptr<PosixConnectedSocketImpl> csi(new PosixConnectedSocketImpl(handler, *out, sd, true));
+  std::unique_ptr<PosixConnectedSocketImpl> csi(
+    new PosixConnectedSocketImpl(handler, *out, sd, true,
+				 static_cast<PosixWorker*>(w),
+				 opt.zerocopy_threshold));
   *sock = ConnectedSocket(std::move(csi));
   return 0;
 }
@@ -272,6 +432,64 @@ void PosixWorker::initialize()
 {
 }
 
+// how often lingering sockets are checked for completions, and how long
+// a peer that stopped acking may keep them
+static constexpr uint64_t LINGER_REAP_INTERVAL_US = 100000;
+static constexpr auto LINGER_MAX = std::chrono::seconds(30);
+
+PosixWorker::~PosixWorker()
+{
+  for (auto& l : lingering) {
+    compat_closesocket(l.fd);
+  }
+}
+
+void PosixWorker::linger_zerocopy(int fd, PosixZerocopySends&& sends)
+{
+  center.submit_to(
+    center.get_id(),
+    [this, fd, sends = std::move(sends)]() mutable {
+      ldout(cct, 10) << __func__ << " fd " << fd
+		     << " waits for zerocopy completions" << dendl;
+      lingering.push_back(
+	lingering_t{fd, ceph::mono_clock::now() + LINGER_MAX,
+		    std::move(sends)});
+      if (!reap_lingering_timer) {
+	reap_lingering_timer = center.create_time_event(
+	  LINGER_REAP_INTERVAL_US, &reap_lingering_cb);
+      }
+    }, true);
+}
+
+void PosixWorker::reap_lingering()
+{
+  reap_lingering_timer = 0;
+  auto now = ceph::mono_clock::now();
+  for (auto l = lingering.begin(); l != lingering.end();) {
+    l->sends.reap(l->fd);
+    if (!l->sends.empty() && now < l->deadline) {
+      ++l;
+      continue;
+    }
+#ifdef HAVE_MSG_ZEROCOPY
+    if (!l->sends.empty()) {
+      // the peer stopped acking; reset the connection so the kernel drops
+      // the queued data along with its references to our pages
+      ldout(cct, 1) << __func__ << " fd " << l->fd
+		    << " zerocopy sends still pending, resetting" << dendl;
+      struct linger lg = {1, 0};
+      ::setsockopt(l->fd, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
+    }
+#endif
+    compat_closesocket(l->fd);
+    l = lingering.erase(l);
+  }
+  if (!lingering.empty()) {
+    reap_lingering_timer = center.create_time_event(
+      LINGER_REAP_INTERVAL_US, &reap_lingering_cb);
+  }
+}
+
 int PosixWorker::listen(entity_addr_t &sa,
 			unsigned addr_slot,
 			const SocketOptions &opt,
@@ -332,7 +550,8 @@ int PosixWorker::connect(const entity_addr_t &addr, const SocketOptions &opts, C
 
   net.set_priority(sd, opts.priority, addr.get_family());
   *socket = ConnectedSocket(
-      std::unique_ptr<PosixConnectedSocketImpl>(new PosixConnectedSocketImpl(net, addr, sd, !opts.nonblock)));
+      std::unique_ptr<PosixConnectedSocketImpl>(new PosixConnectedSocketImpl(
+	net, addr, sd, !opts.nonblock, this, opts.zerocopy_threshold)));
   return 0;
 }
 
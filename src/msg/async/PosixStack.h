@@ -18,24 +18,77 @@
 #ifndef CEPH_MSG_ASYNC_POSIXSTACK_H
 #define CEPH_MSG_ASYNC_POSIXSTACK_H
 
+#include <deque>
+#include <list>
 #include <thread>
 
+#include "common/ceph_time.h"
+#include "include/buffer.h"
 #include "msg/msg_types.h"
 #include "msg/async/net_handler.h"
 
 #include "Stack.h"
 
+/*
+ * The kernel numbers every successful MSG_ZEROCOPY sendmsg() on a socket
+ * and reports ranges of those numbers on the error queue once it no longer
+ * references the user pages. Until then the buffers must stay alive.
+ */
+class PosixZerocopySends {
+  struct send_t {
+    uint32_t first, last;	///< inclusive range of sendmsg() sequence numbers
+    uint32_t outstanding;	///< numbers in [first, last] not yet completed
+    ceph::buffer::list bl;
+  };
+  std::deque<send_t> sends;
+  uint32_t next = 0;
+
+  void complete(uint32_t lo, uint32_t hi);
+ public:
+  bool empty() const {
+    return sends.empty();
+  }
+  /// keep @p bl until the @p calls sendmsg() calls that sent it complete
+  void add(unsigned calls, ceph::buffer::list&& bl);
+  /// drain the error queue of @p fd, returns true if the kernel reported
+  /// that it had to copy the data after all
+  bool reap(int fd);
+};
+
 class PosixWorker : public Worker {
   ceph::NetHandler net;
+
+  // closed sockets whose MSG_ZEROCOPY sends are still in flight; the fd
+  // stays open so the completions can be read, see linger_zerocopy()
+  struct lingering_t {
+    int fd;
+    ceph::mono_time deadline;
+    PosixZerocopySends sends;
+  };
+  std::list<lingering_t> lingering;
+  class C_reap_lingering : public EventCallback {
+    PosixWorker *worker;
+   public:
+    explicit C_reap_lingering(PosixWorker *w) : worker(w) {}
+    void do_request(uint64_t id) override {
+      worker->reap_lingering();
+    }
+  } reap_lingering_cb{this};
+  uint64_t reap_lingering_timer = 0;
+  void reap_lingering();
+
   void initialize() override;
  public:
   PosixWorker(CephContext *c, unsigned i, bool try_smc)
       : Worker(c, i), net(c, try_smc) {}
+  ~PosixWorker() override;
   int listen(entity_addr_t &sa,
 	     unsigned addr_slot,
 	     const SocketOptions &opt,
 	     ServerSocket *socks) override;
   int connect(const entity_addr_t &addr, const SocketOptions &opts, ConnectedSocket *socket) override;
+  /// take over closing @p fd once the kernel is done with @p sends
+  void linger_zerocopy(int fd, PosixZerocopySends&& sends);
 };
 
 class PosixNetworkStack : public NetworkStack {
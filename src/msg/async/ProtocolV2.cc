@@ -572,7 +572,13 @@ ssize_t ProtocolV2::write_message(const MessageRef& m, bool more) {
                  << " off=" << header2.data_off
                  << dendl;
   ssize_t total_send_size = connection->outgoing_bl.length();
-  ssize_t rc = connection->_try_send(more);
+  ssize_t rc = 0;
+  if (connection->_hold_send(more)) {
+    ldout(cct, 20) << __func__ << " holding " << total_send_size
+                   << " bytes for coalescing" << dendl;
+  } else {
+    rc = connection->_try_send(more);
+  }
   if (rc < 0) {
     ldout(cct, 1) << __func__ << " error sending " << m << ", "
                   << cpp_strerror(rc) << dendl;
@@ -609,6 +615,7 @@ bool ProtocolV2::append_frame(F& frame) {
   ldout(cct, 25) << __func__ << " assembled frame " << bl.length()
                  << " bytes " << tx_frame_asm << dendl;
   connection->outgoing_bl.claim_append(bl);
+  connection->outgoing_frames++;
   return true;
 }
 
@@ -671,7 +678,7 @@ void ProtocolV2::write_event() {
     auto start = ceph::mono_clock::now();
     bool more;
     do {
-      if (connection->is_queued()) {
+      if (connection->is_queued() && !connection->_hold_send(true)) {
 	if (r = connection->_try_send(); r!= 0) {
 	  // either fails to send or not all queued buffer is sent
 	  break;
@@ -731,7 +738,7 @@ void ProtocolV2::write_event() {
         } else {
           r = -EILSEQ;
         }
-      } else if (is_queued()) {
+      } else if (is_queued() && !connection->_hold_send(false)) {
         r = connection->_try_send();
       }
     }
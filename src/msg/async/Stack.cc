@@ -19,6 +19,7 @@
 #include "include/compat.h"
 #include "common/Cond.h"
 #include "common/errno.h"
+#include "common/numa.h"
 #include "PosixStack.h"
 #ifdef HAVE_RDMA
 #include "rdma/RDMAStack.h"
@@ -26,6 +27,9 @@
 #ifdef HAVE_DPDK
 #include "dpdk/DPDKStack.h"
 #endif
+#ifdef HAVE_LIBURING
+#include "UringStack.h"
+#endif
 
 #include "common/dout.h"
 #include "include/ceph_assert.h"
@@ -77,6 +81,10 @@ std::shared_ptr<NetworkStack> NetworkStack::create(CephContext *c,
   else if (t == "dpdk")
     stack.reset(new DPDKStack(c));
 #endif
+#ifdef HAVE_LIBURING
+  else if (t == "uring")
+    stack.reset(new UringNetworkStack(c));
+#endif
 
   if (stack == nullptr) {
     lderr(c) << __func__ << " ms_async_transport_type " << t <<
@@ -129,6 +137,77 @@ void NetworkStack::start()
   for (Worker* worker : workers) {
     worker->wait_for_init();
   }
+
+  std::lock_guard l(numa_lock);
+  if (int node = cct->_conf.get_val<int64_t>("ms_async_numa_node");
+      node >= 0 && !numa_fixed && support_numa_affinity()) {
+    numa_nodes = {node};
+    numa_fixed = true;
+  }
+  if (!numa_nodes.empty()) {
+    // also after a restart: new threads do not inherit the old ones' mask
+    _pin_workers();
+  }
+}
+
+int NetworkStack::add_numa_affinity(int node)
+{
+  std::lock_guard l(numa_lock);
+  if (numa_fixed || !support_numa_affinity() || numa_nodes.count(node)) {
+    return 0;
+  }
+  numa_nodes.insert(node);
+  if (numa_nodes.size() > 1) {
+    // e.g. public and cluster network on different nodes. the workers serve
+    // connections of both, so let them run on either.
+    ldout(cct, 1) << __func__ << " messengers are bound to numa nodes "
+                  << numa_nodes << ", workers will span them" << dendl;
+  }
+  return _pin_workers();
+}
+
+int NetworkStack::_pin_workers()
+{
+#if defined(__linux__)
+  cpu_set_t cpu_set;
+  size_t cpu_set_size = 0;
+  CPU_ZERO(&cpu_set);
+  for (int node : numa_nodes) {
+    cpu_set_t node_set;
+    size_t node_set_size;
+    int r = get_numa_node_cpu_set(node, &node_set_size, &node_set);
+    if (r < 0) {
+      lderr(cct) << __func__ << " unable to get cpus of numa node " << node
+                 << ": " << cpp_strerror(r) << dendl;
+      return r;
+    }
+    CPU_OR(&cpu_set, &cpu_set, &node_set);
+    cpu_set_size = std::max(cpu_set_size, node_set_size);
+  }
+  const int node = numa_nodes.size() == 1 ? *numa_nodes.begin() : -1;
+  ldout(cct, 1) << __func__ << " pinning workers to numa node(s) " << numa_nodes
+                << " cpus " << cpu_set_to_str_list(cpu_set_size, &cpu_set)
+                << dendl;
+
+  int ret = 0;
+  for (Worker* w : workers) {
+    w->center.submit_to(
+      w->center.get_id(),
+      [this, w, &cpu_set, node, &ret] {
+        if (sched_setaffinity(0, sizeof(cpu_set), &cpu_set) < 0) {
+          int r = -errno;
+          lderr(cct) << "unable to pin worker " << w->id << ": "
+                     << cpp_strerror(r) << dendl;
+          ret = r;
+          return;
+        }
+        w->set_numa_node(node);
+      });
+  }
+  return ret;
+#else
+  return -ENOTSUP;
+#endif
 }
 
 Worker* NetworkStack::get_worker()
@@ -34,6 +34,7 @@
 #include <condition_variable>
 #include <memory>
 #include <mutex>
+#include <set>
 #include <string>
 
 class Worker;
@@ -55,6 +56,7 @@ struct SocketOptions {
   bool nodelay = true;
   int rcbuf_size = 0;
   int priority = -1;
+  uint64_t zerocopy_threshold = 0; ///< min send size for MSG_ZEROCOPY, 0 = off
   entity_addr_t connect_bind_addr;
 };
 
@@ -225,6 +227,12 @@ enum {
   l_msgr_recv_encrypted_bytes,
   l_msgr_send_encrypted_bytes,
 
+  l_msgr_send_zerocopy_bytes,
+  l_msgr_send_zerocopy_copied,
+
+  l_msgr_send_frames_per_write,
+  l_msgr_send_coalesce_lat,
+
   l_msgr_last,
 };
 
@@ -283,6 +291,12 @@ class Worker {
     plb.add_u64_counter(l_msgr_recv_encrypted_bytes, "msgr_recv_encrypted_bytes", "Network received encrypted bytes", NULL, 0, unit_t(UNIT_BYTES));
     plb.add_u64_counter(l_msgr_send_encrypted_bytes, "msgr_send_encrypted_bytes", "Network sent encrypted bytes", NULL, 0, unit_t(UNIT_BYTES));
 
+    plb.add_u64_counter(l_msgr_send_zerocopy_bytes, "msgr_send_zerocopy_bytes", "Network bytes sent with MSG_ZEROCOPY", NULL, 0, unit_t(UNIT_BYTES));
+    plb.add_u64_counter(l_msgr_send_zerocopy_copied, "msgr_send_zerocopy_copied", "MSG_ZEROCOPY completions the kernel had to copy");
+
+    plb.add_u64_avg(l_msgr_send_frames_per_write, "msgr_send_frames_per_write", "Frames handed to the socket per write");
+    plb.add_time_avg(l_msgr_send_coalesce_lat, "msgr_send_coalesce_lat", "Time frames were held back for send coalescing");
+
     perf_logger = plb.create_perf_counters();
     cct->get_perfcounters_collection()->add(perf_logger);
 
@@ -323,6 +337,9 @@ class Worker {
   virtual void destroy() {}
 
   virtual void initialize() {}
+  /// called on the worker's thread once it is pinned to the cpus of @p node
+  /// (-1 if they span several nodes)
+  virtual void set_numa_node(int node) {}
   PerfCounters *get_perf_counter() { return perf_logger; }
   PerfCounters *get_labeled_perf_counter() { return perf_labeled_logger; }
   void release_worker() {
@@ -357,7 +374,12 @@ class NetworkStack {
   ceph::spinlock pool_spin;
   bool started = false;
 
+  std::mutex numa_lock;
+  std::set<int> numa_nodes;  ///< workers are pinned to the cpus of these
+  bool numa_fixed = false;   ///< set by ms_async_numa_node
+
   std::function<void ()> add_thread(Worker* w);
+  int _pin_workers();
 
   virtual Worker* create_worker(CephContext *c, unsigned i) = 0;
   virtual void rename_thread(unsigned id) {
@@ -391,8 +413,13 @@ class NetworkStack {
   // need to let each thread do binding port.
   virtual bool support_local_listen_table() const { return false; }
   virtual bool nonblock_connect_need_writable_event() const { return true; }
+  // backends whose threads place themselves (dpdk) override this
+  virtual bool support_numa_affinity() const { return true; }
 
   void start();
+  /// pin every worker to the cpus of @p node too, e.g. the node of a NIC a
+  /// messenger has bound to. ignored if ms_async_numa_node is set.
+  int add_numa_affinity(int node);
   void stop();
   virtual Worker *get_worker();
   Worker *get_worker(unsigned worker_id) {
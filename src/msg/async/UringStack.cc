@@ -0,0 +1,391 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:nil -*-
+// vim: ts=8 sw=2 sts=2 expandtab
+
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <errno.h>
+
+#include <algorithm>
+#include <deque>
+
+#include "UringStack.h"
+
+#include "include/buffer.h"
+#include "common/errno.h"
+#include "common/dout.h"
+#include "include/compat.h"
+#include "include/sock_compat.h"
+
+#define dout_subsys ceph_subsys_ms
+#undef dout_prefix
+#define dout_prefix *_dout << "UringStack "
+
+class UringConnectedSocketImpl final : public ConnectedSocketImpl,
+				       public UringDriver::Stream {
+  ceph::NetHandler &handler;
+  UringDriver *driver;
+  int _fd;
+  entity_addr_t sa;
+  bool connected;
+  bool attached = false;
+  bool shut = false;
+  int error = 0;
+
+  // received data waiting for read(). up to rx_max_held chunks stay in the
+  // provided buffers they arrived in; past that, or once the ring shared by
+  // every connection of the worker runs low, they are copied out. so
+  // connections that stop reading (e.g. throttled) cannot drain the ring,
+  // however many of them there are. once rx_bytes reaches
+  // rx_window the recv is paused, leaving the rest in the socket buffer
+  // so TCP pushes back on the peer.
+  struct rx_chunk_t {
+    int bid;			///< provided buffer, or -1 if copied into bp
+    ceph::buffer::ptr bp;
+    unsigned off, len;
+  };
+  std::deque<rx_chunk_t> rx;
+  unsigned rx_held = 0;
+  const unsigned rx_max_held;
+  uint64_t rx_bytes = 0;
+  const uint64_t rx_window;
+  bool rx_paused = false;
+  bool rx_eof = false;
+
+  ceph::buffer::list tx;	///< accepted by send(), not yet submitted
+  uint64_t tx_inflight = 0;
+  bool corked = false;
+  const uint64_t tx_window;
+
+  void attach() {
+    if (!attached) {
+      driver->attach(_fd, this);
+      attached = true;
+    }
+  }
+
+ public:
+  explicit UringConnectedSocketImpl(ceph::NetHandler &h, UringWorker *w,
+				    const entity_addr_t &sa, int f,
+				    bool connected)
+    : handler(h), driver(w->get_driver()), _fd(f), sa(sa),
+      connected(connected),
+      rx_max_held(std::max(2u, w->get_driver()->rx_buffers() / 16)),
+      rx_window(w->recv_window),
+      tx_window(w->send_window) {}
+
+  int is_connected() override {
+    if (connected) {
+      attach();
+      return 1;
+    }
+
+    int r = handler.reconnect(sa, _fd);
+    if (r == 0) {
+      connected = true;
+      attach();
+      return 1;
+    } else if (r < 0) {
+      return r;
+    } else {
+      return 0;
+    }
+  }
+
+  ssize_t read(char *buf, size_t len) override {
+    attach();
+    size_t copied = 0;
+    while (copied < len && !rx.empty()) {
+      auto &c = rx.front();
+      unsigned n = std::min<size_t>(len - copied, c.len);
+      const char *src = c.bid >= 0 ? driver->rx_buffer(c.bid) : c.bp.c_str();
+      memcpy(buf + copied, src + c.off, n);
+      copied += n;
+      c.off += n;
+      c.len -= n;
+      if (c.len == 0) {
+	if (c.bid >= 0) {
+	  driver->recycle(c.bid);
+	  --rx_held;
+	}
+	rx.pop_front();
+      }
+    }
+    rx_bytes -= copied;
+    if (rx_paused && rx_bytes <= rx_window / 2) {
+      driver->resume_recv(_fd);
+      rx_paused = false;
+    }
+    if (copied)
+      return copied;
+    if (error)
+      return -error;
+    if (rx_eof || shut)
+      return 0;
+    return -EAGAIN;
+  }
+
+  ssize_t send(ceph::buffer::list &bl, bool more) override {
+    if (shut)
+      return -EPIPE;
+    if (error)
+      return -error;
+    attach();
+    if (tx.length() + tx_inflight >= tx_window) {
+      // push back until handle_send() makes room and fires EVENT_WRITABLE
+      return 0;
+    }
+    // accept everything; all sends of this loop iteration are gathered into
+    // one sendmsg when the driver uncorks us. "more" needs no special
+    // treatment since nothing leaves before the iteration ends anyway.
+    ssize_t len = bl.length();
+    tx.claim_append(bl);
+    if (!corked && !tx_inflight) {
+      driver->cork(_fd);
+      corked = true;
+    }
+    return len;
+  }
+
+  int handle_recv(int res, int bid) override {
+    if (res > 0) {
+      ceph_assert(bid >= 0);
+      if (rx_held < rx_max_held && !driver->rx_low()) {
+	rx.push_back({bid, {}, 0, (unsigned)res});
+	++rx_held;
+      } else {
+	ceph::buffer::ptr bp = ceph::buffer::create(res);
+	memcpy(bp.c_str(), driver->rx_buffer(bid), res);
+	driver->recycle(bid);
+	rx.push_back({-1, std::move(bp), 0, (unsigned)res});
+      }
+      rx_bytes += res;
+      if (!rx_paused && rx_bytes >= rx_window) {
+	driver->pause_recv(_fd);
+	rx_paused = true;
+      }
+      return EVENT_READABLE;
+    }
+    if (bid >= 0)
+      driver->recycle(bid);
+    if (res == 0) {
+      rx_eof = true;
+      return EVENT_READABLE;
+    }
+    if (res == -ECANCELED)
+      return EVENT_NONE;
+    error = -res;
+    return EVENT_READABLE | EVENT_WRITABLE;
+  }
+
+  int handle_send(int res) override {
+    tx_inflight = 0;
+    if (res < 0) {
+      error = -res;
+      return EVENT_READABLE | EVENT_WRITABLE;
+    }
+    if (tx.length() && !corked) {
+      driver->cork(_fd);
+      corked = true;
+    }
+    return EVENT_WRITABLE;
+  }
+
+  int ready_mask() const override {
+    int mask = EVENT_NONE;
+    if (!rx.empty() || rx_eof || error)
+      mask |= EVENT_READABLE;
+    if (tx.length() + tx_inflight < tx_window || error)
+      mask |= EVENT_WRITABLE;
+    return mask;
+  }
+
+  void uncork() override {
+    corked = false;
+    if (!tx_inflight && tx.length()) {
+      tx_inflight = tx.length();
+      driver->submit_send(_fd, std::move(tx));
+      tx.clear();
+    }
+  }
+
+  void shutdown() override {
+    if (attached) {
+      // best effort: let what was accepted reach the kernel first
+      uncork();
+      driver->flush();
+    }
+    shut = true;
+    ::shutdown(_fd, SHUT_RDWR);
+  }
+  void close() override {
+    if (attached) {
+      uncork();
+      driver->detach(_fd);
+      attached = false;
+      for (auto &c : rx) {
+	if (c.bid >= 0)
+	  driver->recycle(c.bid);
+      }
+      rx.clear();
+      rx_held = 0;
+      rx_bytes = 0;
+      rx_paused = false;
+    }
+    compat_closesocket(_fd);
+  }
+  void set_priority(int sd, int prio, int domain) override {
+    handler.set_priority(sd, prio, domain);
+  }
+  int fd() const override {
+    return _fd;
+  }
+};
+
+class UringServerSocketImpl : public ServerSocketImpl {
+  ceph::NetHandler &handler;
+  int _fd;
+
+ public:
+  explicit UringServerSocketImpl(ceph::NetHandler &h, int f,
+				 const entity_addr_t& listen_addr, unsigned slot)
+    : ServerSocketImpl(listen_addr.get_type(), slot),
+      handler(h), _fd(f) {}
+  int accept(ConnectedSocket *sock, const SocketOptions &opts, entity_addr_t *out, Worker *w) override;
+  void abort_accept() override {
+    ::close(_fd);
+    _fd = -1;
+  }
+  int fd() const override {
+    return _fd;
+  }
+};
+
+int UringServerSocketImpl::accept(ConnectedSocket *sock, const SocketOptions &opt, entity_addr_t *out, Worker *w) {
+  ceph_assert(sock);
+  sockaddr_storage ss;
+  socklen_t slen = sizeof(ss);
+  int sd = accept_cloexec(_fd, (sockaddr*)&ss, &slen);
+  if (sd < 0) {
+    return -ceph_sock_errno();
+  }
+
+  int r = handler.set_nonblock(sd);
+  if (r < 0) {
+    ::close(sd);
+    return -ceph_sock_errno();
+  }
+
+  r = handler.set_socket_options(sd, opt.nodelay, opt.rcbuf_size);
+  if (r < 0) {
+    ::close(sd);
+    return -ceph_sock_errno();
+  }
+
+  ceph_assert(NULL != out); //out should not be NULL in accept connection
+
+  out->set_type(addr_type);
+  out->set_sockaddr((sockaddr*)&ss);
+  handler.set_priority(sd, opt.priority, out->get_family());
+
+  // accept() runs on the listening worker; the socket only touches the ring
+  // of the worker it is handed to, from that worker's thread
+  std::unique_ptr<UringConnectedSocketImpl> csi(
+    new UringConnectedSocketImpl(handler, static_cast<UringWorker*>(w), *out,
+				 sd, true));
+  *sock = ConnectedSocket(std::move(csi));
+  return 0;
+}
+
+UringWorker::UringWorker(CephContext *c, unsigned i)
+  : Worker(c, i), net(c),
+    send_window(c->_conf.get_val<Option::size_t>("ms_async_uring_send_window")),
+    recv_window(c->_conf.get_val<Option::size_t>("ms_async_uring_recv_window"))
+{
+}
+
+void UringWorker::set_numa_node(int node)
+{
+  if (node >= 0) {
+    get_driver()->bind_rx_buffers(node);
+  }
+}
+
+int UringWorker::listen(entity_addr_t &sa,
+			unsigned addr_slot,
+			const SocketOptions &opt,
+			ServerSocket *sock)
+{
+  int listen_sd = net.create_socket(sa.get_family(), true);
+  if (listen_sd < 0) {
+    return -ceph_sock_errno();
+  }
+
+  int r = net.set_nonblock(listen_sd);
+  if (r < 0) {
+    ::close(listen_sd);
+    return -ceph_sock_errno();
+  }
+
+  r = net.set_socket_options(listen_sd, opt.nodelay, opt.rcbuf_size);
+  if (r < 0) {
+    ::close(listen_sd);
+    return -ceph_sock_errno();
+  }
+
+  r = ::bind(listen_sd, sa.get_sockaddr(), sa.get_sockaddr_len());
+  if (r < 0) {
+    r = -ceph_sock_errno();
+    ldout(cct, 10) << __func__ << " unable to bind to " << sa.get_sockaddr()
+                   << ": " << cpp_strerror(r) << dendl;
+    ::close(listen_sd);
+    return r;
+  }
+
+  r = ::listen(listen_sd, cct->_conf->ms_tcp_listen_backlog);
+  if (r < 0) {
+    r = -ceph_sock_errno();
+    lderr(cct) << __func__ << " unable to listen on " << sa << ": " << cpp_strerror(r) << dendl;
+    ::close(listen_sd);
+    return r;
+  }
+
+  *sock = ServerSocket(
+          std::unique_ptr<UringServerSocketImpl>(
+	    new UringServerSocketImpl(net, listen_sd, sa, addr_slot)));
+  return 0;
+}
+
+int UringWorker::connect(const entity_addr_t &addr, const SocketOptions &opts, ConnectedSocket *socket) {
+  int sd;
+
+  if (opts.nonblock) {
+    sd = net.nonblock_connect(addr, opts.connect_bind_addr);
+  } else {
+    sd = net.connect(addr, opts.connect_bind_addr);
+  }
+
+  if (sd < 0) {
+    return -ceph_sock_errno();
+  }
+
+  net.set_priority(sd, opts.priority, addr.get_family());
+  *socket = ConnectedSocket(
+      std::unique_ptr<UringConnectedSocketImpl>(new UringConnectedSocketImpl(
+	net, this, addr, sd, !opts.nonblock)));
+  return 0;
+}
+
+UringNetworkStack::UringNetworkStack(CephContext *c)
+    : NetworkStack(c)
+{
+}
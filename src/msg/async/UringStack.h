@@ -0,0 +1,69 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:nil -*-
+// vim: ts=8 sw=2 sts=2 expandtab
+
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_MSG_ASYNC_URINGSTACK_H
+#define CEPH_MSG_ASYNC_URINGSTACK_H
+
+#include <thread>
+
+#include "msg/msg_types.h"
+#include "msg/async/net_handler.h"
+
+#include "EventUring.h"
+#include "Stack.h"
+
+/*
+ * Kernel TCP like the posix stack, but socket I/O is completion driven
+ * through the worker's io_uring (see UringDriver) instead of a read() or
+ * sendmsg() per readiness event.
+ */
+class UringWorker : public Worker {
+  ceph::NetHandler net;
+ public:
+  /// bytes a connection may have queued or in flight before send() pushes back
+  const uint64_t send_window;
+  /// unread bytes a connection may hold before its receive is paused
+  const uint64_t recv_window;
+
+  UringWorker(CephContext *c, unsigned i);
+  UringDriver *get_driver() {
+    return static_cast<UringDriver*>(center.get_driver());
+  }
+  int listen(entity_addr_t &sa,
+	     unsigned addr_slot,
+	     const SocketOptions &opt,
+	     ServerSocket *socks) override;
+  int connect(const entity_addr_t &addr, const SocketOptions &opts, ConnectedSocket *socket) override;
+  void set_numa_node(int node) override;
+};
+
+class UringNetworkStack : public NetworkStack {
+  std::vector<std::thread> threads;
+
+  virtual Worker* create_worker(CephContext *c, unsigned worker_id) override {
+    return new UringWorker(c, worker_id);
+  }
+
+ public:
+  explicit UringNetworkStack(CephContext *c);
+
+  void spawn_worker(std::function<void ()> &&func) override {
+    threads.emplace_back(std::move(func));
+  }
+  void join_worker(unsigned i) override {
+    ceph_assert(threads.size() > i && threads[i].joinable());
+    threads[i].join();
+  }
+};
+
+#endif //CEPH_MSG_ASYNC_URINGSTACK_H
@@ -22,6 +22,14 @@ static constexpr const std::size_t AESGCM_IV_LEN{12};
 static constexpr const std::size_t AESGCM_TAG_LEN{16};
 static constexpr const std::size_t AESGCM_BLOCK_LEN{16};
 
+// Fragments shorter than this aren't passed to EVP one at a time but are
+// gathered into runs. OpenSSL only switches to its stitched AES-NI/VAES +
+// (V)PCLMULQDQ GCM kernels for inputs of a few hundred bytes and up, and a
+// typical message is a scatter of small encoded pieces in front of its data.
+static constexpr const std::size_t COALESCE_MAX_FRAGMENT{2048};
+// keep a run in cache between gathering and ciphering it
+static constexpr const std::size_t COALESCE_MAX_RUN{64 << 10};
+
 struct nonce_t {
   ceph_le32 fixed;
   ceph_le64 counter;
@@ -42,11 +50,23 @@ class AES128GCM_OnWireTxHandler : public ceph::crypto::onwire::TxHandler {
   CephContext* const cct;
   std::unique_ptr<EVP_CIPHER_CTX, decltype(&::EVP_CIPHER_CTX_free)> ectx;
   ceph::bufferlist buffer;
+  // plaintext staged in buffer, still to be encrypted in place
+  char* run = nullptr;
+  std::size_t run_len = 0;
   nonce_t nonce, initial_nonce;
   bool used_initial_nonce;
   bool new_nonce_format;  // 64-bit counter?
   static_assert(sizeof(nonce) == AESGCM_IV_LEN);
 
+  void encrypt(char* out, const char* in, std::size_t len);
+  void encrypt_run() {
+    if (run_len) {
+      encrypt(run, run, run_len);
+      run = nullptr;
+      run_len = 0;
+    }
+  }
+
 public:
   AES128GCM_OnWireTxHandler(CephContext* const cct,
 			    const key_t& key,
@@ -101,6 +121,7 @@ void AES128GCM_OnWireTxHandler::reset_tx_handler(const uint32_t* first,
   }
 
   ceph_assert(buffer.get_append_buffer_unused_tail_length() == 0);
+  ceph_assert(run_len == 0);
   buffer.reserve(std::accumulate(first, last, AESGCM_TAG_LEN));
 
   if (!new_nonce_format) {
@@ -112,6 +133,23 @@ void AES128GCM_OnWireTxHandler::reset_tx_handler(const uint32_t* first,
   }
 }
 
+void AES128GCM_OnWireTxHandler::encrypt(char* const out,
+                                        const char* const in,
+                                        const std::size_t len)
+{
+  int update_len = 0;
+
+  if(1 != EVP_EncryptUpdate(ectx.get(),
+      reinterpret_cast<unsigned char*>(out),
+      &update_len,
+      reinterpret_cast<const unsigned char*>(in),
+      len)) {
+    throw std::runtime_error("EVP_EncryptUpdate failed");
+  }
+  ceph_assert_always(update_len >= 0);
+  ceph_assert(static_cast<unsigned>(update_len) == len);
+}
+
 void AES128GCM_OnWireTxHandler::authenticated_encrypt_update(
   const ceph::bufferlist& plaintext)
 {
@@ -119,19 +157,32 @@ void AES128GCM_OnWireTxHandler::authenticated_encrypt_update(
               plaintext.length());
   auto filler = buffer.append_hole(plaintext.length());
 
+  // small fragments are copied to where their ciphertext belongs and
+  // encrypted in place as one run, possibly spanning several updates
+  // (segments) of the same frame. large ones go straight from the source.
   for (const auto& plainbuf : plaintext.buffers()) {
-    int update_len = 0;
-
-    if(1 != EVP_EncryptUpdate(ectx.get(),
-	reinterpret_cast<unsigned char*>(filler.c_str()),
-	&update_len,
-	reinterpret_cast<const unsigned char*>(plainbuf.c_str()),
-	plainbuf.length())) {
-      throw std::runtime_error("EVP_EncryptUpdate failed");
+    const std::size_t len = plainbuf.length();
+    if (len < COALESCE_MAX_FRAGMENT) {
+      if (!run) {
+        run = filler.c_str();
+      }
+      // a run carried over from the previous update must end right where
+      // this one's hole starts, otherwise it would encrypt the gap. the
+      // frames_v2 callers always get that: reset_tx_handler() reserves the
+      // whole frame, so every update's hole follows the last one in the
+      // same raw buffer, and final() ends the run before the next reset.
+      // this catches a change to either of those, not a caller.
+      ceph_assert(run + run_len == filler.c_str());
+      filler.copy_in(len, plainbuf.c_str());
+      run_len += len;
+      if (run_len >= COALESCE_MAX_RUN) {
+        encrypt_run();
+      }
+    } else {
+      encrypt_run();
+      encrypt(filler.c_str(), plainbuf.c_str(), len);
+      filler.advance(len);
     }
-    ceph_assert_always(update_len >= 0);
-    ceph_assert(static_cast<unsigned>(update_len) == plainbuf.length());
-    filler.advance(update_len);
   }
 
   ldout(cct, 15) << __func__
@@ -142,6 +193,8 @@ void AES128GCM_OnWireTxHandler::authenticated_encrypt_update(
 
 ceph::bufferlist AES128GCM_OnWireTxHandler::authenticated_encrypt_final()
 {
+  encrypt_run();
+
   int final_len = 0;
   ceph_assert(buffer.get_append_buffer_unused_tail_length() ==
               AESGCM_BLOCK_LEN);
@@ -174,6 +227,8 @@ class AES128GCM_OnWireRxHandler : public ceph::crypto::onwire::RxHandler {
   bool new_nonce_format;  // 64-bit counter?
   static_assert(sizeof(nonce) == AESGCM_IV_LEN);
 
+  void decrypt(char* out, const char* in, std::size_t len);
+
 public:
   AES128GCM_OnWireRxHandler(CephContext* const cct,
 			    const key_t& key,
@@ -227,21 +282,81 @@ void AES128GCM_OnWireRxHandler::reset_rx_handler()
   }
 }
 
+void AES128GCM_OnWireRxHandler::decrypt(char* const out,
+                                        const char* const in,
+                                        const std::size_t len)
+{
+  int update_len = 0;
+
+  if (1 != EVP_DecryptUpdate(ectx.get(),
+      reinterpret_cast<unsigned char*>(out),
+      &update_len,
+      reinterpret_cast<const unsigned char*>(in),
+      len)) {
+    throw std::runtime_error("EVP_DecryptUpdate failed");
+  }
+  ceph_assert_always(update_len >= 0);
+  ceph_assert(static_cast<unsigned>(update_len) == len);
+}
+
+// shared by all connections of a messenger worker, unlike a per-handler
+// buffer which would cost COALESCE_MAX_RUN for every open session
+static char* rx_coalesce_scratch()
+{
+  static thread_local std::unique_ptr<char[]> scratch;
+  if (!scratch) {
+    scratch = std::make_unique<char[]>(COALESCE_MAX_RUN);
+  }
+  return scratch.get();
+}
+
 void AES128GCM_OnWireRxHandler::authenticated_decrypt_update(
   ceph::bufferlist& bl)
 {
   // discard cached crcs as we will be writing through c_str()
   bl.invalidate_crc();
-  for (auto& buf : bl.buffers()) {
-    auto p = reinterpret_cast<unsigned char*>(const_cast<char*>(buf.c_str()));
-    int update_len = 0;
 
-    if (1 != EVP_DecryptUpdate(ectx.get(), p, &update_len, p, buf.length())) {
-      throw std::runtime_error("EVP_DecryptUpdate failed");
+  // received segments are mostly contiguous already, but a run of small
+  // buffers is gathered into scratch, decrypted there with a single call
+  // and scattered back
+  const auto& bufs = bl.buffers();
+  auto run_first = std::end(bufs);
+  std::size_t run_len = 0;
+  char* scratch = nullptr;
+  auto decrypt_run = [&](const auto run_end) {
+    if (run_len == 0) {
+      return;
+    }
+    decrypt(scratch, scratch, run_len);
+    const char* src = scratch;
+    for (auto it = run_first; it != run_end; ++it) {
+      ::memcpy(const_cast<char*>(it->c_str()), src, it->length());
+      src += it->length();
+    }
+    run_len = 0;
+  };
+
+  for (auto it = std::begin(bufs); it != std::end(bufs); ++it) {
+    auto p = const_cast<char*>(it->c_str());
+    const std::size_t len = it->length();
+    if (len < COALESCE_MAX_FRAGMENT) {
+      if (run_len + len > COALESCE_MAX_RUN) {
+        decrypt_run(it);
+      }
+      if (run_len == 0) {
+        run_first = it;
+        if (!scratch) {
+          scratch = rx_coalesce_scratch();
+        }
+      }
+      ::memcpy(scratch + run_len, p, len);
+      run_len += len;
+    } else {
+      decrypt_run(it);
+      decrypt(p, p, len);
     }
-    ceph_assert_always(update_len >= 0);
-    ceph_assert(static_cast<unsigned>(update_len) == buf.length());
   }
+  decrypt_run(std::end(bufs));
 }
 
 void AES128GCM_OnWireRxHandler::authenticated_decrypt_update_final(
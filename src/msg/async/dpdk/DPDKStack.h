@@ -262,6 +262,8 @@ class DPDKStack : public NetworkStack {
     funcs.reserve(cct->_conf->ms_async_op_threads);
   }
   virtual bool support_local_listen_table() const override { return true; }
+  // lcore threads are placed by dpdk itself
+  virtual bool support_numa_affinity() const override { return false; }
 
   virtual void spawn_worker(std::function<void ()> &&func) override;
   virtual void join_worker(unsigned i) override;
@@ -42,9 +42,32 @@ static size_t calc_num_segments(const bufferlist segment_bls[],
   return 1;
 }
 
+// Segment crc32c. Large buffers go through bufferlist::crc32c() so their
+// cached crc is reused, e.g. when an OSD forwards client data it has just
+// verified to its replicas. A raw buffer caches a single range though, and
+// small buffers are mostly slices of one encode buffer that would only evict
+// each other under the cache spinlock, so those are fed to ceph_crc32c()
+// directly.
+static uint32_t segment_crc32c(const bufferlist& segment_bl) {
+  static constexpr unsigned CACHED_CRC_MIN_LEN = 4096;
+  uint32_t crc = -1;
+  for (const auto& bp : segment_bl.buffers()) {
+    if (bp.length() < CACHED_CRC_MIN_LEN) {
+      crc = ceph_crc32c(crc,
+                        reinterpret_cast<const unsigned char*>(bp.c_str()),
+                        bp.length());
+    } else {
+      bufferlist one;
+      one.append(bp);
+      crc = one.crc32c(crc);
+    }
+  }
+  return crc;
+}
+
 static void check_segment_crc(const bufferlist& segment_bl,
                               uint32_t expected_crc) {
-  uint32_t crc = segment_bl.crc32c(-1);
+  uint32_t crc = segment_crc32c(segment_bl);
   if (crc != expected_crc) {
     throw FrameError(fmt::format(
         "bad segment crc calculated={} expected={}", crc, expected_crc));
@@ -105,7 +128,8 @@ bufferlist FrameAssembler::asm_crc_rev0(const preamble_block_t& preamble,
   frame_bl.append(reinterpret_cast<const char*>(&preamble), sizeof(preamble));
   for (size_t i = 0; i < m_descs.size(); i++) {
     ceph_assert(segment_bls[i].length() == m_descs[i].logical_len);
-    epilogue.crc_values[i] = m_with_data_crc ? segment_bls[i].crc32c(-1) : 0;
+    epilogue.crc_values[i] =
+            m_with_data_crc ? segment_crc32c(segment_bls[i]) : 0;
     if (segment_bls[i].length() > 0) {
       frame_bl.claim_append(segment_bls[i]);
     }
@@ -154,7 +178,7 @@ bufferlist FrameAssembler::asm_crc_rev1(const preamble_block_t& preamble,
 
   ceph_assert(segment_bls[0].length() == m_descs[0].logical_len);
   if (segment_bls[0].length() > 0) {
-    uint32_t crc = m_with_data_crc ? segment_bls[0].crc32c(-1) : 0;
+    uint32_t crc = m_with_data_crc ? segment_crc32c(segment_bls[0]) : 0;
     frame_bl.claim_append(segment_bls[0]);
     encode(crc, frame_bl);
   }
@@ -165,7 +189,7 @@ bufferlist FrameAssembler::asm_crc_rev1(const preamble_block_t& preamble,
   for (size_t i = 1; i < m_descs.size(); i++) {
     ceph_assert(segment_bls[i].length() == m_descs[i].logical_len);
     epilogue.crc_values[i - 1] =
-            m_with_data_crc ? segment_bls[i].crc32c(-1) : 0;
+            m_with_data_crc ? segment_crc32c(segment_bls[i]) : 0;
     if (segment_bls[i].length() > 0) {
       frame_bl.claim_append(segment_bls[i]);
     }
@@ -243,6 +243,41 @@ public:
     TrackedOpRef op = TrackedOpRef(),
     ThreadPool::TPHandle *handle = NULL) = 0;
 
+  /**
+   * recompress -- repack the stored data of an object
+   *
+   * Rewrites compressed data of the object that the store finds poorly
+   * packed with its background compressor.  Object content is unchanged,
+   * only its on-disk layout.  May run concurrently with
+   * queue_transactions() on the collection, but not with another
+   * recompress() or retier() of it.
+   *
+   * @param ch collection
+   * @param oid object
+   * @returns bytes of data rewritten (0 if nothing was worth it), or
+   *          negative error code
+   */
+  virtual int64_t recompress(CollectionHandle& ch, const ghobject_t& oid) {
+    return -EOPNOTSUPP;
+  }
+
+  /**
+   * retier -- move the stored data of an object to the tier it belongs on
+   *
+   * For stores with more than one data device (e.g. a fast and a slow
+   * one), moves the data of the object according to how often it is
+   * accessed.  Object content is unchanged, only its on-disk location.
+   * Same concurrency rules as recompress().
+   *
+   * @param ch collection
+   * @param oid object
+   * @returns bytes of data moved (0 if it already is where it belongs),
+   *          or negative error code
+   */
+  virtual int64_t retier(CollectionHandle& ch, const ghobject_t& oid) {
+    return -EOPNOTSUPP;
+  }
+
 
  public:
   ObjectStore(CephContext* cct,
@@ -746,6 +781,9 @@ public:
       // skip provided key (seek_position) even if it exists
       UPPER_BOUND
     } seek_type = LOWER_BOUND;
+    // most entries the caller is going to visit, 0 if unbounded; lets the
+    // store skip read ahead for listings that can't get long
+    uint64_t expected_count = 0;
     static omap_iter_seek_t min_lower_bound() { return {}; }
   };
   enum class omap_iter_ret_t {
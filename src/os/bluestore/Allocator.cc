@@ -10,6 +10,7 @@
 #include "BtreeAllocator.h"
 #include "Btree2Allocator.h"
 #include "HybridAllocator.h"
+#include "ShardedAllocator.h"
 #include "common/debug.h"
 #include "common/admin_socket.h"
 
@@ -60,6 +61,11 @@ Allocator *Allocator::create(
       cct->_conf.get_val<uint64_t>("bluestore_hybrid_alloc_mem_cap"),
       cct->_conf.get_val<double>("bluestore_btree2_alloc_weight_factor"),
       name);
+  } else if (type == "sharded") {
+    return new ShardedAllocator(cct, size, block_size,
+      cct->_conf.get_val<std::string>("bluestore_allocator_shard_type"),
+      cct->_conf.get_val<uint64_t>("bluestore_allocator_shards"),
+      name);
   }
   if (alloc == nullptr) {
     lderr(cct) << "Allocator::" << __func__ << " unknown alloc type "
@@ -82,6 +82,17 @@ BlueStore::SocketHook::SocketHook(BlueStore& store)
       this,
       "print RocksDB sharding");
     ceph_assert(r == 0);
+    r = admin_socket->register_command(
+      "bluestore deferred policy",
+      this,
+      "print state of the adaptive deferred write threshold");
+    ceph_assert(r == 0);
+    r = admin_socket->register_command(
+      "bluestore wa "
+      "name=pool,type=CephInt,req=false",
+      this,
+      "print device and kv bytes written per pool since mount");
+    ceph_assert(r == 0);
     r = admin_socket->register_command("bluestore bluefs-bdev-expand",
                                        this,
                                        "Instruct BlueFS to check the size of its block devices"
@@ -296,6 +307,48 @@ int BlueStore::SocketHook::call(
       }
     }
     return 0;
+  } else if (command == "bluestore deferred policy") {
+    f->open_object_section("deferred_policy");
+    f->dump_bool("adaptive",
+      store.cct->_conf.get_val<bool>("bluestore_deferred_adaptive"));
+    f->dump_unsigned("prefer_deferred_size", store.prefer_deferred_size);
+    f->dump_float("deferred_backlog", store.throttle.get_deferred_backlog());
+    store.deferred_policy.dump(f);
+    f->close_section();
+    return 0;
+  } else if (command == "bluestore wa") {
+    int64_t pool = -1;
+    bool one_pool = cmd_getval(cmdmap, "pool", pool);
+    std::map<uint64_t, wa_stats_t> copied;
+    {
+      std::lock_guard l(store.vstatfs_lock);
+      copied = store.osd_pools_wa;
+    }
+    wa_stats_t total;
+    f->open_object_section("write_amplification");
+    f->open_array_section("pools");
+    for (const auto& [pool_id, s] : copied) {
+      total += s;
+      if (one_pool && pool_id != (uint64_t)pool) {
+        continue;
+      }
+      f->open_object_section("pool");
+      if (pool_id == META_POOL_ID) {
+        f->dump_string("pool_id", "meta");
+      } else {
+        f->dump_int("pool_id", (int64_t)pool_id);
+      }
+      s.dump(f);
+      f->close_section();
+    }
+    f->close_section();
+    if (!one_pool) {
+      f->open_object_section("total");
+      total.dump(f);
+      f->close_section();
+    }
+    f->close_section();
+    return 0;
   } else if (command == "bluestore bluefs-bdev-expand"){
     std::stringstream result;
     int ret = store.expand_devices(result);
@@ -3,6 +3,7 @@
 
 #include <asm-generic/errno-base.h>
 #include <chrono>
+#include <deque>
 #include <fmt/compile.h>
 #include "boost/algorithm/string.hpp" 
 #include "bluestore_common.h"
@@ -382,6 +383,10 @@ void BlueFS::_init_logger()
 		    "Bytes read from prefetch buffer in random read mode",
 		    NULL,
 		    PerfCountersBuilder::PRIO_USEFUL, unit_t(UNIT_BYTES));
+  b.add_u64_counter(l_bluefs_read_random_batch_count, "read_random_batch_count",
+		    "batches of random reads submitted together",
+		    NULL,
+		    PerfCountersBuilder::PRIO_USEFUL);
   b.add_time_avg   (l_bluefs_read_lat, "read_lat",
                     "Average bluefs read latency",
                     "rd_t",
@@ -1132,6 +1137,21 @@ int BlueFS::_bdev_read_random(uint8_t ndev, uint64_t off, uint64_t len,
   return bdev[ndev]->read_random(off, len, buf, buffered);
 }
 
+int BlueFS::_bdev_aio_read_random(uint8_t ndev, uint64_t off, uint64_t len,
+  ceph::buffer::list* pbl, IOContext* ioc)
+{
+  int cnt = 0;
+  switch (ndev) {
+    case BDEV_WAL: cnt = l_bluefs_read_random_disk_bytes_wal; break;
+    case BDEV_DB: cnt = l_bluefs_read_random_disk_bytes_db; break;
+    case BDEV_SLOW: cnt = l_bluefs_read_random_disk_bytes_slow; break;
+  }
+  if (cnt) {
+    logger->inc(cnt, len);
+  }
+  return bdev[ndev]->aio_read(off, len, pbl, ioc);
+}
+
 int BlueFS::mount()
 {
   dout(1) << __func__ << dendl;
@@ -2111,6 +2131,7 @@ int BlueFS::migrate_file(
   }
   new_fnode.recalc_allocated();
 
+  _compact_log_preserve_F(file_ref.get());
   file_ref->fnode.swap_extents(new_fnode);
   l.unlock();
 
@@ -2654,6 +2675,163 @@ int64_t BlueFS::_read_random(
   return ret;
 }
 
+void BlueFS::_prefetch_random_batch(
+  FileReader *h,
+  const read_random_req_t *reqs,
+  size_t num_reqs)
+{
+  auto* buf = &h->buf;
+  for (size_t i = 0; i < num_reqs; i++) {
+    uint64_t off = reqs[i].offset;
+    uint64_t len = reqs[i].len;
+    if (!h->ignore_eof &&
+	off + len > h->file->fnode.size) {
+      if (off > h->file->fnode.size)
+	len = 0;
+      else
+	len = h->file->fnode.size - off;
+    }
+    if (len == 0) {
+      continue;
+    }
+    {
+      std::shared_lock s_lock(h->lock);
+      if (off >= buf->bl_off && off + len <= buf->get_buf_end()) {
+	continue;
+      }
+    }
+    while (len > 0) {
+      uint64_t x_off = 0;
+      auto p = h->file->fnode.seek(off, &x_off);
+      ceph_assert(p != h->file->fnode.extents.end());
+      uint64_t l = std::min(p->length - x_off, len);
+      uint64_t block_size = bdev[p->bdev]->get_block_size();
+      uint64_t dev_off = p->offset + x_off;
+      uint64_t aligned_off = p2align(dev_off, block_size);
+      bdev[p->bdev]->prefetch_cache(
+	aligned_off, p2roundup(dev_off + l, block_size) - aligned_off);
+      off += l;
+      len -= l;
+    }
+  }
+}
+
+void BlueFS::_read_random_batch(
+  FileReader *h,
+  read_random_req_t *reqs,
+  size_t num_reqs)
+{
+  if (num_reqs == 1 || h->buffered || cct->_conf->bluefs_check_for_zeros) {
+    if (num_reqs > 1 && h->buffered) {
+      // buffered reads go through the page cache: have it fetch all the
+      // misses at once, the reads below then mostly find them there
+      _prefetch_random_batch(h, reqs, num_reqs);
+    }
+    // zero checking needs the re-read logic of the single request path
+    for (size_t i = 0; i < num_reqs; i++) {
+      reqs[i].ret = _read_random(h, reqs[i].offset, reqs[i].len, reqs[i].out);
+    }
+    return;
+  }
+  auto t0 = mono_clock::now();
+  auto* buf = &h->buf;
+  dout(10) << __func__ << " h " << h << " " << num_reqs << " reqs"
+	   << " from " << lock_fnode_print(h->file) << dendl;
+
+  ++h->file->num_reading;
+  logger->inc(l_bluefs_read_random_batch_count);
+
+  // part of a request living in a single extent; device reads are
+  // block aligned, head is where the wanted data starts in bl
+  struct piece_t {
+    char *out;
+    uint64_t len;
+    uint64_t head;
+    bufferlist bl;
+  };
+  std::deque<piece_t> pieces; // stable addresses, aio fills bl later
+  std::array<std::unique_ptr<IOContext>, MAX_BDEV> iocs;
+
+  for (size_t i = 0; i < num_reqs; i++) {
+    auto& req = reqs[i];
+    uint64_t off = req.offset;
+    uint64_t len = req.len;
+    if (!h->ignore_eof &&
+	off + len > h->file->fnode.size) {
+      if (off > h->file->fnode.size)
+	len = 0;
+      else
+	len = h->file->fnode.size - off;
+    }
+    req.ret = len;
+    logger->inc(l_bluefs_read_random_count, 1);
+    logger->inc(l_bluefs_read_random_bytes, len);
+    if (len == 0) {
+      continue;
+    }
+    {
+      std::shared_lock s_lock(h->lock);
+      if (off >= buf->bl_off && off + len <= buf->get_buf_end()) {
+	auto p = buf->bl.begin();
+	p.seek(off - buf->bl_off);
+	p.copy(len, req.out);
+	logger->inc(l_bluefs_read_random_buffer_count, 1);
+	logger->inc(l_bluefs_read_random_buffer_bytes, len);
+	continue;
+      }
+    }
+    char *out = req.out;
+    while (len > 0) {
+      uint64_t x_off = 0;
+      auto p = h->file->fnode.seek(off, &x_off);
+      ceph_assert(p != h->file->fnode.extents.end());
+      uint64_t l = std::min(p->length - x_off, len);
+      uint64_t block_size = bdev[p->bdev]->get_block_size();
+      uint64_t dev_off = p->offset + x_off;
+      uint64_t aligned_off = p2align(dev_off, block_size);
+      uint64_t aligned_len = p2roundup(dev_off + l, block_size) - aligned_off;
+      dout(20) << __func__ << " read random 0x"
+	       << std::hex << x_off << "~" << l << std::dec
+	       << " of " << *p << dendl;
+      auto& ioc = iocs[p->bdev];
+      if (!ioc) {
+	ioc = std::make_unique<IOContext>(cct, nullptr);
+      }
+      auto& piece = pieces.emplace_back();
+      piece.out = out;
+      piece.len = l;
+      piece.head = dev_off - aligned_off;
+      int r = _bdev_aio_read_random(p->bdev, aligned_off, aligned_len,
+				    &piece.bl, ioc.get());
+      ceph_assert(r == 0);
+      off += l;
+      len -= l;
+      out += l;
+      logger->inc(l_bluefs_read_random_disk_count, 1);
+      logger->inc(l_bluefs_read_random_disk_bytes, l);
+    }
+  }
+  for (unsigned dev = 0; dev < MAX_BDEV; dev++) {
+    auto& ioc = iocs[dev];
+    if (ioc && ioc->has_pending_aios()) {
+      bdev[dev]->aio_submit(ioc.get());
+    }
+  }
+  for (auto& ioc : iocs) {
+    if (ioc) {
+      ioc->aio_wait();
+      ceph_assert(ioc->get_return_value() == 0);
+    }
+  }
+  for (auto& piece : pieces) {
+    auto p = piece.bl.cbegin(piece.head);
+    p.copy(piece.len, piece.out);
+  }
+  dout(20) << __func__ << " " << pieces.size() << " disk reads" << dendl;
+  --h->file->num_reading;
+  logger->tinc_with_max(l_bluefs_read_random_lat, mono_clock::now() - t0);
+}
+
 std::ostream& operator<<(
   std::ostream& out,
   const BlueFS::File::envelope_t& w) {
@@ -3088,11 +3266,48 @@ void BlueFS::_compact_log_dump_metadata_NF(uint64_t start_seq,
 					int bdev_update_flags,
                                         uint64_t capture_before_seq)
 {
-  dout(20) << __func__ << dendl;
-  t->seq = start_seq;
-  t->uuid = super.uuid;
+  meta_snapshot_t snap;
+  _compact_log_capture_metadata_NF(&snap, bdev_update_flags, capture_before_seq,
+                                   false);
+  _compact_log_encode_metadata(start_seq, snap, t);
+}
 
+// append the first len bytes of the extents of from to to
+static void append_extents_prefix(const bluefs_fnode_t& from, uint64_t len,
+                                  bluefs_fnode_t *to)
+{
+  for (auto e : from.extents) {
+    if (len == 0) {
+      break;
+    }
+    e.length = std::min<uint64_t>(e.length, len);
+    len -= e.length;
+    to->append_extent(e);
+  }
+}
+
+void BlueFS::_compact_log_preserve_F(File *f)
+{
+  // the extents are about to be rewritten, keep what a compaction yet to
+  // encode captured. appends alone leave that as a prefix.
+  ceph_assert(ceph_mutex_is_locked(f->lock));
+  if (f->compact_pending && !f->compact_captured) {
+    dout(20) << __func__ << " " << f->fnode << dendl;
+    f->compact_captured.emplace();
+    append_extents_prefix(f->fnode, f->compact_allocated,
+                          &*f->compact_captured);
+  }
+}
+
+void BlueFS::_compact_log_capture_metadata_NF(meta_snapshot_t *snap,
+                                           int bdev_update_flags,
+                                           uint64_t capture_before_seq,
+                                           bool deferred)
+{
+  dout(20) << __func__ << dendl;
   std::lock_guard nl(nodes.lock);
+  snap->deferred = deferred;
+  snap->files.reserve(nodes.file_map.size());
   bool all_files_plain = true;
   for (auto& [ino, file_ref] : nodes.file_map) {
     if (ino == 1)
@@ -3129,7 +3344,24 @@ void BlueFS::_compact_log_dump_metadata_NF(uint64_t start_seq,
       dout(20) << __func__ << " op_file_update just modified, dirty_seq="
                << file_ref->dirty_seq << " " << file_ref->fnode << dendl;
     }
-    t->op_file_update(file_ref->fnode);
+    // only the fields and the length of the extents are taken here, the
+    // extents are copied when encoding: later appends don't touch them,
+    // and whatever rewrites them keeps a copy, see _compact_log_preserve_F()
+    auto& fnode = file_ref->fnode;
+    auto& f = snap->files.emplace_back(
+      meta_snapshot_t::file_t{file_ref,
+                              bluefs_fnode_t(fnode.ino, fnode.size, fnode.mtime),
+                              fnode.get_allocated()});
+    f.fnode.encoding = fnode.encoding;
+    f.fnode.content_size = fnode.content_size;
+    if (snap->deferred) {
+      file_ref->compact_pending = true;
+      file_ref->compact_allocated = f.allocated;
+      file_ref->compact_captured.reset();
+    }
+    // the full fnode goes to the compacted log, so whatever follows it
+    // in the log tail must be a delta against all of it
+    fnode.reset_delta();
     if (file_ref->envelope_mode()) {
       all_files_plain = false;
     }
@@ -3138,13 +3370,45 @@ void BlueFS::_compact_log_dump_metadata_NF(uint64_t start_seq,
     // we are free to select now
     log.uses_envelope_mode = conf_wal_envelope_mode;
   }
+  snap->dirs.reserve(nodes.dir_map.size());
   for (auto& [path, dir_ref] : nodes.dir_map) {
+    auto& [dir_path, links] = snap->dirs.emplace_back();
+    dir_path = path;
+    links.reserve(dir_ref->file_map.size());
+    for (auto& [fname, file_ref] : dir_ref->file_map) {
+      links.emplace_back(fname, file_ref->fnode.ino);
+    }
+  }
+}
+
+void BlueFS::_compact_log_encode_metadata(uint64_t start_seq,
+                                          meta_snapshot_t& snap,
+                                          bluefs_transaction_t *t)
+{
+  dout(20) << __func__ << " " << snap.files.size() << " files, "
+           << snap.dirs.size() << " dirs" << dendl;
+  t->seq = start_seq;
+  t->uuid = super.uuid;
+  for (auto& [file, fnode, allocated] : snap.files) {
+    std::lock_guard fl(file->lock);
+    if (snap.deferred) {
+      append_extents_prefix(
+        file->compact_captured ? *file->compact_captured : file->fnode,
+        allocated, &fnode);
+      file->compact_pending = false;
+      file->compact_captured.reset();
+    } else {
+      append_extents_prefix(file->fnode, allocated, &fnode);
+    }
+    t->op_file_update(fnode);
+  }
+  for (auto& [path, links] : snap.dirs) {
     dout(20) << __func__ << " op_dir_create " << path << dendl;
     t->op_dir_create(path);
-    for (auto& [fname, file_ref] : dir_ref->file_map) {
+    for (auto& [fname, ino] : links) {
       dout(20) << __func__ << " op_dir_link " << path << "/" << fname
-	       << " to " << file_ref->fnode.ino << dendl;
-      t->op_dir_link(path, fname, file_ref->fnode.ino);
+	       << " to " << ino << dendl;
+      t->op_dir_link(path, fname, ino);
     }
   }
 }
@@ -3513,8 +3777,9 @@ void BlueFS::_compact_log_async_LD_LNF_D() //also locks FW for new_writer
   // Part 2.
   // Build new log starter and compacted metadata body
   // 2.1.  Build full compacted meta transaction.
-  //       While still holding the lock, encode a bluefs transaction
-  //       that dumps all of the in-memory fnodes and names.
+  //       While still holding the lock, capture the in-memory fnodes
+  //       (without their extents) and names, then encode it into a bluefs
+  //       transaction once the lock is released.
   //       This might be pretty large and its allocation map can exceed
   //       superblock size. Hence instead we'll need log starter part which
   //       goes to superblock and refers that new meta through op_update_inc.
@@ -3538,15 +3803,21 @@ void BlueFS::_compact_log_async_LD_LNF_D() //also locks FW for new_writer
   //
 
   // 2.1 Build full compacted meta transaction
-  bluefs_transaction_t compacted_meta_t;
-  _compact_log_dump_metadata_NF(starter_seq + 1, &compacted_meta_t, 0, seq_now);
+  //     Only note the files and copy the names while the log is locked,
+  //     the extents are copied and encoded after the unlock.
+  meta_snapshot_t meta_snap;
+  _compact_log_capture_metadata_NF(&meta_snap, 0, seq_now, true);
 
-  // now state is captured to compacted_meta_t,
+  // now state is captured to meta_snap,
   // current log can be used to write to,
   //ops in log will be continuation of captured state
   logger->tinc_with_max(l_bluefs_compaction_lock_lat, mono_clock::now() - t0);
   log.lock.unlock();
 
+  bluefs_transaction_t compacted_meta_t;
+  _compact_log_encode_metadata(starter_seq + 1, meta_snap, &compacted_meta_t);
+  meta_snap = meta_snapshot_t();
+
   // 2.2 Allocate the space required for the compacted meta transaction
   uint64_t compacted_meta_need = _estimate_transaction_size(&compacted_meta_t);
   dout(20) << __func__ << " compacted_meta_need " << compacted_meta_need
@@ -4399,6 +4670,7 @@ int BlueFS::truncate(FileWriter *h, uint64_t offset)/*_WF_L*/
   {
     std::lock_guard ll(log.lock);
     std::lock_guard dl(dirty.lock);
+    std::lock_guard fl(h->file->lock);
     if (h->file->deleted) {
       dout(10) << __func__ << " deleted, no-op" << dendl;
       return 0;
@@ -4408,6 +4680,7 @@ int BlueFS::truncate(FileWriter *h, uint64_t offset)/*_WF_L*/
     uint64_t x_off = 0;
     auto p = fnode.seek(offset, &x_off);
     if (p != fnode.extents.end()) {
+      _compact_log_preserve_F(h->file.get());
       uint64_t cut_off = p2roundup(x_off, alloc_size[p->bdev]);
       if (0 == cut_off) {
         // whole pextent to remove
@@ -4814,6 +5087,8 @@ int BlueFS::open_for_write(
       dout(20) << __func__ << " dir " << dirname << " (" << dir
 	       << ") file " << filename
 	       << " already exists, truncate + overwrite" << dendl;
+      std::lock_guard fl(file->lock);
+      _compact_log_preserve_F(file.get());
       vselector->sub_usage(file->vselector_hint, file->fnode);
       file->fnode.size = 0;
       vselector->add_usage(file->vselector_hint, file->fnode.size, true); // restore file count
@@ -62,6 +62,7 @@ enum {
   l_bluefs_read_random_disk_bytes_slow,
   l_bluefs_read_random_buffer_count,
   l_bluefs_read_random_buffer_bytes,
+  l_bluefs_read_random_batch_count,
   l_bluefs_read_lat,
   l_bluefs_read_count,
   l_bluefs_read_bytes,
@@ -350,6 +351,14 @@ public:
     bool is_dirty;
     boost::intrusive::list_member_hook<> dirty_item;
 
+    // an async log compaction captured this fnode and encodes it later,
+    // see _compact_log_capture_metadata_NF(). it takes the first
+    // compact_allocated bytes of the extents then, these are kept in
+    // compact_captured if they get rewritten in the meantime.
+    bool compact_pending = false;
+    uint64_t compact_allocated = 0;
+    std::optional<bluefs_fnode_t> compact_captured;
+
     std::atomic_int num_readers, num_writers;
     std::atomic_int num_reading;
 
@@ -562,6 +571,13 @@ public:
     bool ignore_eof;
     bool buffered;
   };
+  struct read_random_req_t {
+    uint64_t offset = 0;
+    uint64_t len = 0;
+    char *out = nullptr;
+    int64_t ret = 0;     ///< bytes read, shorter than len at eof
+  };
+
   struct FileReader {
     MEMPOOL_CLASS_HELPERS();
 
@@ -750,6 +766,26 @@ private:
                                      bluefs_transaction_t *t,
 				     int flags,
 				     uint64_t capture_before_seq);
+  // in-memory metadata as captured for compaction
+  struct meta_snapshot_t {
+    struct file_t {
+      FileRef file;
+      bluefs_fnode_t fnode;  ///< without extents, taken from file on encode
+      uint64_t allocated;    ///< extents bytes captured
+    };
+    std::vector<file_t> files;
+    bool deferred = false;   ///< encoded after the locks were dropped
+    std::vector<std::pair<std::string,
+      std::vector<std::pair<std::string, uint64_t>>>> dirs; ///< dir -> (name, ino)
+  };
+  void _compact_log_capture_metadata_NF(meta_snapshot_t *snap,
+                                        int flags,
+                                        uint64_t capture_before_seq,
+                                        bool deferred);
+  void _compact_log_preserve_F(File *f);
+  void _compact_log_encode_metadata(uint64_t start_seq,
+                                    meta_snapshot_t& snap,
+                                    bluefs_transaction_t *t);
 
   void _compact_log_sync_LNF_LD();
   void _compact_log_async_LD_LNF_D();
@@ -795,6 +831,14 @@ private:
     uint64_t offset, ///< [in] offset
     uint64_t len,    ///< [in] this many bytes
     char *out);      ///< [out] optional: or copy it here
+  void _prefetch_random_batch(
+    FileReader *h,                 ///< [in] read from here
+    const read_random_req_t *reqs, ///< [in] requests
+    size_t num_reqs);
+  void _read_random_batch(
+    FileReader *h,             ///< [in] read from here
+    read_random_req_t *reqs,   ///< [in,out] requests
+    size_t num_reqs);
 
   int _open_super();
   int _write_super(int dev);
@@ -972,6 +1016,11 @@ public:
     // atomics and asserts).
     return _read_random(h, offset, len, out);
   }
+  /// read several ranges of a file, with all device reads in flight at once
+  void read_random_batch(FileReader *h, read_random_req_t *reqs,
+			 size_t num_reqs) {
+    _read_random_batch(h, reqs, num_reqs);
+  }
   void invalidate_cache(FileRef f, uint64_t offset, uint64_t len);
   int preallocate(FileRef f, uint64_t offset, uint64_t len);
   int truncate(FileWriter *h, uint64_t offset);
@@ -998,6 +1047,8 @@ private:
   int _bdev_read(uint8_t ndev, uint64_t off, uint64_t len,
     ceph::buffer::list* pbl, IOContext* ioc, bool buffered);
   int _bdev_read_random(uint8_t ndev, uint64_t off, uint64_t len, char* buf, bool buffered);
+  int _bdev_aio_read_random(uint8_t ndev, uint64_t off, uint64_t len,
+    ceph::buffer::list* pbl, IOContext* ioc);
 
   /// test and compact log, if necessary
   void _maybe_compact_log_LNF_NF_LD_D();
@@ -121,6 +121,28 @@ class BlueRocksRandomAccessFile : public rocksdb::RandomAccessFile {
     return rocksdb::Status::OK();
   }
 
+  // Read a bunch of blocks as described by reqs. The blocks can
+  // optionally be read in parallel.
+  //
+  // BlueFS submits all the device reads at once and waits for them
+  // together, instead of one round trip per block.
+  rocksdb::Status MultiRead(rocksdb::ReadRequest* reqs,
+			    size_t num_reqs) override {
+    std::vector<BlueFS::read_random_req_t> breqs(num_reqs);
+    for (size_t i = 0; i < num_reqs; i++) {
+      breqs[i].offset = reqs[i].offset;
+      breqs[i].len = reqs[i].len;
+      breqs[i].out = reqs[i].scratch;
+    }
+    fs->read_random_batch(h, breqs.data(), num_reqs);
+    for (size_t i = 0; i < num_reqs; i++) {
+      ceph_assert(breqs[i].ret >= 0);
+      reqs[i].result = rocksdb::Slice(reqs[i].scratch, breqs[i].ret);
+      reqs[i].status = rocksdb::Status::OK();
+    }
+    return rocksdb::Status::OK();
+  }
+
   // Tries to get an unique ID for this file that will be the same each time
   // the file is opened (and will stay the same while the file is open).
   // Furthermore, it tries to make this ID at most "max_size" bytes. If such an
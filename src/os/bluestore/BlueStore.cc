@@ -17,6 +17,7 @@
 #include <random>
 #include <utility>
 #include <memory>
+#include <thread>
 #include <unistd.h>
 #include <stdlib.h>
 #include <sys/types.h>
@@ -25,6 +26,7 @@
 #include <algorithm>
 
 #include <boost/container/flat_set.hpp>
+#include <boost/container/small_vector.hpp>
 #include <boost/algorithm/string.hpp>
 #include <boost/random/mersenne_twister.hpp>
 #include <boost/random/uniform_real.hpp>
@@ -143,6 +145,8 @@ const string PREFIX_DEFERRED = "L";    // id -> deferred_transaction_t
 const string PREFIX_ALLOC = "B";       // u64 offset -> u64 length (freelist)
 const string PREFIX_ALLOC_BITMAP = "b";// (see BitmapFreelistManager)
 const string PREFIX_SHARED_BLOB = "X"; // u64 SB id -> shared_blob_t
+const string PREFIX_FAST_ALLOC = "F";  // fast data tier freelist meta
+const string PREFIX_FAST_ALLOC_BITMAP = "f"; // (see BitmapFreelistManager)
 
 const string BLUESTORE_GLOBAL_STATFS_KEY = "bluestore_statfs";
 
@@ -1107,6 +1111,7 @@ struct LruOnodeCacheShard : public BlueStore::OnodeCacheShard {
     o->set_cached();
     if (o->pin_nref == 1) {
       (level > 0) ? lru.push_front(*o) : lru.push_back(*o);
+      o->lru_linked = true;
       o->cache_age_bin = age_bins.front();
       *(o->cache_age_bin) += 1;
     }
@@ -1120,6 +1125,7 @@ struct LruOnodeCacheShard : public BlueStore::OnodeCacheShard {
     if (o->lru_item.is_linked()) {
       *(o->cache_age_bin) -= 1;
       lru.erase(lru.iterator_to(*o));
+      o->lru_linked = false;
     }
     ceph_assert(num);
     --num;
@@ -1128,6 +1134,17 @@ struct LruOnodeCacheShard : public BlueStore::OnodeCacheShard {
 
   void maybe_unpin(BlueStore::Onode* o) override
   {
+    // Already in the LRU: just note the use and let _trim_to() move it to
+    // the front, rather than taking the shard lock on every unpin.
+    // _trim_to() clears lru_linked before it looks at pin_nref, and we
+    // dropped pin_nref before looking at lru_linked, so at least one of
+    // us sees the other and an unlinked onode is never left behind.
+    if (o->lru_linked) {
+      if (o->exists) {
+        o->lru_touched.store(true, std::memory_order_relaxed);
+      }
+      return;
+    }
     OnodeCacheShard* ocs = this;
     ocs->lock.lock();
     // It is possible that during waiting split_cache moved us to different OnodeCacheShard.
@@ -1140,18 +1157,24 @@ struct LruOnodeCacheShard : public BlueStore::OnodeCacheShard {
       if(!o->lru_item.is_linked()) {
         if (o->exists) {
 	  lru.push_front(*o);
+	  o->lru_linked = true;
 	  o->cache_age_bin = age_bins.front();
 	  *(o->cache_age_bin) += 1;
 	  dout(20) << __func__ << " " << this << " " << o->oid << " unpinned"
                    << dendl;
         } else {
-	  ceph_assert(num);
-	  --num;
-	  o->clear_cached();
-	  dout(20) << __func__ << " " << this << " " << o->oid << " removed"
-                   << dendl;
-          // remove will also decrement nref
-          o->c->onode_space._remove(o->oid);
+          // no lock-free hit may pin it from now on; recheck whether one
+          // did in the meantime
+          o->c->onode_space._hot_forget(o);
+          if (o->pin_nref == 1) {
+	    ceph_assert(num);
+	    --num;
+	    o->clear_cached();
+	    dout(20) << __func__ << " " << this << " " << o->oid << " removed"
+                     << dendl;
+            // remove will also decrement nref
+            o->c->onode_space._remove(o->oid);
+          }
         }
       } else if (o->exists) {
         // move onode within LRU
@@ -1178,14 +1201,35 @@ struct LruOnodeCacheShard : public BlueStore::OnodeCacheShard {
                                  // before n == 0 due to pinned
                                  // entries. And hence being unable
                                  // to reach new_size target.
-    while (n-- > 0 && lru.size() > 0) {
+    // every onode touched since it was last seen here gets one more round
+    // at the front of the LRU; bounded so that concurrent touches cannot
+    // keep us spinning
+    uint64_t promotions = lru.size();
+    while (n > 0 && lru.size() > 0) {
       BlueStore::Onode *o = &lru.back();
       lru.pop_back();
 
+      if (promotions > 0 && o->lru_touched.exchange(false)) {
+        --promotions;
+        lru.push_front(*o);
+        if (o->cache_age_bin != age_bins.front()) {
+          *(o->cache_age_bin) -= 1;
+          o->cache_age_bin = age_bins.front();
+          *(o->cache_age_bin) += 1;
+        }
+        dout(20) << __func__ << " " << this << " " << o->oid << " touched"
+                 << dendl;
+        continue;
+      }
+      --n;
+
       dout(20) << __func__ << "  rm " << o->oid << " "
                << o->nref << " " << o->cached << dendl;
 
       *(o->cache_age_bin) -= 1;
+      o->lru_linked = false;
+      // stop lock-free lookups from pinning it behind our back
+      o->c->onode_space._hot_forget(o);
       if (o->pin_nref > 1) {
         dout(20) << __func__ << " " << this << " " << " " << " " << o->oid << dendl;
       } else {
@@ -1211,6 +1255,19 @@ struct LruOnodeCacheShard : public BlueStore::OnodeCacheShard {
     *onodes += num;
     *pinned_onodes += num - lru.size();
   }
+  void list_hot(
+    size_t max,
+    std::vector<std::pair<coll_t, ghobject_t>>* ls) override
+  {
+    std::lock_guard l(lock);
+    for (auto& o : lru) {
+      if (max == 0) {
+        break;
+      }
+      ls->emplace_back(o.c->cid, o.oid);
+      --max;
+    }
+  }
 #ifdef DEBUG_CACHE
   void _audit(const char *when) override
   {
@@ -2061,6 +2118,17 @@ void BlueStore::TransContext::finish_writing()
 #undef dout_prefix
 #define dout_prefix *_dout << "bluestore.OnodeSpace(" << this << " in " << cache << ") "
 
+BlueStore::OnodeSpace::OnodeSpace(OnodeCacheShard *c)
+  : cache(c)
+{
+  uint64_t n = cache->cct->_conf.get_val<uint64_t>("bluestore_onode_hot_slots");
+  if (n) {
+    n = std::bit_ceil(n);
+    hot_slots.reset(new hot_slot_t[n]);
+    hot_mask = n - 1;
+  }
+}
+
 BlueStore::OnodeRef BlueStore::OnodeSpace::add_onode(const ghobject_t& oid,
   OnodeRef& o)
 {
@@ -2075,6 +2143,7 @@ BlueStore::OnodeRef BlueStore::OnodeSpace::add_onode(const ghobject_t& oid,
   }
   ldout(cache->cct, 20) << __func__ << " " << oid << " " << o << dendl;
   cache->_add(o.get(), 1);
+  _hot_set(o.get());
   cache->_trim_some();
   return o;
 }
@@ -2082,13 +2151,77 @@ BlueStore::OnodeRef BlueStore::OnodeSpace::add_onode(const ghobject_t& oid,
 void BlueStore::OnodeSpace::_remove(const ghobject_t& oid)
 {
   ldout(cache->cct, 20) << __func__ << " " << oid << " " << dendl;
-  onode_map.erase(oid);
+  auto p = onode_map.find(oid);
+  if (p != onode_map.end()) {
+    _hot_forget(p->second.get());
+    onode_map.erase(p);
+  }
+}
+
+BlueStore::OnodeRef BlueStore::OnodeSpace::_hot_lookup(const ghobject_t& oid)
+{
+  auto slot = _hot_slot(oid);
+  if (!slot) {
+    return OnodeRef();
+  }
+  uint32_t phase = slot->phase.load() & 1;
+  slot->readers[phase].fetch_add(1);
+  // the onode can't leave onode_map while we are counted
+  Onode* o = reinterpret_cast<Onode*>(slot->onode.load());
+  OnodeRef r;
+  if (o && o->oid == oid) {
+    r = o;
+  }
+  slot->readers[phase].fetch_sub(1, std::memory_order_release);
+  return r;
+}
+
+void BlueStore::OnodeSpace::_hot_publish(hot_slot_t& slot, uintptr_t v)
+{
+  ceph_assert(ceph_mutex_is_locked(cache->lock));
+  slot.onode.store(v);
+  // Readers that may still use the previous onode are counted in the
+  // current phase; new ones go to the other.  One that read the phase
+  // before the flip may only count itself afterwards, in the old one,
+  // so, as with userspace RCU, it takes two rounds.
+  for (int i = 0; i < 2; ++i) {
+    uint32_t old = slot.phase.fetch_add(1) & 1;
+    while (slot.readers[old].load(std::memory_order_acquire) != 0) {
+      // they only check the oid and take a reference
+    }
+  }
+}
+
+void BlueStore::OnodeSpace::_hot_set(Onode* o)
+{
+  ceph_assert(ceph_mutex_is_locked(cache->lock));
+  auto slot = _hot_slot(o->oid);
+  if (slot && slot->onode.load() != reinterpret_cast<uintptr_t>(o)) {
+    // the onode replaced may leave onode_map next, see _hot_forget()
+    _hot_publish(*slot, reinterpret_cast<uintptr_t>(o));
+  }
+}
+
+void BlueStore::OnodeSpace::_hot_forget(Onode* o)
+{
+  ceph_assert(ceph_mutex_is_locked(cache->lock));
+  auto slot = _hot_slot(o->oid);
+  // if it has been replaced already, its readers were waited for then
+  if (slot && slot->onode.load() == reinterpret_cast<uintptr_t>(o)) {
+    _hot_publish(*slot, 0);
+  }
 }
 
 BlueStore::OnodeRef BlueStore::OnodeSpace::lookup(const ghobject_t& oid)
 {
   ldout(cache->cct, 30) << __func__ << dendl;
-  OnodeRef o;
+  OnodeRef o = _hot_lookup(oid);
+  if (o) {
+    ldout(cache->cct, 30) << __func__ << " " << oid << " hit " << o
+                          << " (lockless)" << dendl;
+    cache->logger->inc(l_bluestore_onode_hits);
+    return o;
+  }
 
   {
     std::lock_guard l(cache->lock);
@@ -2104,6 +2237,7 @@ BlueStore::OnodeRef BlueStore::OnodeSpace::lookup(const ghobject_t& oid)
       // This will pin onode and implicitly touch the cache when Onode
       // eventually will become unpinned
       o = p->second;
+      _hot_set(o.get());
 
       cache->logger->inc(l_bluestore_onode_hits);
     }
@@ -2117,6 +2251,7 @@ void BlueStore::OnodeSpace::clear()
   std::lock_guard l(cache->lock);
   ldout(cache->cct, 10) << __func__ << " " << onode_map.size()<< dendl;
   for (auto &p : onode_map) {
+    _hot_forget(p.second.get());
     cache->_rm(p.second.get());
   }
   onode_map.clear();
@@ -2145,10 +2280,13 @@ void BlueStore::OnodeSpace::rename(
   if (pn != onode_map.end()) {
     ldout(cache->cct, 30) << __func__ << "  removing target " << pn->second
 			  << dendl;
+    _hot_forget(pn->second.get());
     cache->_rm(pn->second.get());
     onode_map.erase(pn);
   }
   OnodeRef o = po->second;
+  // its oid is about to change
+  _hot_forget(o.get());
 
   // install a non-existent onode at old location
   oldo.reset(new Onode(o->c, old_oid, o->key));
@@ -2275,9 +2413,112 @@ template <int LogLevelV = 30>
 void BlueStore::SharedBlobSet::dump(CephContext *cct)
 {
   std::lock_guard l(lock);
-  for (auto& i : sb_map) {
-    ldout(cct, LogLevelV) << i.first << " : " << *i.second << dendl;
+  for (auto& i : table.load()->slots) {
+    uint64_t sbid = i.sbid.load();
+    if (sbid != EMPTY && sbid != TOMBSTONE) {
+      ldout(cct, LogLevelV) << sbid << " : " << *i.sb.load() << dendl;
+    }
+  }
+}
+
+void BlueStore::SharedBlobSet::add(Collection* coll, SharedBlob *sb)
+{
+  std::lock_guard l(lock);
+  sb->collection = coll;
+  table_t* t = table.load();
+  uint64_t sbid = sb->get_sbid();
+  size_t mask = t->mask();
+  size_t tombstone = t->slots.size();
+  size_t i = slot_of(sbid, mask);
+  for (;; i = (i + 1) & mask) {
+    uint64_t k = t->slots[i].sbid.load(std::memory_order_relaxed);
+    if (k == sbid) {
+      // the old one is unreferenced and about to be removed
+      t->slots[i].sb.store(sb, std::memory_order_release);
+      return;
+    }
+    if (k == TOMBSTONE && tombstone == t->slots.size()) {
+      tombstone = i;
+    } else if (k == EMPTY) {
+      break;
+    }
+  }
+  if (tombstone != t->slots.size()) {
+    i = tombstone;
+  } else {
+    ++t->used;
+  }
+  t->slots[i].sb.store(sb, std::memory_order_relaxed);
+  t->slots[i].sbid.store(sbid, std::memory_order_release);
+  ++t->live;
+  if (t->used * 4 > t->slots.size() * 3) {
+    rehash(t);
+  }
+}
+
+bool BlueStore::SharedBlobSet::remove(SharedBlob *sb, bool verify_nref_is_zero)
+{
+  std::lock_guard l(lock);
+  ceph_assert(sb->get_parent() == this);
+  if (verify_nref_is_zero && sb->nref != 0) {
+    return false;
+  }
+  table_t* t = table.load();
+  uint64_t sbid = sb->get_sbid();
+  size_t mask = t->mask();
+  for (size_t i = slot_of(sbid, mask);; i = (i + 1) & mask) {
+    uint64_t k = t->slots[i].sbid.load(std::memory_order_relaxed);
+    if (k == sbid) {
+      // only remove if it still points to us
+      if (t->slots[i].sb.load(std::memory_order_relaxed) == sb) {
+	t->slots[i].sb.store(nullptr, std::memory_order_relaxed);
+	t->slots[i].sbid.store(TOMBSTONE, std::memory_order_release);
+	--t->live;
+      }
+      break;
+    }
+    if (k == EMPTY) {
+      break;
+    }
+  }
+  // even when the entry was replaced, lookups may still hold sb
+  synchronize();
+  return true;
+}
+
+void BlueStore::SharedBlobSet::synchronize()
+{
+  ceph_assert(ceph_mutex_is_locked(lock));
+  uint64_t e = epoch.fetch_add(1);
+  while (readers[e & 1].load() != 0) {
+    std::this_thread::yield();
+  }
+}
+
+void BlueStore::SharedBlobSet::rehash(table_t* t)
+{
+  // sized on the live entries only, so it also drops the tombstones and
+  // shrinks a table that emptied
+  size_t n = std::max(MIN_SLOTS, std::bit_ceil(t->live * 2 + 1));
+  auto nt = new table_t(n);
+  size_t mask = nt->mask();
+  for (auto& s : t->slots) {
+    uint64_t k = s.sbid.load(std::memory_order_relaxed);
+    if (k == EMPTY || k == TOMBSTONE) {
+      continue;
+    }
+    size_t i = slot_of(k, mask);
+    while (nt->slots[i].sbid.load(std::memory_order_relaxed) != EMPTY) {
+      i = (i + 1) & mask;
+    }
+    nt->slots[i].sb.store(s.sb.load(std::memory_order_relaxed),
+			  std::memory_order_relaxed);
+    nt->slots[i].sbid.store(k, std::memory_order_relaxed);
   }
+  nt->used = nt->live = t->live;
+  table.store(nt);
+  synchronize();
+  delete t;
 }
 
 // Blob
@@ -3974,6 +4215,102 @@ void BlueStore::ExtentMap::reshard(
   reshard_action(plan, db, t);
 }
 
+// Extent map shards of version 3 keep each extent field in a column of
+// fixed width little endian values.  A column starts with the byte width
+// of its values (0 when all are zero, 1, 2 or 4) and the number of low
+// zero bits all of them share (lengths and offsets are mostly multiples
+// of the allocation unit), which are stripped.  Unlike a chain of
+// varints a column decodes without data dependent branches, in loops
+// the compiler vectorizes.
+//
+// The blob column holds 0 for a blob encoded after the columns, in the
+// order of the extents that refer to it first, or one of:
+enum {
+  EXTENT_REF_SPANNING = 1, ///< ref >> 2 is a spanning blob id
+  EXTENT_REF_LOCAL = 2,    ///< ref >> 2 is the extent that brought the blob
+};
+
+static void encode_shard_column(
+  const uint32_t* v,
+  size_t n,
+  bufferlist::contiguous_appender& app)
+{
+  uint32_t all = 0;
+  for (size_t i = 0; i < n; ++i) {
+    all |= v[i];
+  }
+  __u8 shift = all ? std::countr_zero(all) : 0;
+  __u8 width = 0;
+  all >>= shift;
+  if (all > 0xffff) {
+    width = 4;
+  } else if (all > 0xff) {
+    width = 2;
+  } else if (all) {
+    width = 1;
+  }
+  denc(width, app);
+  denc(shift, app);
+  char* p = app.get_pos_add(n * width);
+  switch (width) {
+  case 1:
+    for (size_t i = 0; i < n; ++i) {
+      p[i] = v[i] >> shift;
+    }
+    break;
+  case 2:
+    for (size_t i = 0; i < n; ++i) {
+      ceph_le16 x(uint16_t(v[i] >> shift));
+      memcpy(p + i * 2, &x, 2);
+    }
+    break;
+  case 4:
+    for (size_t i = 0; i < n; ++i) {
+      ceph_le32 x(v[i] >> shift);
+      memcpy(p + i * 4, &x, 4);
+    }
+    break;
+  }
+}
+
+static void decode_shard_column(
+  bptr_c_it_t& p,
+  uint32_t* v,
+  size_t n)
+{
+  __u8 width, shift;
+  denc(width, p);
+  denc(shift, p);
+  if ((width != 0 && width != 1 && width != 2 && width != 4) || shift >= 32) {
+    throw ceph::buffer::malformed_input("bad extent map column width");
+  }
+  const char* q = p.get_pos_add(n * width);
+  switch (width) {
+  case 0:
+    std::fill(v, v + n, 0);
+    break;
+  case 1:
+    for (size_t i = 0; i < n; ++i) {
+      v[i] = uint32_t(uint8_t(q[i])) << shift;
+    }
+    break;
+  case 2:
+    for (size_t i = 0; i < n; ++i) {
+      ceph_le16 x;
+      memcpy(&x, q + i * 2, 2);
+      v[i] = uint32_t(x) << shift;
+    }
+    break;
+  case 4:
+    for (size_t i = 0; i < n; ++i) {
+      ceph_le32 x;
+      memcpy(&x, q + i * 4, 4);
+      v[i] = uint32_t(x) << shift;
+    }
+    break;
+  }
+}
+
 bool BlueStore::ExtentMap::encode_some(
   uint32_t offset,
   uint32_t length,
@@ -3986,9 +4323,12 @@ bool BlueStore::ExtentMap::encode_some(
   auto start = extent_map.lower_bound(dummy);
   uint32_t end = offset + length;
 
-  __u8 struct_v = 2; // Version 2 differs from v1 in blob's ref_map
-                     // serialization only. Hence there is no specific
-                     // handling at ExtentMap level.
+  // Version 2 differs from v1 in blob's ref_map serialization only.
+  // Version 3 stores the extent fields column-wise, see decode_columnar(),
+  // and its blobs as in version 2.
+  __u8 struct_v =
+    onode->c && onode->c->store->extent_map_columnar ? 3 : 2;
+  __u8 blob_v = 2;
 
   unsigned n = 0;
   size_t bound = 0;
@@ -4029,7 +4369,7 @@ bool BlueStore::ExtentMap::encode_some(
 
       p->blob->bound_encode(
         bound,
-        struct_v,
+        blob_v,
         p->blob->get_sbid(),
         false);
     }
@@ -4038,6 +4378,59 @@ bool BlueStore::ExtentMap::encode_some(
   denc(struct_v, bound);
   denc_varint(0, bound); // number of extents
 
+  if (struct_v == 3) {
+    // the varint bounds above cover the 16 bytes per extent of the
+    // widest columns
+    denc(blob_v, bound);
+    bound += 4 * 2; // column headers
+    auto app = bl.get_contiguous_appender(bound);
+    denc(struct_v, app);
+    denc_varint(n, app);
+    if (pn) {
+      *pn = n;
+    }
+    denc(blob_v, app);
+
+    boost::container::small_vector<uint32_t, 4 * 32> cols(4 * n);
+    uint32_t* gaps = cols.data();
+    uint32_t* blob_offsets = gaps + n;
+    uint32_t* lengths = blob_offsets + n;
+    uint32_t* refs = lengths + n;
+    boost::container::small_vector<Blob*, 32> new_blobs;
+    unsigned i = 0;
+    uint32_t pos = 0;
+    for (auto p = start;
+	 p != extent_map.end() && p->logical_offset < end;
+	 ++p, ++i) {
+      if (complain_shard_spanning && p->logical_end() > end) {
+	using P = BlueStore::printer;
+	dout(-1) << __func__ << " extent spans shard after reshard " << ": " << std::endl
+	  << onode->print(P::NICK + P::SDISK + P::SUSE + P::SBUF) << dendl;
+	ceph_abort();
+      }
+      gaps[i] = p->logical_offset - pos;
+      blob_offsets[i] = p->blob_offset;
+      lengths[i] = p->length;
+      if (p->blob->is_spanning()) {
+	refs[i] = (uint32_t(p->blob->id) << 2) | EXTENT_REF_SPANNING;
+      } else if (p->blob->last_encoded_id < 0) {
+	p->blob->last_encoded_id = i;
+	refs[i] = 0;
+	new_blobs.push_back(p->blob.get());
+      } else {
+	refs[i] = (uint32_t(p->blob->last_encoded_id) << 2) | EXTENT_REF_LOCAL;
+      }
+      pos = p->logical_end();
+    }
+    for (unsigned c = 0; c < 4; ++c) {
+      encode_shard_column(cols.data() + c * n, n, app);
+    }
+    for (auto b : new_blobs) {
+      b->encode(app, blob_v, b->get_sbid(), false);
+    }
+    return false;
+  }
+
   {
     auto app = bl.get_contiguous_appender(bound);
     denc(struct_v, app);
@@ -4095,7 +4488,7 @@ bool BlueStore::ExtentMap::encode_some(
       }
       pos = p->logical_end();
       if (include_blob) {
-	p->blob->encode(app, struct_v, p->blob->get_sbid(), false);
+	p->blob->encode(app, blob_v, p->blob->get_sbid(), false);
       }
     }
   }
@@ -4160,19 +4553,76 @@ unsigned BlueStore::ExtentMap::ExtentDecoder::decode_some(
   // Version 2 differs from v1 in blob's ref_map
   // serialization only. Hence there is no specific
   // handling at ExtentMap level below.
-  ceph_assert(struct_v == 1 || struct_v == 2);
+  ceph_assert(struct_v >= 1 && struct_v <= 3);
+  if (struct_v == 3 && c && c->store->ondisk_format &&
+      c->store->ondisk_compat < c->store->columnar_compat_ondisk_format) {
+    // the txc that wrote it raised the format before it was submitted, so
+    // this is damage.  (ondisk_format is 0 on a store that was never
+    // mounted.)
+    throw ceph::buffer::malformed_input(
+      "v3 extent map shard below min_compat_ondisk_format 6");
+  }
   denc_varint(num, p);
 
   extent_pos = 0;
-  while (!p.end()) {
-    Extent* le = get_next_extent();
-    decode_extent(le, struct_v, p, c);
-    add_extent(le);
+  if (struct_v == 3) {
+    decode_columnar(p, num, c);
+  } else {
+    while (!p.end()) {
+      Extent* le = get_next_extent();
+      decode_extent(le, struct_v, p, c);
+      add_extent(le);
+    }
   }
   ceph_assert(extent_pos == num);
   return num;
 }
 
+void BlueStore::ExtentMap::ExtentDecoder::decode_columnar(
+  bptr_c_it_t& p,
+  uint32_t num,
+  Collection* c)
+{
+  __u8 blob_v;
+  denc(blob_v, p);
+  // every extent has a nonzero length, so that column takes at least a
+  // byte per extent after the four width/shift headers; bound num by the
+  // input before sizing anything from it
+  size_t remaining = p.get_end() - p.get_pos();
+  if (remaining < 4 * 2 || num > remaining - 4 * 2) {
+    throw ceph::buffer::malformed_input("bad extent map extent count");
+  }
+  boost::container::small_vector<uint32_t, 4 * 32> cols(size_t(4) * num);
+  for (unsigned i = 0; i < 4; ++i) {
+    decode_shard_column(p, cols.data() + i * num, num);
+  }
+  const uint32_t* gaps = cols.data();
+  const uint32_t* blob_offsets = gaps + num;
+  const uint32_t* lengths = blob_offsets + num;
+  const uint32_t* refs = lengths + num;
+  uint64_t pos = 0;
+  for (uint32_t i = 0; i < num; ++i) {
+    Extent* le = get_next_extent();
+    pos += gaps[i];
+    le->logical_offset = pos;
+    le->blob_offset = blob_offsets[i];
+    le->length = lengths[i];
+    uint32_t ref = refs[i];
+    if (ref & EXTENT_REF_SPANNING) {
+      consume_blobid(le, true, ref >> 2);
+    } else if (ref & EXTENT_REF_LOCAL) {
+      consume_blobid(le, false, ref >> 2);
+    } else {
+      uint64_t sbid = 0;
+      BlobRef b = decode_create_blob(p, blob_v, &sbid, false, c);
+      consume_blob(le, extent_pos, sbid, b);
+    }
+    pos += lengths[i];
+    add_extent(le);
+    ++extent_pos;
+  }
+}
+
 void BlueStore::ExtentMap::ExtentDecoder::decode_spanning_blobs(
   bptr_c_it_t& p, Collection* c)
 {
@@ -5467,6 +5917,7 @@ void BlueStore::Collection::split_cache(
       // ensuring that nref is always >= 2 and hence onode is pinned
       OnodeRef o_pin = o;
 
+      onode_space._hot_forget(o.get());
       p = onode_space.onode_map.erase(p);
       dest->onode_space.onode_map[o->oid] = o;
       if (o->cached) {
@@ -5876,6 +6327,12 @@ std::vector<std::string> BlueStore::get_tracked_keys() const noexcept
     "bluestore_compression_max_blob_size_ssd"s,
     "bluestore_compression_max_blob_size_hdd"s,
     "bluestore_compression_required_ratio"s,
+    "bluestore_recompress_algorithm"s,
+    "bluestore_recompress_level"s,
+    "bluestore_tier_promote_heat"s,
+    "bluestore_tier_demote_heat"s,
+    "bluestore_tier_heat_halflife"s,
+    "bluestore_tier_fast_full_ratio"s,
     "bluestore_max_alloc_size"s,
     "bluestore_prefer_deferred_size"s,
     "bluestore_prefer_deferred_size_hdd"s,
@@ -5936,7 +6393,9 @@ void BlueStore::handle_conf_change(const ConfigProxy& conf,
       changed.count("bluestore_compression_min_blob_size_ssd") ||
       changed.count("bluestore_compression_max_blob_size") ||
       changed.count("bluestore_compression_max_blob_size_hdd") ||
-      changed.count("bluestore_compression_max_blob_size_ssd")) {
+      changed.count("bluestore_compression_max_blob_size_ssd") ||
+      changed.count("bluestore_recompress_algorithm") ||
+      changed.count("bluestore_recompress_level")) {
     if (bdev) {
       _set_compression();
     }
@@ -5944,6 +6403,12 @@ void BlueStore::handle_conf_change(const ConfigProxy& conf,
   if (changed.count("bluestore_onode_segment_size")) {
     segment_size = (cct->_conf.get_val<Option::size_t>("bluestore_onode_segment_size"));
   }
+  if (changed.count("bluestore_tier_promote_heat") ||
+      changed.count("bluestore_tier_demote_heat") ||
+      changed.count("bluestore_tier_heat_halflife") ||
+      changed.count("bluestore_tier_fast_full_ratio")) {
+    _set_tier_params();
+  }
   if (changed.count("bluestore_max_blob_size") ||
       changed.count("bluestore_max_blob_size_ssd") ||
       changed.count("bluestore_max_blob_size_hdd")) {
@@ -6067,11 +6532,33 @@ void BlueStore::_set_compression()
     def_compressor_alg = Compressor::COMP_ALG_NONE;
     alg_name = "(none)";
   }
+
+  // background recompression may use a stronger codec than client writes
+  CompressorRef rc;
+  auto rc_name = cct->_conf.get_val<std::string>("bluestore_recompress_algorithm");
+  if (!rc_name.empty()) {
+    rc = Compressor::create(cct, rc_name);
+    if (!rc) {
+      derr << __func__ << " unable to initialize " << rc_name
+	   << " compressor for recompression" << dendl;
+    }
+  }
+  auto rc_level = cct->_conf.get_val<int64_t>("bluestore_recompress_level");
+  if (rc && rc_level) {
+    if (auto leveled = rc->with_level(rc_level); leveled) {
+      rc = leveled;
+    }
+  }
+  {
+    std::lock_guard l(recompress_lock);
+    recompress_compressor = rc;
+  }
   dout(10) << __func__ << " mode " << Compressor::get_comp_mode_name(comp_mode)
 	   << " alg " << alg_name
 	   << " min_blob " << comp_min_blob_size
 	   << " max_blob " << comp_max_blob_size
            << " segment_size " << segment_size
+	   << " recompress alg " << (rc ? rc->get_type_name() : "(pool)")
 	   << dendl;
 }
 
@@ -6103,6 +6590,49 @@ void BlueStore::_set_throttle_params()
   dout(10) << __func__ << " throttle_cost_per_io " << throttle_cost_per_io
 	   << dendl;
 }
+void BlueStore::_deferred_policy_update()
+{
+  auto now = mono_clock::now();
+  auto interval = cct->_conf.get_val<double>(
+    "bluestore_deferred_adaptive_interval");
+  if (now - deferred_policy_stamp < make_timespan(interval)) {
+    return;
+  }
+  deferred_policy_stamp = now;
+  if (!cct->_conf.get_val<bool>("bluestore_deferred_adaptive")) {
+    // possibly switched off at runtime, go back to the configured threshold
+    uint64_t base;
+    if (deferred_policy.reset(&base)) {
+      prefer_deferred_size = base;
+      logger->set(l_bluestore_deferred_adaptive_size, base);
+    }
+    return;
+  }
+  DeferredPolicy::params_t p;
+  p.max_level = cct->_conf.get_val<uint64_t>(
+    "bluestore_deferred_adaptive_max_shift");
+  p.backlog_high = cct->_conf.get_val<double>(
+    "bluestore_deferred_adaptive_backlog_ratio");
+  p.raise_ratio = cct->_conf.get_val<double>(
+    "bluestore_deferred_adaptive_raise_ratio");
+  p.lower_ratio = cct->_conf.get_val<double>(
+    "bluestore_deferred_adaptive_lower_ratio");
+  uint64_t old_size = prefer_deferred_size;
+  uint64_t new_size;
+  auto d = deferred_policy.update(throttle.get_deferred_backlog(), p,
+                                  &new_size);
+  if (new_size != old_size) {
+    dout(10) << __func__ << " " << DeferredPolicy::get_decision_name(d)
+             << " prefer_deferred_size 0x" << std::hex << old_size
+             << " -> 0x" << new_size << std::dec << dendl;
+    prefer_deferred_size = new_size;
+    logger->inc(new_size > old_size ?
+      l_bluestore_deferred_adaptive_raises :
+      l_bluestore_deferred_adaptive_lowers);
+  }
+  logger->set(l_bluestore_deferred_adaptive_size, new_size);
+}
+
 void BlueStore::_set_blob_size()
 {
   if (cct->_conf->bluestore_max_blob_size) {
@@ -6119,6 +6649,23 @@ void BlueStore::_set_blob_size()
            << std::dec << dendl;
 }
 
+void BlueStore::_set_tier_params()
+{
+  tier_promote_heat =
+    cct->_conf.get_val<uint64_t>("bluestore_tier_promote_heat");
+  tier_demote_heat =
+    cct->_conf.get_val<uint64_t>("bluestore_tier_demote_heat");
+  tier_heat_halflife = std::max<uint32_t>(1,
+    cct->_conf.get_val<std::chrono::seconds>(
+      "bluestore_tier_heat_halflife").count());
+  tier_fast_full_ratio =
+    cct->_conf.get_val<double>("bluestore_tier_fast_full_ratio");
+  dout(10) << __func__ << " promote_heat " << tier_promote_heat
+	   << " demote_heat " << tier_demote_heat
+	   << " heat_halflife " << tier_heat_halflife
+	   << " fast_full_ratio " << tier_fast_full_ratio << dendl;
+}
+
 void BlueStore::_update_osd_memory_options()
 {
   osd_memory_target = cct->_conf.get_val<Option::size_t>("osd_memory_target");
@@ -6364,6 +6911,16 @@ void BlueStore::_init_logger()
 	    "au_b",
 	    PerfCountersBuilder::PRIO_CRITICAL,
 	    unit_t(UNIT_BYTES));
+  b.add_u64(l_bluestore_tier_fast_size, "tier_fast_size",
+	    "Size of the fast data tier",
+	    NULL,
+	    PerfCountersBuilder::PRIO_USEFUL,
+	    unit_t(UNIT_BYTES));
+  b.add_u64(l_bluestore_tier_fast_free, "tier_fast_free",
+	    "Free space on the fast data tier",
+	    NULL,
+	    PerfCountersBuilder::PRIO_USEFUL,
+	    unit_t(UNIT_BYTES));
   //****************************************
 
   // Update op processing state latencies
@@ -6515,6 +7072,18 @@ void BlueStore::_init_logger()
 		    NULL,
 		    PerfCountersBuilder::PRIO_DEBUGONLY,
 		    unit_t(UNIT_BYTES));
+  b.add_u64(l_bluestore_deferred_adaptive_size,
+	    "deferred_adaptive_size",
+	    "Deferred write threshold in effect",
+	    NULL,
+	    PerfCountersBuilder::PRIO_DEBUGONLY,
+	    unit_t(UNIT_BYTES));
+  b.add_u64_counter(l_bluestore_deferred_adaptive_raises,
+		    "deferred_adaptive_raises",
+		    "Times the deferred write threshold was raised");
+  b.add_u64_counter(l_bluestore_deferred_adaptive_lowers,
+		    "deferred_adaptive_lowers",
+		    "Times the deferred write threshold was lowered");
 
   b.add_u64_counter(l_bluestore_write_big_skipped_blobs,
       "write_big_skipped_blobs",
@@ -6528,6 +7097,18 @@ void BlueStore::_init_logger()
   b.add_u64_counter(l_bluestore_write_small_skipped_bytes,
       "write_small_skipped_bytes",
       "Small writes into existing or sparse small blobs skipped due to zero detection (bytes)");
+  b.add_u64_counter(l_bluestore_wa_user_bytes, "wa_user_bytes",
+		    "Sum for object data and omap bytes written by clients",
+		    NULL, 0, unit_t(UNIT_BYTES));
+  b.add_u64_counter(l_bluestore_wa_device_bytes, "wa_device_bytes",
+		    "Sum for data bytes written to the block devices",
+		    NULL, 0, unit_t(UNIT_BYTES));
+  b.add_u64_counter(l_bluestore_wa_deferred_bytes, "wa_deferred_bytes",
+		    "Sum for data bytes written twice, via the kv log first",
+		    NULL, 0, unit_t(UNIT_BYTES));
+  b.add_u64_counter(l_bluestore_wa_kv_bytes, "wa_kv_bytes",
+		    "Sum for bytes of submitted kv transactions",
+		    NULL, 0, unit_t(UNIT_BYTES));
   //****************************************
 
   // compressions stats
@@ -6610,6 +7191,21 @@ void BlueStore::_init_logger()
   b.add_u64_counter(l_bluestore_gc_merged, "gc_merged",
 		    "Sum for extents that have been merged due to garbage "
 		    "collection");
+  b.add_u64_counter(l_bluestore_recompress_bytes, "recompress_bytes",
+		    "Sum for object data rewritten by background recompression",
+		    NULL, 0, unit_t(UNIT_BYTES));
+  b.add_u64_counter(l_bluestore_recompress_released, "recompress_released",
+		    "Sum for disk space released by background recompression",
+		    NULL, 0, unit_t(UNIT_BYTES));
+  b.add_u64_counter(l_bluestore_tier_fast_alloc_bytes, "tier_fast_alloc_bytes",
+		    "Sum for space allocated on the fast data tier",
+		    NULL, 0, unit_t(UNIT_BYTES));
+  b.add_u64_counter(l_bluestore_tier_promote_bytes, "tier_promote_bytes",
+		    "Sum for object data moved to the fast data tier",
+		    NULL, 0, unit_t(UNIT_BYTES));
+  b.add_u64_counter(l_bluestore_tier_demote_bytes, "tier_demote_bytes",
+		    "Sum for object data moved back to the main device",
+		    NULL, 0, unit_t(UNIT_BYTES));
   //****************************************
   // misc
   //****************************************
@@ -7231,6 +7827,7 @@ void BlueStore::_set_alloc_sizes(void)
       prefer_deferred_size = cct->_conf->bluestore_prefer_deferred_size_ssd;
     }
   }
+  deferred_policy.set_base(prefer_deferred_size);
 
   if (cct->_conf->bluestore_deferred_batch_ops) {
     deferred_batch_ops = cct->_conf->bluestore_deferred_batch_ops;
@@ -7600,6 +8197,120 @@ void BlueStore::_close_alloc()
   alloc = nullptr;
 }
 
+int BlueStore::_open_fast_tier(KeyValueDB::Transaction t, bool read_only)
+{
+  ceph_assert(bdev_fast == nullptr);
+  string p = path + "/block.fast";
+  struct stat st;
+  if (::stat(p.c_str(), &st) < 0) {
+    if (fast_tier_compat) {
+      derr << __func__ << " " << p << " is missing but the store has data"
+	   << " on the fast tier" << dendl;
+      return -ENOENT;
+    }
+    return 0;
+  }
+  bool create = t != nullptr;
+  // nothing is ever discarded on the fast tier
+  bdev_fast = BlockDevice::create(cct, p, aio_cb, static_cast<void*>(this),
+				  nullptr, nullptr, "bluestore");
+  int r = bdev_fast->open(p);
+  if (r < 0) {
+    derr << __func__ << " failed to open " << p << ": " << cpp_strerror(r)
+	 << dendl;
+    delete bdev_fast;
+    bdev_fast = nullptr;
+    return r;
+  }
+  uint64_t reserved = p2roundup<uint64_t>(BDEV_LABEL_BLOCK_SIZE, min_alloc_size);
+  uint64_t size = p2align(bdev_fast->get_size(), (uint64_t)min_alloc_size);
+  if (bdev_fast->supported_bdev_label()) {
+    r = _check_or_set_bdev_label(bdev_fast, p, "bluestore fast tier", create);
+    if (r < 0) {
+      goto out_close;
+    }
+  }
+  if (min_alloc_size % bdev_fast->get_block_size() != 0 || size <= reserved) {
+    derr << __func__ << " " << p << " with block size 0x" << std::hex
+	 << bdev_fast->get_block_size() << " and size 0x" << size
+	 << " does not fit min_alloc_size 0x" << min_alloc_size << std::dec
+	 << dendl;
+    r = -EINVAL;
+    goto out_close;
+  }
+
+  fast_fm = FreelistManager::create(cct, "bitmap", PREFIX_FAST_ALLOC);
+  ceph_assert(fast_fm);
+  if (create) {
+    fast_fm->create(bdev_fast->get_size(), min_alloc_size, t);
+    fast_fm->allocate(0, reserved, t);
+  } else {
+    // unlike the main freelist all of its meta lives in the db
+    r = fast_fm->init(db, read_only,
+      [](const std::string&, std::string*) { return -ENOENT; });
+    if (r < 0) {
+      derr << __func__ << " freelist: " << cpp_strerror(r) << dendl;
+      goto out_fm;
+    }
+  }
+
+  fast_alloc = Allocator::create(
+    cct, cct->_conf->bluestore_allocator,
+    size,
+    min_alloc_size,
+    "fast");
+  if (!fast_alloc) {
+    derr << __func__ << " failed to create " << cct->_conf->bluestore_allocator
+	 << " allocator" << dendl;
+    r = -EINVAL;
+    goto out_fm;
+  }
+  if (create) {
+    fast_alloc->init_add_free(reserved, size - reserved);
+  } else {
+    uint64_t offset, length;
+    fast_fm->enumerate_reset();
+    while (fast_fm->enumerate_next(db, &offset, &length)) {
+      fast_alloc->init_add_free(offset, length);
+    }
+    fast_fm->enumerate_reset();
+  }
+  dout(1) << __func__ << " " << p << std::hex
+	  << " size 0x" << size
+	  << " free 0x" << fast_alloc->get_free()
+	  << std::dec << dendl;
+  return 0;
+
+ out_fm:
+  fast_fm->shutdown();
+  delete fast_fm;
+  fast_fm = nullptr;
+ out_close:
+  bdev_fast->close();
+  delete bdev_fast;
+  bdev_fast = nullptr;
+  return r;
+}
+
+void BlueStore::_close_fast_tier()
+{
+  if (fast_alloc) {
+    fast_alloc->shutdown();
+    delete fast_alloc;
+    fast_alloc = nullptr;
+  }
+  if (fast_fm) {
+    fast_fm->shutdown();
+    delete fast_fm;
+    fast_fm = nullptr;
+  }
+  if (bdev_fast) {
+    bdev_fast->close();
+    delete bdev_fast;
+    bdev_fast = nullptr;
+  }
+}
+
 int BlueStore::_open_fsid(bool create)
 {
   ceph_assert(fsid_fd < 0);
@@ -8048,6 +8759,10 @@ int BlueStore::_open_db_and_around(bool read_only, bool to_repair)
   if (r < 0)
     goto out_fm;
 
+  r = _open_fast_tier(nullptr, read_only);
+  if (r < 0)
+    goto out_alloc;
+
   if (bdev_label_multi) {
     _main_bdev_label_try_reserve();
   }
@@ -8093,6 +8808,7 @@ int BlueStore::_open_db_and_around(bool read_only, bool to_repair)
   return 0;
 
 out_alloc:
+  _close_fast_tier();
   _close_alloc();
 out_fm:
   _close_fm();
@@ -8120,6 +8836,7 @@ void BlueStore::_close_around_db()
   if (bluefs) {
     _close_bluefs();
   }
+  _close_fast_tier();
   _close_fm();
   _close_alloc();
   _close_bdev();
@@ -8762,6 +9479,12 @@ int BlueStore::mkfs()
     if (r < 0)
       goto out_close_fsid;
   }
+  r = _setup_block_symlink_or_file("block.fast",
+    cct->_conf.get_val<std::string>("bluestore_block_fast_path"),
+    cct->_conf.get_val<Option::size_t>("bluestore_block_fast_size"),
+    cct->_conf.get_val<bool>("bluestore_block_fast_create"));
+  if (r < 0)
+    goto out_close_fsid;
 
   r = _open_bdev(true);
   if (r < 0)
@@ -8871,6 +9594,9 @@ int BlueStore::mkfs()
     r = _open_fm(t, false, true);
     if (r < 0)
       goto out_close_db;
+    r = _open_fast_tier(t, false);
+    if (r < 0)
+      goto out_close_fm;
     {
       bufferlist bl;
       encode((uint64_t)0, bl);
@@ -8920,6 +9646,7 @@ int BlueStore::mkfs()
   }
 
  out_close_fm:
+  _close_fast_tier();
   _close_fm();
  out_close_db:
   _close_db();
@@ -9643,6 +10370,7 @@ int BlueStore::_mount()
     }
   }
   debug_extent_map_encode_check = cct->_conf.get_val<bool>("bluestore_debug_extent_map_encode_check");
+  extent_map_columnar = cct->_conf.get_val<bool>("bluestore_extent_map_columnar");
   _kv_only = false;
   if (cct->_conf->bluestore_fsck_on_mount) {
     int rc = fsck(cct->_conf->bluestore_fsck_on_mount_deep);
@@ -9725,6 +10453,8 @@ int BlueStore::_mount()
     bluefs->spillover_cleaner_start();
   }
 
+  _start_onode_warmup();
+
   mounted = true;
   return 0;
 }
@@ -9738,6 +10468,10 @@ int BlueStore::umount()
   if (bluefs) {
     bluefs->spillover_cleaner_stop();
   }
+  if (!_kv_only) {
+    _stop_onode_warmup();
+    _save_onode_warmup();
+  }
 
   mounted = false;
 
@@ -9814,6 +10548,7 @@ int BlueStore::_fsck_check_extents(
   const PExtentVector& extents,
   bool compressed,
   mempool_dynamic_bitset &used_blocks,
+  mempool_dynamic_bitset *fast_used_blocks,
   uint64_t granularity,
   BlueStoreRepairer* repairer,
   store_statfs_t& expected_statfs,
@@ -9830,6 +10565,40 @@ int BlueStore::_fsck_check_extents(
     if (compressed) {
       expected_statfs.data_compressed_allocated += e.length;
     }
+    if (e.is_fast_tier()) {
+      // the fast tier has a freelist of its own, checked against
+      // fast_used_blocks at the end of fsck
+      if (depth == FSCK_SHALLOW) {
+	continue;
+      }
+      if (!bdev_fast ||
+	  e.end() > BLUESTORE_FAST_TIER_BASE + bdev_fast->get_size()) {
+	derr << "fsck error:  " << ctx_descr << ", extent " << e
+	     << " past end of fast tier device" << dendl;
+	++errors;
+	continue;
+      }
+      ceph_assert(fast_used_blocks);
+      bool already = false;
+      apply_for_bitset_range(
+	e.offset - BLUESTORE_FAST_TIER_BASE, e.length,
+	fast_fm->get_alloc_size(), *fast_used_blocks,
+	[&](uint64_t pos, mempool_dynamic_bitset &bs) {
+	  if (bs.test(pos)) {
+	    // misreferences are not repaired on the fast tier
+	    if (!already) {
+	      derr << __func__ << "::fsck error: " << ctx_descr << ", extent "
+		   << e << " or a subset is already allocated on the fast tier"
+		   << " (misreferenced)" << dendl;
+	      ++errors;
+	      already = true;
+	    }
+	  } else {
+	    bs.set(pos);
+	  }
+	});
+      continue;
+    }
     if (depth != FSCK_SHALLOW) {
       bool already = false;
       apply_for_bitset_range(
@@ -10301,15 +11070,22 @@ BlueStore::OnodeRef BlueStore::fsck_check_objects_shallow(
     } else if (depth != FSCK_SHALLOW) {
       ceph_assert(used_blocks);
       string ctx_descr = " oid " + stringify(oid);
+      if (ctx.used_lock) {
+        ctx.used_lock->lock();
+      }
       errors += _fsck_check_extents(ctx_descr,
 	blob.get_extents(),
         blob.is_compressed(),
         *used_blocks,
+        ctx.fast_used_blocks,
         fm->get_alloc_size(),
         repairer,
         *res_statfs,
         *pool_fsck_stat,
         depth);
+      if (ctx.used_lock) {
+        ctx.used_lock->unlock();
+      }
     } else {
       errors += _fsck_sum_extents(
         blob.get_extents(),
@@ -10360,10 +11136,187 @@ BlueStore::OnodeRef BlueStore::fsck_check_objects_shallow(
   return o;
 }
 
-class ShallowFSCKThreadPool : public ThreadPool
+void BlueStore::fsck_check_object(
+  BlueStore::FSCKDepth depth,
+  int64_t pool_id,
+  BlueStore::CollectionRef c,
+  const ghobject_t& oid,
+  const string& key,
+  const bufferlist& value,
+  const mempool::bluestore_fsck::list<string>& shard_keys,
+  BlueStore::FSCK_ObjectCtx& ctx)
 {
-public:
-  ShallowFSCKThreadPool(CephContext* cct_, std::string nm, std::string tn, int n) :
+  if (depth == FSCK_SHALLOW) {
+    fsck_check_objects_shallow(
+      depth,
+      pool_id,
+      c,
+      oid,
+      key,
+      value,
+      nullptr, // expecting_shards
+      nullptr, // referenced
+      ctx);
+    return;
+  }
+  auto& errors = ctx.errors;
+  auto repairer = ctx.repairer;
+
+  mempool::bluestore_fsck::list<string> expecting_shards;
+  map<BlobRef, bluestore_blob_t::unused_t> referenced;
+  OnodeRef o = fsck_check_objects_shallow(
+    depth,
+    pool_id,
+    c,
+    oid,
+    key,
+    value,
+    &expecting_shards,
+    &referenced,
+    ctx);
+  ceph_assert(o != nullptr);
+
+  // both lists are in key order
+  auto e = expecting_shards.begin();
+  auto s = shard_keys.begin();
+  while (e != expecting_shards.end() || s != shard_keys.end()) {
+    if (s == shard_keys.end() ||
+        (e != expecting_shards.end() && *e < *s)) {
+      derr << "fsck error: missing shard key "
+        << pretty_binary_string(*e) << dendl;
+      ++errors;
+      ++e;
+    } else if (e == expecting_shards.end() || *s < *e) {
+      uint32_t offset;
+      string okey;
+      get_key_extent_shard(*s, &okey, &offset);
+      derr << "fsck error: " << oid << " stray shard 0x" << std::hex << offset
+        << std::dec << dendl;
+      ++errors;
+      if (repairer) {
+        repairer->remove_key(db, PREFIX_OBJ, *s);
+      }
+      ++s;
+    } else {
+      // all good
+      ++e;
+      ++s;
+    }
+  }
+
+  if (o->onode.nid) {
+    if (o->onode.nid > nid_max) {
+      derr << "fsck error: " << oid << " nid " << o->onode.nid
+        << " > nid_max " << nid_max << dendl;
+      ++errors;
+    }
+    ceph_assert(ctx.used_nids);
+    bool in_use = false;
+    if (ctx.used_lock) {
+      ctx.used_lock->lock();
+    }
+    if (ctx.used_nids->count(o->onode.nid)) {
+      in_use = true;
+    } else {
+      ctx.used_nids->insert(o->onode.nid);
+    }
+    if (ctx.used_lock) {
+      ctx.used_lock->unlock();
+    }
+    if (in_use) {
+      derr << "fsck error: " << oid << " nid " << o->onode.nid
+        << " already in use" << dendl;
+      ++errors;
+      return; // go for next object
+    }
+  }
+  for (auto& i : referenced) {
+    dout(20) << __func__ << "  referenced 0x" << std::hex << i.second
+      << std::dec << " for " << *i.first << dendl;
+    const bluestore_blob_t& blob = i.first->get_blob();
+    if (i.second & blob.unused) {
+      derr << "fsck error: " << oid << " blob claims unused 0x"
+        << std::hex << blob.unused
+        << " but extents reference 0x" << i.second << std::dec
+        << " on blob " << *i.first << dendl;
+      ++errors;
+    }
+    if (blob.has_csum()) {
+      uint64_t blob_len = blob.get_logical_length();
+      uint64_t unused_chunk_size = blob_len / (sizeof(blob.unused) * 8);
+      unsigned csum_count = blob.get_csum_count();
+      unsigned csum_chunk_size = blob.get_csum_chunk_size();
+      for (unsigned p = 0; p < csum_count; ++p) {
+        unsigned pos = p * csum_chunk_size;
+        unsigned firstbit = pos / unused_chunk_size;    // [firstbit,lastbit]
+        unsigned lastbit = (pos + csum_chunk_size - 1) / unused_chunk_size;
+        unsigned mask = 1u << firstbit;
+        for (unsigned b = firstbit + 1; b <= lastbit; ++b) {
+          mask |= 1u << b;
+        }
+        if ((blob.unused & mask) == mask) {
+          // this csum chunk region is marked unused
+          if (blob.get_csum_item(p) != 0) {
+            derr << "fsck error: " << oid
+              << " blob claims csum chunk 0x" << std::hex << pos
+              << "~" << csum_chunk_size
+              << " is unused (mask 0x" << mask << " of unused 0x"
+              << blob.unused << ") but csum is non-zero 0x"
+              << blob.get_csum_item(p) << std::dec << " on blob "
+              << *i.first << dendl;
+            ++errors;
+          }
+        }
+      }
+    }
+  }
+  // omap
+  if (o->onode.has_omap()) {
+    ceph_assert(ctx.used_omap_head);
+    bool in_use = false;
+    if (ctx.used_lock) {
+      ctx.used_lock->lock();
+    }
+    if (ctx.used_omap_head->count(o->onode.nid)) {
+      in_use = true;
+    } else {
+      ctx.used_omap_head->insert(o->onode.nid);
+    }
+    if (ctx.used_lock) {
+      ctx.used_lock->unlock();
+    }
+    if (in_use) {
+      derr << "fsck error: " << o->oid << " omap_head " << o->onode.nid
+           << " already in use" << dendl;
+      ++errors;
+    }
+  } // if (o->onode.has_omap())
+  if (depth == FSCK_DEEP) {
+    bufferlist bl;
+    uint64_t max_read_block = cct->_conf->bluestore_fsck_read_bytes_cap;
+    uint64_t offset = 0;
+    do {
+      uint64_t l = std::min(uint64_t(o->onode.size - offset), max_read_block);
+      int r = _do_read(c.get(), o, offset, l, bl,
+        CEPH_OSD_OP_FLAG_FADVISE_NOCACHE);
+      if (r < 0) {
+        ++errors;
+        derr << "fsck error: " << oid << std::hex
+          << " error during read: "
+          << " " << offset << "~" << l
+          << " " << cpp_strerror(r) << std::dec
+          << dendl;
+        break;
+      }
+      offset += l;
+    } while (offset < o->onode.size);
+  } // deep
+}
+
+class FSCKThreadPool : public ThreadPool
+{
+public:
+  FSCKThreadPool(CephContext* cct_, std::string nm, std::string tn, int n) :
     ThreadPool(cct_, nm, tn, n) {
   }
   void worker(ThreadPool::WorkThread* wt) override {
@@ -10390,6 +11343,7 @@ public:
       ghobject_t oid;
       string key;
       bufferlist value;
+      mempool::bluestore_fsck::list<string> shard_keys;
     };
     struct Batch {
       std::atomic<size_t> running = { 0 };
@@ -10410,12 +11364,20 @@ public:
 
     size_t batchCount;
     BlueStore* store = nullptr;
+    BlueStore::FSCKDepth depth;
 
     ceph::mutex* sb_info_lock = nullptr;
     sb_info_space_efficient_map_t* sb_info = nullptr;
     shared_blob_2hash_tracker_t* sb_ref_counts = nullptr;
     BlueStoreRepairer* repairer = nullptr;
 
+    // shared between batches, regular and deep fsck only
+    mempool_dynamic_bitset* used_blocks = nullptr;
+    BlueStore::uint64_t_btree_t* used_omap_head = nullptr;
+    BlueStore::uint64_t_btree_t* used_nids = nullptr;
+    mempool_dynamic_bitset* fast_used_blocks = nullptr;
+    ceph::mutex* used_lock = nullptr;
+
     Batch* batches = nullptr;
     size_t last_batch_pos = 0;
     bool batch_acquired = false;
@@ -10423,18 +11385,24 @@ public:
     FSCKWorkQueue(std::string n,
                   size_t _batchCount,
                   BlueStore* _store,
-                  ceph::mutex* _sb_info_lock,
-                  sb_info_space_efficient_map_t& _sb_info,
-		  shared_blob_2hash_tracker_t& _sb_ref_counts,
-                  BlueStoreRepairer* _repairer) :
+                  BlueStore::FSCKDepth _depth,
+                  const BlueStore::FSCK_ObjectCtx& ctx) :
       WorkQueue_(n, ceph::timespan::zero(), ceph::timespan::zero()),
       batchCount(_batchCount),
       store(_store),
-      sb_info_lock(_sb_info_lock),
-      sb_info(&_sb_info),
-      sb_ref_counts(&_sb_ref_counts),
-      repairer(_repairer)
+      depth(_depth),
+      sb_info_lock(ctx.sb_info_lock),
+      sb_info(&ctx.sb_info),
+      sb_ref_counts(&ctx.sb_ref_counts),
+      repairer(ctx.repairer)
     {
+      if (depth != BlueStore::FSCK_SHALLOW) {
+        used_blocks = ctx.used_blocks;
+        used_omap_head = ctx.used_omap_head;
+        used_nids = ctx.used_nids;
+        fast_used_blocks = ctx.fast_used_blocks;
+        used_lock = ctx.used_lock;
+      }
       batches = new Batch[batchCount];
     }
     ~FSCKWorkQueue() {
@@ -10481,8 +11449,8 @@ public:
         batch->num_blobs,
         batch->num_sharded_objects,
         batch->num_spanning_blobs,
-        nullptr, // used_blocks
-        nullptr, //used_omap_head
+        used_blocks,
+        used_omap_head,
 	nullptr,
         sb_info_lock,
         *sb_info,
@@ -10491,19 +11459,21 @@ public:
         batch->expected_pool_statfs,
         batch->per_pool_fsck_stats,
         repairer);
+      ctx.used_nids = used_nids;
+      ctx.fast_used_blocks = fast_used_blocks;
+      ctx.used_lock = used_lock;
 
       for (size_t i = 0; i < batch->entry_count; i++) {
         auto& entry = batch->entries[i];
 
-        store->fsck_check_objects_shallow(
-          BlueStore::FSCK_SHALLOW,
+        store->fsck_check_object(
+          depth,
           entry.pool_id,
           entry.c,
           entry.oid,
           entry.key,
           entry.value,
-          nullptr, // expecting_shards - this will need a protection if passed
-          nullptr, // referenced
+          entry.shard_keys,
           ctx);
       }
       batch->entry_count = 0;
@@ -10522,7 +11492,8 @@ public:
       BlueStore::CollectionRef c,
       const ghobject_t& oid,
       const string& key,
-      const bufferlist& value) {
+      const bufferlist& value,
+      mempool::bluestore_fsck::list<string>&& shard_keys) {
       bool res = false;
       size_t pos0 = last_batch_pos;
       if (!batch_acquired) {
@@ -10550,6 +11521,7 @@ public:
         entry.oid = oid;
         entry.key = key;
         entry.value = value;
+        entry.shard_keys = std::move(shard_keys);
 
         ++batch.entry_count;
         if (batch.entry_count == BatchLen) {
@@ -10765,38 +11737,83 @@ void BlueStore::_fsck_check_objects(
 {
   auto& errors = ctx.errors;
   auto sb_info_lock = ctx.sb_info_lock;
-  auto& sb_info = ctx.sb_info;
-  auto& sb_ref_counts = ctx.sb_ref_counts;
   auto repairer = ctx.repairer;
 
   uint64_t_btree_t used_nids;
+  ceph::mutex used_lock = ceph::make_mutex("BlueStore::fsck::used_lock");
 
   size_t processed_myself = 0;
 
   auto it = db->get_iterator(PREFIX_OBJ, KeyValueDB::ITERATOR_NOCACHE);
-  mempool::bluestore_fsck::list<string> expecting_shards;
   if (it) {
-    const size_t thread_count = cct->_conf->bluestore_fsck_quick_fix_threads;
-    typedef ShallowFSCKThreadPool::FSCKWorkQueue<256> WQ;
+    const size_t thread_count = depth == FSCK_SHALLOW ?
+      cct->_conf->bluestore_fsck_quick_fix_threads :
+      cct->_conf->bluestore_fsck_threads;
+    if (depth != FSCK_SHALLOW) {
+      ctx.used_nids = &used_nids;
+      if (thread_count > 0) {
+        ctx.used_lock = &used_lock;
+      }
+    }
+    typedef FSCKThreadPool::FSCKWorkQueue<256> WQ;
     std::unique_ptr<WQ> wq(
       new WQ(
         "FSCKWorkQueue",
         (thread_count ? : 1) * 32,
         this,
-        sb_info_lock,
-        sb_info,
-	sb_ref_counts,
-        repairer));
+        depth,
+        ctx));
 
-    ShallowFSCKThreadPool thread_pool(cct, "ShallowFSCKThreadPool", "ShallowFSCK", thread_count);
+    FSCKThreadPool thread_pool(cct, "FSCKThreadPool", "FSCK", thread_count);
 
     thread_pool.add_work_queue(wq.get());
-    if (depth == FSCK_SHALLOW && thread_count > 0) {
+    if (thread_count > 0) {
       //not the best place but let's check anyway
       ceph_assert(sb_info_lock);
       thread_pool.start();
     }
 
+    // An object is checked once all its extent shard keys, which follow
+    // the onode key, have been collected. Until then it is kept here.
+    struct {
+      bool valid = false;
+      int64_t pool_id = -1;
+      CollectionRef c;
+      ghobject_t oid;
+      string key;
+      bufferlist value;
+      mempool::bluestore_fsck::list<string> shard_keys;
+    } pending;
+    auto dispatch_pending = [&]() {
+      if (!pending.valid) {
+        return;
+      }
+      pending.valid = false;
+      bool queued = false;
+      if (thread_count > 0) {
+        queued = wq->queue(
+          pending.pool_id,
+          pending.c,
+          pending.oid,
+          pending.key,
+          pending.value,
+          std::move(pending.shard_keys));
+      }
+      if (!queued) {
+        ++processed_myself;
+        fsck_check_object(
+          depth,
+          pending.pool_id,
+          pending.c,
+          pending.oid,
+          pending.key,
+          pending.value,
+          pending.shard_keys,
+          ctx);
+      }
+      pending.shard_keys.clear();
+    };
+
     // fill global if not overriden below
     CollectionRef c;
     int64_t pool_id = -1;
@@ -10808,48 +11825,26 @@ void BlueStore::_fsck_check_objects(
         if (depth == FSCK_SHALLOW) {
           continue;
         }
-        while (!expecting_shards.empty() &&
-          expecting_shards.front() < it->key()) {
-          derr << "fsck error: missing shard key "
-            << pretty_binary_string(expecting_shards.front())
-            << dendl;
-          ++errors;
-          expecting_shards.pop_front();
-        }
-        if (!expecting_shards.empty() &&
-          expecting_shards.front() == it->key()) {
-          // all good
-          expecting_shards.pop_front();
-          continue;
-        }
-
         uint32_t offset;
         string okey;
         get_key_extent_shard(it->key(), &okey, &offset);
-        derr << "fsck error: stray shard 0x" << std::hex << offset
-          << std::dec << dendl;
-        if (expecting_shards.empty()) {
-          derr << "fsck error: " << pretty_binary_string(it->key())
-            << " is unexpected" << dendl;
-          ++errors;
-          if (repairer) {
-            repairer->remove_key(db, PREFIX_OBJ, it->key());
-          }
+        if (pending.valid && okey == pending.key) {
+          pending.shard_keys.push_back(it->key());
           continue;
         }
-        if (expecting_shards.front() > it->key()) {
-          derr << "fsck error:   saw " << pretty_binary_string(it->key())
-            << dendl;
-          derr << "fsck error:   exp "
-            << pretty_binary_string(expecting_shards.front()) << dendl;
-          ++errors;
-          if (repairer) {
-            repairer->remove_key(db, PREFIX_OBJ, it->key());
-          }
+        derr << "fsck error: stray shard 0x" << std::hex << offset
+          << std::dec << dendl;
+        derr << "fsck error: " << pretty_binary_string(it->key())
+          << " is unexpected" << dendl;
+        ++errors;
+        if (repairer) {
+          repairer->remove_key(db, PREFIX_OBJ, it->key());
         }
         continue;
       }
 
+      dispatch_pending();
+
       ghobject_t oid;
       int r = get_key_object(it->key(), &oid);
       if (r < 0) {
@@ -10880,132 +11875,15 @@ void BlueStore::_fsck_check_objects(
           << dendl;
       }
 
-      if (depth != FSCK_SHALLOW &&
-        !expecting_shards.empty()) {
-        for (auto& k : expecting_shards) {
-          derr << "fsck error: missing shard key "
-            << pretty_binary_string(k) << dendl;
-        }
-        ++errors;
-        expecting_shards.clear();
-      }
-
-      bool queued = false;
-      if (depth == FSCK_SHALLOW && thread_count > 0) {
-        queued = wq->queue(
-          pool_id,
-          c,
-          oid,
-          it->key(),
-          it->value());
-      }
-      OnodeRef o;
-      map<BlobRef, bluestore_blob_t::unused_t> referenced;
-
-      if (!queued) {
-        ++processed_myself;
-         o = fsck_check_objects_shallow(
-          depth,
-          pool_id,
-          c,
-          oid,
-          it->key(),
-          it->value(),
-          &expecting_shards,
-          &referenced,
-          ctx);
-      }
-
-      if (depth != FSCK_SHALLOW) {
-        ceph_assert(o != nullptr);
-        if (o->onode.nid) {
-          if (o->onode.nid > nid_max) {
-            derr << "fsck error: " << oid << " nid " << o->onode.nid
-              << " > nid_max " << nid_max << dendl;
-            ++errors;
-          }
-          if (used_nids.count(o->onode.nid)) {
-            derr << "fsck error: " << oid << " nid " << o->onode.nid
-              << " already in use" << dendl;
-            ++errors;
-            continue; // go for next object
-          }
-          used_nids.insert(o->onode.nid);
-        }
-        for (auto& i : referenced) {
-          dout(20) << __func__ << "  referenced 0x" << std::hex << i.second
-            << std::dec << " for " << *i.first << dendl;
-          const bluestore_blob_t& blob = i.first->get_blob();
-          if (i.second & blob.unused) {
-            derr << "fsck error: " << oid << " blob claims unused 0x"
-              << std::hex << blob.unused
-              << " but extents reference 0x" << i.second << std::dec
-              << " on blob " << *i.first << dendl;
-            ++errors;
-          }
-          if (blob.has_csum()) {
-            uint64_t blob_len = blob.get_logical_length();
-            uint64_t unused_chunk_size = blob_len / (sizeof(blob.unused) * 8);
-            unsigned csum_count = blob.get_csum_count();
-            unsigned csum_chunk_size = blob.get_csum_chunk_size();
-            for (unsigned p = 0; p < csum_count; ++p) {
-              unsigned pos = p * csum_chunk_size;
-              unsigned firstbit = pos / unused_chunk_size;    // [firstbit,lastbit]
-              unsigned lastbit = (pos + csum_chunk_size - 1) / unused_chunk_size;
-              unsigned mask = 1u << firstbit;
-              for (unsigned b = firstbit + 1; b <= lastbit; ++b) {
-                mask |= 1u << b;
-              }
-              if ((blob.unused & mask) == mask) {
-                // this csum chunk region is marked unused
-                if (blob.get_csum_item(p) != 0) {
-                  derr << "fsck error: " << oid
-                    << " blob claims csum chunk 0x" << std::hex << pos
-                    << "~" << csum_chunk_size
-                    << " is unused (mask 0x" << mask << " of unused 0x"
-                    << blob.unused << ") but csum is non-zero 0x"
-                    << blob.get_csum_item(p) << std::dec << " on blob "
-                    << *i.first << dendl;
-                  ++errors;
-                }
-              }
-            }
-          }
-        }
-        // omap
-        if (o->onode.has_omap()) {
-          ceph_assert(ctx.used_omap_head);
-          if (ctx.used_omap_head->count(o->onode.nid)) {
-            derr << "fsck error: " << o->oid << " omap_head " << o->onode.nid
-                 << " already in use" << dendl;
-            ++errors;
-          } else {
-            ctx.used_omap_head->insert(o->onode.nid);
-          }
-        } // if (o->onode.has_omap())
-        if (depth == FSCK_DEEP) {
-          bufferlist bl;
-          uint64_t max_read_block = cct->_conf->bluestore_fsck_read_bytes_cap;
-          uint64_t offset = 0;
-          do {
-            uint64_t l = std::min(uint64_t(o->onode.size - offset), max_read_block);
-            int r = _do_read(c.get(), o, offset, l, bl,
-              CEPH_OSD_OP_FLAG_FADVISE_NOCACHE);
-            if (r < 0) {
-              ++errors;
-              derr << "fsck error: " << oid << std::hex
-                << " error during read: "
-                << " " << offset << "~" << l
-                << " " << cpp_strerror(r) << std::dec
-                << dendl;
-              break;
-            }
-            offset += l;
-          } while (offset < o->onode.size);
-        } // deep
-      } //if (depth != FSCK_SHALLOW)
+      pending.valid = true;
+      pending.pool_id = pool_id;
+      pending.c = c;
+      pending.oid = oid;
+      pending.key = it->key();
+      pending.value = it->value();
     } // for (it->lower_bound(string()); it->valid(); it->next())
-    if (depth == FSCK_SHALLOW && thread_count > 0) {
+    dispatch_pending();
+    if (thread_count > 0) {
       wq->finalize(thread_pool, ctx);
       if (processed_myself) {
         // may be needs more threads?
@@ -11017,6 +11895,8 @@ void BlueStore::_fsck_check_objects(
       }
     }
   } // if (it)
+  ctx.used_nids = nullptr;
+  ctx.used_lock = nullptr;
 }
 /**
 An overview for currently implemented repair logics 
@@ -11146,6 +12026,7 @@ int BlueStore::_fsck_on_open(BlueStore::FSCKDepth depth, bool repair, bluestore_
   uint64_t_btree_t used_sbids;
 
   mempool_dynamic_bitset used_blocks, bluefs_used_blocks;
+  mempool_dynamic_bitset fast_used_blocks;
   KeyValueDB::Iterator it;
   store_statfs_t expected_store_statfs;
   per_pool_statfs expected_pool_statfs;
@@ -11208,6 +12089,16 @@ int BlueStore::_fsck_on_open(BlueStore::FSCKDepth depth, bool repair, bluestore_
 
   _fsck_collections(&errors);
   used_blocks.resize(fm->get_alloc_units());
+  if (fast_fm) {
+    fast_used_blocks.resize(fast_fm->get_alloc_units());
+    // the label at the start of block.fast, see _open_fast_tier()
+    apply_for_bitset_range(
+      0, p2roundup<uint64_t>(BDEV_LABEL_BLOCK_SIZE, min_alloc_size),
+      fast_fm->get_alloc_size(), fast_used_blocks,
+      [&](uint64_t pos, mempool_dynamic_bitset &bs) {
+	bs.set(pos);
+      });
+  }
 
   if (bluefs) {
     interval_set<uint64_t> bluefs_extents;
@@ -11369,15 +12260,16 @@ int BlueStore::_fsck_on_open(BlueStore::FSCKDepth depth, bool repair, bluestore_
       &used_blocks,
       &used_omap_head,
       &zone_refs,
-      //no need for the below lock when in non-shallow mode as
-      // there is no multithreading in this case
-      depth == FSCK_SHALLOW ? &sb_info_lock : nullptr,
+      &sb_info_lock,
       sb_info,
       sb_ref_counts,
       expected_store_statfs,
       expected_pool_statfs,
       per_pool_fsck_stats,
       repair ? &repairer : nullptr);
+    if (fast_fm && depth != FSCK_SHALLOW) {
+      ctx.fast_used_blocks = &fast_used_blocks;
+    }
 
     _fsck_check_objects(depth, ctx);
   }
@@ -11488,6 +12380,7 @@ int BlueStore::_fsck_on_open(BlueStore::FSCKDepth depth, bool repair, bluestore_
 	  extents,
 	  sbi.allocated_chunks < 0,
 	  used_blocks,
+	  &fast_used_blocks,
 	  fm->get_alloc_size(),
 	  repair ? &repairer : nullptr,
 	  *expected_statfs,
@@ -11943,6 +12836,62 @@ int BlueStore::_fsck_on_open(BlueStore::FSCKDepth depth, bool repair, bluestore_
         used_blocks.flip();
       }
     }
+
+    if (fast_fm) {
+      dout(1) << __func__ << " checking fast tier freelist vs allocated"
+	      << dendl;
+      uint64_t fast_alloc_size = fast_fm->get_alloc_size();
+      fast_fm->enumerate_reset();
+      uint64_t offset, length;
+      while (fast_fm->enumerate_next(db, &offset, &length)) {
+        bool intersects = false;
+        apply_for_bitset_range(
+          offset, length, fast_alloc_size, fast_used_blocks,
+          [&](uint64_t pos, mempool_dynamic_bitset &bs) {
+            ceph_assert(pos < bs.size());
+            if (bs.test(pos)) {
+              intersects = true;
+              if (repair) {
+                repairer.fix_false_free(db, fast_fm,
+                                        pos * fast_alloc_size,
+                                        fast_alloc_size);
+              }
+            } else {
+              bs.set(pos);
+            }
+          });
+        if (intersects) {
+          derr << "fsck error: free fast tier extent 0x" << std::hex << offset
+               << "~" << length << std::dec
+               << " intersects allocated blocks" << dendl;
+          ++errors;
+        }
+      }
+      fast_fm->enumerate_reset();
+
+      // check for leaked extents
+      fast_used_blocks.flip();
+      size_t start = fast_used_blocks.find_first();
+      while (start != decltype(fast_used_blocks)::npos) {
+        size_t cur = start;
+        size_t next;
+        while ((next = fast_used_blocks.find_next(cur)) == cur + 1) {
+          cur = next;
+        }
+        ++errors;
+        derr << "fsck error: leaked fast tier extent 0x" << std::hex
+             << ((uint64_t)start * fast_alloc_size) << "~"
+             << ((cur + 1 - start) * fast_alloc_size) << std::dec
+             << dendl;
+        if (repair) {
+          repairer.fix_leaked(db, fast_fm,
+                              start * fast_alloc_size,
+                              (cur + 1 - start) * fast_alloc_size);
+        }
+        start = next;
+      }
+      fast_used_blocks.flip();
+    }
   }
   if (repair) {
     if (per_pool_omap != OMAP_PER_PG) {
@@ -12476,6 +13425,11 @@ void BlueStore::_get_statfs_overall(struct store_statfs_t *buf)
   } else {
     buf->total += bdev->get_size();
   }
+  if (fast_alloc) {
+    // object data lives on one tier or the other, never on both
+    buf->total += bdev_fast->get_size();
+    bfree += fast_alloc->get_free();
+  }
   buf->available = bfree;
 
   logger->set(l_bluestore_omap, buf->omap_allocated);
@@ -12662,6 +13616,10 @@ void BlueStore::refresh_perf_counters()
   logger->set(l_bluestore_blobs, num_blobs);
   logger->set(l_bluestore_buffers, num_buffers);
   logger->set(l_bluestore_buffer_bytes, num_buffer_bytes);
+  if (fast_alloc) {
+    logger->set(l_bluestore_tier_fast_size, bdev_fast->get_size());
+    logger->set(l_bluestore_tier_fast_free, fast_alloc->get_free());
+  }
 }
 
 // ---------------
@@ -12859,6 +13817,9 @@ int BlueStore::read(
     if (offset == length && offset == 0)
       length = o->onode.size;
 
+    if (bdev_fast) {
+      _tier_heat(o.get(), true);
+    }
     r = _do_read(c, o, offset, length, bl, op_flags);
     if (r == -EIO) {
       logger->inc(l_bluestore_read_eio);
@@ -12968,7 +13929,7 @@ void BlueStore::_read_cache(
           regions2read_t& r2r = blobs2read[bptr];
           if (r2r.size()) {
             read_req_t& pre = r2r.back();
-            if (r_off <= (pre.r_off + pre.r_len)) {
+            if (pre.r_off <= r_off && r_off <= (pre.r_off + pre.r_len)) {
               front += (r_off - pre.r_off);
               pre.r_len += (r_off + r_len - pre.r_off - pre.r_len);
               pre.regs.emplace_back(region_t(pos, b_off, l, front));
@@ -12996,6 +13957,16 @@ int BlueStore::_prepare_read_ioc(
   vector<bufferlist>* compressed_blob_bls,
   IOContext* ioc)
 {
+  // device extents to fetch, in the order they get appended to their
+  // destination buffers
+  struct pextent_read_t {
+    uint64_t offset;
+    uint64_t length;
+    bufferlist* dest;
+    bufferlist bl;
+  };
+  vector<pextent_read_t> preads;
+
   for (auto& p : blobs2read) {
     const BlobRef& bptr = p.first;
     regions2read_t& r2r = p.second;
@@ -13009,22 +13980,12 @@ int BlueStore::_prepare_read_ioc(
       }
       compressed_blob_bls->push_back(bufferlist());
       bufferlist& bl = compressed_blob_bls->back();
-      auto r = bptr->get_blob().map(
+      bptr->get_blob().map(
         0, bptr->get_blob().get_ondisk_size(),
         [&](uint64_t offset, uint64_t length) {
-          int r = bdev->aio_read(offset, length, &bl, ioc);
-          if (r < 0)
-            return r;
+          preads.push_back({offset, length, &bl, {}});
           return 0;
         });
-      if (r < 0) {
-        derr << __func__ << " bdev-read failed: " << cpp_strerror(r) << dendl;
-        if (r == -EIO) {
-          // propagate EIO to caller
-          return r;
-        }
-        ceph_assert(r == 0);
-      }
     } else {
       // read the pieces
       for (auto& req : r2r) {
@@ -13034,25 +13995,70 @@ int BlueStore::_prepare_read_ioc(
                  << " reading 0x" << req.r_off
                  << "~" << req.r_len << std::dec
                  << dendl;
-
-        // read it
-        auto r = bptr->get_blob().map(
+        bptr->get_blob().map(
           req.r_off, req.r_len,
           [&](uint64_t offset, uint64_t length) {
-            int r = bdev->aio_read(offset, length, &req.bl, ioc);
-            if (r < 0)
-              return r;
+            preads.push_back({offset, length, &req.bl, {}});
             return 0;
           });
-        if (r < 0) {
-          derr << __func__ << " bdev-read failed: " << cpp_strerror(r)
-               << dendl;
-          if (r == -EIO) {
-            // propagate EIO to caller
-            return r;
-          }
-          ceph_assert(r == 0);
-        }
+      }
+    }
+  }
+
+  // issue device extents that are adjacent or overlapping (e.g. neighbour
+  // blobs, or several intervals of a readv) as a single IO; the pieces are
+  // carved out of the result with substr_of(), i.e. without copying.
+  vector<size_t> order(preads.size());
+  for (size_t i = 0; i < order.size(); ++i) {
+    order[i] = i;
+  }
+  std::sort(order.begin(), order.end(),
+    [&](size_t a, size_t b) {
+      return preads[a].offset < preads[b].offset;
+    });
+  for (size_t i = 0; i < order.size(); ) {
+    uint64_t run_off = preads[order[i]].offset;
+    uint64_t run_end = run_off + preads[order[i]].length;
+    size_t j = i + 1;
+    while (j < order.size() && preads[order[j]].offset <= run_end) {
+      run_end = std::max(run_end,
+                         preads[order[j]].offset + preads[order[j]].length);
+      ++j;
+    }
+    if (j - i > 1) {
+      dout(20) << __func__ << "    coalesced " << (j - i) << " extents into 0x"
+               << std::hex << run_off << "~" << (run_end - run_off)
+               << std::dec << dendl;
+    }
+    bufferlist run_bl;
+    int r;
+    if (run_off >= BLUESTORE_FAST_TIER_BASE) {
+      // the fast tier does not make it worth an aio round trip
+      r = bdev_fast->read(run_off - BLUESTORE_FAST_TIER_BASE,
+			  run_end - run_off, &run_bl, ioc, false);
+    } else {
+      r = bdev->aio_read(run_off, run_end - run_off, &run_bl, ioc);
+    }
+    if (r < 0) {
+      derr << __func__ << " bdev-read failed: " << cpp_strerror(r) << dendl;
+      if (r == -EIO) {
+        // propagate EIO to caller
+        return r;
+      }
+      ceph_assert(r == 0);
+    }
+    for (; i < j; ++i) {
+      auto& pr = preads[order[i]];
+      pr.bl.substr_of(run_bl, pr.offset - run_off, pr.length);
+    }
+  }
+  for (auto& pr : preads) {
+    pr.dest->claim_append(pr.bl);
+  }
+
+  for (auto& p : blobs2read) {
+    if (!p.first->get_blob().is_compressed()) {
+      for (auto& req : p.second) {
         ceph_assert(req.bl.length() == req.r_len);
       }
     }
@@ -13060,16 +14066,13 @@ int BlueStore::_prepare_read_ioc(
   return 0;
 }
 
-int BlueStore::_generate_read_result_bl(
+int BlueStore::_fill_ready_regions(
   OnodeRef& o,
-  uint64_t offset,
-  size_t length,
   ready_regions_t& ready_regions,
   vector<bufferlist>& compressed_blob_bls,
   blobs2read_t& blobs2read,
   bool buffered,
-  bool* csum_error,
-  bufferlist& bl)
+  bool* csum_error)
 {
  // enumerate and decompress desired blobs
   auto p = compressed_blob_bls.begin();
@@ -13126,9 +14129,16 @@ int BlueStore::_generate_read_result_bl(
     }
     ++b2r_it;
   }
+  return 0;
+}
 
-  // generate a resulting buffer
-  auto pr = ready_regions.begin();
+void BlueStore::_assemble_read_result(
+  ready_regions_t& ready_regions,
+  ready_regions_t::iterator& pr,
+  uint64_t offset,
+  size_t length,
+  bufferlist& bl)
+{
   auto pr_end = ready_regions.end();
   uint64_t pos = 0;
   while (pos < length) {
@@ -13141,7 +14151,7 @@ int BlueStore::_generate_read_result_bl(
       ++pr;
     } else {
       uint64_t l = length - pos;
-      if (pr != pr_end) {
+      if (pr != pr_end && pr->first < offset + length) {
         ceph_assert(pr->first > pos + offset);
         l = pr->first - (pos + offset);
       }
@@ -13152,9 +14162,31 @@ int BlueStore::_generate_read_result_bl(
       pos += l;
     }
   }
-  ceph_assert(bl.length() == length);
   ceph_assert(pos == length);
-  ceph_assert(pr == pr_end);
+}
+
+int BlueStore::_generate_read_result_bl(
+  OnodeRef& o,
+  uint64_t offset,
+  size_t length,
+  ready_regions_t& ready_regions,
+  vector<bufferlist>& compressed_blob_bls,
+  blobs2read_t& blobs2read,
+  bool buffered,
+  bool* csum_error,
+  bufferlist& bl)
+{
+  int r = _fill_ready_regions(o, ready_regions, compressed_blob_bls,
+                              blobs2read, buffered, csum_error);
+  if (r < 0) {
+    return r;
+  }
+
+  // generate a resulting buffer
+  auto pr = ready_regions.begin();
+  _assemble_read_result(ready_regions, pr, offset, length, bl);
+  ceph_assert(bl.length() == length);
+  ceph_assert(pr == ready_regions.end());
   return 0;
 }
 
@@ -13592,6 +14624,9 @@ int BlueStore::readv(
       goto out;
     }
 
+    if (bdev_fast) {
+      _tier_heat(o.get(), true);
+    }
     r = _do_readv(c, o, m, bl, op_flags);
     if (r == -EIO) {
       logger->inc(l_bluestore_read_eio);
@@ -13670,21 +14705,23 @@ int BlueStore::_do_readv(
     "", l_bluestore_slow_read_onode_meta_count);
   _dump_onode<30>(cct, *o);
 
+  // plan all intervals in one go: regions of the same blob coming from
+  // different intervals end up in one read request, and the device
+  // extents of all of them are coalesced by _prepare_read_ioc().
   IOContext ioc(cct, NULL, !cct->_conf->bluestore_fail_eio);
-  vector<std::tuple<ready_regions_t, vector<bufferlist>, blobs2read_t>> raw_results;
-  raw_results.reserve(m.num_intervals());
-  int i = 0;
-  for (auto p = m.begin(); p != m.end(); p++, i++) {
-    raw_results.push_back({});
+  ready_regions_t ready_regions;
+  vector<bufferlist> compressed_blob_bls;
+  blobs2read_t blobs2read;
+  for (auto p = m.begin(); p != m.end(); ++p) {
     _read_cache(o, p.get_start(), p.get_len(), read_cache_policy,
-                std::get<0>(raw_results[i]), std::get<2>(raw_results[i]));
-    r = _prepare_read_ioc(std::get<2>(raw_results[i]), &std::get<1>(raw_results[i]), &ioc);
-    // we always issue aio for reading, so errors other than EIO are not allowed
-    if (r < 0)
-      return r;
-    if (cct->_conf->bluestore_frag_runtime) {
-      _measure_runtime_frag(c, std::get<2>(raw_results[i]));
-    }
+                ready_regions, blobs2read);
+  }
+  r = _prepare_read_ioc(blobs2read, &compressed_blob_bls, &ioc);
+  // we always issue aio for reading, so errors other than EIO are not allowed
+  if (r < 0)
+    return r;
+  if (cct->_conf->bluestore_frag_runtime) {
+    _measure_runtime_frag(c, blobs2read);
   }
 
   auto num_ios = m.size();
@@ -13735,29 +14772,28 @@ int BlueStore::_do_readv(
     }
   }
 
-  ceph_assert(raw_results.size() == (size_t)m.num_intervals());
-  i = 0;
-  for (auto p = m.begin(); p != m.end(); p++, i++) {
-    bool csum_error = false;
-    bufferlist t;
-    r = _generate_read_result_bl(o, p.get_start(), p.get_len(),
-                                 std::get<0>(raw_results[i]),
-                                 std::get<1>(raw_results[i]),
-                                 std::get<2>(raw_results[i]),
-                                 buffered, &csum_error, t);
-    if (csum_error) {
-      // Handles spurious read errors caused by a kernel bug.
-      // We sometimes get all-zero pages as a result of the read under
-      // high memory pressure. Retrying the failing read succeeds in most
-      // cases.
-      // See also: http://tracker.ceph.com/issues/22464
-      if (retry_count >= cct->_conf->bluestore_retry_disk_reads) {
-        return -EIO;
-      }
-      return _do_readv(c, o, m, bl, op_flags, retry_count + 1);
+  bool csum_error = false;
+  r = _fill_ready_regions(o, ready_regions, compressed_blob_bls, blobs2read,
+                          buffered && !ioc.skip_cache(), &csum_error);
+  if (csum_error) {
+    // Handles spurious read errors caused by a kernel bug.
+    // We sometimes get all-zero pages as a result of the read under
+    // high memory pressure. Retrying the failing read succeeds in most
+    // cases.
+    // See also: http://tracker.ceph.com/issues/22464
+    if (retry_count >= cct->_conf->bluestore_retry_disk_reads) {
+      return -EIO;
     }
-    bl.claim_append(t);
+    return _do_readv(c, o, m, bl, op_flags, retry_count + 1);
   }
+  if (r < 0) {
+    return r;
+  }
+  auto pr = ready_regions.begin();
+  for (auto p = m.begin(); p != m.end(); ++p) {
+    _assemble_read_result(ready_regions, pr, p.get_start(), p.get_len(), bl);
+  }
+  ceph_assert(pr == ready_regions.end());
   if (retry_count) {
     logger->inc(l_bluestore_reads_with_retries);
     dout(5) << __func__ << " read fiemap " << m
@@ -14292,6 +15328,8 @@ int BlueStore::omap_iterate(
   std::string tail;
   std::string seek_key;
   std::string_view::size_type userkey_offset_in_dbkey;
+  std::string omap_prefix;
+  KeyValueDB::IteratorBounds omap_bounds;
   {
     std::shared_lock l(c->lock);
 
@@ -14319,10 +15357,23 @@ int BlueStore::omap_iterate(
       o->get_omap_tail(&upper_bound);
       bounds.lower_bound = std::move(lower_bound);
       bounds.upper_bound = std::move(upper_bound);
-      it = db->get_iterator(o->get_omap_prefix(), 0, std::move(bounds));
+      omap_prefix = o->get_omap_prefix();
+      omap_bounds = bounds;
+      it = db->get_iterator(omap_prefix, 0, std::move(bounds));
     }
   }
 
+  // Readahead only pays off for scans that really are long: the caller's
+  // limit is an upper bound, most listings end well before it. So start
+  // without it and move over to a prefetching iterator once enough keys
+  // have actually been visited and the caller is after a good deal more.
+  uint64_t prefetch_at = cct->_conf->bluestore_omap_prefetch_min_keys;
+  if (start_from.expected_count &&
+      start_from.expected_count < 2 * prefetch_at) {
+    prefetch_at = 0;
+  }
+  uint64_t visited = 0;
+
   // seek the iterator
   {
     auto start = ceph::mono_clock::now();
@@ -14358,7 +15409,14 @@ int BlueStore::omap_iterate(
       break;
     } else if (ret == omap_iter_ret_t::NEXT) {
       ceph::time_guard<ceph::mono_clock> measure_next{next_lat_acc};
-      it->next();
+      if (prefetch_at && ++visited == prefetch_at) {
+        std::string cur(db_key);
+        it = db->get_iterator(omap_prefix, KeyValueDB::ITERATOR_PREFETCH,
+                              KeyValueDB::IteratorBounds(omap_bounds));
+        it->upper_bound(cur);
+      } else {
+        it->next();
+      }
     } else {
       ceph_abort();
     }
@@ -14393,8 +15451,9 @@ void BlueStore::_prepare_ondisk_format_super(KeyValueDB::Transaction& t)
     t->set(PREFIX_SUPER, "ondisk_format", bl);
   }
   {
+    // an upgrade must not lower what the data written so far needs
     bufferlist bl;
-    encode(min_compat_ondisk_format, bl);
+    encode(std::max(min_compat_ondisk_format, ondisk_compat.load()), bl);
     t->set(PREFIX_SUPER, "min_compat_ondisk_format", bl);
   }
 }
@@ -14491,6 +15550,15 @@ int BlueStore::_open_super_meta()
 	 << latest_ondisk_format << dendl;
     return -EPERM;
   }
+  ondisk_compat = compat_ondisk_format;
+  {
+    // 5 was only ever written for the fast tier, later formats say so in
+    // a key of its own
+    bufferlist bl;
+    fast_tier_compat =
+      compat_ondisk_format == fast_tier_compat_ondisk_format ||
+      db->get(PREFIX_SUPER, "fast_tier_data", &bl) >= 0;
+  }
 
   {
     if(cct->_conf->bluestore_debug_enforce_min_alloc_size == 0) {
@@ -14528,6 +15596,7 @@ int BlueStore::_open_super_meta()
   _set_csum();
   _set_compression();
   _set_blob_size();
+  _set_tier_params();
   _update_allocator_lookup_policy();
 
   _validate_bdev();
@@ -14583,6 +15652,20 @@ int BlueStore::_upgrade_super()
       ceph_assert(r == 0);
       ondisk_format = 4;
     }
+    if (ondisk_format == 4) {
+      // changes:
+      // - pextents from BLUESTORE_FAST_TIER_BASE up address block.fast;
+      //   min_compat_ondisk_format is raised to 5 along with the first one
+      //   that is written, nothing changes before that
+      ondisk_format = 5;
+    }
+    if (ondisk_format == 5) {
+      // changes:
+      // - extent map shards may be encoded in the columnar v3 layout;
+      //   min_compat_ondisk_format is raised to 6 along with the first
+      //   onode written with bluestore_extent_map_columnar on
+      ondisk_format = 6;
+    }
     // This to be the last operation
     _prepare_ondisk_format_super(t);
     int r = db->submit_transaction_sync(t);
@@ -14650,7 +15733,7 @@ BlueStore::TransContext *BlueStore::_txc_create(
 void BlueStore::_txc_calc_cost(TransContext *txc)
 {
   // one "io" for the kv commit
-  auto ios = 1 + txc->ioc.get_num_ios();
+  auto ios = 1 + txc->ioc.get_num_ios() + txc->ioc_fast.get_num_ios();
   auto cost = throttle_cost_per_io.load();
   txc->cost = ios * cost + txc->bytes;
   txc->ios = ios;
@@ -14698,6 +15781,34 @@ void BlueStore::_txc_update_store_statfs(TransContext *txc)
   txc->statfs_delta.reset();
 }
 
+void BlueStore::wa_stats_t::dump(Formatter *f) const
+{
+  f->dump_unsigned("user_bytes", user_bytes);
+  f->dump_unsigned("device_bytes", device_bytes);
+  f->dump_unsigned("deferred_bytes", deferred_bytes);
+  f->dump_unsigned("kv_bytes", kv_bytes);
+  if (user_bytes) {
+    f->dump_float("write_amplification",
+		  (double)(device_bytes + kv_bytes) / user_bytes);
+  }
+}
+
+void BlueStore::_update_wa_stats(const std::map<uint64_t, wa_stats_t>& delta)
+{
+  wa_stats_t total;
+  for (auto& [pool, s] : delta) {
+    total += s;
+  }
+  logger->inc(l_bluestore_wa_user_bytes, total.user_bytes);
+  logger->inc(l_bluestore_wa_device_bytes, total.device_bytes);
+  logger->inc(l_bluestore_wa_deferred_bytes, total.deferred_bytes);
+  logger->inc(l_bluestore_wa_kv_bytes, total.kv_bytes);
+  std::lock_guard l(vstatfs_lock);
+  for (auto& [pool, s] : delta) {
+    osd_pools_wa[pool] += s;
+  }
+}
+
 void BlueStore::_txc_state_proc(TransContext *txc)
 {
   BLUE_SCOPE(txc_state_proc);
@@ -14707,7 +15818,7 @@ void BlueStore::_txc_state_proc(TransContext *txc)
     switch (txc->get_state()) {
     case TransContext::STATE_PREPARE:
       throttle.log_state_latency(*txc, logger, l_bluestore_state_prepare_lat);
-      if (txc->ioc.has_pending_aios()) {
+      if (txc->ioc.has_pending_aios() || txc->ioc_fast.has_pending_aios()) {
 	txc->set_state(TransContext::STATE_AIO_WAIT);
 #ifdef WITH_BLKIN
         if (txc->trace) {
@@ -14724,6 +15835,9 @@ void BlueStore::_txc_state_proc(TransContext *txc)
       {
 	mono_clock::duration lat = throttle.log_state_latency(
 	  *txc, logger, l_bluestore_state_aio_wait_lat);
+	if (txc->had_ios) {
+	  deferred_policy.note_direct(lat);
+	}
 	if (ceph::to_seconds<double>(lat) >= cct->_conf->bluestore_log_op_age) {
 	  logger->inc(l_bluestore_slow_aio_wait_count);
 	  dout(0) << __func__ << " slow aio_wait, txc = " << txc
@@ -14830,6 +15944,7 @@ void BlueStore::_txc_finish_io(TransContext *txc)
   std::lock_guard l(osr->qlock);
   txc->set_state(TransContext::STATE_IO_DONE);
   txc->ioc.release_running_aios();
+  txc->ioc_fast.release_running_aios();
   OpSequencer::q_list_t::iterator p = osr->q.iterator_to(*txc);
   while (p != osr->q.begin()) {
     --p;
@@ -14917,6 +16032,26 @@ void BlueStore::BSPerfTracker::update_from_perfcounters(
       l_bluestore_commit_lat));
 }
 
+// move the fast tier intervals of s to fast, device relative
+static void split_fast_tier(
+  interval_set<uint64_t>& s,
+  interval_set<uint64_t>* fast)
+{
+  if (s.empty() || s.range_end() <= BLUESTORE_FAST_TIER_BASE) {
+    return;
+  }
+  interval_set<uint64_t> rest;
+  for (auto p = s.begin(); p != s.end(); ++p) {
+    if (p.get_start() >= BLUESTORE_FAST_TIER_BASE) {
+      fast->insert(p.get_start() - BLUESTORE_FAST_TIER_BASE, p.get_len());
+    } else {
+      ceph_assert(p.get_end() <= BLUESTORE_FAST_TIER_BASE);
+      rest.insert(p.get_start(), p.get_len());
+    }
+  }
+  s.swap(rest);
+}
+
 void BlueStore::_txc_finalize_kv(TransContext *txc, KeyValueDB::Transaction t)
 {
   BLUE_SCOPE(txc_finalize_kv);
@@ -14925,22 +16060,23 @@ void BlueStore::_txc_finalize_kv(TransContext *txc, KeyValueDB::Transaction t)
 	   << " released 0x" << txc->released
 	   << std::dec << dendl;
 
-  if (!fm->is_null_manager())
-  {
+  auto update_fm = [&](FreelistManager* f,
+		       interval_set<uint64_t>& allocated,
+		       interval_set<uint64_t>& released) {
     // We have to handle the case where we allocate *and* deallocate the
     // same region in this transaction.  The freelist doesn't like that.
     // (Actually, the only thing that cares is the BitmapFreelistManager
     // debug check. But that's important.)
     interval_set<uint64_t> tmp_allocated, tmp_released;
-    interval_set<uint64_t> *pallocated = &txc->allocated;
-    interval_set<uint64_t> *preleased = &txc->released;
-    if (!txc->allocated.empty() && !txc->released.empty()) {
+    interval_set<uint64_t> *pallocated = &allocated;
+    interval_set<uint64_t> *preleased = &released;
+    if (!allocated.empty() && !released.empty()) {
       interval_set<uint64_t> overlap;
-      overlap.intersection_of(txc->allocated, txc->released);
+      overlap.intersection_of(allocated, released);
       if (!overlap.empty()) {
-	tmp_allocated = txc->allocated;
+	tmp_allocated = allocated;
 	tmp_allocated.subtract(overlap);
-	tmp_released = txc->released;
+	tmp_released = released;
 	tmp_released.subtract(overlap);
 	dout(20) << __func__ << "  overlap 0x" << std::hex << overlap
 		 << ", new allocated 0x" << tmp_allocated
@@ -14955,16 +16091,38 @@ void BlueStore::_txc_finalize_kv(TransContext *txc, KeyValueDB::Transaction t)
     for (interval_set<uint64_t>::iterator p = pallocated->begin();
 	 p != pallocated->end();
 	 ++p) {
-      fm->allocate(p.get_start(), p.get_len(), t);
+      f->allocate(p.get_start(), p.get_len(), t);
     }
     for (interval_set<uint64_t>::iterator p = preleased->begin();
 	 p != preleased->end();
 	 ++p) {
       dout(20) << __func__ << " release 0x" << std::hex << p.get_start()
 	       << "~" << p.get_len() << std::dec << dendl;
-      fm->release(p.get_start(), p.get_len(), t);
+      f->release(p.get_start(), p.get_len(), t);
+    }
+  };
+
+  if (fast_fm) {
+    // the fast tier keeps its own freelist, also with a null main one
+    split_fast_tier(txc->allocated, &txc->fast_allocated);
+    split_fast_tier(txc->released, &txc->fast_released);
+    update_fm(fast_fm, txc->fast_allocated, txc->fast_released);
+    if (!fast_tier_compat && !txc->fast_allocated.empty()) {
+      // keep releases that do not know about block.fast from reading these
+      // extents as main device offsets; every txc carries the key until one
+      // of them is submitted, see _txc_apply_kv()
+      t->set(PREFIX_SUPER, "fast_tier_data", bufferlist());
+      txc->compat_ondisk_format = fast_tier_compat_ondisk_format;
     }
   }
+  if (extent_map_columnar && !txc->onodes.empty()) {
+    // any of the shards _txc_write_nodes() encoded may be v3
+    txc->compat_ondisk_format = std::max(txc->compat_ondisk_format,
+					 columnar_compat_ondisk_format);
+  }
+  if (!fm->is_null_manager()) {
+    update_fm(fm, txc->allocated, txc->released);
+  }
 
   _txc_update_store_statfs(txc);
 }
@@ -14983,8 +16141,32 @@ void BlueStore::_txc_apply_kv(TransContext *txc, bool sync_submit_transaction)
     }
 #endif
 
+    std::unique_lock cl(ondisk_compat_lock, std::defer_lock);
+    if (txc->compat_ondisk_format > ondisk_compat) {
+      // the txcs that raise the format are submitted one at a time, so
+      // one that wants less can not overwrite one that wants more
+      cl.lock();
+      if (txc->compat_ondisk_format > ondisk_compat) {
+	dout(1) << __func__ << " min_compat_ondisk_format "
+		<< ondisk_compat << " -> " << txc->compat_ondisk_format
+		<< dendl;
+	bufferlist bl;
+	encode(txc->compat_ondisk_format, bl);
+	txc->t->set(PREFIX_SUPER, "min_compat_ondisk_format", bl);
+      } else {
+	cl.unlock();
+      }
+    }
     int r = cct->_conf->bluestore_debug_omit_kv_commit ? 0 : db->submit_transaction(txc->t);
     ceph_assert(r == 0);
+    if (cl.owns_lock()) {
+      // anything submitted after this is ordered behind the key
+      ondisk_compat = txc->compat_ondisk_format;
+      cl.unlock();
+    }
+    if (!fast_tier_compat && !txc->fast_allocated.empty()) {
+      fast_tier_compat = true;
+    }
     txc->set_state(TransContext::STATE_KV_SUBMITTED);
     if (txc->osr->kv_submitted_waiters) {
       std::lock_guard l(txc->osr->qlock);
@@ -15029,7 +16211,8 @@ void BlueStore::_txc_committed_kv(TransContext *txc)
       finisher.queue(txc->oncommits);
     }
   }
-  throttle.log_state_latency(*txc, logger, l_bluestore_state_kv_committing_lat);
+  deferred_policy.note_commit(
+    throttle.log_state_latency(*txc, logger, l_bluestore_state_kv_committing_lat));
   log_latency_fn(
     __func__,
     l_bluestore_commit_lat,
@@ -15140,6 +16323,14 @@ void BlueStore::_txc_finish(TransContext *txc)
 void BlueStore::_txc_release_alloc(TransContext *txc)
 {
   bool discard_queued = false;
+  if (fast_alloc && !txc->fast_released.empty() &&
+      !cct->_conf->bluestore_debug_no_reuse_blocks) {
+    dout(10) << __func__ << "(fast) " << txc << " " << std::hex
+	     << txc->fast_released << std::dec << dendl;
+    fast_alloc->release(txc->fast_released);
+  }
+  txc->fast_allocated.clear();
+  txc->fast_released.clear();
   // it's expected we're called with lazy_release_lock already taken!
   if (unlikely(cct->_conf->bluestore_debug_no_reuse_blocks ||
                txc->released.size() == 0 ||
@@ -15383,6 +16574,7 @@ void BlueStore::_kv_sync_thread()
       twait = ceph::make_timespan(0);
       kv_submitted = 0;
     }
+    _deferred_policy_update();
     ceph_assert(kv_committing.empty());
     if (kv_queue.empty() &&
 	((deferred_done_queue.empty() && deferred_stable_queue.empty()) ||
@@ -15462,6 +16654,11 @@ void BlueStore::_kv_sync_thread()
           deferred_done.clear();
         }
       }
+      if (bdev_fast) {
+	// fast tier writes are synchronous and not counted as aios; this
+	// is a no-op if there were none since the last flush
+	bdev_fast->flush();
+      }
       auto after_flush = mono_clock::now();
 
       // we will use one final transaction to force a sync
@@ -15491,6 +16688,7 @@ void BlueStore::_kv_sync_thread()
 	dout(10) << __func__ << " new_blobid_max " << new_blobid_max << dendl;
       }
 
+      std::map<uint64_t, wa_stats_t> wa;
       for (auto txc : kv_committing) {
 	throttle.log_state_latency(*txc, logger, l_bluestore_state_kv_queued_lat);
 	if (txc->get_state() == TransContext::STATE_KV_QUEUED) {
@@ -15503,6 +16701,8 @@ void BlueStore::_kv_sync_thread()
 	if (txc->had_ios) {
 	  --txc->osr->txc_with_unstable_io;
 	}
+	txc->wa.kv_bytes = txc->t->get_size_bytes();
+	wa[txc->osd_pool_id] += txc->wa;
       }
 
       // release throttle *before* we commit.  this allows new ops
@@ -15524,6 +16724,10 @@ void BlueStore::_kv_sync_thread()
 	}
       }
 
+      // deferred cleanups and nid/blobid bumps are charged to no pool
+      wa[META_POOL_ID].kv_bytes += synct->get_size_bytes();
+      _update_wa_stats(wa);
+
 #if defined(WITH_LTTNG)
       auto sync_start = mono_clock::now();
 #endif
@@ -15706,6 +16910,8 @@ bluestore_deferred_op_t *BlueStore::_get_deferred_op(
     txc->deferred_txn = new bluestore_deferred_transaction_t;
   }
   txc->deferred_txn->ops.push_back(bluestore_deferred_op_t());
+  txc->wa.device_bytes += len;
+  txc->wa.deferred_bytes += len;
   logger->inc(l_bluestore_issued_deferred_writes);
   logger->inc(l_bluestore_issued_deferred_write_bytes, len);
   return &txc->deferred_txn->ops.back();
@@ -15824,7 +17030,7 @@ void BlueStore::_deferred_submit_unlock(OpSequencer *osr)
 	if (!g_conf()->bluestore_debug_omit_block_device_write) {
 	  logger->inc(l_bluestore_submitted_deferred_writes);
 	  logger->inc(l_bluestore_submitted_deferred_write_bytes, bl.length());
-	  int r = bdev->aio_write(start, bl, &b->ioc, false);
+	  int r = _data_aio_write(start, bl, &b->ioc, &b->ioc_fast, false);
 	  ceph_assert(r == 0);
 	}
       }
@@ -15846,7 +17052,24 @@ void BlueStore::_deferred_submit_unlock(OpSequencer *osr)
     ++i;
   }
 
-  bdev->aio_submit(&b->ioc);
+  bool main_ios = b->ioc.has_pending_aios();
+  bool fast_ios = b->ioc_fast.has_pending_aios();
+  if (!main_ios && !fast_ios) {
+    // nothing was written; there won't be an aio completion to finish
+    // the batch
+    finisher.queue(new LambdaContext(
+      [this, osr = OpSequencerRef(osr)](int) {
+	_deferred_aio_finish(osr.get());
+      }));
+    return;
+  }
+  b->iocs_running = int(main_ios) + int(fast_ios);
+  if (main_ios) {
+    bdev->aio_submit(&b->ioc);
+  }
+  if (fast_ios) {
+    bdev_fast->aio_submit(&b->ioc_fast);
+  }
 }
 
 struct C_DeferredTrySubmit : public Context {
@@ -16063,16 +17286,53 @@ int BlueStore::queue_transactions(
   OpSequencer *osr = c->osr.get();
   dout(10) << __func__ << " ch " << c << " " << c->cid << dendl;
 
+  std::shared_lock sl(c->submit_lock);
   // prepare
   TransContext *txc = _txc_create(static_cast<Collection*>(ch.get()), osr,
 				  &on_commit, op);
 
-  for (vector<Transaction>::iterator p = tls.begin(); p != tls.end(); ++p) {
-    txc->bytes += (*p).get_num_bytes();
-    _txc_add_transaction(txc, &(*p));
+  for (vector<Transaction>::iterator p = tls.begin(); p != tls.end(); ++p) {
+    txc->bytes += (*p).get_num_bytes();
+    _txc_add_transaction(txc, &(*p));
+  }
+  _txc_calc_cost(txc);
+
+  auto throttle_lat = _txc_journal_and_start(txc, handle);
+  sl.unlock();
+
+  // we're immediately readable (unlike FileStore)
+  for (auto c : on_applied_sync) {
+    c->complete(0);
+  }
+  if (!on_applied.empty()) {
+    if (c->commit_queue) {
+      c->commit_queue->queue(on_applied);
+    } else {
+      finisher.queue(on_applied);
+    }
+  }
+
+#ifdef WITH_BLKIN
+  if (txc->trace) {
+    txc->trace.event("txc applied");
   }
-  _txc_calc_cost(txc);
+#endif
+
+  log_latency("submit_transact",
+    l_bluestore_submit_lat,
+    mono_clock::now() - start,
+    cct->_conf->bluestore_log_op_age);
+  log_latency("throttle_transact",
+    l_bluestore_throttle_lat,
+    throttle_lat,
+    cct->_conf->bluestore_log_op_age);
+  return 0;
+}
 
+ceph::timespan BlueStore::_txc_journal_and_start(
+  TransContext *txc,
+  ThreadPool::TPHandle *handle)
+{
   _txc_write_nodes(txc, txc->t);
 
   // journal deferred items
@@ -16127,40 +17387,175 @@ int BlueStore::queue_transactions(
 
   // execute (start)
   _txc_state_proc(txc);
+  return tend - tstart;
+}
 
-  // we're immediately readable (unlike FileStore)
-  for (auto c : on_applied_sync) {
-    c->complete(0);
+struct BlueStore::rewrite_t {
+  interval_set<uint64_t> regions;
+  std::vector<ceph::buffer::list> data;  ///< per region, as read
+  uint64_t write_gen = 0;                ///< Onode::write_gen when read
+  // recompress() only
+  WriteContext wctx;
+  std::vector<Writer::blob_vec> blobs;   ///< per region, empty to skip
+};
+
+int64_t BlueStore::recompress(CollectionHandle& ch, const ghobject_t& oid)
+{
+  CollectionRef c = static_cast<Collection*>(ch.get());
+  dout(15) << __func__ << " " << c->cid << " " << oid << dendl;
+  if (!use_write_v2) {
+    // the estimator only drives write_v2
+    return -EOPNOTSUPP;
   }
-  if (!on_applied.empty()) {
-    if (c->commit_queue) {
-      c->commit_queue->queue(on_applied);
-    } else {
-      finisher.queue(on_applied);
+  rewrite_t rw;
+  OnodeRef o;
+  {
+    // the data is read like a client read, writers wait for no more
+    std::shared_lock l(c->lock);
+    o = c->get_onode(oid, false);
+    if (!o || !o->exists) {
+      return -ENOENT;
+    }
+    if (!_recompress_lookup(c, o, &rw)) {
+      return 0;
+    }
+    if (int r = _rewrite_read(c.get(), o, rw); r < 0) {
+      c->recompress_estimator->finish();
+      return r;
     }
   }
-
-#ifdef WITH_BLKIN
-  if (txc->trace) {
-    txc->trace.event("txc applied");
+  // compressing is the slow part, no lock is held for it
+  if (!_recompress_compress(c.get(), rw)) {
+    c->recompress_estimator->finish();
+    return 0;
   }
-#endif
+  // client writes may have gone in since the read, keep them out until
+  // the rewrite is queued behind them
+  std::unique_lock sl(c->submit_lock);
+  std::unique_lock l(c->lock);
+  if (!_rewrite_still_valid(c.get(), o.get(), rw)) {
+    dout(20) << __func__ << " " << oid << " changed since the read" << dendl;
+    c->recompress_estimator->finish();
+    return 0;
+  }
+  std::list<Context*> on_commit;
+  TransContext *txc = _txc_create(c.get(), c->osr.get(), &on_commit);
+  uint64_t rewritten = _do_recompress(txc, c, o, rw);
+  if (rewritten) {
+    txc->write_onode(o);
+  }
+  l.unlock();
+  int64_t released = -txc->statfs_delta.allocated();
+  txc->bytes += rewritten;
+  _txc_calc_cost(txc);
+  _txc_journal_and_start(txc, nullptr);
+  sl.unlock();
+  logger->inc(l_bluestore_recompress_bytes, rewritten);
+  if (released > 0) {
+    logger->inc(l_bluestore_recompress_released, released);
+  }
+  dout(10) << __func__ << " " << c->cid << " " << oid
+	   << " rewrote 0x" << std::hex << rewritten
+	   << " released 0x" << released << std::dec << dendl;
+  return rewritten;
+}
 
-  log_latency("submit_transact",
-    l_bluestore_submit_lat,
-    mono_clock::now() - start,
-    cct->_conf->bluestore_log_op_age);
-  log_latency("throttle_transact",
-    l_bluestore_throttle_lat,
-    tend - tstart,
-    cct->_conf->bluestore_log_op_age);
-  return 0;
+int64_t BlueStore::retier(CollectionHandle& ch, const ghobject_t& oid)
+{
+  if (!bdev_fast) {
+    return -EOPNOTSUPP;
+  }
+  CollectionRef c = static_cast<Collection*>(ch.get());
+  dout(15) << __func__ << " " << c->cid << " " << oid << dendl;
+  rewrite_t rw;
+  OnodeRef o;
+  bool to_fast;
+  {
+    std::shared_lock l(c->lock);
+    o = c->get_onode(oid, false);
+    if (!o || !o->exists) {
+      return -ENOENT;
+    }
+    // in between the two thresholds data stays where it is
+    uint32_t heat = _tier_heat(o.get(), false);
+    if (heat >= tier_promote_heat) {
+      to_fast = true;
+    } else if (heat <= tier_demote_heat) {
+      to_fast = false;
+    } else {
+      return 0;
+    }
+    if (!_retier_lookup(o, to_fast, &rw.regions)) {
+      return 0;
+    }
+    // as in recompress(), read without holding back client reads
+    if (int r = _rewrite_read(c.get(), o, rw); r < 0) {
+      return r;
+    }
+  }
+  // as with recompress(), ordered against client writes by submit_lock
+  std::unique_lock sl(c->submit_lock);
+  std::unique_lock l(c->lock);
+  // the space check comes last, writes since the lookup may have used
+  // some of it up
+  if (!_rewrite_still_valid(c.get(), o.get(), rw) ||
+      !_retier_has_space(o.get(), to_fast, rw.regions)) {
+    dout(20) << __func__ << " " << oid << " changed since the read, or no "
+	     << "room on the " << (to_fast ? "fast" : "main") << " tier"
+	     << dendl;
+    return 0;
+  }
+  PExtentVector reserved;
+  if (int r = _retier_reserve(to_fast, rw.regions, &reserved); r < 0) {
+    dout(20) << __func__ << " " << oid << " no room on the "
+	     << (to_fast ? "fast" : "main") << " tier after all" << dendl;
+    return r;
+  }
+  std::list<Context*> on_commit;
+  TransContext *txc = _txc_create(c.get(), c->osr.get(), &on_commit);
+  txc->reserved.swap(reserved);
+  uint64_t moved = 0;
+  int r = _do_retier(txc, c, o, rw, &moved);
+  if (!txc->reserved.empty()) {
+    // nothing refers to what the writes left over
+    _release_data(txc->reserved);
+    txc->reserved.clear();
+  }
+  if (r < 0) {
+    // with the space set aside only a read of a neighbouring block, to
+    // pad a write, can fail.  the onode is half rewritten in memory and
+    // there is no way back, as for a client transaction.
+    _dump_onode<0>(cct, *o);
+    ceph_abort_msg("unexpected error retiering an object");
+  }
+  txc->write_onode(o);
+  l.unlock();
+  txc->bytes += moved;
+  _txc_calc_cost(txc);
+  _txc_journal_and_start(txc, nullptr);
+  sl.unlock();
+  logger->inc(to_fast ? l_bluestore_tier_promote_bytes :
+			l_bluestore_tier_demote_bytes, moved);
+  dout(10) << __func__ << " " << c->cid << " " << oid
+	   << (to_fast ? " promoted 0x" : " demoted 0x")
+	   << std::hex << moved << std::dec << dendl;
+  return moved;
 }
 
 void BlueStore::_txc_aio_submit(TransContext *txc)
 {
   dout(10) << __func__ << " txc " << txc << dendl;
-  bdev->aio_submit(&txc->ioc);
+  bool main_ios = txc->ioc.has_pending_aios();
+  bool fast_ios = txc->ioc_fast.has_pending_aios();
+  // set before either is submitted, the first completion may come before
+  // the second submit
+  txc->iocs_running = int(main_ios) + int(fast_ios);
+  if (main_ios) {
+    bdev->aio_submit(&txc->ioc);
+  }
+  if (fast_ios) {
+    bdev_fast->aio_submit(&txc->ioc_fast);
+  }
 }
 
 
@@ -16761,8 +18156,11 @@ void BlueStore::_do_write_small(
               b->get_blob().map_bl(
                   b_off, bl,
 		[&](uint64_t offset, bufferlist& t) {
-                    bdev->aio_write(offset, t,
-				  &txc->ioc, wctx->buffered);
+                    txc->wa.device_bytes += t.length();
+                    wctx->note_io_error(
+                      _data_aio_write(offset, t,
+				      &txc->ioc, &txc->ioc_fast,
+				      wctx->buffered));
                   });
           }
           }
@@ -17352,6 +18750,144 @@ void BlueStore::_do_write_big(
   }
 }
 
+uint32_t BlueStore::_tier_heat(Onode* o, bool touch)
+{
+  uint32_t now = std::chrono::duration_cast<std::chrono::seconds>(
+    ceph::coarse_mono_clock::now().time_since_epoch()).count();
+  uint32_t halflife = tier_heat_halflife;
+  uint32_t stamp = o->heat_stamp;
+  uint32_t heat = o->heat;
+  if (now - stamp >= halflife) {
+    // racing callers may lose an access or repeat a halving; the heat
+    // only steers placement, it need not be exact
+    uint32_t halvings = (now - stamp) / halflife;
+    heat = halvings < 32 ? heat >> halvings : 0;
+    o->heat = heat;
+    o->heat_stamp = now - (now - stamp) % halflife;
+  }
+  if (touch) {
+    heat = ++o->heat;
+  }
+  return heat;
+}
+
+bool BlueStore::_tier_want_fast(Onode* o, uint64_t want)
+{
+  if (!fast_alloc || _tier_heat(o, false) < tier_promote_heat) {
+    return false;
+  }
+  uint64_t capacity = fast_alloc->get_capacity();
+  uint64_t free = fast_alloc->get_free();
+  return free >= want &&
+    capacity - free + want <= capacity * tier_fast_full_ratio;
+}
+
+int64_t BlueStore::_allocate_data(
+  TransContext* txc,
+  Onode* o,
+  uint64_t want, uint64_t unit, uint64_t max, int64_t hint,
+  PExtentVector* extents)
+{
+  if (txc && !txc->reserved.empty()) {
+    // retier() took all the space its writes can need up front; the
+    // extents are in min_alloc_size units like want
+    uint64_t got = 0;
+    while (got < want && !txc->reserved.empty()) {
+      auto& e = txc->reserved.back();
+      uint64_t l = std::min<uint64_t>(e.length, want - got);
+      if (max) {
+	l = std::min(l, max);
+      }
+      extents->emplace_back(e.offset + e.length - l, l);
+      e.length -= l;
+      if (!e.length) {
+	txc->reserved.pop_back();
+      }
+      got += l;
+    }
+    if (got == want) {
+      return got;
+    }
+    int64_t r = _allocate_data(nullptr, o, want - got, unit, max, hint,
+			       extents);
+    return r < 0 ? r : got + r;
+  }
+  auto allocate_fast = [&]() -> int64_t {
+    PExtentVector fast;
+    int64_t got = fast_alloc->allocate(want, unit, max, 0, &fast);
+    if (got < (int64_t)want) {
+      if (!fast.empty()) {
+	fast_alloc->release(fast);
+      }
+      return -ENOSPC;
+    }
+    for (auto& e : fast) {
+      extents->emplace_back(e.offset + BLUESTORE_FAST_TIER_BASE, e.length);
+    }
+    logger->inc(l_bluestore_tier_fast_alloc_bytes, got);
+    return got;
+  };
+
+  if (_tier_want_fast(o, want)) {
+    int64_t got = allocate_fast();
+    if (got >= 0) {
+      return got;
+    }
+  }
+  size_t n = extents->size();
+  int64_t got = alloc->allocate(want, unit, max, hint, extents);
+  if (fast_alloc && got < (int64_t)want) {
+    // the main device is full, whatever the heat the fast tier is
+    // better than failing the write
+    PExtentVector partial(extents->begin() + n, extents->end());
+    extents->resize(n);
+    int64_t r = allocate_fast();
+    if (r >= 0) {
+      if (!partial.empty()) {
+	alloc->release(partial);
+      }
+      return r;
+    }
+    extents->insert(extents->end(), partial.begin(), partial.end());
+  }
+  return got;
+}
+
+void BlueStore::_release_data(const PExtentVector& extents)
+{
+  PExtentVector to_main, to_fast;
+  for (auto& e : extents) {
+    if (e.is_fast_tier()) {
+      to_fast.emplace_back(e.offset - BLUESTORE_FAST_TIER_BASE, e.length);
+    } else {
+      to_main.push_back(e);
+    }
+  }
+  if (!to_main.empty()) {
+    alloc->release(to_main);
+  }
+  if (!to_fast.empty()) {
+    ceph_assert(fast_alloc);
+    fast_alloc->release(to_fast);
+  }
+}
+
+int BlueStore::_data_aio_write(
+  uint64_t offset,
+  bufferlist& bl,
+  IOContext* ioc,
+  bool buffered)
+{
+  if (offset >= BLUESTORE_FAST_TIER_BASE) {
+    ceph_assert(bdev_fast);
+    // a ring or aio context serves one device, so the fast tier gets an
+    // ioc of its own; both are submitted together
+    return bdev_fast->aio_write(offset - BLUESTORE_FAST_TIER_BASE, bl,
+				ioc_fast, buffered);
+  }
+  return bdev->aio_write(offset, bl, ioc, buffered);
+}
+
 int BlueStore::_do_alloc_write(
   TransContext *txc,
   CollectionRef coll,
@@ -17362,7 +18898,8 @@ int BlueStore::_do_alloc_write(
 	   << " " << wctx->writes.size() << " blobs"
 	   << dendl;
   if (wctx->writes.empty()) {
-    return 0;
+    // _do_write_small() may have written to unused space already
+    return wctx->io_error;
   }
 
   // checksum
@@ -17471,8 +19008,8 @@ int BlueStore::_do_alloc_write(
   prealloc.reserve(2 * wctx->writes.size());
   int64_t prealloc_left = 0;
   auto start = mono_clock::now();
-  prealloc_left = alloc->allocate(
-    need, min_alloc_size, need,
+  prealloc_left = _allocate_data(
+    txc, o.get(), need, min_alloc_size, need,
     use_last_allocator_lookup_position ? -1 : 0,
     &prealloc);
   log_latency("allocator@_do_alloc_write",
@@ -17486,7 +19023,7 @@ int BlueStore::_do_alloc_write(
          << " available 0x " << alloc->get_free()
          << std::dec << dendl;
     if (prealloc.size()) {
-      alloc->release(prealloc);
+      _release_data(prealloc);
     }
     return -ENOSPC;
   }
@@ -17633,7 +19170,9 @@ int BlueStore::_do_alloc_write(
 	wi.b->get_blob().map_bl(
 	  b_off, *l,
 	  [&](uint64_t offset, bufferlist& t) {
-	    bdev->aio_write(offset, t, &txc->ioc, false);
+	    txc->wa.device_bytes += t.length();
+	    wctx->note_io_error(_data_aio_write(offset, t, &txc->ioc,
+						&txc->ioc_fast, false));
 	  });
 	logger->inc(l_bluestore_write_new);
       }
@@ -17641,7 +19180,11 @@ int BlueStore::_do_alloc_write(
   }
   ceph_assert(prealloc_pos == prealloc.end());
   ceph_assert(prealloc_left == 0);
-  return 0;
+  if (wctx->io_error < 0) {
+    derr << __func__ << " data write failed: " << cpp_strerror(wctx->io_error)
+         << dendl;
+  }
+  return wctx->io_error;
 }
 
 void BlueStore::_wctx_finish(
@@ -18079,6 +19622,10 @@ int BlueStore::_do_write_v2(
     o->extent_map.dirty_range(wr.left_affected_range, wr.right_affected_range - wr.left_affected_range);
     o->extent_map.maybe_reshard(wr.left_affected_range, wr.right_affected_range);
   }
+  if (wctx.io_error < 0) {
+    r = wctx.io_error;
+    derr << __func__ << " data write failed: " << cpp_strerror(r) << dendl;
+  }
   return r;
 }
 
@@ -18147,6 +19694,257 @@ int BlueStore::_do_write_v2_compressed(
   return 0;
 }
 
+bool BlueStore::_recompress_lookup(
+  CollectionRef& c,
+  OnodeRef& o,
+  rewrite_t* rw)
+{
+  WriteContext* wctx = &rw->wctx;
+  _choose_write_options(c, o, CEPH_OSD_OP_FLAG_FADVISE_DONTNEED, wctx);
+  if (!wctx->compress) {
+    return false;
+  }
+  {
+    std::lock_guard l(recompress_lock);
+    if (recompress_compressor) {
+      wctx->compressor = recompress_compressor;
+    }
+  }
+  if (!wctx->compressor) {
+    return false;
+  }
+  uint32_t window = wctx->target_blob_size;
+  if (o->onode.segment_size) {
+    window = std::min(window, o->onode.segment_size);
+  }
+  o->extent_map.fault_range(db, 0, OBJECT_MAX_SIZE);
+  if (!c->recompress_estimator) {
+    c->recompress_estimator.reset(create_estimator());
+  }
+  Estimator* estimator = c->recompress_estimator.get();
+  estimator->set_wctx(wctx);
+  Scanner scanner(this);
+  scanner.recompress_lookup(o.get(), window, estimator);
+  std::vector<Estimator::region_t> found;
+  estimator->get_regions(found);
+  if (found.empty()) {
+    estimator->finish();
+    return false;
+  }
+  for (const auto& i : found) {
+    rw->regions.insert(i.offset, i.length);
+  }
+  dout(15) << __func__ << " " << o->oid << " " << rw->regions << dendl;
+  return true;
+}
+
+uint64_t BlueStore::_recompress_compress(
+  Collection* c,
+  rewrite_t& rw)
+{
+  Estimator* estimator = c->recompress_estimator.get();
+  uint32_t au_size = min_alloc_size;
+  uint64_t to_write = 0;
+  rw.blobs.resize(rw.data.size());
+  auto d = rw.data.begin();
+  auto bd = rw.blobs.begin();
+  for (auto i = rw.regions.begin(); i != rw.regions.end(); ++i, ++d, ++bd) {
+    uint32_t offset = i.get_start();
+    uint32_t length = i.get_len();
+    int32_t disk_for_compressed = estimator->split_and_compress(*d, *bd);
+    int32_t disk_for_raw =
+      p2roundup(offset + length, au_size) - p2align(offset, au_size);
+    if (disk_for_compressed >= disk_for_raw) {
+      // unlike a client write we are not forced to store it
+      dout(20) << __func__ << " skipping 0x" << std::hex << offset << "~"
+	       << length << std::dec << ", does not compress" << dendl;
+      bd->clear();
+      continue;
+    }
+    to_write += length;
+  }
+  return to_write;
+}
+
+uint64_t BlueStore::_do_recompress(
+  TransContext *txc,
+  CollectionRef& c,
+  OnodeRef& o,
+  rewrite_t& rw)
+{
+  Estimator* estimator = c->recompress_estimator.get();
+  uint64_t rewritten = 0;
+  auto bd = rw.blobs.begin();
+  for (auto i = rw.regions.begin(); i != rw.regions.end(); ++i, ++bd) {
+    if (bd->empty()) {
+      continue;
+    }
+    uint32_t offset = i.get_start();
+    uint32_t length = i.get_len();
+    BlueStore::Writer wr(this, txc, &rw.wctx, o);
+    wr.do_write_with_blobs(offset, offset + length, offset + length, *bd);
+    rewritten += length;
+  }
+  estimator->finish();
+  if (rewritten) {
+    uint32_t changes_start = rw.regions.range_start();
+    uint32_t changes_end = rw.regions.range_end();
+    o->extent_map.compress_extent_map(changes_start, changes_end - changes_start);
+    o->extent_map.dirty_range(changes_start, changes_end - changes_start);
+    o->extent_map.maybe_reshard(changes_start, changes_end);
+  }
+  return rewritten;
+}
+
+bool BlueStore::_retier_lookup(
+  OnodeRef& o,
+  bool to_fast,
+  interval_set<uint64_t>* regions)
+{
+  o->extent_map.fault_range(db, 0, OBJECT_MAX_SIZE);
+  for (auto& e : o->extent_map.extent_map) {
+    const bluestore_blob_t& b = e.blob->get_blob();
+    if (b.is_shared()) {
+      // moving a clone's blob would unshare it and take twice the space
+      continue;
+    }
+    for (auto& p : b.get_extents()) {
+      if (p.is_valid() && p.is_fast_tier() != to_fast) {
+	regions->insert(e.logical_offset, e.length);
+	break;
+      }
+    }
+  }
+  if (regions->empty()) {
+    return false;
+  }
+  dout(15) << __func__ << " " << o->oid << (to_fast ? " to fast " : " to main ")
+	   << *regions << dendl;
+  return true;
+}
+
+/// the most new space rewriting regions can take
+static uint64_t rewrite_need(
+  const interval_set<uint64_t>& regions,
+  uint64_t au_size)
+{
+  uint64_t need = 0;
+  for (auto i = regions.begin(); i != regions.end(); ++i) {
+    need += p2roundup(i.get_end(), au_size) - p2align(i.get_start(), au_size);
+  }
+  return need;
+}
+
+bool BlueStore::_retier_has_space(
+  Onode* o,
+  bool to_fast,
+  const interval_set<uint64_t>& regions)
+{
+  // the old extents are only released once the move commits, so all of
+  // the new space has to be free now
+  uint64_t need = rewrite_need(regions, min_alloc_size);
+  if (to_fast) {
+    return _tier_want_fast(o, need);
+  }
+  // a demotion that spills back to the fast tier is pointless
+  return alloc->get_free() >= need;
+}
+
+int BlueStore::_retier_reserve(
+  bool to_fast,
+  const interval_set<uint64_t>& regions,
+  PExtentVector* reserved)
+{
+  // the allocators are shared with the other collections, the space
+  // _retier_has_space() saw may be gone by the time the writes allocate.
+  // _do_retier() cannot back out of a half done move, so all of the space
+  // is taken now, before anything changes.
+  uint64_t need = rewrite_need(regions, min_alloc_size);
+  Allocator* a = to_fast ? fast_alloc : alloc;
+  PExtentVector extents;
+  int64_t got = a->allocate(need, min_alloc_size, need, 0, &extents);
+  if (got < (int64_t)need) {
+    if (!extents.empty()) {
+      a->release(extents);
+    }
+    return -ENOSPC;
+  }
+  uint64_t base = to_fast ? BLUESTORE_FAST_TIER_BASE : 0;
+  for (auto& e : extents) {
+    reserved->emplace_back(e.offset + base, e.length);
+  }
+  if (to_fast) {
+    logger->inc(l_bluestore_tier_fast_alloc_bytes, got);
+  }
+  return 0;
+}
+
+int BlueStore::_rewrite_read(
+  Collection* c,
+  OnodeRef& o,
+  rewrite_t& rw)
+{
+  rw.data.reserve(rw.regions.num_intervals());
+  for (auto i = rw.regions.begin(); i != rw.regions.end(); ++i) {
+    auto& bl = rw.data.emplace_back();
+    int r = _do_read(c, o, i.get_start(), i.get_len(), bl,
+		     CEPH_OSD_OP_FLAG_FADVISE_DONTNEED);
+    if (r < 0) {
+      derr << __func__ << " " << o->oid << " read 0x" << std::hex
+	   << i.get_start() << "~" << i.get_len() << std::dec << ": "
+	   << cpp_strerror(r) << dendl;
+      return r;
+    }
+    // a region may end in the unwritten tail of the last block
+    if (bl.length() < i.get_len()) {
+      bl.append_zero(i.get_len() - bl.length());
+    }
+  }
+  rw.write_gen = o->write_gen;
+  return 0;
+}
+
+bool BlueStore::_rewrite_still_valid(
+  Collection* c,
+  Onode* o,
+  const rewrite_t& rw)
+{
+  // the object may have been written, removed, renamed or split off to
+  // another collection since it was read; the next pass has another go
+  return o->exists && o->c == c && o->write_gen == rw.write_gen;
+}
+
+int BlueStore::_do_retier(
+  TransContext *txc,
+  CollectionRef& c,
+  OnodeRef& o,
+  rewrite_t& rw,
+  uint64_t* moved)
+{
+  // punch the old blobs out first so the write gets new space, which
+  // _allocate_data() takes from txc->reserved
+  auto d = rw.data.begin();
+  for (auto i = rw.regions.begin(); i != rw.regions.end(); ++i, ++d) {
+    _do_zero(txc, c, o, i.get_start(), i.get_len());
+    int r;
+    if (use_write_v2) {
+      r = _do_write_v2(txc, c, o, i.get_start(), i.get_len(), *d,
+		       CEPH_OSD_OP_FLAG_FADVISE_DONTNEED);
+    } else {
+      r = _do_write(txc, c, o, i.get_start(), i.get_len(), *d,
+		    CEPH_OSD_OP_FLAG_FADVISE_DONTNEED);
+    }
+    if (r < 0) {
+      derr << __func__ << " " << o->oid << " write 0x" << std::hex
+	   << i.get_start() << "~" << i.get_len() << std::dec << ": "
+	   << cpp_strerror(r) << dendl;
+      return r;
+    }
+    *moved += i.get_len();
+  }
+  return 0;
+}
+
 int BlueStore::_write(TransContext *txc,
 		      CollectionRef& c,
 		      OnodeRef& o,
@@ -18163,12 +19961,16 @@ int BlueStore::_write(TransContext *txc,
     r = -E2BIG;
   } else {
     _assign_nid(txc, o);
+    if (bdev_fast) {
+      _tier_heat(o.get(), true);
+    }
     if (use_write_v2) {
       r = _do_write_v2(txc, c, o, offset, length, bl, fadvise_flags);
     } else {
       r = _do_write(txc, c, o, offset, length, bl, fadvise_flags);
     }
     txc->write_onode(o);
+    txc->wa.user_bytes += length;
   }
   auto finish = mono_clock::now();
   logger->tinc_with_max(l_bluestore_write_lat, finish - start);
@@ -18634,6 +20436,7 @@ int BlueStore::_omap_setkeys(TransContext *txc,
   logger->inc(l_bluestore_omap_setkeys_count);
   logger->inc(l_bluestore_omap_setkeys_records, num0);
   logger->inc(l_bluestore_omap_setkeys_bytes, total_bytes);
+  txc->wa.user_bytes += total_bytes;
   r = 0;
   dout(10) << __func__ << " " << c->cid << " " << o->oid << " = " << r << dendl;
   return r;
@@ -18668,6 +20471,7 @@ int BlueStore::_omap_setheader(TransContext *txc,
   txc->t->set(prefix, key, bl);
   logger->inc(l_bluestore_omap_setheader_count);
   logger->inc(l_bluestore_omap_setheader_bytes, bl.length());
+  txc->wa.user_bytes += bl.length();
   r = 0;
   dout(10) << __func__ << " " << c->cid << " " << o->oid << " = " << r << dendl;
   return r;
@@ -19585,7 +21389,9 @@ void BlueStore::generate_db_histogram(Formatter *f)
     } else if (key.first == PREFIX_DEFERRED) {
 	hist.update_hist_entry(hist.key_hist, PREFIX_DEFERRED, key_size, value_size);
 	num_deferred++;
-    } else if (key.first == PREFIX_ALLOC || key.first == PREFIX_ALLOC_BITMAP) {
+    } else if (key.first == PREFIX_ALLOC || key.first == PREFIX_ALLOC_BITMAP ||
+	       key.first == PREFIX_FAST_ALLOC ||
+	       key.first == PREFIX_FAST_ALLOC_BITMAP) {
 	hist.update_hist_entry(hist.key_hist, PREFIX_ALLOC, key_size, value_size);
 	num_alloc++;
     } else if (key.first == PREFIX_SHARED_BLOB) {
@@ -20787,6 +22593,10 @@ void BlueStore::set_allocation_in_simple_bmap(SimpleBitmap* sbmap, uint64_t offs
            << offset << "~" << length
            << " " << min_alloc_size_mask
            << dendl;
+  if (offset >= BLUESTORE_FAST_TIER_BASE) {
+    // the fast tier freelist is never null, there is nothing to recover
+    return;
+  }
   ceph_assert((offset & min_alloc_size_mask) == 0);
   ceph_assert((length & min_alloc_size_mask) == 0);
   sbmap->set(offset >> min_alloc_size_order, length >> min_alloc_size_order);
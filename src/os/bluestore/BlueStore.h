@@ -21,6 +21,7 @@
 #include <tuple>
 #include <unistd.h>
 
+#include <array>
 #include <atomic>
 #include <bit>
 #include <chrono>
@@ -58,6 +59,7 @@
 #include "bluestore_types.h"
 #include "bluestore_common.h"
 #include "BlueFS.h"
+#include "DeferredPolicy.h"
 #include "common/EventTrace.h"
 #include "common/admin_socket.h"
 #ifdef WITH_CPUTRACE
@@ -91,6 +93,8 @@ enum {
   l_bluestore_omap,
   l_bluestore_fragmentation,
   l_bluestore_alloc_unit,
+  l_bluestore_tier_fast_size,
+  l_bluestore_tier_fast_free,
   //****************************************
 
   // Update op processing state latencies
@@ -157,11 +161,19 @@ enum {
   l_bluestore_issued_deferred_write_bytes,
   l_bluestore_submitted_deferred_writes,
   l_bluestore_submitted_deferred_write_bytes,
+  l_bluestore_deferred_adaptive_size,
+  l_bluestore_deferred_adaptive_raises,
+  l_bluestore_deferred_adaptive_lowers,
 
   l_bluestore_write_big_skipped_blobs,
   l_bluestore_write_big_skipped_bytes,
   l_bluestore_write_small_skipped,
   l_bluestore_write_small_skipped_bytes,
+
+  l_bluestore_wa_user_bytes,
+  l_bluestore_wa_device_bytes,
+  l_bluestore_wa_deferred_bytes,
+  l_bluestore_wa_kv_bytes,
   //****************************************
 
   // compressions stats
@@ -202,6 +214,11 @@ enum {
   l_bluestore_blob_split,
   l_bluestore_extent_compress,
   l_bluestore_gc_merged,
+  l_bluestore_recompress_bytes,
+  l_bluestore_recompress_released,
+  l_bluestore_tier_fast_alloc_bytes,
+  l_bluestore_tier_promote_bytes,
+  l_bluestore_tier_demote_bytes,
   //****************************************
 
   // misc
@@ -606,52 +623,103 @@ public:
   typedef boost::intrusive_ptr<SharedBlob> SharedBlobRef;
 
   /// a lookup table of SharedBlobs
+  ///
+  /// Open addressing with linear probing over (sbid, SharedBlob*) slots.
+  /// lookup() takes no lock, it only registers with the reader count of
+  /// the current epoch.  Writers serialize on the lock and, before
+  /// anything a reader might still look at goes away (the SharedBlob of
+  /// a dropped entry, a table replaced by a rehash, a slot reused for
+  /// another sbid), wait for the readers of the epoch they close.
   struct SharedBlobSet {
-    /// protect lookup, insertion, removal
+    /// protect insertion, removal
     ceph::mutex lock = ceph::make_mutex("BlueStore::SharedBlobSet::lock");
 
-    // we use a bare pointer because we don't want to affect the ref
-    // count
-    mempool::bluestore_cache_meta::unordered_map<uint64_t,SharedBlob*> sb_map;
+    static constexpr uint64_t EMPTY = 0;
+    static constexpr uint64_t TOMBSTONE = std::numeric_limits<uint64_t>::max();
+    static constexpr size_t MIN_SLOTS = 16;
 
-    SharedBlobRef lookup(uint64_t sbid) {
-      std::lock_guard l(lock);
-      auto p = sb_map.find(sbid);
-      if (p == sb_map.end() ||
-	  p->second->nref == 0) {
-        return nullptr;
+    struct slot_t {
+      std::atomic<uint64_t> sbid = EMPTY;
+      // we use a bare pointer because we don't want to affect the ref
+      // count
+      std::atomic<SharedBlob*> sb = nullptr;
+    };
+    struct table_t {
+      mempool::bluestore_cache_meta::vector<slot_t> slots;
+      size_t used = 0; ///< live and tombstone slots
+      size_t live = 0;
+      explicit table_t(size_t n) : slots(n) {}
+      size_t mask() const {
+        return slots.size() - 1;
       }
-      return p->second;
+    };
+    std::atomic<table_t*> table;
+    std::atomic<uint64_t> epoch = 0;
+    std::atomic<uint32_t> readers[2] = {0, 0};
+
+    SharedBlobSet() : table(new table_t(MIN_SLOTS)) {}
+    ~SharedBlobSet() {
+      delete table.load();
     }
 
-    void add(Collection* coll, SharedBlob *sb) {
-      std::lock_guard l(lock);
-      sb_map[sb->get_sbid()] = sb;
-      sb->collection = coll;
+    static size_t slot_of(uint64_t sbid, size_t mask) {
+      // sbids are handed out sequentially, spread them
+      uint64_t h = sbid * 0x9e3779b97f4a7c15ull;
+      return (h ^ (h >> 32)) & mask;
     }
 
-    bool remove(SharedBlob *sb, bool verify_nref_is_zero=false) {
-      std::lock_guard l(lock);
-      ceph_assert(sb->get_parent() == this);
-      if (verify_nref_is_zero && sb->nref != 0) {
-	return false;
+    SharedBlobRef lookup(uint64_t sbid) {
+      unsigned r = read_enter();
+      table_t* t = table.load();
+      SharedBlob* sb = nullptr;
+      size_t mask = t->mask();
+      for (size_t i = slot_of(sbid, mask);; i = (i + 1) & mask) {
+        uint64_t k = t->slots[i].sbid.load(std::memory_order_acquire);
+        if (k == sbid) {
+          sb = t->slots[i].sb.load(std::memory_order_acquire);
+          break;
+        }
+        if (k == EMPTY) {
+          break;
+        }
       }
-      // only remove if it still points to us
-      auto p = sb_map.find(sb->get_sbid());
-      if (p != sb_map.end() &&
-	  p->second == sb) {
-	sb_map.erase(p);
+      SharedBlobRef ret;
+      if (sb) {
+        // one on its way to deletion (nref 0) must not come back
+        int n = sb->nref.load();
+        while (n > 0 && !sb->nref.compare_exchange_weak(n, n + 1));
+        if (n > 0) {
+          ret = SharedBlobRef(sb, false);
+        }
       }
-      return true;
+      readers[r].fetch_sub(1);
+      return ret;
     }
 
+    void add(Collection* coll, SharedBlob *sb);
+    bool remove(SharedBlob *sb, bool verify_nref_is_zero=false);
+
     bool empty() {
       std::lock_guard l(lock);
-      return sb_map.empty();
+      return table.load()->live == 0;
     }
 
     template <int LogLevelV>
     void dump(CephContext *cct);
+
+  private:
+    unsigned read_enter() {
+      while (true) {
+        uint64_t e = epoch.load();
+        readers[e & 1].fetch_add(1);
+        if (epoch.load() == e) {
+          return e & 1;
+        }
+        readers[e & 1].fetch_sub(1);
+      }
+    }
+    void synchronize();
+    void rehash(table_t* t);
   };
 
   /// in-memory blob metadata and associated cached buffers (if any)
@@ -1072,6 +1140,7 @@ public:
                          __u8 struct_v,
                          bptr_c_it_t& p,
                          Collection* c);
+      void decode_columnar(bptr_c_it_t& p, uint32_t num, Collection* c);
     public:
       virtual ~ExtentDecoder() {
       }
@@ -1388,6 +1457,10 @@ public:
     mempool::bluestore_cache_meta::string key;
 
     boost::intrusive::list_member_hook<> lru_item;
+    std::atomic<bool> lru_linked = false;  ///< lru_item is linked, readable
+                                           ///  without the shard lock
+    std::atomic<bool> lru_touched = false; ///< used while in the LRU; the move
+                                           ///  to its front is done on trim
 
     bluestore_onode_t onode;  ///< metadata stored as value in kv store
     bool exists;              ///< true if object logically exists
@@ -1407,6 +1480,13 @@ public:
     ceph::condition_variable flush_cond;   ///< wait here for uncommitted txns
     std::shared_ptr<int64_t> cache_age_bin;  ///< cache age bin
 
+    /// recent reads and writes, halving every bluestore_tier_heat_halflife;
+    /// in memory only, see BlueStore::_tier_heat()
+    std::atomic<uint32_t> heat = 0;
+    std::atomic<uint32_t> heat_stamp = 0;  ///< seconds, last halving
+    /// bumped by every transaction that changes the object, under c->lock
+    uint64_t write_gen = 0;
+
     Onode(Collection *c, const ghobject_t& o,
 	  const mempool::bluestore_cache_meta::string& k)
       : c(c),
@@ -1623,6 +1703,10 @@ public:
 
     virtual void maybe_unpin(Onode* o) = 0;
     virtual void add_stats(uint64_t *onodes, uint64_t *pinned_onodes) = 0;
+    /// append up to max most recently used onodes, hottest first
+    virtual void list_hot(
+      size_t max,
+      std::vector<std::pair<coll_t, ghobject_t>>* ls) = 0;
     bool empty() {
       return _get_num() == 0;
     }
@@ -1685,12 +1769,39 @@ public:
     /// forward lookups
     mempool::bluestore_cache_meta::unordered_map<ghobject_t,OnodeRef> onode_map;
 
+    /// Lock-free front of onode_map for cache hits.  A slot only ever
+    /// points to an onode present in onode_map.  Readers count themselves
+    /// in the slot's current phase while they check the oid and take a
+    /// reference, and never wait.  Writers, all under cache->lock, change
+    /// the slot, then flip the phase and wait for the readers of the
+    /// previous one, before an onode may leave onode_map, change its oid
+    /// or have its pin state evaluated.  bluestore_onode_hot_slots sizes
+    /// it, 0 disables it.
+    struct hot_slot_t {
+      std::atomic<uintptr_t> onode = 0;
+      std::atomic<uint32_t> phase = 0;
+      std::atomic<uint32_t> readers[2] = {0, 0};
+    };
+    std::unique_ptr<hot_slot_t[]> hot_slots;
+    size_t hot_mask = 0;
+
+    hot_slot_t* _hot_slot(const ghobject_t& oid) {
+      if (!hot_slots) {
+        return nullptr;
+      }
+      return &hot_slots[std::hash<ghobject_t>()(oid) & hot_mask];
+    }
+    void _hot_publish(hot_slot_t& slot, uintptr_t v);
+    OnodeRef _hot_lookup(const ghobject_t& oid);
+    void _hot_set(Onode* o);
+    void _hot_forget(Onode* o);
+
     friend struct Collection; // for split_cache()
     friend struct Onode; // for put()
     friend struct LruOnodeCacheShard;
     void _remove(const ghobject_t& oid);
   public:
-    OnodeSpace(OnodeCacheShard *c) : cache(c) {}
+    OnodeSpace(OnodeCacheShard *c);
     ~OnodeSpace() {
       clear();
     }
@@ -1720,6 +1831,11 @@ public:
     bluestore_cnode_t cnode;
     ceph::shared_mutex lock =
       ceph::make_shared_mutex("BlueStore::Collection::lock", true, false);
+    /// held shared from txc creation until its nodes are encoded, so that
+    /// background rewrites (recompress, retier) that hold it exclusively
+    /// land in the sequencer in the order their changes were made
+    ceph::shared_mutex submit_lock =
+      ceph::make_shared_mutex("BlueStore::Collection::submit_lock", true, false);
 
     bool exists;
 
@@ -1740,6 +1856,7 @@ public:
 
     ContextQueue *commit_queue;
     std::unique_ptr<Estimator> estimator;
+    std::unique_ptr<Estimator> recompress_estimator;
 
     std::atomic<uint64_t> runtime_frag_count{0};
     std::atomic<uint64_t> runtime_read_samples{0};
@@ -1903,6 +2020,23 @@ public:
     }
   };
 
+  /// where the bytes a pool writes end up, see "bluestore wa"
+  struct wa_stats_t {
+    uint64_t user_bytes = 0;     ///< object data and omap written by clients
+    uint64_t device_bytes = 0;   ///< data written to the block devices
+    uint64_t deferred_bytes = 0; ///< part of device_bytes also logged to kv
+    uint64_t kv_bytes = 0;       ///< size of the submitted kv transactions
+
+    wa_stats_t& operator+=(const wa_stats_t& o) {
+      user_bytes += o.user_bytes;
+      device_bytes += o.device_bytes;
+      deferred_bytes += o.deferred_bytes;
+      kv_bytes += o.kv_bytes;
+      return *this;
+    }
+    void dump(ceph::Formatter *f) const;
+  };
+
   struct TransContext final : public AioContext {
     MEMPOOL_CLASS_HELPERS();
 
@@ -1986,11 +2120,21 @@ public:
     bluestore_deferred_transaction_t *deferred_txn = nullptr; ///< if any
 
     interval_set<uint64_t> allocated, released;
+    ///< fast tier part of the above, device relative; see _txc_finalize_kv
+    interval_set<uint64_t> fast_allocated, fast_released;
     volatile_statfs statfs_delta;	   ///< overall store statistics delta
     uint64_t osd_pool_id = META_POOL_ID;    ///< osd pool id we're operating on
+    wa_stats_t wa;                          ///< accounted in _kv_sync_thread
 
     IOContext ioc;
+    IOContext ioc_fast;    ///< aios to the fast tier device, if any
+    PExtentVector reserved;  ///< space set aside by retier(), taken first
+                             ///  by _allocate_data()
+    std::atomic<int> iocs_running = 0;  ///< see _txc_aio_submit()
     bool had_ios = false;  ///< true if we submitted IOs before our kv txn
+    /// min_compat_ondisk_format the data of this txc needs, see
+    /// _txc_finalize_kv()
+    int32_t compat_ondisk_format = 0;
 
     //uint64_t seq = 0;
     ceph::mono_clock::time_point start;
@@ -2027,6 +2171,7 @@ public:
       : ch(c),
 	osr(o),
 	ioc(cct, this),
+	ioc_fast(cct, this),
 	start(ceph::mono_clock::now()) {
       last_stamp = start;
       if (on_commits) {
@@ -2043,6 +2188,7 @@ public:
     }
 
     void write_onode(OnodeRef& o) {
+      ++o->write_gen;
       onodes.insert(o);
     }
     void write_shared_blob(const SharedBlobRef &sb) {
@@ -2063,7 +2209,10 @@ public:
     }
 
     void aio_finish(BlueStore *store) override {
-      store->txc_aio_finish(this);
+      // called once for each of ioc and ioc_fast that had aios
+      if (--iocs_running == 0) {
+	store->txc_aio_finish(this);
+      }
     }
   private:
     state_t state = STATE_PREPARE;
@@ -2180,6 +2329,17 @@ public:
     bool should_submit_deferred() {
       return throttle_deferred_bytes.past_midpoint();
     }
+    /// deferred bytes in flight beyond the regular throttle, 0..1
+    double get_deferred_backlog() {
+      int64_t max = throttle_deferred_bytes.get_max();
+      int64_t base = throttle_bytes.get_max();
+      if (max <= base) {
+        return 0;
+      }
+      int64_t cur = throttle_deferred_bytes.get_current() -
+        throttle_bytes.get_current();
+      return std::clamp(double(cur) / (max - base), 0.0, 1.0);
+    }
     void reset_throttle(const ConfigProxy &conf) {
       throttle_bytes.reset_max(conf->bluestore_throttle_bytes);
       throttle_deferred_bytes.reset_max(
@@ -2208,6 +2368,8 @@ public:
     std::map<uint64_t,deferred_io> iomap; ///< map of ios in this batch
     deferred_queue_t txcs;           ///< txcs in this batch
     IOContext ioc;                   ///< our aios
+    IOContext ioc_fast;              ///< our aios to the fast tier device
+    std::atomic<int> iocs_running = 0;
 #if defined(DEBUG_DEFERRED)
     /// bytes of pending io for each deferred seq (may be 0)
     std::map<uint64_t,int> seq_bytes;
@@ -2216,7 +2378,7 @@ public:
     void _discard(CephContext *cct, uint64_t offset, uint64_t length);
 
     DeferredBatch(CephContext *cct, OpSequencer *osr)
-      : osr(osr), ioc(cct, this) {}
+      : osr(osr), ioc(cct, this), ioc_fast(cct, this) {}
 
     /// prepare a write
     void prepare_write(CephContext *cct,
@@ -2224,7 +2386,9 @@ public:
 		       ceph::buffer::list::const_iterator& p);
 
     void aio_finish(BlueStore *store) override {
-      store->_deferred_aio_finish(osr);
+      if (--iocs_running == 0) {
+	store->_deferred_aio_finish(osr);
+      }
     }
   };
 
@@ -2425,6 +2589,12 @@ private:
   Allocator *alloc = nullptr;   ///< allocator consumed by BlueStore
   bluefs_shared_alloc_context_t shared_alloc; ///< consumed by BlueFS (may be == alloc)
 
+  // optional fast data tier (block.fast), addressed by physical offsets
+  // from BLUESTORE_FAST_TIER_BASE on
+  BlockDevice *bdev_fast = nullptr;
+  FreelistManager *fast_fm = nullptr;  ///< always a bitmap, even with null fm
+  Allocator *fast_alloc = nullptr;
+
   uuid_d fsid;
   int path_fd = -1;  ///< open handle to $path
   int fsid_fd = -1;  ///< open handle (locked) to $path/fsid
@@ -2509,6 +2679,7 @@ private:
   bool elastic_shared_blobs = false; ///< use smart ExtentMap::dup to reduce shared blob count
   bool use_write_v2 = false; ///< use new write path
   bool debug_extent_map_encode_check = false;
+  bool extent_map_columnar = false; ///< encode shards in the v3 layout
 
   enum {
     // Please preserve the order since it's DB persistent
@@ -2526,6 +2697,10 @@ private:
   ///< size threshold for forced deferred writes
   std::atomic<uint64_t> prefer_deferred_size = {0};
 
+  ///< moves prefer_deferred_size around if bluestore_deferred_adaptive is set
+  DeferredPolicy deferred_policy;
+  ceph::mono_clock::time_point deferred_policy_stamp;
+
   ///< approx cost per io, in bytes
   std::atomic<uint64_t> throttle_cost_per_io = {0};
 
@@ -2533,10 +2708,24 @@ private:
     {Compressor::COMP_NONE}; ///< compression mode
   std::atomic<int> def_compressor_alg = {Compressor::COMP_ALG_NONE};
   std::vector<CompressorRef> compressors;
+  ceph::mutex recompress_lock = ceph::make_mutex("BlueStore::recompress_lock");
+  CompressorRef recompress_compressor; ///< protected by recompress_lock
   std::atomic<uint64_t> comp_min_blob_size = {0};
   std::atomic<uint64_t> comp_max_blob_size = {0};
 
   std::atomic<uint64_t> max_blob_size = {0};  ///< maximum blob size
+
+  // fast tier placement, see _tier_want_fast()
+  std::atomic<uint32_t> tier_promote_heat = {0};
+  std::atomic<uint32_t> tier_demote_heat = {0};
+  std::atomic<uint32_t> tier_heat_halflife = {1};
+  std::atomic<double> tier_fast_full_ratio = {0};
+  /// there is data on the fast tier, see _txc_finalize_kv()
+  std::atomic<bool> fast_tier_compat = {false};
+  /// min_compat_ondisk_format as it is on disk, see _txc_apply_kv()
+  std::atomic<int32_t> ondisk_compat = {0};
+  ceph::mutex ondisk_compat_lock =
+    ceph::make_mutex("BlueStore::ondisk_compat_lock");
   std::atomic<uint32_t> segment_size = {0}; ///< snapshot of conf value "bluestore_onode_segment_size"
                                             /// When 0 onode_bluestore_t v2 is in force, otherwise v3 is used.
                                             /// Ability to disable is important for efficient testing.
@@ -2583,6 +2772,7 @@ private:
   ceph::mutex vstatfs_lock = ceph::make_mutex("BlueStore::vstatfs_lock");
   volatile_statfs vstatfs;
   osd_pools_map osd_pools; // protected by vstatfs_lock as well
+  std::map<uint64_t, wa_stats_t> osd_pools_wa; // protected by vstatfs_lock
 
   bool per_pool_stat_collection = true;
 
@@ -2845,7 +3035,9 @@ private:
   int _write_fsid();
   void _close_fsid();
   void _set_alloc_sizes();
+  void _deferred_policy_update();
   void _set_blob_size();
+  void _set_tier_params();
   void _set_finisher_num();
   void _set_per_pool_omap();
   void _update_osd_memory_options();
@@ -2894,6 +3086,10 @@ private:
   int _init_alloc();
   void _post_init_alloc();
   void _close_alloc();
+  /// open block.fast if there is one, along with its freelist and
+  /// allocator; t is the mkfs transaction
+  int _open_fast_tier(KeyValueDB::Transaction t, bool read_only);
+  void _close_fast_tier();
   int _open_collections();
   void _fsck_collections(int64_t* errors);
   void _close_collections();
@@ -2958,10 +3154,13 @@ private:
 			    std::list<Context*> *on_commits,
 			    TrackedOpRef osd_op=TrackedOpRef());
   void _txc_update_store_statfs(TransContext *txc);
+  void _update_wa_stats(const std::map<uint64_t, wa_stats_t>& delta);
   void _txc_add_transaction(TransContext *txc, Transaction *t);
   void _txc_calc_cost(TransContext *txc);
   void _txc_write_nodes(TransContext *txc, KeyValueDB::Transaction t);
   void _txc_state_proc(TransContext *txc);
+  ceph::timespan _txc_journal_and_start(TransContext *txc,
+					ThreadPool::TPHandle *handle);
   void _txc_aio_submit(TransContext *txc);
 public:
   void txc_aio_finish(void *p) {
@@ -3042,6 +3241,7 @@ private:
     const PExtentVector& extents,
     bool compressed,
     mempool_dynamic_bitset &used_blocks,
+    mempool_dynamic_bitset *fast_used_blocks,
     uint64_t granularity,
     BlueStoreRepairer* repairer,
     store_statfs_t& expected_statfs,
@@ -3109,9 +3309,13 @@ private:
 
   // -- ondisk version ---
 public:
-  const int32_t latest_ondisk_format = 4;        ///< our version
+  const int32_t latest_ondisk_format = 6;        ///< our version
   const int32_t min_readable_ondisk_format = 1;  ///< what we can read
   const int32_t min_compat_ondisk_format = 3;    ///< who can read us
+  /// who can read us once there is data on the fast tier
+  const int32_t fast_tier_compat_ondisk_format = 5;
+  /// who can read us once an extent map shard is in the v3 layout
+  const int32_t columnar_compat_ondisk_format = 6;
 
 private:
   int32_t ondisk_format = 0;  ///< value detected on mount
@@ -3361,6 +3565,21 @@ private:
     std::vector<ceph::buffer::list>* compressed_blob_bls,
     IOContext* ioc);
 
+  int _fill_ready_regions(
+    OnodeRef& o,
+    ready_regions_t& ready_regions,
+    std::vector<ceph::buffer::list>& compressed_blob_bls,
+    blobs2read_t& blobs2read,
+    bool buffered,
+    bool* csum_error);
+
+  void _assemble_read_result(
+    ready_regions_t& ready_regions,
+    ready_regions_t::iterator& pr,
+    uint64_t offset,
+    size_t length,
+    ceph::buffer::list& bl);
+
   int _generate_read_result_bl(
     OnodeRef& o,
     uint64_t offset,
@@ -3548,6 +3767,9 @@ public:
     TrackedOpRef op = TrackedOpRef(),
     ThreadPool::TPHandle *handle = NULL) override;
 
+  int64_t recompress(CollectionHandle& ch, const ghobject_t& oid) override;
+  int64_t retier(CollectionHandle& ch, const ghobject_t& oid) override;
+
   // error injection
   void inject_data_error(const ghobject_t& o) override {
     std::unique_lock l(debug_read_error_lock);
@@ -3600,6 +3822,10 @@ public:
     o->extent_map.punch_hole(c, off, len, &wctx.old_extents);
     _wctx_finish(&txc, c, o, &wctx, nullptr);
   }
+  // pick the extent map shard encoding without a remount
+  void debug_set_extent_map_columnar(bool columnar) {
+    extent_map_columnar = columnar;
+  }
 
   static int debug_write_bdev_label(
     CephContext* cct, BlockDevice* bdev, const std::string &path,
@@ -3645,6 +3871,7 @@ public:
   }
   void debug_set_prefer_deferred_size(uint64_t s) {
     prefer_deferred_size = s;
+    deferred_policy.set_base(s);
   }
   OnodeRef debug_get_onode(const coll_t& cid, const ghobject_t& hoid) {
     std::shared_lock l(coll_lock);
@@ -3816,6 +4043,13 @@ private:
 	 new_blob(_new_blob) {}
     };
     std::vector<write_item> writes;                 ///< blobs we're writing
+    int io_error = 0;  ///< first failed direct data write (fast tier ones are sync)
+
+    void note_io_error(int r) {
+      if (r < 0 && io_error == 0) {
+        io_error = r;
+      }
+    }
 
     /// partial clone of the context
     void fork(const WriteContext& other) {
@@ -3888,6 +4122,27 @@ private:
     CollectionRef c,
     OnodeRef& o,
     WriteContext *wctx);
+
+  /// access heat of o, after counting one more access if touch
+  uint32_t _tier_heat(Onode* o, bool touch);
+  /// true if want bytes of new data for o should go to the fast tier
+  bool _tier_want_fast(Onode* o, uint64_t want);
+  /// Allocator::allocate() on the tier o belongs to; falls back to the
+  /// other tier if that one is full.  takes txc->reserved first.
+  int64_t _allocate_data(
+    TransContext* txc,
+    Onode* o,
+    uint64_t want, uint64_t unit, uint64_t max, int64_t hint,
+    PExtentVector* extents);
+  void _release_data(const PExtentVector& extents);
+  /// queue a data write at a physical offset of either tier, on @p ioc or
+  /// on @p ioc_fast for the fast tier
+  int _data_aio_write(
+    uint64_t offset,
+    ceph::buffer::list& bl,
+    IOContext* ioc,
+    IOContext* ioc_fast,
+    bool buffered);
   void _wctx_finish(
     TransContext *txc,
     CollectionRef& c,
@@ -3944,6 +4199,48 @@ private:
     uint32_t offset, uint32_t length,
     ceph::buffer::list& bl,
     uint32_t scan_left, uint32_t scan_right);
+  /// a background rewrite of part of an object.  the data is read and,
+  /// for recompress(), compressed without the collection lock held for
+  /// writing; it is applied only if the object did not change meanwhile.
+  struct rewrite_t;
+  int _rewrite_read(
+    Collection* c,
+    OnodeRef& o,
+    rewrite_t& rw);
+  bool _rewrite_still_valid(
+    Collection* c,
+    Onode* o,
+    const rewrite_t& rw);
+  bool _recompress_lookup(
+    CollectionRef& c,
+    OnodeRef& o,
+    rewrite_t* rw);
+  uint64_t _recompress_compress(
+    Collection* c,
+    rewrite_t& rw);
+  uint64_t _do_recompress(
+    TransContext *txc,
+    CollectionRef& c,
+    OnodeRef& o,
+    rewrite_t& rw);
+  bool _retier_lookup(
+    OnodeRef& o,
+    bool to_fast,
+    interval_set<uint64_t>* regions);
+  bool _retier_has_space(
+    Onode* o,
+    bool to_fast,
+    const interval_set<uint64_t>& regions);
+  int _retier_reserve(
+    bool to_fast,
+    const interval_set<uint64_t>& regions,
+    PExtentVector* reserved);
+  int _do_retier(
+    TransContext *txc,
+    CollectionRef& c,
+    OnodeRef& o,
+    rewrite_t& rw,
+    uint64_t* moved);
   int _touch(TransContext *txc,
 	     CollectionRef& c,
 	     OnodeRef& o);
@@ -4093,6 +4390,14 @@ public:
     per_pool_fsck_stats_t& per_pool_fsck_stats;
     BlueStoreRepairer* repairer;
 
+    // set for regular and deep fsck only
+    uint64_t_btree_t* used_nids = nullptr;
+    // fast tier counterpart of used_blocks, if there is a fast tier
+    mempool_dynamic_bitset* fast_used_blocks = nullptr;
+    // optional and provided in multithreading mode only,
+    // guards used_blocks, fast_used_blocks, used_omap_head and used_nids
+    ceph::mutex* used_lock = nullptr;
+
     FSCK_ObjectCtx(int64_t& e,
                    int64_t& w,
                    uint64_t& _num_objects,
@@ -4141,6 +4446,16 @@ public:
     mempool::bluestore_fsck::list<std::string>* expecting_shards,
     std::map<BlobRef, bluestore_blob_t::unused_t>* referenced,
     BlueStore::FSCK_ObjectCtx& ctx);
+  /// check an object along with the extent shard keys found for it
+  void fsck_check_object(
+    FSCKDepth depth,
+    int64_t pool_id,
+    CollectionRef c,
+    const ghobject_t& oid,
+    const std::string& key,
+    const ceph::buffer::list& value,
+    const mempool::bluestore_fsck::list<std::string>& shard_keys,
+    BlueStore::FSCK_ObjectCtx& ctx);
 #ifdef CEPH_BLUESTORE_TOOL_RESTORE_ALLOCATION
   int  push_allocation_to_rocksdb();
   int  read_allocation_from_drive_for_bluestore_tool();
@@ -4261,6 +4576,13 @@ private:
   int  read_allocation_from_onodes_mt(SimpleBitmap *smbmp, read_alloc_stats_t& stats);
   class OnodeScanMT;
   friend OnodeScanMT;
+
+  class OnodeWarmupMT;
+  friend OnodeWarmupMT;
+  OnodeWarmupMT* onode_warmup = nullptr;
+  void _save_onode_warmup();
+  void _start_onode_warmup();
+  void _stop_onode_warmup();
   int  commit_freelist_type();
   int  commit_to_null_manager();
   int  commit_to_real_manager();
@@ -230,6 +230,11 @@ int32_t Estimator::split_and_compress(
 
 void Estimator::finish()
 {
+  if (actual_compressed == 0) {
+    // nothing got compressed, there is nothing to learn from
+    cleanup();
+    return;
+  }
   dout(25) << "new_size=" << new_size
           << " unc_size=" << total_uncompressed_size
           << " comp_cost=" << total_compressed_size << dendl;
@@ -368,6 +373,67 @@ void Scanner::write_lookaround(
   on_write.on_write_start(offset, length, left_limit, right_limit);
 }
 
+void Scanner::recompress_lookup(
+  BlueStore::Onode* onode,
+  uint32_t window,
+  Estimator* estimator)
+{
+  const auto& extent_map = onode->extent_map.extent_map;
+  // for each compressed blob: end of its rightmost extent
+  // and the bytes of it not visited yet
+  std::map<const Blob*, std::pair<uint32_t, uint32_t>> compressed;
+  for (const auto& e : extent_map) {
+    const bluestore_blob_t& bblob = e.blob->get_blob();
+    if (bblob.is_compressed() && !bblob.is_shared()) {
+      auto& c = compressed[&(*e.blob)];
+      c.first = e.logical_end();
+      c.second += e.length;
+    }
+  }
+  auto i = extent_map.begin();
+  while (i != extent_map.end()) {
+    // a window is stretched so that every compressed blob it touches
+    // is whole inside, otherwise the blob could not be released
+    auto left = i;
+    uint32_t right = p2align(i->logical_offset, window) + window;
+    bool has_compressed = false;
+    for (; i != extent_map.end() && i->logical_offset < right; ++i) {
+      auto c = compressed.find(&(*i->blob));
+      if (c != compressed.end()) {
+        has_compressed = true;
+        right = std::max(right, c->second.first);
+      }
+    }
+    if (!has_compressed) {
+      continue;
+    }
+    for (auto j = left; j != i; ++j) {
+      const bluestore_blob_t& bblob = j->blob->get_blob();
+      if (bblob.is_shared()) {
+        continue;
+      }
+      uint32_t gain = j->length;
+      if (bblob.is_compressed()) {
+        auto& c = compressed[&(*j->blob)];
+        c.second -= j->length;
+        gain = c.second == 0 ? bblob.get_ondisk_size() : 0;
+      }
+      estimator->batch(&(*j), gain);
+    }
+    bool take = estimator->is_worth();
+    dout(20) << fmt::format("recompress_lookup {:#x}~{:#x} {}",
+      left->logical_offset, right - left->logical_offset,
+      take ? "accepted" : "rejected") << dendl;
+    if (take) {
+      for (auto j = left; j != i; ++j) {
+        if (!j->blob->get_blob().is_shared()) {
+          estimator->mark_recompress(&(*j));
+        }
+      }
+    }
+  }
+}
+
 std::ostream& operator<<(
   std::ostream& out, const scan_blob_element_t& b)
 {
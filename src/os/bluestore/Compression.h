@@ -93,6 +93,13 @@ public:
     uint32_t offset, uint32_t length,
     uint32_t left_limit, uint32_t right_limit,
     Estimator* estimator);
+  // Walk the whole object in windows of 'window' bytes and pass to
+  // the estimator the extents of windows that hold compressed data.
+  // Windows accepted by the estimator are marked for recompression.
+  void recompress_lookup(
+    BlueStore::Onode* onode,
+    uint32_t window,
+    Estimator* estimator);
   class Scan;
 };
 #endif
@@ -0,0 +1,102 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:nil -*-
+// vim: ts=8 sw=2 sts=2 expandtab
+
+#include "DeferredPolicy.h"
+
+#include <algorithm>
+
+const char* DeferredPolicy::get_decision_name(decision_t d)
+{
+  switch (d) {
+  case HOLD: return "hold";
+  case RAISE: return "raise";
+  case LOWER_BACKLOG: return "lower_backlog";
+  case LOWER_FAST_DEVICE: return "lower_fast_device";
+  }
+  return "???";
+}
+
+uint64_t DeferredPolicy::_get_effective() const
+{
+  if (level <= MIN_LEVEL) {
+    return 0;
+  }
+  return level >= 0 ? base << level : base >> -level;
+}
+
+uint64_t DeferredPolicy::get_effective() const
+{
+  std::lock_guard l(lock);
+  return _get_effective();
+}
+
+void DeferredPolicy::set_base(uint64_t b)
+{
+  std::lock_guard l(lock);
+  base = b;
+  level = 0;
+}
+
+bool DeferredPolicy::reset(uint64_t* b)
+{
+  std::lock_guard l(lock);
+  *b = base;
+  bool adjusted = level != 0;
+  level = 0;
+  return adjusted;
+}
+
+DeferredPolicy::decision_t DeferredPolicy::update(
+  double backlog,
+  const params_t& p,
+  uint64_t* effective)
+{
+  uint64_t direct_samples, commit_samples;
+  double direct = direct_lat.take(&direct_samples);
+  double commit = commit_lat.take(&commit_samples);
+
+  std::lock_guard l(lock);
+  decision_t d = HOLD;
+  if (backlog >= p.backlog_high) {
+    d = LOWER_BACKLOG;
+  } else if (direct_samples >= p.min_samples && commit_samples > 0) {
+    if (direct > commit * p.raise_ratio && backlog < p.backlog_high / 2) {
+      d = RAISE;
+    } else if (direct < commit * p.lower_ratio) {
+      d = LOWER_FAST_DEVICE;
+    }
+  }
+  int old_level = level;
+  if (d == RAISE) {
+    level = std::min(level + 1, std::max(p.max_level, 0));
+  } else if (d != HOLD) {
+    level = std::max(level - 1, MIN_LEVEL);
+  }
+  if (level > old_level) {
+    ++raises;
+  } else if (level < old_level) {
+    ++lowers;
+  }
+  last_decision = d;
+  last_direct_lat = direct;
+  last_commit_lat = commit;
+  last_direct_samples = direct_samples;
+  last_backlog = backlog;
+  *effective = _get_effective();
+  return d;
+}
+
+void DeferredPolicy::dump(ceph::Formatter* f) const
+{
+  std::lock_guard l(lock);
+  f->dump_unsigned("base", base);
+  f->dump_int("level", level);
+  f->dump_unsigned("effective", _get_effective());
+  f->dump_string("last_decision", get_decision_name(last_decision));
+  f->dump_float("last_direct_aio_wait_lat", last_direct_lat);
+  f->dump_float("last_kv_commit_lat", last_commit_lat);
+  f->dump_unsigned("last_direct_samples", last_direct_samples);
+  f->dump_float("last_deferred_backlog", last_backlog);
+  f->dump_unsigned("raises", raises);
+  f->dump_unsigned("lowers", lowers);
+}
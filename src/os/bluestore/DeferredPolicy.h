@@ -0,0 +1,98 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:nil -*-
+// vim: ts=8 sw=2 sts=2 expandtab
+
+#pragma once
+
+#include <atomic>
+
+#include "common/ceph_mutex.h"
+#include "common/ceph_time.h"
+#include "common/Formatter.h"
+
+/*
+ * Feedback controller for the deferred write threshold.
+ *
+ * Writes smaller than prefer_deferred_size are acked once their data is
+ * in the KV WAL and land in place later, bigger ones wait for the main
+ * device.  Which way is cheaper changes with the load on both devices,
+ * so rather than a fixed threshold this scales the configured one by a
+ * power of two once per interval:
+ *  - down while the deferred backlog is close to its throttle,
+ *  - up while direct aio waits are long compared to KV commits,
+ *  - down while direct aio waits are short compared to KV commits.
+ */
+class DeferredPolicy {
+public:
+  enum decision_t {
+    HOLD,
+    RAISE,
+    LOWER_BACKLOG,
+    LOWER_FAST_DEVICE,
+  };
+  static const char* get_decision_name(decision_t d);
+
+  static constexpr int MIN_LEVEL = -5;   ///< deferring disabled
+
+  struct params_t {
+    int max_level = 2;          ///< threshold capped at base << max_level
+    double backlog_high = 0.5;  ///< deferred throttle fill forcing LOWER
+    double raise_ratio = 1.0;   ///< RAISE if aio wait > commit * raise_ratio
+    double lower_ratio = 0.25;  ///< LOWER if aio wait < commit * lower_ratio
+    uint64_t min_samples = 16;  ///< direct writes needed to judge latency
+  };
+
+private:
+  // latency accumulated between two updates
+  struct window_t {
+    std::atomic<uint64_t> ns = 0;
+    std::atomic<uint64_t> count = 0;
+
+    void add(ceph::timespan lat) {
+      ns += std::chrono::duration_cast<std::chrono::nanoseconds>(lat).count();
+      ++count;
+    }
+    // returns the average in seconds and resets
+    double take(uint64_t* n) {
+      *n = count.exchange(0);
+      uint64_t sum = ns.exchange(0);
+      return *n ? double(sum) / *n / 1e9 : 0.0;
+    }
+  };
+
+  window_t direct_lat;   ///< aio wait of transactions with direct writes
+  window_t commit_lat;   ///< kv commit
+
+  mutable ceph::mutex lock = ceph::make_mutex("DeferredPolicy::lock");
+  uint64_t base = 0;
+  int level = 0;
+  decision_t last_decision = HOLD;
+  double last_direct_lat = 0;
+  double last_commit_lat = 0;
+  uint64_t last_direct_samples = 0;
+  double last_backlog = 0;
+  uint64_t raises = 0;
+  uint64_t lowers = 0;
+
+  uint64_t _get_effective() const;
+
+public:
+  void note_direct(ceph::timespan lat) {
+    direct_lat.add(lat);
+  }
+  void note_commit(ceph::timespan lat) {
+    commit_lat.add(lat);
+  }
+
+  /// configured threshold changed; restart from it
+  void set_base(uint64_t b);
+  /// drop any adjustment, returns true if there was one
+  bool reset(uint64_t* b);
+
+  /// fold in the latencies seen since the last call along with the
+  /// current deferred backlog (0..1 of its throttle); *effective is
+  /// the threshold to use from now on
+  decision_t update(double backlog, const params_t& p, uint64_t* effective);
+
+  uint64_t get_effective() const;
+  void dump(ceph::Formatter* f) const;
+};
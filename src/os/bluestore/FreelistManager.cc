@@ -12,8 +12,13 @@ FreelistManager *FreelistManager::create(
   // a bit of a hack... we hard-code the prefixes here.  we need to
   // put the freelistmanagers in different prefixes because the merge
   // op is per prefix, has to done pre-db-open, and we don't know the
-  // freelist type until after we open the db.
-  ceph_assert(prefix == "B");
+  // freelist type until after we open the db.  "F" is the freelist of
+  // the fast data tier, which is always a bitmap.
+  ceph_assert(prefix == "B" || prefix == "F");
+  if (prefix == "F") {
+    ceph_assert(type == "bitmap");
+    return new BitmapFreelistManager(cct, "F", "f");
+  }
   if (type == "bitmap") {
     return new BitmapFreelistManager(cct, "B", "b");
   }
@@ -31,4 +36,5 @@ void FreelistManager::setup_merge_operators(KeyValueDB *db,
 					    const std::string& type)
 {
   BitmapFreelistManager::setup_merge_operator(db, "b");
+  BitmapFreelistManager::setup_merge_operator(db, "f");
 }
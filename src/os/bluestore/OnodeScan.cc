@@ -17,8 +17,12 @@
 using namespace std;
 
 // kv store prefixes, copied from BlueStore.cc
+const string PREFIX_SUPER = "S";       // field -> value
 const string PREFIX_OBJ = "O";         // object name -> onode_t
 
+// PREFIX_SUPER key holding the onodes to prefetch on mount
+const string ONODE_WARMUP_KEY = "onode_warmup";
+
 #undef dout_prefix
 #define dout_prefix *_dout << "bs.onode_scan "
 #undef dout_context
@@ -362,3 +366,128 @@ int BlueStore::read_allocation_from_onodes_mt(SimpleBitmap *sbmap, read_alloc_st
   return 0;
 }
 
+
+class BlueStore::OnodeWarmupMT {
+  BlueStore& store;
+  std::vector<std::pair<coll_t, ghobject_t>> hot;
+  bool load_shards;
+  std::atomic<size_t> pos = 0;
+  std::atomic<bool> stop = false;
+  std::atomic<size_t> running = 0;
+  std::atomic<uint64_t> loaded = 0;
+  ceph::mono_time started_at;
+  std::vector<std::thread> thr;
+
+  void warmup_thread()
+  {
+    [[maybe_unused]] auto& cct = store.cct;
+    size_t i;
+    while (!stop && (i = pos++) < hot.size()) {
+      auto& [cid, oid] = hot[i];
+      CollectionRef c = store._get_collection(cid);
+      if (!c) {
+        continue;
+      }
+      std::shared_lock l(c->lock);
+      spg_t pgid;
+      if (c->cid.is_pg(&pgid) && !oid.match(c->cnode.bits, pgid.ps())) {
+        // split away since the list was saved
+        continue;
+      }
+      OnodeRef o = c->get_onode(oid, false);
+      if (!o || !o->exists) {
+        continue;
+      }
+      if (load_shards && o->onode.size) {
+        o->extent_map.fault_range(store.db, 0, o->onode.size);
+      }
+      ++loaded;
+    }
+    if (--running == 0) {
+      dout(1) << "onode warmup loaded " << loaded << " of " << hot.size()
+              << " onodes in " << ceph::mono_clock::now() - started_at << dendl;
+    }
+  }
+
+public:
+  OnodeWarmupMT(BlueStore& store,
+                std::vector<std::pair<coll_t, ghobject_t>>&& hot,
+                bool load_shards)
+  : store(store), hot(std::move(hot)), load_shards(load_shards) {}
+
+  void start(size_t num_threads)
+  {
+    started_at = ceph::mono_clock::now();
+    num_threads = std::min(num_threads, hot.size());
+    running = num_threads;
+    for (size_t i = 0; i < num_threads; i++) {
+      thr.emplace_back(&BlueStore::OnodeWarmupMT::warmup_thread, this);
+    }
+  }
+
+  void shutdown()
+  {
+    stop = true;
+    for (auto& t : thr) {
+      t.join();
+    }
+    thr.clear();
+  }
+};
+
+void BlueStore::_save_onode_warmup()
+{
+  size_t max = cct->_conf.get_val<uint64_t>("bluestore_onode_warmup_max");
+  if (max == 0 || onode_cache_shards.empty()) {
+    return;
+  }
+  std::vector<std::pair<coll_t, ghobject_t>> hot;
+  // every shard holds its share of the hottest onodes
+  size_t per_shard = std::max<size_t>(1, max / onode_cache_shards.size());
+  for (auto i : onode_cache_shards) {
+    i->list_hot(per_shard, &hot);
+  }
+  bufferlist bl;
+  encode(hot, bl);
+  KeyValueDB::Transaction t = db->get_transaction();
+  t->set(PREFIX_SUPER, ONODE_WARMUP_KEY, bl);
+  int r = db->submit_transaction_sync(t);
+  dout(5) << __func__ << " saved " << hot.size() << " onodes, "
+          << bl.length() << " bytes, r = " << r << dendl;
+}
+
+void BlueStore::_start_onode_warmup()
+{
+  if (cct->_conf.get_val<uint64_t>("bluestore_onode_warmup_max") == 0) {
+    return;
+  }
+  bufferlist bl;
+  if (db->get(PREFIX_SUPER, ONODE_WARMUP_KEY, &bl) < 0 || bl.length() == 0) {
+    return;
+  }
+  std::vector<std::pair<coll_t, ghobject_t>> hot;
+  try {
+    auto p = bl.cbegin();
+    decode(hot, p);
+  } catch (ceph::buffer::error& e) {
+    derr << __func__ << " failed to decode onode warmup list: " << e.what()
+         << dendl;
+    return;
+  }
+  dout(5) << __func__ << " prefetching " << hot.size() << " onodes" << dendl;
+  ceph_assert(!onode_warmup);
+  onode_warmup = new OnodeWarmupMT(
+    *this, std::move(hot),
+    cct->_conf.get_val<bool>("bluestore_onode_warmup_extent_shards"));
+  onode_warmup->start(
+    cct->_conf.get_val<uint64_t>("bluestore_onode_warmup_threads"));
+}
+
+void BlueStore::_stop_onode_warmup()
+{
+  if (onode_warmup) {
+    onode_warmup->shutdown();
+    delete onode_warmup;
+    onode_warmup = nullptr;
+  }
+}
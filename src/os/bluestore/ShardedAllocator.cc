@@ -0,0 +1,258 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:nil -*-
+// vim: ts=8 sw=2 sts=2 expandtab
+
+#include "ShardedAllocator.h"
+
+#include <sched.h>
+
+#include "HybridAllocator.h"
+#include "common/debug.h"
+
+#define dout_context cct
+#define dout_subsys ceph_subsys_bluestore
+#undef dout_prefix
+#define dout_prefix *_dout << "shardedalloc 0x" << this << " "
+
+ShardedAllocator::ShardedAllocator(CephContext* cct,
+                                   int64_t device_size,
+                                   int64_t _block_size,
+                                   std::string_view _shard_type,
+                                   size_t num_shards,
+                                   std::string_view name)
+  : AllocatorBase(name, device_size, _block_size),
+    cct(cct),
+    shard_type(_shard_type)
+{
+  ceph_assert(block_size > 0);
+  if (num_shards == 0) {
+    num_shards = 1;
+  }
+  // region boundaries are aligned well past any allocation unit asked for
+  // (e.g. bluefs_shared_alloc_size), so that extents aligned within a
+  // region stay aligned on the device
+  uint64_t align = std::max<uint64_t>(block_size, SHARD_ALIGN);
+  shard_size = p2roundup<uint64_t>(
+    std::max<uint64_t>(1, (device_size + num_shards - 1) / num_shards),
+    align);
+  // a small device may not have enough room for all of them
+  num_shards = std::max<uint64_t>(
+    1, std::min<uint64_t>(num_shards,
+                          (device_size + shard_size - 1) / shard_size));
+  // the memory cap of hybrid allocators applies to all the shards together
+  uint64_t max_mem =
+    cct->_conf.get_val<uint64_t>("bluestore_hybrid_alloc_mem_cap") / num_shards;
+  for (size_t i = 0; i < num_shards; i++) {
+    std::string shard_name = std::string(name) + ".shard" + std::to_string(i);
+    int64_t size = i + 1 < num_shards ?
+      shard_size : std::max<int64_t>(device_size - _base(i), block_size);
+    Allocator* a;
+    if (shard_type == "hybrid") {
+      a = new HybridAvlAllocator(cct, size, block_size, max_mem, shard_name);
+    } else if (shard_type == "hybrid_btree2") {
+      a = new HybridBtree2Allocator(cct, size, block_size, max_mem,
+        cct->_conf.get_val<double>("bluestore_btree2_alloc_weight_factor"),
+        shard_name);
+    } else {
+      a = Allocator::create(cct, shard_type, size, block_size, shard_name);
+    }
+    ceph_assert(a);
+    shards.emplace_back(a);
+  }
+  ldout(cct, 1) << __func__ << " " << shards.size() << " x " << shard_type
+                << " shards of 0x" << std::hex << shard_size << std::dec
+                << dendl;
+}
+
+ShardedAllocator::~ShardedAllocator()
+{
+}
+
+size_t ShardedAllocator::_home_shard() const
+{
+#ifdef __linux__
+  int cpu = sched_getcpu();
+  if (cpu >= 0) {
+    return cpu % shards.size();
+  }
+#endif
+  // no CPU information: spread threads over the shards round-robin
+  static std::atomic<size_t> next_thread_shard = 0;
+  static thread_local size_t thread_shard = next_thread_shard++;
+  return thread_shard % shards.size();
+}
+
+int64_t ShardedAllocator::allocate(
+  uint64_t want_size,
+  uint64_t alloc_unit,
+  uint64_t max_alloc_size,
+  int64_t hint,
+  PExtentVector* extents)
+{
+  uint64_t allocated = 0;
+  size_t home = hint > 0 ? _shard_of(hint) : _home_shard();
+  for (size_t i = 0; i < shards.size() && allocated < want_size; i++) {
+    size_t s = (home + i) % shards.size();
+    size_t first = extents->size();
+    int64_t r = shards[s]->allocate(want_size - allocated, alloc_unit,
+                                    max_alloc_size,
+                                    i == 0 && hint > 0 ?
+                                      hint - (int64_t)_base(s) : -1,
+                                    extents);
+    for (size_t j = first; j < extents->size(); j++) {
+      (*extents)[j].offset += _base(s);
+    }
+    if (r > 0) {
+      allocated += r;
+      if (i != 0) {
+        ++steals;
+        ldout(cct, 20) << __func__ << " shard " << home << " short, took 0x"
+                       << std::hex << r << std::dec << " from shard " << s
+                       << dendl;
+      }
+    }
+  }
+  return allocated ? allocated : -ENOSPC;
+}
+
+void ShardedAllocator::release(const release_set_t& release_set)
+{
+  std::vector<release_set_t> per_shard(shards.size());
+  for (auto p = release_set.begin(); p != release_set.end(); ++p) {
+    _split(p.get_start(), p.get_len(),
+      [&](size_t s, uint64_t o, uint64_t l) {
+        per_shard[s].insert(o, l);
+      });
+  }
+  for (size_t s = 0; s < shards.size(); s++) {
+    if (!per_shard[s].empty()) {
+      shards[s]->release(per_shard[s]);
+    }
+  }
+}
+
+uint64_t ShardedAllocator::get_free()
+{
+  uint64_t res = 0;
+  for (auto& a : shards) {
+    res += a->get_free();
+  }
+  return res;
+}
+
+double ShardedAllocator::get_fragmentation()
+{
+  // weighted by the free space of each shard, like HybridAllocator does
+  uint64_t total = 0;
+  double res = 0;
+  for (auto& a : shards) {
+    uint64_t f = a->get_free();
+    res += a->get_fragmentation() * f;
+    total += f;
+  }
+  return total ? res / total : 0.0;
+}
+
+void ShardedAllocator::dump()
+{
+  for (size_t s = 0; s < shards.size(); s++) {
+    ldout(cct, 0) << __func__ << " shard " << s << " at 0x" << std::hex
+                  << _base(s) << std::dec << dendl;
+    shards[s]->dump();
+  }
+}
+
+void ShardedAllocator::foreach(
+  std::function<void(uint64_t offset, uint64_t length)> notify)
+{
+  // free extents crossing a region boundary are reported whole, so that
+  // the fragmentation score and histograms don't see the sharding
+  uint64_t pending_off = 0;
+  uint64_t pending_len = 0;
+  for (size_t s = 0; s < shards.size(); s++) {
+    shards[s]->foreach(
+      [&, base = _base(s)](uint64_t off, uint64_t len) {
+        off += base;
+        if (pending_len && pending_off + pending_len == off) {
+          pending_len += len;
+          return;
+        }
+        if (pending_len) {
+          notify(pending_off, pending_len);
+        }
+        pending_off = off;
+        pending_len = len;
+      });
+  }
+  if (pending_len) {
+    notify(pending_off, pending_len);
+  }
+}
+
+uint64_t ShardedAllocator::get_free_extents(
+  uint64_t range_begin,
+  uint64_t range_end,
+  size_t max_count,
+  free_extent_vector_t* out)
+{
+  size_t start_size = out->size();
+  uint64_t pos = range_begin;
+  while (pos < range_end) {
+    size_t s = _shard_of(pos);
+    uint64_t base = _base(s);
+    uint64_t shard_end = s + 1 < shards.size() ?
+      std::min(range_end, _base(s + 1)) : range_end;
+    size_t left = 0;
+    if (max_count) {
+      left = max_count - (out->size() - start_size);
+    }
+    size_t first = out->size();
+    uint64_t cursor = shards[s]->get_free_extents(
+      pos - base, shard_end - base, left, out) + base;
+    for (size_t i = first; i < out->size(); i++) {
+      (*out)[i].offset += base;
+    }
+    if (cursor < shard_end) {
+      return cursor;
+    }
+    pos = shard_end;
+    if (max_count && out->size() - start_size >= max_count) {
+      break;
+    }
+  }
+  return pos;
+}
+
+void ShardedAllocator::init_add_free(uint64_t offset, uint64_t length)
+{
+  ldout(cct, 10) << __func__ << " 0x" << std::hex << offset << "~" << length
+                 << std::dec << dendl;
+  _split(offset, length,
+    [&](size_t s, uint64_t o, uint64_t l) {
+      shards[s]->init_add_free(o, l);
+    });
+}
+
+void ShardedAllocator::init_rm_free(uint64_t offset, uint64_t length)
+{
+  ldout(cct, 10) << __func__ << " 0x" << std::hex << offset << "~" << length
+                 << std::dec << dendl;
+  _split(offset, length,
+    [&](size_t s, uint64_t o, uint64_t l) {
+      shards[s]->init_rm_free(o, l);
+    });
+}
+
+void ShardedAllocator::expand(int64_t new_size)
+{
+  // the new space lands in the last region
+  shards.back()->expand(new_size - _base(shards.size() - 1));
+  AllocatorBase::expand(new_size);
+}
+
+void ShardedAllocator::shutdown()
+{
+  ldout(cct, 1) << __func__ << " steals " << steals << dendl;
+  for (auto& a : shards) {
+    a->shutdown();
+  }
+}
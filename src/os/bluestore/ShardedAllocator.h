@@ -0,0 +1,96 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:nil -*-
+// vim: ts=8 sw=2 sts=2 expandtab
+
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "AllocatorBase.h"
+
+/*
+ * Front-end splitting the device into equally sized regions, each one
+ * served by its own allocator instance (and hence its own lock).
+ * A thread allocates from the region assigned to the CPU it runs on and
+ * falls back to the other regions once that one runs short of space.
+ * Releases go to the region owning the extent.
+ *
+ * Each shard is sized to its region and addresses it from 0, so offsets
+ * are translated on the way in and out.
+ */
+class ShardedAllocator : public AllocatorBase {
+  static constexpr uint64_t SHARD_ALIGN = 1ull << 20;
+
+  CephContext* cct;
+  std::string shard_type;
+  uint64_t shard_size = 0;
+  std::vector<std::unique_ptr<Allocator>> shards;
+  std::atomic<uint64_t> steals = 0; ///< allocations served by a foreign shard
+
+  size_t _shard_of(uint64_t offset) const {
+    return std::min<size_t>(offset / shard_size, shards.size() - 1);
+  }
+  uint64_t _base(size_t s) const {
+    return s * shard_size;
+  }
+  size_t _home_shard() const;
+
+  // call f(shard, offset, length) for every per-shard piece of the extent,
+  // with offset relative to the shard's region
+  template <typename F>
+  void _split(uint64_t offset, uint64_t length, F&& f) {
+    while (length > 0) {
+      size_t s = _shard_of(offset);
+      uint64_t l = s + 1 < shards.size() ?
+        std::min(length, _base(s + 1) - offset) : length;
+      f(s, offset - _base(s), l);
+      offset += l;
+      length -= l;
+    }
+  }
+
+public:
+  ShardedAllocator(CephContext* cct,
+                   int64_t device_size,
+                   int64_t block_size,
+                   std::string_view shard_type,
+                   size_t num_shards,
+                   std::string_view name);
+  ~ShardedAllocator() override;
+
+  const char* get_type() const override
+  {
+    return "sharded";
+  }
+
+  int64_t allocate(
+    uint64_t want_size, uint64_t alloc_unit, uint64_t max_alloc_size,
+    int64_t hint, PExtentVector *extents) override;
+
+  void release(const release_set_t& release_set) override;
+
+  uint64_t get_free() override;
+  double get_fragmentation() override;
+
+  void dump() override;
+  void foreach(
+    std::function<void(uint64_t offset, uint64_t length)> notify) override;
+  uint64_t get_free_extents(
+    uint64_t range_begin,
+    uint64_t range_end,
+    size_t max_count,
+    free_extent_vector_t* out) override;
+
+  void init_add_free(uint64_t offset, uint64_t length) override;
+  void init_rm_free(uint64_t offset, uint64_t length) override;
+
+  void expand(int64_t new_size) override;
+  void shutdown() override;
+
+  size_t get_shard_count() const {
+    return shards.size();
+  }
+  uint64_t get_steals() const {
+    return steals;
+  }
+};
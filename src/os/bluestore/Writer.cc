@@ -723,7 +723,10 @@ inline void BlueStore::Writer::_schedule_io_masked(
       bufferlist ddata;
       data.splice(0, chunk_size, &ddata);
       if (chunk_is_unused) {
-        bstore->bdev->aio_write(disk_position, ddata, &txc->ioc, false);
+        txc->wa.device_bytes += ddata.length();
+        wctx->note_io_error(
+          bstore->_data_aio_write(disk_position, ddata, &txc->ioc,
+                                  &txc->ioc_fast, false));
         bstore->logger->inc(l_bluestore_write_small_unused);
       } else {
         bluestore_deferred_op_t *op = bstore->_get_deferred_op(txc, ddata.length());
@@ -775,7 +778,10 @@ inline void BlueStore::Writer::_schedule_io(
       for (const auto& loc : disk_extents) {
         bufferlist data_chunk;
         data.splice(0, loc.length, &data_chunk);
-        bstore->bdev->aio_write(loc.offset, data_chunk, &txc->ioc, false);
+        txc->wa.device_bytes += data_chunk.length();
+        wctx->note_io_error(
+          bstore->_data_aio_write(loc.offset, data_chunk, &txc->ioc,
+                                  &txc->ioc_fast, false));
       }
       ceph_assert(data.length() == 0);
     }
@@ -1327,7 +1333,8 @@ void BlueStore::Writer::_defer_or_allocate(uint32_t need_size)
     statfs_delta.allocated() += need_size;
     disk_allocs.pos = 0;
   } else {
-    int64_t new_alloc_size = bstore->alloc->allocate(need_size, au_size, 0, 0, &allocated);
+    int64_t new_alloc_size = bstore->_allocate_data(
+      txc, onode.get(), need_size, au_size, 0, 0, &allocated);
     ceph_assert(need_size == new_alloc_size);
     statfs_delta.allocated() += new_alloc_size;
     disk_allocs.it = allocated.begin();
@@ -313,6 +313,7 @@ int main(int argc, char **argv)
   string resharding_ctrl;
   int log_level = 30;
   bool fsck_deep = false;
+  int fsck_threads = -1;
   uint64_t disk_offset;
   po::options_description po_options("Options");
   po_options.add_options()
@@ -330,6 +331,7 @@ int main(int argc, char **argv)
     ("devs-source", po::value<vector<string>>(&devs_source), "bluefs-dev-migrate source device(s)")
     ("dev-target", po::value<string>(&dev_target), "target/resulting device")
     ("deep", po::value<bool>(&fsck_deep), "deep fsck (read all data)")
+    ("threads", po::value<int>(&fsck_threads), "number of additional threads to check objects with in fsck/repair/quick-fix")
     ("key,k", po::value<string>(&key), "label metadata key name")
     ("value,v", po::value<string>(&value), "label metadata value")
     ("allocator", po::value<vector<string>>(&allocs_name), "allocator to inspect: 'block'/'bluefs-wal'/'bluefs-db'")
@@ -735,6 +737,14 @@ int main(int argc, char **argv)
       action == "quick-fix" ||
       action == "revert-wal-to-plain") {
     validate_path(cct.get(), path, false);
+    if (fsck_threads >= 0) {
+      // make sure we can adjust any config settings
+      g_conf()._clear_safe_to_start_threads();
+      g_conf().set_val_or_die("bluestore_fsck_threads",
+                              stringify(fsck_threads));
+      g_conf().set_val_or_die("bluestore_fsck_quick_fix_threads",
+                              stringify(fsck_threads));
+    }
     BlueStore bluestore(cct.get(), path);
     int r;
     if (action == "fsck") {
@@ -110,6 +110,10 @@ struct bluestore_interval_t
 
 };
 
+/// physical offsets starting here address the optional fast data tier
+/// (block.fast), at offset - BLUESTORE_FAST_TIER_BASE on that device
+static constexpr uint64_t BLUESTORE_FAST_TIER_BASE = 1ull << 60;
+
 /// pextent: physical extent
 struct bluestore_pextent_t : public bluestore_interval_t<uint64_t, uint32_t> 
 {
@@ -118,6 +122,10 @@ struct bluestore_pextent_t : public bluestore_interval_t<uint64_t, uint32_t>
   bluestore_pextent_t(const bluestore_interval_t &ext) :
     bluestore_interval_t(ext.offset, ext.length) {}
 
+  bool is_fast_tier() const {
+    return is_valid() && offset >= BLUESTORE_FAST_TIER_BASE;
+  }
+
   DENC(bluestore_pextent_t, v, p) {
     denc_lba(v.offset, p);
     denc_varint_lowz(v.length, p);
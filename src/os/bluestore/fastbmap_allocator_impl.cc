@@ -9,6 +9,146 @@
 
 #include "fastbmap_allocator_impl.h"
 
+#include "common/cpu_dispatch.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define FASTBMAP_HAVE_X86_KERNELS
+#endif
+
+static size_t slots_find_first_not_scalar(const slot_t* v, size_t n,
+  slot_t val)
+{
+  size_t i = 0;
+  while (i < n && v[i] == val) {
+    ++i;
+  }
+  return i;
+}
+
+static uint64_t slots_count_bits_scalar(const slot_t* v, size_t n)
+{
+  uint64_t res = 0;
+  for (size_t i = 0; i < n; ++i) {
+    res += std::popcount(v[i]);
+  }
+  return res;
+}
+
+#ifdef FASTBMAP_HAVE_X86_KERNELS
+__attribute__((target("avx2")))
+static size_t slots_find_first_not_avx2(const slot_t* v, size_t n,
+  slot_t val)
+{
+  const __m256i x = _mm256_set1_epi64x(val);
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256i eq = _mm256_cmpeq_epi64(
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(v + i)), x);
+    unsigned m = ~_mm256_movemask_pd(_mm256_castsi256_pd(eq)) & 0xf;
+    if (m) {
+      return i + std::countr_zero(m);
+    }
+  }
+  return i + slots_find_first_not_scalar(v + i, n - i, val);
+}
+
+// Mula's nibble lookup, summed per 64-bit lane with psadbw
+__attribute__((target("avx2")))
+static uint64_t slots_count_bits_avx2(const slot_t* v, size_t n)
+{
+  const __m256i lookup = _mm256_setr_epi8(
+    0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+    0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+  const __m256i low_mask = _mm256_set1_epi8(0x0f);
+  __m256i acc = _mm256_setzero_si256();
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(v + i));
+    __m256i lo = _mm256_and_si256(x, low_mask);
+    __m256i hi = _mm256_and_si256(_mm256_srli_epi16(x, 4), low_mask);
+    __m256i cnt = _mm256_add_epi8(_mm256_shuffle_epi8(lookup, lo),
+                                  _mm256_shuffle_epi8(lookup, hi));
+    acc = _mm256_add_epi64(acc,
+                           _mm256_sad_epu8(cnt, _mm256_setzero_si256()));
+  }
+  uint64_t res = _mm256_extract_epi64(acc, 0) + _mm256_extract_epi64(acc, 1) +
+                 _mm256_extract_epi64(acc, 2) + _mm256_extract_epi64(acc, 3);
+  return res + slots_count_bits_scalar(v + i, n - i);
+}
+
+__attribute__((target("avx512f")))
+static size_t slots_find_first_not_avx512(const slot_t* v, size_t n,
+  slot_t val)
+{
+  const __m512i x = _mm512_set1_epi64(val);
+  size_t i = 0;
+  // a slotset is exactly one zmm register
+  for (; i + 8 <= n; i += 8) {
+    __mmask8 m = _mm512_cmpneq_epi64_mask(_mm512_loadu_si512(v + i), x);
+    if (m) {
+      return i + std::countr_zero(unsigned(m));
+    }
+  }
+  return i + slots_find_first_not_avx2(v + i, n - i, val);
+}
+
+__attribute__((target("avx512f,avx512vpopcntdq")))
+static uint64_t slots_count_bits_avx512(const slot_t* v, size_t n)
+{
+  __m512i acc = _mm512_setzero_si512();
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    acc = _mm512_add_epi64(acc,
+                           _mm512_popcnt_epi64(_mm512_loadu_si512(v + i)));
+  }
+  return _mm512_reduce_add_epi64(acc) +
+         slots_count_bits_scalar(v + i, n - i);
+}
+#endif
+
+struct slots_scan_ops_t {
+  const char* name;
+  size_t (*find_first_not)(const slot_t*, size_t, slot_t);
+  uint64_t (*count_bits)(const slot_t*, size_t);
+  bool (*supported)();
+};
+
+static const slots_scan_ops_t slots_scan_ops[] = {
+#ifdef FASTBMAP_HAVE_X86_KERNELS
+  { "avx512", slots_find_first_not_avx512, slots_count_bits_avx512,
+    [] { return __builtin_cpu_supports("avx512f") &&
+                __builtin_cpu_supports("avx512vpopcntdq") &&
+                __builtin_cpu_supports("avx2"); } },
+  { "avx2", slots_find_first_not_avx2, slots_count_bits_avx2,
+    [] { return bool(__builtin_cpu_supports("avx2")); } },
+#endif
+  { "scalar", slots_find_first_not_scalar, slots_count_bits_scalar,
+    [] { return true; } },
+};
+
+static ceph::cpu_dispatch_t<slots_scan_ops_t> slots_scan{slots_scan_ops};
+
+size_t slots_find_first_not(const slot_t* v, size_t n, slot_t val)
+{
+  return slots_scan.get().find_first_not(v, n, val);
+}
+
+uint64_t slots_count_bits(const slot_t* v, size_t n)
+{
+  return slots_scan.get().count_bits(v, n);
+}
+
+const char* slots_scan_impl()
+{
+  return slots_scan.name();
+}
+
+bool slots_scan_set_impl(std::string_view name)
+{
+  return slots_scan.set(name);
+}
+
 uint64_t AllocatorLevel::l0_dives = 0;
 uint64_t AllocatorLevel::l0_iterations = 0;
 uint64_t AllocatorLevel::l0_inner_iterations = 0;
@@ -30,7 +170,6 @@ interval_t AllocatorLevel01Loose::_get_longest_from_l0(uint64_t pos0,
   if (pos0 >= pos1) {
     return res;
   }
-  auto pos = pos0;
 
   interval_t res_candidate;
   if (tail->length != 0) {
@@ -42,73 +181,48 @@ interval_t AllocatorLevel01Loose::_get_longest_from_l0(uint64_t pos0,
   *tail = interval_t();
 
   auto d = bits_per_slot;
-  slot_t bits = l0[pos / d];
-  bits >>= pos % d;
-  bool end_loop = false;
   auto min_granules = min_length / l0_granularity;
+  auto close_candidate = [&]() {
+    res_candidate = _align2units(res_candidate.offset,
+      res_candidate.length, min_granules);
+    if (res.length < res_candidate.length) {
+      res = res_candidate;
+    }
+    res_candidate = interval_t();
+  };
 
-  do {
-    if ((pos % d) == 0) {
-      bits = l0[pos / d];
-      if (pos1 - pos >= d) {
-        switch(bits) {
-	  case all_slot_set:
-	    // slot is totally free
-	    if (!res_candidate.length) {
-	      res_candidate.offset = pos;
-	    }
-	    res_candidate.length += d;
-	    pos += d;
-	    end_loop = pos >= pos1;
-	    if (end_loop) {
-	      *tail = res_candidate;
-	      res_candidate = _align2units(res_candidate.offset,
-		res_candidate.length, min_granules);
-	      if(res.length < res_candidate.length) {
-		res = res_candidate;
-	      }
-	    }
-	    continue;
-	  case all_slot_clear:
-	    // slot is totally allocated
-	    res_candidate = _align2units(res_candidate.offset,
-	      res_candidate.length, min_granules);
-	    if (res.length < res_candidate.length) {
-	      res = res_candidate;
-	    }
-	    res_candidate = interval_t();
-	    pos += d;
-	    end_loop = pos >= pos1;
-	    continue;
-	}
-      }
-    } //if ((pos % d) == 0)
-
-    end_loop = ++pos >= pos1;
-    if (bits & 1) {
-      // item is free
-      if (!res_candidate.length) {
-	res_candidate.offset = pos - 1;
-      }
-      ++res_candidate.length;
-      if (end_loop) {
-	*tail = res_candidate;
-	res_candidate = _align2units(res_candidate.offset,
-	  res_candidate.length, min_granules);
-	if (res.length < res_candidate.length) {
-	  res = res_candidate;
-	}
-      }
-    } else {
-      res_candidate = _align2units(res_candidate.offset,
-	res_candidate.length, min_granules);
-      if (res.length < res_candidate.length) {
-	res = res_candidate;
+  // walk runs of free/allocated bits a word at a time rather than bit by bit
+  auto pos = pos0;
+  while (pos < pos1) {
+    uint64_t base = p2align<uint64_t>(pos, d);
+    uint64_t width = std::min<uint64_t>(pos1 - base, d) - (pos - base);
+    slot_t bits = l0[pos / d] >> (pos - base);
+    if (width < d) {
+      bits &= (slot_t(1) << width) - 1;
+    }
+    uint64_t p = 0;
+    while (p < width) {
+      uint64_t n;
+      if (bits & 1) {
+        // item is free
+        n = std::min<uint64_t>(std::countr_one(bits), width - p);
+        if (!res_candidate.length) {
+          res_candidate.offset = pos + p;
+        }
+        res_candidate.length += n;
+      } else {
+        n = std::min<uint64_t>(std::countr_zero(bits), width - p);
+        close_candidate();
       }
-      res_candidate = interval_t();
+      p += n;
+      bits = n < d ? bits >> n : 0;
     }
-    bits >>= 1;
-  } while (!end_loop);
+    pos += width;
+  }
+  // a run reaching pos1 may continue in the next slotset
+  *tail = res_candidate;
+  close_candidate();
+
   res.offset *= l0_granularity;
   res.length *= l0_granularity;
   tail->offset *= l0_granularity;
@@ -132,9 +246,18 @@ void AllocatorLevel01Loose::_analyze_partials(uint64_t pos_start,
 
   uint64_t next_free_l1_pos = 0;
   for (auto pos = pos_start / d; pos < pos_end / d; ++pos) {
+    // skip fully allocated slots in bulk
+    auto full = slots_find_first_not(l1.data() + pos, pos_end / d - pos,
+                                     all_slot_clear);
+    if (full) {
+      prev_tail = empty_tail;
+      pos += full;
+      l1_pos += full * d;
+      if (pos == pos_end / d) {
+        break;
+      }
+    }
     slot_t slot_val = l1[pos];
-    // FIXME minor: code below can be optimized to check slot_val against
-    // all_slot_set(_clear) value
 
     for (auto c = 0; c < d; c++) {
       switch (slot_val & L1_ENTRY_MASK) {
@@ -208,64 +331,47 @@ void AllocatorLevel01Loose::_mark_l1_on_l0(int64_t l0_pos, int64_t l0_pos_end)
 
   int64_t idx = l0_pos / bits_per_slot;
   int64_t idx_end = l0_pos_end / bits_per_slot;
-  slot_t mask_to_apply = L1_ENTRY_NOT_USED;
 
   auto l1_pos = l0_pos / d0;
 
-  while (idx < idx_end) {
-    if (l0[idx] == all_slot_clear) {
-      // if not all prev slots are allocated then no need to check the
-      // current slot set, it's partial
-      ++idx;
-      if (mask_to_apply == L1_ENTRY_NOT_USED) {
-	mask_to_apply = L1_ENTRY_FULL;
-      } else if (mask_to_apply != L1_ENTRY_FULL) {
-	idx = p2roundup(idx, int64_t(slots_per_slotset));
-        mask_to_apply = L1_ENTRY_PARTIAL;
+  for (; idx < idx_end; idx += slots_per_slotset, ++l1_pos) {
+    const slot_t* slotset = l0.data() + idx;
+    // the first slot tells which uniform state is still possible
+    slot_t mask_to_apply = L1_ENTRY_PARTIAL;
+    if (slotset[0] == all_slot_clear) {
+      if (slots_find_first_not(slotset, slots_per_slotset, all_slot_clear) ==
+          slots_per_slotset) {
+        mask_to_apply = L1_ENTRY_FULL;
       }
-    } else if (l0[idx] == all_slot_set) {
-      // if not all prev slots are free then no need to check the
-      // current slot set, it's partial
-      ++idx;
-      if (mask_to_apply == L1_ENTRY_NOT_USED) {
-	mask_to_apply = L1_ENTRY_FREE;
-      } else if (mask_to_apply != L1_ENTRY_FREE) {
-	idx = p2roundup(idx, int64_t(slots_per_slotset));
-        mask_to_apply = L1_ENTRY_PARTIAL;
+    } else if (slotset[0] == all_slot_set) {
+      if (slots_find_first_not(slotset, slots_per_slotset, all_slot_set) ==
+          slots_per_slotset) {
+        mask_to_apply = L1_ENTRY_FREE;
       }
-    } else {
-      // no need to check the current slot set, it's partial
-      mask_to_apply = L1_ENTRY_PARTIAL;
-      ++idx;
-      idx = p2roundup(idx, int64_t(slots_per_slotset));
     }
-    if ((idx % slots_per_slotset) == 0) {
-      ceph_assert(mask_to_apply != L1_ENTRY_NOT_USED);
-      uint64_t shift = (l1_pos % l1_w) * L1_ENTRY_WIDTH;
-      slot_t& slot_val = l1[l1_pos / l1_w];
-      auto mask = slot_t(L1_ENTRY_MASK) << shift;
-
-      slot_t old_mask = (slot_val & mask) >> shift;
-      switch(old_mask) {
-      case L1_ENTRY_FREE:
-	unalloc_l1_count--;
-	break;
-      case L1_ENTRY_PARTIAL:
-	partial_l1_count--;
-	break;
-      }
-      slot_val &= ~mask;
-      slot_val |= slot_t(mask_to_apply) << shift;
-      switch(mask_to_apply) {
-      case L1_ENTRY_FREE:
-	unalloc_l1_count++;
-	break;
-      case L1_ENTRY_PARTIAL:
-	partial_l1_count++;
-	break;
-      }
-      mask_to_apply = L1_ENTRY_NOT_USED;
-      ++l1_pos;
+
+    uint64_t shift = (l1_pos % l1_w) * L1_ENTRY_WIDTH;
+    slot_t& slot_val = l1[l1_pos / l1_w];
+    auto mask = slot_t(L1_ENTRY_MASK) << shift;
+
+    slot_t old_mask = (slot_val & mask) >> shift;
+    switch(old_mask) {
+    case L1_ENTRY_FREE:
+      unalloc_l1_count--;
+      break;
+    case L1_ENTRY_PARTIAL:
+      partial_l1_count--;
+      break;
+    }
+    slot_val &= ~mask;
+    slot_val |= slot_t(mask_to_apply) << shift;
+    switch(mask_to_apply) {
+    case L1_ENTRY_FREE:
+      unalloc_l1_count++;
+      break;
+    case L1_ENTRY_PARTIAL:
+      partial_l1_count++;
+      break;
     }
   }
 }
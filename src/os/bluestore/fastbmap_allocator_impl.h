@@ -73,6 +73,24 @@ inline size_t find_next_set_bit(slot_t slot_val, size_t start_pos)
   return start_pos;
 }
 
+// -----------------------------------------------------------------------
+// Scans over arrays of slots. The implementation is picked on first use:
+// AVX-512 or AVX2 kernels where the CPU supports them, plain C++ otherwise.
+// -----------------------------------------------------------------------
+
+// Index of the first of the n slots at v that differs from val, n if none.
+size_t slots_find_first_not(const slot_t* v, size_t n, slot_t val);
+
+// Number of set bits in the n slots at v.
+uint64_t slots_count_bits(const slot_t* v, size_t n);
+
+// Name of the implementation in use: "scalar", "avx2" or "avx512".
+const char* slots_scan_impl();
+
+// Switch to the named implementation ("auto" picks the best one available).
+// Returns false if the CPU doesn't support it. Meant for tests/benchmarks.
+bool slots_scan_set_impl(std::string_view name);
+
 // -----------------------------------------------------------------------
 // L0 bit-range primitives, shared by the free-extent walk (see
 // AllocatorLevel01Loose::get_free_extents_internal) and by any level of
@@ -489,33 +507,26 @@ protected:
 
   bool _is_empty_l0(uint64_t l0_pos, uint64_t l0_pos_end)
   {
-    bool no_free = true;
     uint64_t d = slots_per_slotset * L0_ENTRIES_PER_SLOT;
     ceph_assert(0 == (l0_pos % d));
     ceph_assert(0 == (l0_pos_end % d));
 
     auto idx = l0_pos / L0_ENTRIES_PER_SLOT;
     auto idx_end = l0_pos_end / L0_ENTRIES_PER_SLOT;
-    while (idx < idx_end && no_free) {
-      no_free = l0[idx] == all_slot_clear;
-      ++idx;
-    }
-    return no_free;
+    return slots_find_first_not(l0.data() + idx, idx_end - idx,
+                                all_slot_clear) == idx_end - idx;
   }
   bool _is_empty_l1(uint64_t l1_pos, uint64_t l1_pos_end)
   {
-    bool no_free = true;
     uint64_t d = slots_per_slotset * _children_per_slot();
     ceph_assert(0 == (l1_pos % d));
     ceph_assert(0 == (l1_pos_end % d));
 
     auto idx = l1_pos / L1_ENTRIES_PER_SLOT;
     auto idx_end = l1_pos_end / L1_ENTRIES_PER_SLOT;
-    while (idx < idx_end && no_free) {
-      no_free = _is_slot_fully_allocated(idx);
-      ++idx;
-    }
-    return no_free;
+    // fully allocated L1 slots are all_slot_clear
+    return slots_find_first_not(l1.data() + idx, idx_end - idx,
+                                all_slot_clear) == idx_end - idx;
   }
 
   interval_t _allocate_l1_contiguous(uint64_t length,
@@ -594,25 +605,7 @@ public:
       idx1 = l0.size();
     }
 
-    uint64_t res = 0;
-    for (uint64_t i = idx0; i < idx1; ++i) {
-      auto v = l0[i];
-      if (v == all_slot_set) {
-        res += L0_ENTRIES_PER_SLOT;
-      } else if (v != all_slot_clear) {
-        size_t cnt = 0;
-#ifdef __GNUC__
-        cnt = __builtin_popcountll(v);
-#else
-        // Kernighan's Alg to count set bits
-        while (v) {
-          v &= (v - 1);
-          cnt++;
-        }
-#endif
-        res += cnt;
-      }
-    }
+    uint64_t res = slots_count_bits(l0.data() + idx0, idx1 - idx0);
     return res * l0_granularity;
   }
   void collect_stats(
@@ -134,6 +134,12 @@ void MemStore::dump(ceph::Formatter *f)
     f->close_section();
   }
   f->close_section();
+
+  if (page_arena) {
+    f->open_object_section("page_arena");
+    page_arena->dump(f);
+    f->close_section();
+  }
 }
 
 int MemStore::_load()
@@ -158,7 +164,7 @@ int MemStore::_load()
     int r = cbl.read_file(fn.c_str(), &err);
     if (r < 0)
       return r;
-    auto c = ceph::make_ref<Collection>(cct, *q);
+    auto c = ceph::make_ref<Collection>(cct, *q, page_arena);
     auto p = cbl.cbegin();
     c->decode(p);
     coll_map[*q] = c;
@@ -259,7 +265,7 @@ MemStore::CollectionRef MemStore::get_collection(const coll_t& cid)
 ObjectStore::CollectionHandle MemStore::create_new_collection(const coll_t& cid)
 {
   std::lock_guard l{coll_lock};
-  auto c = ceph::make_ref<Collection>(cct, cid);
+  auto c = ceph::make_ref<Collection>(cct, cid, page_arena);
   new_coll_map[cid] = c;
   return c;
 }
@@ -1773,7 +1779,61 @@ int MemStore::PageSetObject::truncate(uint64_t size)
 }
 
 
+// ArenaObject
+
+struct MemStore::ArenaObject : public Object {
+  ArenaPageSet data;
+  uint64_t data_len = 0;
+
+  size_t get_size() const override { return data_len; }
+
+  int read(uint64_t offset, uint64_t len, ceph::buffer::list &bl) override {
+    data.read(offset, len, bl);
+    return len;
+  }
+  int write(uint64_t offset, const ceph::buffer::list &bl) override {
+    data.write(offset, bl);
+    data_len = std::max<uint64_t>(data_len, offset + bl.length());
+    return 0;
+  }
+  int clone(Object *src, uint64_t srcoff, uint64_t len,
+            uint64_t dstoff) override {
+    data.clone(static_cast<ArenaObject*>(src)->data, srcoff, len, dstoff);
+    data_len = std::max(data_len, dstoff + len);
+    return 0;
+  }
+  int truncate(uint64_t size) override {
+    data.truncate(size);
+    data_len = size;
+    return 0;
+  }
+
+  // encoded like PageSetObject
+  void encode(ceph::buffer::list& bl) const override {
+    ENCODE_START(1, 1, bl);
+    encode(data_len, bl);
+    data.encode(bl);
+    encode_base(bl);
+    ENCODE_FINISH(bl);
+  }
+  void decode(ceph::buffer::list::const_iterator& p) override {
+    DECODE_START(1, p);
+    decode(data_len, p);
+    data.decode(p);
+    decode_base(p);
+    DECODE_FINISH(p);
+  }
+
+private:
+  FRIEND_MAKE_REF(ArenaObject);
+  explicit ArenaObject(std::shared_ptr<PageArena> arena)
+    : data(std::move(arena)) {}
+};
+
+
 MemStore::ObjectRef MemStore::Collection::create_object() const {
+  if (use_page_set && page_arena)
+    return ceph::make_ref<ArenaObject>(page_arena);
   if (use_page_set)
     return ceph::make_ref<PageSetObject>(cct->_conf->memstore_page_size);
   return make_ref<BufferlistObject>();
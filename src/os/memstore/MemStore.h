@@ -18,6 +18,7 @@
 #define CEPH_MEMSTORE_H
 
 #include <atomic>
+#include <memory>
 #include <mutex>
 #include <shared_mutex> // for std::shared_lock
 #include <unordered_map>
@@ -27,6 +28,7 @@
 #include "common/Finisher.h"
 #include "common/RefCountedObj.h"
 #include "os/ObjectStore.h"
+#include "PageArena.h"
 #include "PageSet.h"
 #include "include/ceph_assert.h"
 
@@ -92,10 +94,12 @@ public:
   using ObjectRef = Object::Ref;
 
   struct PageSetObject;
+  struct ArenaObject;
   struct Collection : public CollectionImpl {
     int bits = 0;
     CephContext *cct;
     bool use_page_set;
+    std::shared_ptr<PageArena> page_arena;  ///< if set, page set objects use it
     std::unordered_map<ghobject_t, ObjectRef> object_hash;  ///< for lookup
     std::map<ghobject_t, ObjectRef> object_map;        ///< for iteration
     std::map<std::string,ceph::buffer::ptr> xattr;
@@ -178,10 +182,12 @@ public:
 
   private:
     FRIEND_MAKE_REF(Collection);
-    explicit Collection(CephContext *cct, coll_t c)
+    Collection(CephContext *cct, coll_t c,
+	       std::shared_ptr<PageArena> page_arena)
       : CollectionImpl(cct, c),
 	cct(cct),
-	use_page_set(cct->_conf->memstore_page_set) {}
+	use_page_set(cct->_conf->memstore_page_set),
+	page_arena(std::move(page_arena)) {}
   };
   typedef Collection::Ref CollectionRef;
 
@@ -198,6 +204,9 @@ private:
 
   std::atomic<uint64_t> used_bytes;
 
+  /// pages for all page set objects, if memstore_page_arena is set
+  std::shared_ptr<PageArena> page_arena;
+
   void _do_transaction(Transaction& t);
 
   int _touch(const coll_t& cid, const ghobject_t& oid);
@@ -240,7 +249,15 @@ public:
   MemStore(CephContext *cct, const std::string& path)
     : ObjectStore(cct, path),
       finisher(cct),
-      used_bytes(0) {}
+      used_bytes(0) {
+    if (cct->_conf->memstore_page_set &&
+	cct->_conf.get_val<bool>("memstore_page_arena")) {
+      page_arena = std::make_shared<PageArena>(
+	cct, cct->_conf->memstore_page_size,
+	cct->_conf.get_val<Option::size_t>("memstore_page_arena_size"),
+	cct->_conf.get_val<bool>("memstore_page_arena_hugetlb"));
+    }
+  }
   ~MemStore() override { }
 
   std::string get_type() override {
@@ -0,0 +1,383 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:nil -*-
+// vim: ts=8 sw=2 sts=2 expandtab
+
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include "PageArena.h"
+
+#include <sys/mman.h>
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <new>
+
+#include "common/debug.h"
+#include "common/deleter.h"
+#include "common/errno.h"
+#include "common/Formatter.h"
+#include "include/ceph_assert.h"
+#include "include/intarith.h"
+
+#define dout_context cct
+#define dout_subsys ceph_subsys_memstore
+#undef dout_prefix
+#define dout_prefix *_dout << "memstore.arena(" << this << ") "
+
+// PageArena
+
+PageArena::PageArena(CephContext *cct, size_t page_size, size_t arena_size,
+                     bool hugetlb)
+  : cct(cct),
+    page_size(page_size),
+    arena_size(p2roundup(std::max(arena_size, page_size), page_size)),
+    pages_per_arena(this->arena_size / page_size),
+    try_hugetlb(hugetlb)
+{
+  ceph_assert(std::has_single_bit(page_size));
+}
+
+PageArena::~PageArena()
+{
+  for (auto &a : arenas) {
+    ::munmap(a.base, arena_size);
+  }
+}
+
+void PageArena::_new_arena()
+{
+  void *p = MAP_FAILED;
+  bool hugetlb = false;
+#ifdef MAP_HUGETLB
+  if (try_hugetlb) {
+    p = ::mmap(nullptr, arena_size, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (p == MAP_FAILED) {
+      // no (or not enough) reserved huge pages; don't try again
+      ldout(cct, 1) << __func__ << " MAP_HUGETLB failed: "
+                    << cpp_strerror(errno)
+                    << ", falling back to transparent huge pages" << dendl;
+      try_hugetlb = false;
+    } else {
+      hugetlb = true;
+    }
+  }
+#endif
+  if (p == MAP_FAILED) {
+    p = ::mmap(nullptr, arena_size, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+      throw std::bad_alloc();
+    }
+#ifdef MADV_HUGEPAGE
+    ::madvise(p, arena_size, MADV_HUGEPAGE);
+#endif
+  }
+  arena_t a{static_cast<char*>(p), hugetlb,
+            std::make_unique<Page[]>(pages_per_arena)};
+  for (size_t i = 0; i < pages_per_arena; i++) {
+    a.pages[i].data = a.base + i * page_size;
+  }
+  arenas.push_back(std::move(a));
+  next_unused = 0;
+  ldout(cct, 10) << __func__ << " #" << arenas.size() << " 0x" << std::hex
+                 << arena_size << std::dec << " at " << p
+                 << (hugetlb ? " hugetlb" : "") << dendl;
+}
+
+void PageArena::alloc(size_t n, Page **out)
+{
+  std::lock_guard l(lock);
+  for (size_t i = 0; i < n; i++) {
+    bool fresh_left = !arenas.empty() && next_unused < pages_per_arena;
+    Page *p;
+    // runs come from the untouched tail of the arena so they end up
+    // contiguous, single pages recycle freed ones first
+    if (free_list && (n == 1 || !fresh_left)) {
+      p = free_list;
+      free_list = p->next_free;
+      p->next_free = nullptr;
+      --num_free;
+    } else {
+      if (!fresh_left) {
+        _new_arena();
+      }
+      p = &arenas.back().pages[next_unused++];
+    }
+    p->nrefs = 1;
+    out[i] = p;
+  }
+}
+
+void PageArena::_free(Page *p)
+{
+  std::lock_guard l(lock);
+  p->next_free = free_list;
+  free_list = p;
+  ++num_free;
+}
+
+void PageArena::dump(ceph::Formatter *f) const
+{
+  std::lock_guard l(lock);
+  unsigned hugetlb = std::count_if(arenas.begin(), arenas.end(),
+                                   [](auto &a) { return a.hugetlb; });
+  uint64_t total = arenas.empty() ? 0 :
+    (arenas.size() - 1) * pages_per_arena + next_unused;
+  f->dump_unsigned("page_size", page_size);
+  f->dump_unsigned("arena_size", arena_size);
+  f->dump_unsigned("arenas", arenas.size());
+  f->dump_unsigned("hugetlb_arenas", hugetlb);
+  f->dump_unsigned("pages_in_use", total - num_free);
+  f->dump_unsigned("pages_free", num_free);
+}
+
+// ArenaPageSet
+
+ArenaPageSet::ArenaPageSet(std::shared_ptr<PageArena> _arena)
+  : arena(std::move(_arena)),
+    page_size(arena->get_page_size()),
+    page_shift(std::countr_zero(page_size))
+{
+}
+
+ArenaPageSet::~ArenaPageSet()
+{
+  truncate(0);
+}
+
+void ArenaPageSet::_set(uint64_t pn, Page *p)
+{
+  auto l = pn >> LEAF_BITS;
+  if (l >= leaves.size()) {
+    if (!p)
+      return;
+    leaves.resize(l + 1);
+  }
+  if (!leaves[l]) {
+    if (!p)
+      return;
+    leaves[l] = std::make_unique<leaf_t>();
+  }
+  Page *&slot = (*leaves[l])[pn & (LEAF_SIZE - 1)];
+  if (slot) {
+    arena->put(slot);
+    --npages;
+  }
+  slot = p;
+  if (p) {
+    ++npages;
+  }
+}
+
+void ArenaPageSet::read(uint64_t offset, uint64_t len,
+                        ceph::buffer::list &bl) const
+{
+  std::lock_guard lock{mutex};
+  _read(offset, len, bl);
+}
+
+void ArenaPageSet::_read(uint64_t offset, uint64_t len,
+                         ceph::buffer::list &bl) const
+{
+  const uint64_t end = offset + len;
+  while (offset < end) {
+    const uint64_t pn = offset >> page_shift;
+    uint64_t run_end = std::min(end, (pn + 1) << page_shift);
+    Page *p = _get(pn);
+    if (!p) {
+      while (run_end < end && !_get(run_end >> page_shift)) {
+        run_end = std::min(end, run_end + page_size);
+      }
+      bl.append_zero(run_end - offset);
+      offset = run_end;
+      continue;
+    }
+    // extend the run while the following pages sit right after this one
+    std::vector<Page*> run{p};
+    while (run_end < end) {
+      Page *next = _get(run_end >> page_shift);
+      if (!next || next->data != run.back()->data + page_size)
+        break;
+      run.push_back(next);
+      run_end = std::min(end, run_end + page_size);
+    }
+    for (auto r : run) {
+      arena->get(r);
+    }
+    bl.append(ceph::buffer::ptr(ceph::buffer::claim_buffer(
+      run_end - offset, p->data + (offset & (page_size - 1)),
+      make_deleter([a = arena, run = std::move(run)] {
+        for (auto r : run) {
+          a->put(r);
+        }
+      }))));
+    offset = run_end;
+  }
+}
+
+void ArenaPageSet::write(uint64_t offset, const ceph::buffer::list &bl)
+{
+  std::lock_guard lock{mutex};
+  _write(offset, bl);
+}
+
+void ArenaPageSet::_write(uint64_t offset, const ceph::buffer::list &bl)
+{
+  const uint64_t len = bl.length();
+  if (!len)
+    return;
+  const uint64_t end = offset + len;
+  const uint64_t first = offset >> page_shift;
+  const uint64_t last = (end - 1) >> page_shift;
+
+  // missing pages and pages someone else still looks at get replaced;
+  // allocate all of them at once so they come out back to back.  decide
+  // up front, a reader may drop its ref while we copy (but cannot take a
+  // new one, we hold the mutex)
+  std::vector<bool> replace(last - first + 1);
+  std::vector<Page*> fresh;
+  for (uint64_t pn = first; pn <= last; pn++) {
+    Page *p = _get(pn);
+    if (!p || p->nrefs > 1) {
+      replace[pn - first] = true;
+      fresh.push_back(nullptr);
+    }
+  }
+  if (!fresh.empty()) {
+    arena->alloc(fresh.size(), fresh.data());
+  }
+
+  auto f = fresh.begin();
+  auto it = bl.begin();
+  for (uint64_t pn = first; pn <= last; pn++) {
+    const uint64_t pstart = pn << page_shift;
+    const uint64_t b = std::max(offset, pstart) - pstart;
+    const uint64_t e = std::min(end, pstart + page_size) - pstart;
+    Page *p = _get(pn);
+    if (replace[pn - first]) {
+      Page *n = *f++;
+      // keep (or zero) whatever this write does not cover
+      if (p) {
+        memcpy(n->data, p->data, b);
+        memcpy(n->data + e, p->data + e, page_size - e);
+      } else {
+        memset(n->data, 0, b);
+        memset(n->data + e, 0, page_size - e);
+      }
+      _set(pn, n);
+      p = n;
+    }
+    it.copy(e - b, p->data + b);
+  }
+  ceph_assert(f == fresh.end());
+}
+
+void ArenaPageSet::clone(const ArenaPageSet &src, uint64_t srcoff,
+                         uint64_t len, uint64_t dstoff)
+{
+  if (&src == this || src.arena != arena ||
+      ((srcoff ^ dstoff) & (page_size - 1))) {
+    ceph::buffer::list bl;
+    src.read(srcoff, len, bl);
+    write(dstoff, bl);
+    return;
+  }
+  // the page grids line up: copy the partial pages at both ends and
+  // share the whole ones in between
+  std::scoped_lock lock{mutex, src.mutex};
+  const uint64_t end = srcoff + len;
+  const uint64_t head_end = std::min(end, p2roundup(srcoff, page_size));
+  const uint64_t tail_start = std::max(head_end, p2align(end, page_size));
+  if (head_end > srcoff) {
+    ceph::buffer::list bl;
+    src._read(srcoff, head_end - srcoff, bl);
+    _write(dstoff, bl);
+  }
+  for (uint64_t o = head_end; o < tail_start; o += page_size) {
+    Page *p = src._get(o >> page_shift);
+    if (p) {
+      arena->get(p);
+    }
+    _set((o - srcoff + dstoff) >> page_shift, p);
+  }
+  if (end > tail_start) {
+    ceph::buffer::list bl;
+    src._read(tail_start, end - tail_start, bl);
+    _write(tail_start - srcoff + dstoff, bl);
+  }
+}
+
+void ArenaPageSet::truncate(uint64_t size)
+{
+  std::lock_guard lock{mutex};
+  const uint64_t keep = (size + page_size - 1) >> page_shift;
+  for (uint64_t l = keep >> LEAF_BITS; l < leaves.size(); l++) {
+    if (!leaves[l])
+      continue;
+    for (uint64_t i = 0; i < LEAF_SIZE; i++) {
+      if ((l << LEAF_BITS) + i >= keep) {
+        _set((l << LEAF_BITS) + i, nullptr);
+      }
+    }
+  }
+  leaves.resize(std::min<uint64_t>(leaves.size(),
+                                   (keep + LEAF_SIZE - 1) >> LEAF_BITS));
+
+  // zero the rest of the last page
+  const uint64_t tail = size & (page_size - 1);
+  if (tail && _get(size >> page_shift)) {
+    ceph::buffer::list zeros;
+    zeros.append_zero(page_size - tail);
+    _write(size, zeros);
+  }
+}
+
+void ArenaPageSet::encode(ceph::buffer::list &bl) const
+{
+  using ceph::encode;
+  std::lock_guard lock{mutex};
+  encode(page_size, bl);
+  unsigned count = npages;
+  encode(count, bl);
+  // PageSet::decode() expects the pages in descending order
+  for (uint64_t l = leaves.size(); l-- > 0; ) {
+    if (!leaves[l])
+      continue;
+    for (uint64_t i = LEAF_SIZE; i-- > 0; ) {
+      Page *p = (*leaves[l])[i];
+      if (!p)
+        continue;
+      bl.append(ceph::buffer::copy(p->data, page_size));
+      uint64_t offset = ((l << LEAF_BITS) + i) << page_shift;
+      encode(offset, bl);
+    }
+  }
+}
+
+void ArenaPageSet::decode(ceph::buffer::list::const_iterator &p)
+{
+  using ceph::decode;
+  std::lock_guard lock{mutex};
+  ceph_assert(npages == 0);
+  // the saved page size may differ from ours, so go through write()
+  uint64_t saved_page_size;
+  decode(saved_page_size, p);
+  unsigned count;
+  decode(count, p);
+  for (unsigned i = 0; i < count; i++) {
+    ceph::buffer::list data;
+    p.copy(saved_page_size, data);
+    uint64_t offset;
+    decode(offset, p);
+    _write(offset, data);
+  }
+}
@@ -0,0 +1,154 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:nil -*-
+// vim: ts=8 sw=2 sts=2 expandtab
+
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_PAGEARENA_H
+#define CEPH_PAGEARENA_H
+
+#include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "include/buffer.h"
+
+class CephContext;
+namespace ceph {
+  class Formatter;
+}
+
+/*
+ * Pages for the MemStore page set carved out of large arenas.
+ *
+ * An arena is mapped with MAP_HUGETLB if possible and is otherwise advised
+ * for transparent huge pages, so walking a big object costs few TLB misses.
+ * The pages of a multi-page write are handed out back to back from the
+ * arena, which lets reads return them as a single bufferptr without copying.
+ * Freed pages go to a free list for reuse; the arenas themselves are only
+ * unmapped together with the PageArena.
+ */
+class PageArena {
+public:
+  struct Page {
+    char *data = nullptr;
+    std::atomic<uint32_t> nrefs = 0;
+    Page *next_free = nullptr;
+  };
+
+private:
+  struct arena_t {
+    char *base;
+    bool hugetlb;
+    std::unique_ptr<Page[]> pages;
+  };
+
+  CephContext *cct;
+  const size_t page_size;
+  const size_t arena_size;
+  const size_t pages_per_arena;
+
+  mutable std::mutex lock;
+  bool try_hugetlb;
+  std::vector<arena_t> arenas;
+  size_t next_unused = 0;   ///< first never handed out page of the last arena
+  Page *free_list = nullptr;
+  uint64_t num_free = 0;
+
+  void _new_arena();
+  void _free(Page *p);
+
+public:
+  PageArena(CephContext *cct, size_t page_size, size_t arena_size,
+            bool hugetlb);
+  ~PageArena();
+
+  PageArena(const PageArena&) = delete;
+  PageArena& operator=(const PageArena&) = delete;
+
+  size_t get_page_size() const { return page_size; }
+
+  /// fill out[0..n) with pages holding one ref each, back to back in
+  /// memory as far as the current arena allows
+  void alloc(size_t n, Page **out);
+
+  void get(Page *p) { ++p->nrefs; }
+  void put(Page *p) {
+    if (--p->nrefs == 0)
+      _free(p);
+  }
+
+  void dump(ceph::Formatter *f) const;
+};
+
+/*
+ * The pages of one object, indexed by page number in a flat radix table:
+ * a vector of fixed size leaves, so finding a page takes two array lookups
+ * instead of a tree walk.
+ *
+ * Reads hand out references to the pages themselves; a page that is still
+ * referenced by a reader or shared by a clone is copied before it is
+ * written to.  Reads may run concurrently with writes, so the table and
+ * the page refs are guarded by a mutex like PageSet's.
+ */
+class ArenaPageSet {
+public:
+  typedef PageArena::Page Page;
+
+private:
+  static constexpr unsigned LEAF_BITS = 9;
+  static constexpr uint64_t LEAF_SIZE = 1ull << LEAF_BITS;
+  typedef std::array<Page*, LEAF_SIZE> leaf_t;
+
+  std::shared_ptr<PageArena> arena;
+  const uint64_t page_size;
+  const unsigned page_shift;
+  mutable std::mutex mutex;
+  std::vector<std::unique_ptr<leaf_t>> leaves;
+  size_t npages = 0;
+
+  Page *_get(uint64_t pn) const {
+    auto l = pn >> LEAF_BITS;
+    if (l >= leaves.size() || !leaves[l])
+      return nullptr;
+    return (*leaves[l])[pn & (LEAF_SIZE - 1)];
+  }
+  /// install p (whose ref is taken over) as page pn, dropping the old one
+  void _set(uint64_t pn, Page *p);
+  void _read(uint64_t offset, uint64_t len, ceph::buffer::list &bl) const;
+  void _write(uint64_t offset, const ceph::buffer::list &bl);
+
+public:
+  explicit ArenaPageSet(std::shared_ptr<PageArena> arena);
+  ~ArenaPageSet();
+
+  ArenaPageSet(const ArenaPageSet&) = delete;
+  ArenaPageSet& operator=(const ArenaPageSet&) = delete;
+
+  bool empty() const { return npages == 0; }
+  size_t size() const { return npages; }
+  size_t get_page_size() const { return page_size; }
+
+  /// append [offset, offset+len) to bl, holes read as zeroes
+  void read(uint64_t offset, uint64_t len, ceph::buffer::list &bl) const;
+  void write(uint64_t offset, const ceph::buffer::list &bl);
+  /// pages lined up on the same page grid are shared, the rest is copied
+  void clone(const ArenaPageSet &src, uint64_t srcoff, uint64_t len,
+             uint64_t dstoff);
+  void truncate(uint64_t size);
+
+  // same format as PageSet, so either can load what the other saved
+  void encode(ceph::buffer::list &bl) const;
+  void decode(ceph::buffer::list::const_iterator &p);
+};
+
+#endif // CEPH_PAGEARENA_H
@@ -1785,6 +1785,58 @@ void OSDService::queue_for_snap_trim(PG *pg, uint64_t cost_per_object)
       pg->get_osdmap_epoch()));
 }
 
+bool OSDService::store_pass_idle()
+{
+  if (is_recovery_active()) {
+    return false;
+  }
+  auto threshold =
+    cct->_conf.get_val<double>("osd_store_pass_load_threshold");
+  if (threshold <= 0) {
+    return true;
+  }
+  double loadavg;
+  if (getloadavg(&loadavg, 1) != 1) {
+    return true;
+  }
+  static const long ncpus = std::max(sysconf(_SC_NPROCESSORS_ONLN), 1L);
+  return loadavg / ncpus < threshold;
+}
+
+void OSDService::queue_for_store_rewrite(PG *pg, store_pass_t p,
+					 std::vector<ghobject_t> ls, bool last)
+{
+  dout(10) << "queueing " << *pg << " for " << p << " of " << ls.size()
+	   << " objects" << dendl;
+  uint64_t cost =
+    cct->_conf.get_val<Option::size_t>("osd_store_pass_cost") * ls.size();
+  enqueue_back(
+    OpSchedulerItem(
+      unique_ptr<OpSchedulerItem::OpQueueable>(
+	new PGStoreRewrite(pg->get_pgid(), pg->get_osdmap_epoch(), p,
+			   std::move(ls), last)),
+      cost,
+      cct->_conf.get_val<uint64_t>("osd_store_pass_priority"),
+      ceph_clock_now(),
+      0,
+      pg->get_osdmap_epoch()));
+}
+
+void OSDService::queue_for_store_pass(PG *pg, store_pass_t p)
+{
+  dout(10) << "queueing " << *pg << " for " << p << " pass" << dendl;
+  enqueue_back(
+    OpSchedulerItem(
+      unique_ptr<OpSchedulerItem::OpQueueable>(
+	new PGStorePass(pg->get_pgid(), pg->get_osdmap_epoch(), p)),
+      // only lists the next batch, see queue_for_store_rewrite()
+      cct->_conf.get_val<Option::size_t>("osd_store_pass_cost"),
+      cct->_conf.get_val<uint64_t>("osd_store_pass_priority"),
+      ceph_clock_now(),
+      0,
+      pg->get_osdmap_epoch()));
+}
+
 template <class MSG_TYPE>
 void OSDService::queue_scrub_event_msg(PG* pg,
 				       Scrub::scrub_prio_t with_priority,
@@ -6488,6 +6540,7 @@ void OSD::tick_without_osd_lock()
     service.promote_throttle_recalibrate();
     resume_creating_pg();
     maybe_send_beacon();
+    maybe_queue_store_passes();
   }
 
   mgrc.update_daemon_health(get_health_metrics());
@@ -6496,6 +6549,43 @@ void OSD::tick_without_osd_lock()
 					      new C_Tick_WithoutOSDLock(this));
 }
 
+void OSD::maybe_queue_store_passes()
+{
+  utime_t now = ceph_clock_now();
+  vector<PGRef> pgs;
+  bool idle = false;
+  for (size_t i = 0; i < last_store_pass_sched.size(); ++i) {
+    auto p = static_cast<store_pass_t>(i);
+    double interval =
+      cct->_conf.get_val<double>(get_store_pass_info(p).interval_option);
+    if (interval <= 0) {
+      continue;
+    }
+    if (!idle) {
+      if (!service.store_pass_idle()) {
+	// neither start nor resume anything while the OSD is busy
+	return;
+      }
+      idle = true;
+    }
+    bool start = now - last_store_pass_sched[i] >= interval;
+    if (start) {
+      last_store_pass_sched[i] = now;
+    }
+    if (pgs.empty()) {
+      _get_pgs(&pgs);
+    }
+    // PGs still busy with their previous pass are left alone; the
+    // passes pace themselves through the op scheduler.  Paused ones
+    // carry on from where they stopped.
+    for (auto& pg : pgs) {
+      if ((start || pg->store_pass_paused(p)) && pg->start_store_pass(p)) {
+	service.queue_for_store_pass(pg.get(), p);
+      }
+    }
+  }
+}
+
 // Usage:
 //   setomapval <pool-id> [namespace/]<obj-name> <key> <val>
 //   rmomapkey <pool-id> [namespace/]<obj-name> <key>
@@ -520,11 +520,16 @@ public:
   AsyncReserver<spg_t, Finisher> snap_reserver;
   /// keeping track of replicas being reserved for scrubbing
   AsyncReserver<spg_t, Finisher> scrub_reserver;
+  /// whether the OSD is quiet enough for background store passes
+  bool store_pass_idle();
   void queue_recovery_context(PG *pg,
                               GenContext<ThreadPool::TPHandle&> *c,
                               uint64_t cost,
 			      int priority);
   void queue_for_snap_trim(PG *pg, uint64_t cost);
+  void queue_for_store_pass(PG *pg, store_pass_t p);
+  void queue_for_store_rewrite(PG *pg, store_pass_t p,
+			       std::vector<ghobject_t> ls, bool last);
   void queue_for_scrub(PG* pg, Scrub::scrub_prio_t with_priority);
 
   /// Signals either (a) the end of a sleep period, or (b) a recheck of the availability
@@ -2007,6 +2012,9 @@ protected:
   // == monitor interaction ==
   ceph::mutex mon_report_lock = ceph::make_mutex("OSD::mon_report_lock");
   utime_t last_mon_report;
+  std::array<utime_t,
+	     static_cast<size_t>(store_pass_t::NUM_PASSES)> last_store_pass_sched;
+  void maybe_queue_store_passes();
   Finisher boot_finisher;
 
   // -- boot --
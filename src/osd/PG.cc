@@ -1538,6 +1538,107 @@ void PG::queue_snap_retrim(snapid_t snap)
   }
 }
 
+void PG::finish_store_pass(store_pass_t p)
+{
+  auto& pass = store_passes[static_cast<size_t>(p)];
+  pass.cursor = ghobject_t();
+  pass.paused = false;
+  pass.queued = false;
+}
+
+void PG::store_pass(store_pass_t p, epoch_t epoch_queued,
+		    ThreadPool::TPHandle &handle)
+{
+  // Only the layout of the local copy changes, so every OSD of the PG
+  // reworks its own objects.  Under the pg lock only the next batch is
+  // picked.  The rewrites are queued as an item of their own, costed by
+  // the batch size, and run without the pg lock.
+  const auto& info = get_store_pass_info(p);
+  auto& pass = store_passes[static_cast<size_t>(p)];
+  if (pg_has_reset_since(epoch_queued) ||
+      !is_active() ||
+      (is_primary() && !is_clean()) ||
+      cct->_conf.get_val<double>(info.interval_option) <= 0) {
+    dout(10) << __func__ << " " << p
+	     << " not active and clean, ending the pass" << dendl;
+    finish_store_pass(p);
+    return;
+  }
+  if (!osd->store_pass_idle()) {
+    // OSD::maybe_queue_store_passes() picks it up from here
+    dout(10) << __func__ << " " << p << " osd busy, pausing at "
+	     << pass.cursor << dendl;
+    pass.paused = true;
+    pass.queued = false;
+    return;
+  }
+  pass.paused = false;
+  auto max = cct->_conf.get_val<uint64_t>("osd_store_pass_max_objects");
+  std::vector<ghobject_t> ls;
+  ghobject_t next;
+  int r = osd->store->collection_list(ch, pass.cursor,
+				      ghobject_t::get_max(), max, &ls, &next);
+  if (r < 0) {
+    dout(0) << __func__ << " " << p << " collection_list failed: "
+	    << cpp_strerror(r) << dendl;
+    finish_store_pass(p);
+    return;
+  }
+  std::erase_if(ls, [](const ghobject_t& oid) { return oid.is_pgmeta(); });
+  dout(20) << __func__ << " " << p << " " << ls.size() << " objects from "
+	   << pass.cursor << dendl;
+  pass.cursor = next;
+  osd->queue_for_store_rewrite(this, p, std::move(ls), next.is_max());
+}
+
+void PG::do_store_pass(store_pass_t p, epoch_t epoch_queued,
+		       const std::vector<ghobject_t>& ls, bool last,
+		       ThreadPool::TPHandle &handle)
+{
+  const auto& info = get_store_pass_info(p);
+  // the store orders its rewrites against client writes itself, client
+  // ops on the PG go ahead meanwhile
+  auto ch = this->ch;
+  unlock();
+  uint64_t done = 0;
+  bool unsupported = false;
+  for (auto& oid : ls) {
+    if (osd->is_stopping()) {
+      return;
+    }
+    handle.reset_tp_timeout();
+    int64_t r = (osd->store->*info.op)(ch, oid);
+    if (r == -EOPNOTSUPP) {
+      dout(10) << __func__ << " " << p << " not supported by the object store"
+	       << dendl;
+      unsupported = true;
+      break;
+    }
+    if (r < 0) {
+      dout(10) << __func__ << " " << p << " " << oid << " " << cpp_strerror(r)
+	       << dendl;
+    } else {
+      done += r;
+    }
+  }
+  dout(20) << __func__ << " " << p << " " << ls.size() << " objects, rewrote "
+	   << done << " bytes" << dendl;
+  std::scoped_lock l{*this};
+  if (pg_has_reset_since(epoch_queued)) {
+    dout(10) << __func__ << " " << p << " pg reset, ending the pass" << dendl;
+    finish_store_pass(p);
+    return;
+  }
+  if (unsupported || last) {
+    dout(10) << __func__ << " " << p << " pass done" << dendl;
+    finish_store_pass(p);
+    return;
+  }
+  if (!osd->is_stopping()) {
+    osd->queue_for_store_pass(this, p);
+  }
+}
+
 void PG::on_active_actmap()
 {
   if (cct->_conf->osd_check_for_log_corruption)
@@ -42,9 +42,11 @@
 #include "recovery_types.h"
 #include "MissingLoc.h"
 #include "scrubber_common.h"
+#include "StorePass.h"
 
 #include "mgr/OSDPerfMetricTypes.h"
 
+#include <array>
 #include <atomic>
 #include <list>
 #include <memory>
@@ -729,6 +731,21 @@ public:
   virtual int get_cache_obj_count() = 0;
 
   virtual void snap_trimmer(epoch_t epoch_queued) = 0;
+
+  /// claim the next background pass of kind @p p; false if one is on
+  bool start_store_pass(store_pass_t p) {
+    return !store_passes[static_cast<size_t>(p)].queued.exchange(true);
+  }
+  /// whether a pass of kind @p p stopped half way for a busy OSD
+  bool store_pass_paused(store_pass_t p) const {
+    return store_passes[static_cast<size_t>(p)].paused;
+  }
+  void store_pass(store_pass_t p, epoch_t epoch_queued,
+		  ThreadPool::TPHandle &handle);
+  /// called with the pg locked, returns with it unlocked
+  void do_store_pass(store_pass_t p, epoch_t epoch_queued,
+		     const std::vector<ghobject_t>& ls, bool last,
+		     ThreadPool::TPHandle &handle);
   virtual void do_command(
     std::string_view prefix,
     const cmdmap_t& cmdmap,
@@ -859,6 +876,17 @@ protected:
 
   int recovery_ops_active;
   std::set<pg_shard_t> waiting_on_backfill;
+
+  // background object store passes, see OSD::maybe_queue_store_passes()
+  struct store_pass_state_t {
+    std::atomic<bool> queued = false;
+    /// stopped at cursor until the OSD is idle again
+    std::atomic<bool> paused = false;
+    ghobject_t cursor;
+  };
+  std::array<store_pass_state_t,
+	     static_cast<size_t>(store_pass_t::NUM_PASSES)> store_passes;
+  void finish_store_pass(store_pass_t p);
 #ifdef DEBUG_RECOVERY_OIDS
   multiset<hobject_t> recovering_oids;
 #endif
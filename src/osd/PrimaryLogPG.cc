@@ -7912,7 +7912,8 @@ int PrimaryLogPG::do_osd_ops(OpContext *ctx, vector<OSDOp>& ops)
             ch, ghobject_t(soid, ghobject_t::NO_GEN, whoami_shard().shard),
             ObjectStore::omap_iter_seek_t{
               .seek_position = start_after,
-              .seek_type = ObjectStore::omap_iter_seek_t::UPPER_BOUND
+              .seek_type = ObjectStore::omap_iter_seek_t::UPPER_BOUND,
+              .expected_count = max_return
             },
             [&bl, &num, max_return,
 	     max_bytes=cct->_conf->osd_max_omap_bytes_per_request]
@@ -7972,7 +7973,8 @@ int PrimaryLogPG::do_osd_ops(OpContext *ctx, vector<OSDOp>& ops)
 	    ObjectStore::omap_iter_seek_t{
 	      .seek_position = std::max(start_after, filter_prefix),
 	      .seek_type = filter_prefix > start_after ? omap_iter_seek_t::LOWER_BOUND
-						       : omap_iter_seek_t::UPPER_BOUND
+						       : omap_iter_seek_t::UPPER_BOUND,
+	      .expected_count = max_return
 	    },
 	    [&bl, &truncated, &filter_prefix, &num, max_return,
 	     max_bytes=cct->_conf->osd_max_omap_bytes_per_request]
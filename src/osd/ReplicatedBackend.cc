@@ -2306,7 +2306,8 @@ int ReplicatedBackend::build_push_op(const ObjectRecoveryInfo &recovery_info,
       // than just seek(n).
       ObjectStore::omap_iter_seek_t{
         .seek_position = progress.omap_recovered_to,
-        .seek_type = omap_iter_seek_t::LOWER_BOUND
+        .seek_type = omap_iter_seek_t::LOWER_BOUND,
+        .expected_count = cct->_conf->osd_recovery_max_omap_entries_per_chunk
       },
       [&available, &new_progress, &omap_entries=out_op->omap_entries,
        max_entries=cct->_conf->osd_recovery_max_omap_entries_per_chunk]
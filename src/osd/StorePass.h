@@ -0,0 +1,61 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:nil -*-
+// vim: ts=8 sw=2 sts=2 expandtab
+
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_OSD_STOREPASS_H
+#define CEPH_OSD_STOREPASS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <ostream>
+
+#include "os/ObjectStore.h"
+
+/*
+ * Background passes over the objects of a PG that have the object store
+ * rework its local copy of each one (repack, move between devices, ...).
+ * They all share one walk, see PG::store_pass() and
+ * OSD::maybe_queue_store_passes(); only the store call and the option
+ * that turns them on differ.
+ */
+enum class store_pass_t : uint8_t {
+  RECOMPRESS,
+  RETIER,
+  NUM_PASSES
+};
+
+struct store_pass_info_t {
+  const char *name;
+  /// seconds between two passes over a PG, 0 disables the pass
+  const char *interval_option;
+  /// the store call made for every object, see ObjectStore::recompress()
+  int64_t (ObjectStore::*op)(ObjectStore::CollectionHandle&, const ghobject_t&);
+};
+
+inline const store_pass_info_t& get_store_pass_info(store_pass_t p)
+{
+  static const store_pass_info_t info[] = {
+    { "recompress", "osd_recompress_interval", &ObjectStore::recompress },
+    { "retier", "osd_retier_interval", &ObjectStore::retier },
+  };
+  static_assert(std::size(info) ==
+                static_cast<size_t>(store_pass_t::NUM_PASSES));
+  return info[static_cast<size_t>(p)];
+}
+
+inline std::ostream& operator<<(std::ostream& out, store_pass_t p)
+{
+  return out << get_store_pass_info(p).name;
+}
+
+#endif
@@ -49,6 +49,25 @@ void PGSnapTrim::run(
   pg->unlock();
 }
 
+void PGStorePass::run(
+  OSD *osd,
+  OSDShard *sdata,
+  PGRef& pg,
+  ThreadPool::TPHandle &handle)
+{
+  pg->store_pass(pass, epoch_queued, handle);
+  pg->unlock();
+}
+
+void PGStoreRewrite::run(
+  OSD *osd,
+  OSDShard *sdata,
+  PGRef& pg,
+  ThreadPool::TPHandle &handle)
+{
+  pg->do_store_pass(pass, epoch_queued, ls, last, handle);
+}
+
 void PGScrub::run(OSD* osd, OSDShard* sdata, PGRef& pg, ThreadPool::TPHandle& handle)
 {
   pg->scrub(epoch_queued, handle);
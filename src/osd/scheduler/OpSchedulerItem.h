@@ -351,6 +351,66 @@ public:
   }
 };
 
+class PGStorePass : public PGOpQueueable {
+  epoch_t epoch_queued;
+  store_pass_t pass;
+public:
+  PGStorePass(
+    spg_t pg,
+    epoch_t epoch_queued,
+    store_pass_t pass)
+    : PGOpQueueable(pg), epoch_queued(epoch_queued), pass(pass) {}
+  std::ostream &print(std::ostream &rhs) const final {
+    return rhs << "PGStorePass(pgid=" << get_pgid()
+	       << " pass=" << pass
+	       << " epoch_queued=" << epoch_queued
+	       << ")";
+  }
+  std::string print() const final {
+    return fmt::format(
+	"PGStorePass(pgid={} pass={} epoch_queued={})", get_pgid(),
+	get_store_pass_info(pass).name, epoch_queued);
+  }
+  void run(
+    OSD *osd, OSDShard *sdata, PGRef& pg, ThreadPool::TPHandle &handle) final;
+  SchedulerClass get_scheduler_class() const final {
+    return SchedulerClass::background_best_effort;
+  }
+};
+
+class PGStoreRewrite : public PGOpQueueable {
+  epoch_t epoch_queued;
+  store_pass_t pass;
+  std::vector<ghobject_t> ls;
+  bool last;
+public:
+  PGStoreRewrite(
+    spg_t pg,
+    epoch_t epoch_queued,
+    store_pass_t pass,
+    std::vector<ghobject_t> ls,
+    bool last)
+    : PGOpQueueable(pg), epoch_queued(epoch_queued), pass(pass),
+      ls(std::move(ls)), last(last) {}
+  std::ostream &print(std::ostream &rhs) const final {
+    return rhs << "PGStoreRewrite(pgid=" << get_pgid()
+	       << " pass=" << pass
+	       << " objects=" << ls.size()
+	       << " epoch_queued=" << epoch_queued
+	       << ")";
+  }
+  std::string print() const final {
+    return fmt::format(
+	"PGStoreRewrite(pgid={} pass={} objects={} epoch_queued={})",
+	get_pgid(), get_store_pass_info(pass).name, ls.size(), epoch_queued);
+  }
+  void run(
+    OSD *osd, OSDShard *sdata, PGRef& pg, ThreadPool::TPHandle &handle) final;
+  SchedulerClass get_scheduler_class() const final {
+    return SchedulerClass::background_best_effort;
+  }
+};
+
 class PGScrub : public PGOpQueueable {
   epoch_t epoch_queued;
 public:
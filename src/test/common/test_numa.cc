@@ -1,6 +1,11 @@
 // -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:nil -*-
 // vim: ts=8 sw=2 sts=2 expandtab
 
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+
 #include "gtest/gtest.h"
 #include "common/numa.h"
 
@@ -70,3 +75,25 @@ TEST(cpu_set, round_trip_list)
   }
 }
 
+
+TEST(numa, bind_memory)
+{
+  cpu_set_t cpu_set;
+  size_t size;
+  if (get_numa_node_cpu_set(0, &size, &cpu_set) < 0) {
+    GTEST_SKIP() << "numa node 0 not found";
+  }
+  const size_t page_size = sysconf(_SC_PAGESIZE);
+  const size_t len = 4 * page_size;
+  void *p = aligned_alloc(page_size, len);
+  ASSERT_TRUE(p);
+  memset(p, 0, len);
+  int r = bind_memory_to_numa_node(p, len, 0);
+  if (r == -EPERM || r == -ENOSYS) {
+    free(p);
+    GTEST_SKIP() << "mbind not permitted here";
+  }
+  ASSERT_EQ(0, r);
+  ASSERT_EQ(-EINVAL, bind_memory_to_numa_node(p, len, -1));
+  free(p);
+}
@@ -44,6 +44,8 @@ struct ceph_msgr_options {
   const char *hostname;
   const char *conffile;
   enum ceph_msgr_type ms_type;
+  unsigned int zerocopy;
+  unsigned long long zerocopy_threshold;
 };
 
 class FioDispatcher;
@@ -121,6 +123,14 @@ static void create_or_get_ceph_context(struct ceph_msgr_options *o)
   /* Will use g_ceph_context instead */
   cct.detach();
 
+  if (o->zerocopy) {
+    g_ceph_context->_conf.set_val_or_die("ms_tcp_zerocopy", "true");
+    if (o->zerocopy_threshold) {
+      g_ceph_context->_conf.set_val_or_die(
+	"ms_tcp_zerocopy_threshold", std::to_string(o->zerocopy_threshold));
+    }
+  }
+
   common_init_finish(g_ceph_context);
   g_ceph_context->_conf.apply_changes(NULL);
   g_dummy_auth = new DummyAuthClientServer(g_ceph_context);
@@ -671,6 +681,22 @@ static std::vector<fio_option> options {
     o.off1  = offsetof(struct ceph_msgr_options, conffile);
     o.help  = "Path to CEPH configuration file";
   }),
+  make_option([] (fio_option& o) {
+    o.name  = "zerocopy";
+    o.lname = "CEPH messenger MSG_ZEROCOPY sends";
+    o.type  = FIO_OPT_BOOL;
+    o.off1  = offsetof(struct ceph_msgr_options, zerocopy);
+    o.help  = "Send large messages with MSG_ZEROCOPY (async+posix only), see 'ms_tcp_zerocopy'";
+    o.def   = "0";
+  }),
+  make_option([] (fio_option& o) {
+    o.name  = "zerocopy_threshold";
+    o.lname = "CEPH messenger MSG_ZEROCOPY threshold";
+    o.type  = FIO_OPT_STR_VAL;
+    o.off1  = offsetof(struct ceph_msgr_options, zerocopy_threshold);
+    o.help  = "Minimum send size for MSG_ZEROCOPY, 0 keeps 'ms_tcp_zerocopy_threshold'";
+    o.def   = "0";
+  }),
   {} /* Last NULL */
 };
 
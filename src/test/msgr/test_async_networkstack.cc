@@ -427,6 +427,192 @@ TEST_P(NetworkWorkerTest, AcceptAndCloseTest) {
   });
 }
 
+// large sends take the MSG_ZEROCOPY path where the stack supports it; over
+// loopback the kernel ends up copying, but the data must come through intact
+// and the held buffers must be released on completion or close
+TEST_P(NetworkWorkerTest, ZeroCopyTest) {
+  entity_addr_t bind_addr;
+  ASSERT_TRUE(bind_addr.parse(get_addr().c_str()));
+
+  exec_events([this, bind_addr](Worker *worker) mutable {
+    if (worker->id != 0)
+      return;
+    EventCenter *center = &worker->center;
+    entity_addr_t cli_addr;
+    SocketOptions options;
+    options.zerocopy_threshold = 4096;
+    ServerSocket bind_socket;
+    ssize_t r = worker->listen(bind_addr, 0, options, &bind_socket);
+    ASSERT_EQ(0, r);
+
+    ConnectedSocket cli_socket, srv_socket;
+    r = worker->connect(bind_addr, options, &cli_socket);
+    ASSERT_EQ(0, r);
+    {
+      C_poll cb(center);
+      center->create_file_event(bind_socket.fd(), EVENT_READABLE, &cb);
+      ASSERT_TRUE(cb.poll(500));
+      center->delete_file_event(bind_socket.fd(), EVENT_READABLE);
+    }
+    r = bind_socket.accept(&srv_socket, options, &cli_addr, worker);
+    ASSERT_EQ(0, r);
+    {
+      C_poll cb(center);
+      center->create_file_event(cli_socket.fd(), EVENT_READABLE, &cb);
+      r = cli_socket.is_connected();
+      if (r == 0) {
+        ASSERT_TRUE(cb.poll(500));
+        r = cli_socket.is_connected();
+      }
+      ASSERT_EQ(1, r);
+      center->delete_file_event(cli_socket.fd(), EVENT_READABLE);
+    }
+
+    const size_t total = 16 << 20;
+    const size_t chunk = 65536;
+    bufferlist bl;
+    for (size_t off = 0; off < total; off += chunk) {
+      bufferptr bp = buffer::create(chunk);
+      for (size_t i = 0; i < chunk; ++i)
+        bp[i] = (char)((off + i) % 251);
+      bl.append(std::move(bp));
+    }
+
+    char buf[65536];
+    size_t received = 0;
+    auto start = ceph::coarse_mono_clock::now();
+    while (received < total) {
+      ASSERT_LT(ceph::coarse_mono_clock::now() - start, 60s);
+      if (bl.length()) {
+        r = cli_socket.send(bl, false);
+        ASSERT_GE(r, 0);
+      }
+      r = srv_socket.read(buf, sizeof(buf));
+      if (r == -EAGAIN) {
+        // completion driven stacks only make progress in the event loop
+        center->process_events(0);
+        continue;
+      }
+      ASSERT_GT(r, 0);
+      for (ssize_t i = 0; i < r; ++i)
+        ASSERT_EQ((char)((received + i) % 251), buf[i]);
+      received += r;
+    }
+    ASSERT_EQ(0u, bl.length());
+
+    cli_socket.close();
+    srv_socket.close();
+    bind_socket.abort_accept();
+  });
+}
+
+TEST_P(NetworkWorkerTest, IdleReadersTest) {
+  entity_addr_t bind_addr;
+  ASSERT_TRUE(bind_addr.parse(get_addr().c_str()));
+
+  exec_events([this, bind_addr](Worker *worker) mutable {
+    if (worker->id != 0)
+      return;
+    EventCenter *center = &worker->center;
+    SocketOptions options;
+    ServerSocket bind_socket;
+    ssize_t r = worker->listen(bind_addr, 0, options, &bind_socket);
+    ASSERT_EQ(0, r);
+
+    auto connect_pair = [&](ConnectedSocket *cli, ConnectedSocket *srv) {
+      entity_addr_t cli_addr;
+      ssize_t r = worker->connect(bind_addr, options, cli);
+      ASSERT_EQ(0, r);
+      {
+        C_poll cb(center);
+        center->create_file_event(bind_socket.fd(), EVENT_READABLE, &cb);
+        ASSERT_TRUE(cb.poll(500));
+        center->delete_file_event(bind_socket.fd(), EVENT_READABLE);
+      }
+      r = bind_socket.accept(srv, options, &cli_addr, worker);
+      ASSERT_EQ(0, r);
+      C_poll cb(center);
+      center->create_file_event(cli->fd(), EVENT_READABLE, &cb);
+      r = cli->is_connected();
+      if (r == 0) {
+        ASSERT_TRUE(cb.poll(500));
+        r = cli->is_connected();
+      }
+      ASSERT_EQ(1, r);
+      center->delete_file_event(cli->fd(), EVENT_READABLE);
+      // start receiving; nothing is ever read from the idle ones
+      ASSERT_EQ(1, srv->is_connected());
+    };
+    auto make_data = [](size_t total) {
+      bufferlist bl;
+      const size_t chunk = 65536;
+      for (size_t off = 0; off < total; off += chunk) {
+        bufferptr bp = buffer::create(chunk);
+        for (size_t i = 0; i < chunk; ++i)
+          bp[i] = (char)((off + i) % 251);
+        bl.append(std::move(bp));
+      }
+      return bl;
+    };
+
+    // more connections that stop reading than a uring worker lets hold
+    // ms_async_uring_rx_buffers / 16 provided buffers each, and each of
+    // them sent enough to fill its share
+    const unsigned num_idle = 24;
+    std::vector<ConnectedSocket> idle_cli(num_idle), idle_srv(num_idle);
+    std::vector<bufferlist> idle_bl(num_idle);
+    for (unsigned i = 0; i < num_idle; ++i) {
+      connect_pair(&idle_cli[i], &idle_srv[i]);
+      ASSERT_FALSE(HasFatalFailure());
+      idle_bl[i] = make_data(1 << 20);
+    }
+    auto start = ceph::coarse_mono_clock::now();
+    while (ceph::coarse_mono_clock::now() - start < 1s) {
+      for (unsigned i = 0; i < num_idle; ++i) {
+        if (idle_bl[i].length()) {
+          r = idle_cli[i].send(idle_bl[i], false);
+          ASSERT_GE(r, 0);
+        }
+      }
+      center->process_events(1000);
+    }
+
+    // another connection still gets all of its data through
+    ConnectedSocket cli_socket, srv_socket;
+    connect_pair(&cli_socket, &srv_socket);
+    ASSERT_FALSE(HasFatalFailure());
+    const size_t total = 8 << 20;
+    bufferlist bl = make_data(total);
+    char buf[65536];
+    size_t received = 0;
+    start = ceph::coarse_mono_clock::now();
+    while (received < total) {
+      ASSERT_LT(ceph::coarse_mono_clock::now() - start, 60s);
+      if (bl.length()) {
+        r = cli_socket.send(bl, false);
+        ASSERT_GE(r, 0);
+      }
+      r = srv_socket.read(buf, sizeof(buf));
+      if (r == -EAGAIN) {
+        center->process_events(0);
+        continue;
+      }
+      ASSERT_GT(r, 0);
+      for (ssize_t i = 0; i < r; ++i)
+        ASSERT_EQ((char)((received + i) % 251), buf[i]);
+      received += r;
+    }
+
+    cli_socket.close();
+    srv_socket.close();
+    for (unsigned i = 0; i < num_idle; ++i) {
+      idle_cli[i].close();
+      idle_srv[i].close();
+    }
+    bind_socket.abort_accept();
+  });
+}
+
 TEST_P(NetworkWorkerTest, ComplexTest) {
   entity_addr_t bind_addr;
   std::atomic_bool listen_done(false);
@@ -1049,6 +1235,9 @@ INSTANTIATE_TEST_SUITE_P(
   ::testing::Values(
 #ifdef HAVE_DPDK
     "dpdk",
+#endif
+#ifdef HAVE_LIBURING
+    "uring",
 #endif
     "posix"
   )
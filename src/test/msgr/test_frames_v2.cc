@@ -15,6 +15,7 @@
 
 #include "msg/async/frames_v2.h"
 
+#include <algorithm>
 #include <numeric>
 #include <ostream>
 #include <string>
@@ -148,6 +149,36 @@ static bufferlist make_bufferlist(size_t len, char c) {
   return bl;
 }
 
+// Splits the payload into separately allocated fragments on both sides of
+// the sizes the crc and crypto paths treat differently.
+static bufferlist make_fragmented_bufferlist(size_t len, char c) {
+  static constexpr size_t fragment_lens[] = {1, 13, 100, 2000, 5000, 7, 700};
+  bufferlist bl;
+  for (size_t i = 0; bl.length() < len; i++) {
+    size_t n = std::min(fragment_lens[i % std::size(fragment_lens)],
+                        len - bl.length());
+    auto bp = buffer::create(n);
+    memset(bp.c_str(), c, n);
+    bl.push_back(std::move(bp));
+  }
+  return bl;
+}
+
+// Re-slices an assembled frame so that disassembly sees a fragmented
+// receive buffer.
+static void fragment_bufferlist(bufferlist& bl) {
+  static constexpr size_t fragment_lens[] = {3, 61, 1500, 9000, 16};
+  bufferlist out;
+  for (size_t i = 0; bl.length() > 0; i++) {
+    bufferlist piece;
+    bl.splice(0, std::min<size_t>(fragment_lens[i % std::size(fragment_lens)],
+                                  bl.length()),
+              &piece);
+    out.claim_append(piece);
+  }
+  bl = std::move(out);
+}
+
 bool disassemble_frame(FrameAssembler& frame_asm, bufferlist& frame_bl,
                        Tag& tag, segment_bls_t& segment_bls) {
   bufferlist preamble_bl;
@@ -176,15 +207,18 @@ bool disassemble_frame(FrameAssembler& frame_asm, bufferlist& frame_bl,
 class RoundTripTestBase : public ::testing::TestWithParam<
                               std::tuple<round_trip_instance_t, mode_t>> {
 protected:
-  RoundTripTestBase()
+  explicit RoundTripTestBase(
+      bufferlist (*make_bl)(size_t, char) = make_bufferlist,
+      bool fragment_onwire = false)
       : m_tx_frame_asm(&m_tx_crypto, std::get<1>(GetParam()).is_rev1, true,
                                                  &m_tx_comp),
         m_rx_frame_asm(&m_rx_crypto, std::get<1>(GetParam()).is_rev1, true,
                                                  &m_rx_comp),
-        m_header(make_bufferlist(std::get<0>(GetParam()).header_len, 'H')),
-        m_front(make_bufferlist(std::get<0>(GetParam()).front_len, 'F')),
-        m_middle(make_bufferlist(std::get<0>(GetParam()).middle_len, 'M')),
-        m_data(make_bufferlist(std::get<0>(GetParam()).data_len, 'D')) {
+        m_fragment_onwire(fragment_onwire),
+        m_header(make_bl(std::get<0>(GetParam()).header_len, 'H')),
+        m_front(make_bl(std::get<0>(GetParam()).front_len, 'F')),
+        m_middle(make_bl(std::get<0>(GetParam()).middle_len, 'M')),
+        m_data(make_bl(std::get<0>(GetParam()).data_len, 'D')) {
     const auto& m = std::get<1>(GetParam());
     if (m.is_secure) {
       AuthConnectionMeta auth_meta;
@@ -238,6 +272,9 @@ protected:
     auto onwire_bl = tx_frame.get_buffer(m_tx_frame_asm);
     check_frame_assembler(m_tx_frame_asm);
     EXPECT_EQ(m_tx_frame_asm.get_frame_onwire_len(), onwire_bl.length());
+    if (m_fragment_onwire) {
+      fragment_bufferlist(onwire_bl);
+    }
 
     Tag rx_tag;
     segment_bls_t rx_segment_bls;
@@ -261,6 +298,7 @@ protected:
   ceph::compression::onwire::rxtx_t m_rx_comp;
   FrameAssembler m_tx_frame_asm;
   FrameAssembler m_rx_frame_asm;
+  const bool m_fragment_onwire;
 
   const bufferlist m_header;
   const bufferlist m_front;
@@ -423,6 +461,28 @@ INSTANTIATE_TEST_SUITE_P(
         ::testing::ValuesIn(round_trip_instances),
         ::testing::ValuesIn(modes)));
 
+class FragmentedRoundTripTest : public RoundTripTestBase {
+protected:
+  FragmentedRoundTripTest()
+      : RoundTripTestBase(make_fragmented_bufferlist,
+                          /*fragment_onwire=*/true) {}
+};
+
+TEST_P(FragmentedRoundTripTest, Basic) {
+  test_round_trip();
+}
+
+TEST_P(FragmentedRoundTripTest, Reuse) {
+  for (int i = 0; i < 3; i++) {
+    test_round_trip();
+  }
+}
+
+INSTANTIATE_TEST_SUITE_P(
+    FragmentedRoundTripTests, FragmentedRoundTripTest, ::testing::Combine(
+        ::testing::ValuesIn(round_trip_instances),
+        ::testing::ValuesIn(modes)));
+
 class RoundTripPerfTest : public RoundTripTestBase {};
 
 TEST_P(RoundTripPerfTest, DISABLED_Basic) {
@@ -469,6 +529,11 @@ INSTANTIATE_TEST_SUITE_P(
         ::testing::ValuesIn(round_trip_perf_instances),
         ::testing::ValuesIn(modes)));
 
+INSTANTIATE_TEST_SUITE_P(
+    FragmentedLargeRoundTripTests, FragmentedRoundTripTest, ::testing::Combine(
+        ::testing::ValuesIn(round_trip_perf_instances),
+        ::testing::ValuesIn(modes)));
+
 }  // namespace ceph::msgr::v2
 
 int main(int argc, char* argv[]) {
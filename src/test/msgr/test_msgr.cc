@@ -36,6 +36,7 @@
 
 #include "common/ceph_argparse.h"
 #include "common/ceph_mutex.h"
+#include "common/perf_counters_collection.h"
 #include "global/global_init.h"
 #include "messages/MCommand.h"
 #include "messages/MPing.h"
@@ -2544,6 +2545,68 @@ TEST_P(MessengerTest, SyntheticInjectTest) {
       "ms_dispatch_throttle_bytes", std::to_string(dispatch_throttle_bytes));
 }
 
+// sum and count of an averaged counter, over all the messenger workers
+static std::pair<uint64_t, uint64_t> read_worker_avg(const std::string& name)
+{
+  std::pair<uint64_t, uint64_t> total{0, 0};
+  g_ceph_context->get_perfcounters_collection()->with_counters(
+    [&](const PerfCountersCollectionImpl::CounterMap& counters) {
+      for (auto& [path, ref] : counters) {
+        if (path.starts_with("AsyncMessenger::Worker") &&
+            path.ends_with("." + name)) {
+          auto [sum, count] = ref.data->read_avg();
+          total.first += sum;
+          total.second += count;
+        }
+      }
+    });
+  return total;
+}
+
+TEST_P(MessengerTest, SyntheticSendCoalesceTest) {
+  g_ceph_context->_conf.set_val("ms_async_send_coalesce_bytes", "65536");
+  g_ceph_context->_conf.set_val("ms_async_send_coalesce_delay_us", "200");
+  auto [frames_before, writes_before] =
+    read_worker_avg("msgr_send_frames_per_write");
+  auto held_before = read_worker_avg("msgr_send_coalesce_lat").second;
+  SyntheticWorkload test_msg(8, 32, GetParam(), 100,
+                             Messenger::Policy::stateful_server(0),
+                             Messenger::Policy::lossless_client(0));
+  for (int i = 0; i < 50; ++i) {
+    if (!(i % 10)) lderr(g_ceph_context) << "seeding connection " << i << dendl;
+    test_msg.generate_connection();
+  }
+  gen_type rng(time(NULL));
+  for (int i = 0; i < 2000; ++i) {
+    if (!(i % 10)) {
+      lderr(g_ceph_context) << "Op " << i << ": " << dendl;
+      test_msg.print_internal_state();
+    }
+    boost::uniform_int<> true_false(0, 99);
+    int val = true_false(rng);
+    if (val > 95) {
+      test_msg.generate_connection();
+    } else if (val > 90) {
+      test_msg.drop_connection();
+    } else if (val > 5) {
+      test_msg.send_message();
+    } else {
+      usleep(rand() % 500 + 100);
+    }
+  }
+  test_msg.wait_for_done();
+  g_ceph_context->_conf.set_val("ms_async_send_coalesce_bytes", "0");
+  g_ceph_context->_conf.set_val("ms_async_send_coalesce_delay_us", "0");
+
+  // frames were held back, and on average more than one went per write
+  auto [frames, writes] = read_worker_avg("msgr_send_frames_per_write");
+  frames -= frames_before;
+  writes -= writes_before;
+  ASSERT_GT(writes, 0u);
+  ASSERT_GT(frames, writes);
+  ASSERT_GT(read_worker_avg("msgr_send_coalesce_lat").second, held_before);
+}
+
 TEST_P(MessengerTest, SyntheticInjectTest2) {
   g_ceph_context->_conf.set_val("ms_inject_socket_failures", "30");
   g_ceph_context->_conf.set_val("ms_inject_internal_delays", "0.1");
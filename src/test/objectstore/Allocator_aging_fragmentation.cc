@@ -18,6 +18,7 @@
 #include "include/stringify.h"
 #include "include/Context.h"
 #include "os/bluestore/Allocator.h"
+#include "os/bluestore/fastbmap_allocator_impl.h"
 
 #include <boost/random/uniform_int.hpp>
 
@@ -415,6 +416,49 @@ TEST_P(AllocTest, test_alloc_fragmentation_max_chunk_8M)
   }
 }
 
+TEST_P(AllocTest, test_alloc_8M_and_64K_scan_impls)
+{
+  // same aging as test_alloc_8M_and_64K, once per bitmap scan kernel
+  std::string allocator_name = GetParam();
+  if (allocator_name != "bitmap") {
+    GTEST_SKIP() << "only the bitmap allocator has scan kernels";
+  }
+  constexpr uint32_t max_chunk_size = 8*1024*1024;
+  constexpr uint32_t min_chunk_size = 64*1024;
+  for (auto impl : {"scalar", "avx2", "avx512"}) {
+    if (!slots_scan_set_impl(impl)) {
+      std::cout << "Scan kernel " << impl << " not supported" << std::endl;
+      continue;
+    }
+    utime_t start = ceph_clock_now();
+    for (auto& s:scenarios) {
+      if (s.alloc_unit != 65536/16) {
+        // small allocation units make for the longest scans
+        continue;
+      }
+      std::cout << "Scan kernel: " << impl << ", ";
+      PrintTo(s, &std::cout);
+      std::cout << std::endl;
+      boost::uniform_int<> D(0, 1);
+
+      auto size_generator = [&]() -> uint32_t {
+        if (D(rng) == 0)
+          return max_chunk_size;
+        else
+          return min_chunk_size;
+      };
+
+      doAgingTest(size_generator, allocator_name, s.capacity * _1G, s.alloc_unit,
+                  s.high_mark * s.capacity * _1G,
+                  s.low_mark * s.capacity * _1G,
+                  s.repeats, s.leakness);
+    }
+    std::cout << "Scan kernel " << impl << " total time="
+              << (ceph_clock_now() - start) * 1000 << "ms" << std::endl;
+  }
+  slots_scan_set_impl("auto");
+}
+
 TEST_P(AllocTest, test_bonus_empty_fragmented)
 {
   uint64_t capacity = uint64_t(512) * 1024 * 1024 * 1024; //512 G
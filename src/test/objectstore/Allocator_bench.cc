@@ -16,6 +16,7 @@
 #include "include/Context.h"
 #include "os/bluestore/Allocator.h"
 #include "os/bluestore/AllocatorBase.h"
+#include "os/bluestore/fastbmap_allocator_impl.h"
 
 #include <boost/random/mersenne_twister.hpp>
 #include <boost/random/uniform_int.hpp>
@@ -817,6 +818,48 @@ TEST_P(AllocTest, test_alloc_bench2_75_500_x2)
   doOverwriteMPC2Test(2, capacity, prefill, overwrite, 0.05);
 }
 
+/*
+* Compares bitmap scan kernels on a checkerboard-fragmented disk: every
+* other allocation unit is free, so every L1 entry is partial and each
+* request has to walk L0 looking for the longest free run.
+*/
+TEST_P(AllocTest, test_alloc_bench_fragmented_scan)
+{
+  if (GetParam() != string("bitmap")) {
+    GTEST_SKIP() << "only the bitmap allocator has scan kernels";
+  }
+  uint64_t capacity = uint64_t(1024) * 1024 * 1024 * 16;
+  uint64_t alloc_unit = 4096;
+  uint64_t want_size = 64 * 1024;
+  size_t iterations = 100000;
+
+  for (auto impl : {"scalar", "avx2", "avx512"}) {
+    if (!slots_scan_set_impl(impl)) {
+      std::cout << "Scan kernel " << impl << " not supported" << std::endl;
+      continue;
+    }
+    init_alloc(capacity, alloc_unit);
+    alloc->init_add_free(0, capacity);
+    alloc->init_rm_free(0, capacity);
+    for (uint64_t i = 0; i < capacity; i += alloc_unit * 2) {
+      alloc->init_add_free(i, alloc_unit);
+    }
+
+    utime_t start = ceph_clock_now();
+    for (size_t i = 0; i < iterations; ++i) {
+      PExtentVector tmp;
+      EXPECT_EQ(static_cast<int64_t>(want_size),
+                alloc->allocate(want_size, alloc_unit, 0, -1, &tmp));
+      alloc->release(tmp);
+    }
+    std::cout << "Scan kernel " << impl << ": " << iterations
+              << " allocations executed in " << ceph_clock_now() - start
+              << std::endl;
+    init_close();
+  }
+  slots_scan_set_impl("auto");
+}
+
 TEST_P(AllocTest, mempoolAccounting)
 {
   uint64_t bytes = mempool::bluestore_alloc::allocated_bytes();
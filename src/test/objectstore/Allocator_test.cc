@@ -15,6 +15,7 @@
 #include "include/stringify.h"
 #include "include/Context.h"
 #include "os/bluestore/Allocator.h"
+#include "os/bluestore/ShardedAllocator.h"
 
 using namespace std;
 
@@ -1321,6 +1322,158 @@ TEST_P(AllocTest, test_get_free_extents_needle_at_end)
   alloc->shutdown();
 }
 
+static ShardedAllocator* create_sharded(
+  const char* shard_type, size_t shards, int64_t capacity, int64_t alloc_unit)
+{
+  auto& conf = g_ceph_context->_conf;
+  // the settings are only read at creation, put them back for later tests
+  auto old_type = conf.get_val<std::string>("bluestore_allocator_shard_type");
+  auto old_shards = conf.get_val<uint64_t>("bluestore_allocator_shards");
+  conf.set_val_or_die("bluestore_allocator_shard_type", shard_type);
+  conf.set_val_or_die("bluestore_allocator_shards", stringify(shards));
+  auto a = Allocator::create(g_ceph_context, "sharded", capacity, alloc_unit);
+  conf.set_val_or_die("bluestore_allocator_shard_type", old_type);
+  conf.set_val_or_die("bluestore_allocator_shards", stringify(old_shards));
+  return static_cast<ShardedAllocator*>(a);
+}
+
+TEST(ShardedAllocator, test_regions_and_foreach)
+{
+  int64_t alloc_unit = 4096;
+  int64_t capacity = 64 * 1024 * 1024;
+  std::unique_ptr<ShardedAllocator> alloc(
+    create_sharded("avl", 4, capacity, alloc_unit));
+  ASSERT_EQ(4u, alloc->get_shard_count());
+  alloc->init_add_free(0, capacity);
+  ASSERT_EQ((uint64_t)capacity, alloc->get_free());
+
+  // the region boundaries aren't visible to foreach()
+  std::vector<std::pair<uint64_t, uint64_t>> extents;
+  alloc->foreach([&](uint64_t o, uint64_t l) { extents.emplace_back(o, l); });
+  ASSERT_EQ(1u, extents.size());
+  ASSERT_EQ(0u, extents[0].first);
+  ASSERT_EQ((uint64_t)capacity, extents[0].second);
+  ASSERT_EQ(0.0, alloc->get_fragmentation_score());
+
+  // an extent crossing a boundary is split between the shards and
+  // put back together
+  uint64_t off = capacity / 4 - alloc_unit;
+  alloc->init_rm_free(off, 2 * alloc_unit);
+  ASSERT_EQ((uint64_t)capacity - 2 * alloc_unit, alloc->get_free());
+  interval_set<uint64_t> release_set;
+  release_set.insert(off, 2 * alloc_unit);
+  alloc->release(release_set);
+  extents.clear();
+  alloc->foreach([&](uint64_t o, uint64_t l) { extents.emplace_back(o, l); });
+  ASSERT_EQ(1u, extents.size());
+
+  free_extent_vector_t out;
+  uint64_t cursor = alloc->get_free_extents(0, capacity, 0, &out);
+  ASSERT_GE(cursor, (uint64_t)capacity);
+  uint64_t total = 0;
+  for (auto& e : out) {
+    total += e.length;
+  }
+  ASSERT_EQ((uint64_t)capacity, total);
+  alloc->shutdown();
+}
+
+TEST(ShardedAllocator, test_steal_from_other_shards)
+{
+  int64_t alloc_unit = 4096;
+  int64_t capacity = 64 * 1024 * 1024;
+  int64_t region = capacity / 4;
+  std::unique_ptr<ShardedAllocator> alloc(
+    create_sharded("avl", 4, capacity, alloc_unit));
+  // only the last region has free space
+  alloc->init_add_free(3 * region, region);
+
+  PExtentVector extents;
+  ASSERT_EQ(region / 2,
+            alloc->allocate(region / 2, alloc_unit, 0, -1, &extents));
+  for (auto& e : extents) {
+    ASSERT_GE(e.offset, (uint64_t)3 * region);
+  }
+  // more than is left: whatever remains is returned
+  PExtentVector extents2;
+  ASSERT_EQ(region / 2,
+            alloc->allocate(region, alloc_unit, 0, -1, &extents2));
+  PExtentVector extents3;
+  ASSERT_EQ(-ENOSPC,
+            alloc->allocate(alloc_unit, alloc_unit, 0, -1, &extents3));
+  alloc->release(extents);
+  alloc->release(extents2);
+  ASSERT_EQ((uint64_t)region, alloc->get_free());
+  alloc->shutdown();
+}
+
+TEST(ShardedAllocator, test_offsets_are_device_relative)
+{
+  int64_t alloc_unit = 4096;
+  // the last region comes out short
+  int64_t capacity = 64 * 1024 * 1024 - 3 * alloc_unit;
+  uint64_t region = 16 * 1024 * 1024;
+  auto shard_type = g_ceph_context->_conf.get_val<std::string>(
+    "bluestore_allocator_shard_type");
+  for (const char* type : {"bitmap", "hybrid", "hybrid_btree2"}) {
+    std::unique_ptr<ShardedAllocator> alloc(
+      create_sharded(type, 4, capacity, alloc_unit));
+    ASSERT_EQ(4u, alloc->get_shard_count());
+    alloc->init_add_free(0, capacity);
+    ASSERT_EQ((uint64_t)capacity, alloc->get_free());
+
+    // a hint picks the region, and what comes back lies inside it
+    for (uint64_t s = 0; s < 4; s++) {
+      PExtentVector extents;
+      ASSERT_EQ(alloc_unit, alloc->allocate(alloc_unit, alloc_unit, 0,
+                                            s * region + alloc_unit,
+                                            &extents));
+      ASSERT_EQ(1u, extents.size());
+      ASSERT_GE(extents[0].offset, s * region);
+      ASSERT_LT(extents[0].offset, (s + 1) * region);
+      alloc->release(extents);
+    }
+    // the very end of the device
+    alloc->init_rm_free(0, capacity - alloc_unit);
+    PExtentVector extents;
+    ASSERT_EQ(alloc_unit,
+              alloc->allocate(alloc_unit, alloc_unit, 0, -1, &extents));
+    ASSERT_EQ(1u, extents.size());
+    ASSERT_EQ((uint64_t)capacity - alloc_unit, extents[0].offset);
+    alloc->release(extents);
+
+    free_extent_vector_t out;
+    alloc->get_free_extents(0, capacity, 0, &out);
+    ASSERT_EQ(1u, out.size());
+    ASSERT_EQ((uint64_t)capacity - alloc_unit, out[0].offset);
+    alloc->shutdown();
+  }
+  ASSERT_EQ(shard_type, g_ceph_context->_conf.get_val<std::string>(
+    "bluestore_allocator_shard_type"));
+}
+
+TEST(ShardedAllocator, test_fragmentation_score_matches_unsharded)
+{
+  int64_t alloc_unit = 4096;
+  int64_t capacity = 256 * 1024 * 1024;
+  std::unique_ptr<ShardedAllocator> sharded(
+    create_sharded("avl", 8, capacity, alloc_unit));
+  std::unique_ptr<Allocator> plain(
+    Allocator::create(g_ceph_context, "avl", capacity, alloc_unit));
+  sharded->init_add_free(0, capacity);
+  plain->init_add_free(0, capacity);
+  // fragment the first half, including across region boundaries
+  for (uint64_t pos = 0; pos < (uint64_t)capacity / 2; pos += alloc_unit * 3) {
+    sharded->init_rm_free(pos, alloc_unit);
+    plain->init_rm_free(pos, alloc_unit);
+  }
+  ASSERT_EQ(plain->get_free(), sharded->get_free());
+  ASSERT_DOUBLE_EQ(plain->get_fragmentation_score(),
+                   sharded->get_fragmentation_score());
+  sharded->shutdown();
+  plain->shutdown();
+}
+
 INSTANTIATE_TEST_SUITE_P(
   Allocator,
   AllocTest,
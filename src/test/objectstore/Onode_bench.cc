@@ -0,0 +1,236 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:nil -*-
+// vim: ts=8 sw=2 sts=2 expandtab
+
+/*
+ * BlueStore onode benchmarks: cache lookups of a working set that fits
+ * the cache from a growing number of threads, with and without the
+ * lock-free hit table, decoding the extent map of a heavily fragmented
+ * object in each shard encoding, and shared blob lookups while snapshot
+ * trimming churns the shared blob set.
+ */
+#include <atomic>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "common/ceph_time.h"
+#include "common/perf_counters.h"
+#include "global/global_context.h"
+#include "os/bluestore/BlueStore.h"
+
+using namespace std;
+
+class OnodeBench : public ::testing::TestWithParam<int> {
+public:
+  static constexpr unsigned NUM_ONODES = 1024;
+  static constexpr unsigned LOOKUPS_PER_THREAD = 2000000;
+};
+
+TEST_P(OnodeBench, lookup_hits)
+{
+  const int num_threads = GetParam();
+
+  PerfCountersBuilder b(g_ceph_context, "onode_bench",
+                        l_bluestore_first, l_bluestore_last);
+  b.add_u64_counter(l_bluestore_onode_hits, "onode_hits", "");
+  b.add_u64_counter(l_bluestore_onode_misses, "onode_misses", "");
+  std::unique_ptr<PerfCounters> logger{b.create_perf_counters()};
+
+  BlueStore store(g_ceph_context, "", 4096);
+  std::unique_ptr<BlueStore::OnodeCacheShard> oc{
+      BlueStore::OnodeCacheShard::create(g_ceph_context, "lru", logger.get())};
+  std::unique_ptr<BlueStore::BufferCacheShard> bc{
+      BlueStore::BufferCacheShard::create(&store, "lru", logger.get())};
+  oc->set_max(NUM_ONODES * 2);
+
+  vector<ghobject_t> oids;
+  for (unsigned i = 0; i < NUM_ONODES; ++i) {
+    oids.emplace_back(hobject_t(sobject_t("obj" + to_string(i), CEPH_NOSNAP)));
+  }
+
+  auto& conf = g_ceph_context->_conf;
+  auto saved_slots = conf.get_val<uint64_t>("bluestore_onode_hot_slots");
+  // baseline without lock-free hits, a table much smaller than the
+  // working set, and the default one, as large as the working set
+  double baseline = 0;
+  for (unsigned slots : {0u, 64u, NUM_ONODES}) {
+    conf.set_val_or_die("bluestore_onode_hot_slots", to_string(slots));
+    auto coll = ceph::make_ref<BlueStore::Collection>(
+      &store, oc.get(), bc.get(), coll_t());
+    for (auto& oid : oids) {
+      BlueStore::OnodeRef o(new BlueStore::Onode(coll.get(), oid, ""));
+      o->exists = true;
+      coll->onode_space.add_onode(oid, o);
+    }
+
+    std::atomic<uint64_t> misses = 0;
+    auto start = ceph::mono_clock::now();
+    vector<std::thread> threads;
+    for (int t = 0; t < num_threads; ++t) {
+      threads.emplace_back([&, t] {
+        uint64_t my_misses = 0;
+        for (unsigned i = 0; i < LOOKUPS_PER_THREAD; ++i) {
+          // threads walk the set with different strides so they collide
+          // on some onodes and not on others
+          auto& oid = oids[(i * (t + 1)) % oids.size()];
+          if (!coll->onode_space.lookup(oid)) {
+            ++my_misses;
+          }
+        }
+        misses += my_misses;
+      });
+    }
+    for (auto& th : threads) {
+      th.join();
+    }
+    double secs = ceph::to_seconds<double>(ceph::mono_clock::now() - start);
+    uint64_t total = uint64_t(num_threads) * LOOKUPS_PER_THREAD;
+    double rate = total / secs;
+    if (!slots) {
+      baseline = rate;
+    }
+    cout << num_threads << " threads, " << slots << " hot slots for "
+         << NUM_ONODES << " onodes: " << total << " lookups in " << secs
+         << "s, " << rate << " lookups/s (" << (rate / baseline)
+         << "x baseline), " << misses << " misses" << std::endl;
+    EXPECT_EQ(0u, misses);
+
+    coll->onode_space.clear();
+  }
+  conf.set_val_or_die("bluestore_onode_hot_slots", to_string(saved_slots));
+}
+
+INSTANTIATE_TEST_SUITE_P(
+  BlueStore,
+  OnodeBench,
+  ::testing::Values(1, 2, 4, 8, 16));
+
+TEST(ExtentMapBench, decode)
+{
+  static constexpr unsigned NUM_EXTENTS = 4096;
+  static constexpr unsigned ROUNDS = 200;
+
+  BlueStore store(g_ceph_context, "", 4096);
+  std::unique_ptr<BlueStore::OnodeCacheShard> oc{
+      BlueStore::OnodeCacheShard::create(g_ceph_context, "lru", nullptr)};
+  std::unique_ptr<BlueStore::BufferCacheShard> bc{
+      BlueStore::BufferCacheShard::create(&store, "lru", nullptr)};
+  auto coll = ceph::make_ref<BlueStore::Collection>(
+    &store, oc.get(), bc.get(), coll_t());
+
+  // an RBD image object after random 4k overwrites: every extent has its
+  // own blob, most blobs are referenced by two extents
+  BlueStore::Onode onode(coll.get(), ghobject_t(), "");
+  uint32_t pos = 0;
+  for (unsigned i = 0; i < NUM_EXTENTS / 2; ++i) {
+    BlueStore::BlobRef b(coll->new_blob());
+    b->dirty_blob().allocated_test(
+      bluestore_pextent_t(0x1000000 + (i * 7919 % NUM_EXTENTS) * 0x2000,
+                          0x2000));
+    b->dirty_blob().init_csum(Checksummer::CSUM_CRC32C, 12, 0x2000);
+    onode.extent_map.set_lextent(coll, pos, 0, 0x1000, b, nullptr);
+    onode.extent_map.set_lextent(coll, pos + 0x1000, 0x1000, 0x1000, b,
+                                 nullptr);
+    pos += i % 5 ? 0x2000 : 0x3000;
+  }
+
+  for (bool columnar : {false, true}) {
+    store.debug_set_extent_map_columnar(columnar);
+    bufferlist bl;
+    unsigned n = 0;
+    ASSERT_FALSE(onode.extent_map.encode_some(
+      0, BlueStore::OBJECT_MAX_SIZE, bl, &n, false, false));
+    bl.rebuild();
+    auto start = ceph::mono_clock::now();
+    for (unsigned r = 0; r < ROUNDS; ++r) {
+      BlueStore::Onode loaded(coll.get(), ghobject_t(), "");
+      ASSERT_EQ(n, loaded.extent_map.decode_some(bl));
+    }
+    double secs = ceph::to_seconds<double>(ceph::mono_clock::now() - start);
+    cout << (columnar ? "v3 columnar" : "v2 varint") << ": " << n
+         << " extents in " << bl.length() << " bytes, "
+         << (secs * 1e9 / (double(n) * ROUNDS)) << " ns/extent" << std::endl;
+  }
+}
+
+class SharedBlobSetBench : public ::testing::TestWithParam<int> {
+public:
+  static constexpr uint64_t NUM_SBIDS = 65536;
+  static constexpr unsigned LOOKUPS_PER_THREAD = 2000000;
+};
+
+TEST_P(SharedBlobSetBench, lookup_with_churn)
+{
+  const int num_threads = GetParam();
+
+  BlueStore store(g_ceph_context, "", 4096);
+  std::unique_ptr<BlueStore::OnodeCacheShard> oc{
+      BlueStore::OnodeCacheShard::create(g_ceph_context, "lru", nullptr)};
+  std::unique_ptr<BlueStore::BufferCacheShard> bc{
+      BlueStore::BufferCacheShard::create(&store, "lru", nullptr)};
+  auto coll = ceph::make_ref<BlueStore::Collection>(
+    &store, oc.get(), bc.get(), coll_t());
+  auto& set = coll->shared_blob_set;
+
+  auto meta_before = mempool::bluestore_cache_meta::allocated_bytes();
+  // the odd sbids stay, the even ones are opened and dropped again by
+  // the trimmer, like the clones of COW writes and snap trim
+  vector<BlueStore::SharedBlobRef> pinned;
+  for (uint64_t sbid = 1; sbid <= NUM_SBIDS; sbid += 2) {
+    pinned.emplace_back(new BlueStore::SharedBlob(sbid, coll.get()));
+    set.add(coll.get(), pinned.back().get());
+  }
+  cout << "shared blob set: "
+       << double(mempool::bluestore_cache_meta::allocated_bytes() -
+                 meta_before) / pinned.size()
+       << " bytes per entry" << std::endl;
+
+  std::atomic<bool> stop = false;
+  std::atomic<uint64_t> churned = 0;
+  std::thread trimmer([&] {
+    uint64_t n = 0;
+    while (!stop) {
+      uint64_t sbid = 2 + (n * 2 * 7919) % NUM_SBIDS;
+      BlueStore::SharedBlobRef sb(new BlueStore::SharedBlob(sbid, coll.get()));
+      set.add(coll.get(), sb.get());
+      ++n;
+    }
+    churned = n;
+  });
+
+  std::atomic<uint64_t> misses = 0;
+  auto start = ceph::mono_clock::now();
+  vector<std::thread> threads;
+  for (int t = 0; t < num_threads; ++t) {
+    threads.emplace_back([&, t] {
+      uint64_t my_misses = 0;
+      for (unsigned i = 0; i < LOOKUPS_PER_THREAD; ++i) {
+        uint64_t sbid = 1 + ((i * (t + 1) * 2) % NUM_SBIDS);
+        if (!set.lookup(sbid)) {
+          ++my_misses;
+        }
+      }
+      misses += my_misses;
+    });
+  }
+  for (auto& th : threads) {
+    th.join();
+  }
+  double secs = ceph::to_seconds<double>(ceph::mono_clock::now() - start);
+  stop = true;
+  trimmer.join();
+  uint64_t total = uint64_t(num_threads) * LOOKUPS_PER_THREAD;
+  cout << num_threads << " threads: " << total << " lookups in " << secs
+       << "s, " << (total / secs) << " lookups/s, " << churned
+       << " shared blobs churned" << std::endl;
+  ASSERT_EQ(0u, misses);
+
+  pinned.clear();
+  ASSERT_TRUE(set.empty());
+}
+
+INSTANTIATE_TEST_SUITE_P(
+  BlueStore,
+  SharedBlobSetBench,
+  ::testing::Values(1, 2, 4, 8, 16));
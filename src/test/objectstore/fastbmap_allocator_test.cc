@@ -2,6 +2,7 @@
 // vim: ts=8 sw=2 sts=2 expandtab
 
 #include <iostream>
+#include <random>
 #include <gtest/gtest.h>
 
 #include "os/bluestore/fastbmap_allocator_impl.h"
@@ -1252,3 +1253,32 @@ TEST(TestAllocatorLevel02, test_expand_multiple_times)
   uint64_t free_final = al2.debug_get_free();
   ASSERT_EQ(free_final, 28 * 1024 * 1024); // 128MiB - 100MiB
 }
+
+TEST(TestSlotsScan, kernels_match_scalar)
+{
+  std::mt19937_64 rng(0);
+  std::vector<slot_t> v(200);
+  for (size_t round = 0; round < 1000; ++round) {
+    slot_t val = (round % 2) ? all_slot_set : all_slot_clear;
+    size_t n = rng() % v.size();
+    size_t diff = rng() % (v.size() + 1);
+    for (size_t i = 0; i < v.size(); ++i) {
+      v[i] = i < diff ? val : slot_t(rng());
+    }
+
+    ASSERT_TRUE(slots_scan_set_impl("scalar"));
+    size_t expected_pos = slots_find_first_not(v.data(), n, val);
+    uint64_t expected_bits = slots_count_bits(v.data(), n);
+    ASSERT_EQ(std::min(n, diff), expected_pos);
+
+    for (auto impl : {"avx2", "avx512"}) {
+      if (!slots_scan_set_impl(impl)) {
+        continue;
+      }
+      ASSERT_EQ(expected_pos, slots_find_first_not(v.data(), n, val)) << impl;
+      ASSERT_EQ(expected_bits, slots_count_bits(v.data(), n)) << impl;
+    }
+  }
+  ASSERT_TRUE(slots_scan_set_impl("auto"));
+  std::cout << "using " << slots_scan_impl() << std::endl;
+}
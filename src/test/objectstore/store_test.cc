@@ -2417,6 +2417,263 @@ TEST_P(StoreTestSpecificAUSize, BluestoreStatFSTest) {
   }
 }
 
+TEST_P(StoreTestSpecificAUSize, BluestoreRecompressTest) {
+  if(string(GetParam()) != "bluestore")
+    return;
+  SetVal(g_conf(), "bluestore_write_v2", "true");
+  SetVal(g_conf(), "bluestore_block_db_path", "");
+  StartDeferred(0x1000);
+  SetVal(g_conf(), "bluestore_compression_mode", "force");
+  SetVal(g_conf(), "bluestore_compression_algorithm", "snappy");
+  SetVal(g_conf(), "bluestore_compression_min_blob_size", "65536");
+  SetVal(g_conf(), "bluestore_compression_max_blob_size", "65536");
+  SetVal(g_conf(), "bluestore_recompress_algorithm", "zstd");
+  SetVal(g_conf(), "bluestore_recompress_level", "9");
+  // keep the write path from repacking the overwritten blobs by itself
+  SetVal(g_conf(), "bluestore_recompression_min_gain", "1000");
+  g_conf().apply_changes(nullptr);
+
+  int r;
+  coll_t cid;
+  ghobject_t hoid(hobject_t(sobject_t("Object 1", CEPH_NOSNAP)));
+  ghobject_t hoid_missing(hobject_t(sobject_t("Object 2", CEPH_NOSNAP)));
+  auto ch = store->create_new_collection(cid);
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  const size_t obj_size = 0x40000;
+  bufferlist expected;
+  {
+    std::string s(obj_size, 0);
+    for (size_t i = 0; i < s.size(); ++i) {
+      s[i] = 'a' + (i / 7 + i / 1000) % 26;
+    }
+    expected.append(s);
+    ObjectStore::Transaction t;
+    t.write(cid, hoid, 0, expected.length(), expected);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  {
+    // punch incompressible 4k holes into every compressed blob
+    ObjectStore::Transaction t;
+    for (size_t off = 0x2000; off < obj_size; off += 0x10000) {
+      bufferlist bl;
+      bufferptr p(0x1000);
+      for (size_t i = 0; i < p.length(); ++i) {
+        p.c_str()[i] = rand();
+      }
+      bl.append(p);
+      t.write(cid, hoid, off, bl.length(), bl);
+      bufferlist head, tail;
+      head.substr_of(expected, 0, off);
+      tail.substr_of(expected, off + bl.length(),
+                     expected.length() - off - bl.length());
+      expected = std::move(head);
+      expected.append(bl);
+      expected.append(tail);
+    }
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  SetVal(g_conf(), "bluestore_recompression_min_gain", "1.2");
+  g_conf().apply_changes(nullptr);
+
+  struct store_statfs_t before;
+  r = store->statfs(&before);
+  ASSERT_EQ(r, 0);
+
+  ASSERT_EQ(-ENOENT, store->recompress(ch, hoid_missing));
+  int64_t rewritten = store->recompress(ch, hoid);
+  ASSERT_GE(rewritten, 0);
+  EXPECT_GT(rewritten, 0);
+  struct store_statfs_t after;
+  r = store->statfs(&after);
+  ASSERT_EQ(r, 0);
+  EXPECT_LE(rewritten, (int64_t)obj_size);
+  EXPECT_LE(after.allocated, before.allocated);
+  EXPECT_EQ(after.data_stored, before.data_stored);
+
+  {
+    bufferlist in;
+    r = store->read(ch, hoid, 0, obj_size, in);
+    ASSERT_EQ((int)obj_size, r);
+    ASSERT_TRUE(bl_eq(expected, in));
+  }
+  ch.reset();
+  EXPECT_EQ(store->umount(), 0);
+  ASSERT_EQ(store->fsck(false), 0);
+  EXPECT_EQ(store->mount(), 0);
+  ch = store->open_collection(cid);
+  {
+    bufferlist in;
+    r = store->read(ch, hoid, 0, obj_size, in);
+    ASSERT_EQ((int)obj_size, r);
+    ASSERT_TRUE(bl_eq(expected, in));
+  }
+  {
+    ObjectStore::Transaction t;
+    t.remove(cid, hoid);
+    t.remove_collection(cid);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+}
+
+TEST_P(StoreTestSpecificAUSize, BluestoreWriteAmplificationTest) {
+  if(string(GetParam()) != "bluestore")
+    return;
+  SetVal(g_conf(), "bluestore_prefer_deferred_size", "32768");
+  g_conf().apply_changes(nullptr);
+  StartDeferred(0x1000);
+
+  int r;
+  coll_t cid;
+  ghobject_t hoid(hobject_t(sobject_t("Object 1", CEPH_NOSNAP)));
+  const PerfCounters* logger = store->get_perf_counters();
+  auto ch = store->create_new_collection(cid);
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  auto user0 = logger->get(l_bluestore_wa_user_bytes);
+  auto device0 = logger->get(l_bluestore_wa_device_bytes);
+  auto deferred0 = logger->get(l_bluestore_wa_deferred_bytes);
+  auto kv0 = logger->get(l_bluestore_wa_kv_bytes);
+  {
+    ObjectStore::Transaction t;
+    bufferlist bl;
+    bl.append(std::string(0x10000, 'a'));
+    t.write(cid, hoid, 0, bl.length(), bl);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  EXPECT_EQ(logger->get(l_bluestore_wa_user_bytes) - user0, 0x10000u);
+  EXPECT_EQ(logger->get(l_bluestore_wa_device_bytes) - device0, 0x10000u);
+  EXPECT_EQ(logger->get(l_bluestore_wa_deferred_bytes) - deferred0, 0u);
+  EXPECT_GT(logger->get(l_bluestore_wa_kv_bytes), kv0);
+  {
+    // overwrite goes through the deferred path
+    ObjectStore::Transaction t;
+    bufferlist bl;
+    bl.append(std::string(0x1000, 'b'));
+    t.write(cid, hoid, 0x2000, bl.length(), bl);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  EXPECT_EQ(logger->get(l_bluestore_wa_user_bytes) - user0, 0x11000u);
+  EXPECT_EQ(logger->get(l_bluestore_wa_device_bytes) - device0, 0x11000u);
+  EXPECT_EQ(logger->get(l_bluestore_wa_deferred_bytes) - deferred0, 0x1000u);
+  {
+    ObjectStore::Transaction t;
+    t.remove(cid, hoid);
+    t.remove_collection(cid);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+}
+
+TEST_P(StoreTestSpecificAUSize, BluestoreFastTierTest) {
+  if(string(GetParam()) != "bluestore")
+    return;
+  SetVal(g_conf(), "bluestore_block_db_path", "");
+  SetVal(g_conf(), "bluestore_block_fast_create", "true");
+  SetVal(g_conf(), "bluestore_block_fast_size", "268435456");
+  // every written object is hot right away
+  SetVal(g_conf(), "bluestore_tier_promote_heat", "1");
+  SetVal(g_conf(), "bluestore_tier_demote_heat", "0");
+  StartDeferred(0x1000);
+
+  int r;
+  coll_t cid;
+  ghobject_t hoid(hobject_t(sobject_t("Object 1", CEPH_NOSNAP)));
+  ghobject_t hoid_missing(hobject_t(sobject_t("Object 2", CEPH_NOSNAP)));
+  auto ch = store->create_new_collection(cid);
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  const size_t obj_size = 0x80000;
+  bufferlist expected;
+  {
+    bufferptr p(obj_size);
+    for (size_t i = 0; i < p.length(); ++i) {
+      p.c_str()[i] = rand();
+    }
+    expected.append(p);
+    ObjectStore::Transaction t;
+    t.write(cid, hoid, 0, expected.length(), expected);
+    // a small overwrite goes through the deferred path
+    bufferlist small;
+    small.substr_of(expected, 0x3000, 0x1000);
+    t.write(cid, hoid, 0x3000, small.length(), small);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  struct store_statfs_t hot;
+  r = store->statfs(&hot);
+  ASSERT_EQ(r, 0);
+  EXPECT_EQ(hot.data_stored, obj_size);
+  // statfs covers both devices
+  EXPECT_GT(hot.total, (uint64_t)268435456);
+
+  // everything is cold now
+  SetVal(g_conf(), "bluestore_tier_promote_heat", "1000");
+  SetVal(g_conf(), "bluestore_tier_demote_heat", "999");
+  g_conf().apply_changes(nullptr);
+  ASSERT_EQ(-ENOENT, store->retier(ch, hoid_missing));
+  EXPECT_EQ((int64_t)obj_size, store->retier(ch, hoid));
+  EXPECT_EQ(0, store->retier(ch, hoid));
+  {
+    bufferlist in;
+    r = store->read(ch, hoid, 0, obj_size, in);
+    ASSERT_EQ((int)obj_size, r);
+    ASSERT_TRUE(bl_eq(expected, in));
+  }
+  ch.reset();
+  EXPECT_EQ(store->umount(), 0);
+  ASSERT_EQ(store->fsck(false), 0);
+  EXPECT_EQ(store->mount(), 0);
+  ch = store->open_collection(cid);
+
+  // and hot again
+  SetVal(g_conf(), "bluestore_tier_promote_heat", "1");
+  SetVal(g_conf(), "bluestore_tier_demote_heat", "0");
+  g_conf().apply_changes(nullptr);
+  {
+    bufferlist in;
+    r = store->read(ch, hoid, 0, obj_size, in);
+    ASSERT_EQ((int)obj_size, r);
+    ASSERT_TRUE(bl_eq(expected, in));
+  }
+  EXPECT_EQ((int64_t)obj_size, store->retier(ch, hoid));
+  {
+    bufferlist in;
+    r = store->read(ch, hoid, 0, obj_size, in);
+    ASSERT_EQ((int)obj_size, r);
+    ASSERT_TRUE(bl_eq(expected, in));
+  }
+  ch.reset();
+  EXPECT_EQ(store->umount(), 0);
+  ASSERT_EQ(store->fsck(false), 0);
+  EXPECT_EQ(store->mount(), 0);
+  ch = store->open_collection(cid);
+  {
+    ObjectStore::Transaction t;
+    t.remove(cid, hoid);
+    t.remove_collection(cid);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+}
+
 TEST_P(StoreTestSpecificAUSize, BluestoreFragmentedBlobTest) {
   if(string(GetParam()) != "bluestore")
     return;
@@ -8558,6 +8815,138 @@ TEST_P(StoreTestSpecificAUSize, ManyManyExtents2) {
   }
 }
 
+TEST_P(StoreTestSpecificAUSize, OnodeWarmupAfterRemount) {
+  if (string(GetParam()) != "bluestore")
+    return;
+
+  StartDeferred(4096);
+  SetVal(g_conf(), "bluestore_onode_warmup_max", "1000");
+  g_conf().apply_changes(nullptr);
+
+  const unsigned num_objects = 50;
+  int r;
+  coll_t cid;
+  auto ch = store->create_new_collection(cid);
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  vector<ghobject_t> oids;
+  for (unsigned i = 0; i < num_objects; ++i) {
+    ghobject_t hoid(hobject_t(sobject_t("warm_" + stringify(i), CEPH_NOSNAP)));
+    ObjectStore::Transaction t;
+    bufferlist bl;
+    bl.append(std::string(8192, 'a' + i % 26));
+    t.write(cid, hoid, 0, bl.length(), bl);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+    oids.push_back(hoid);
+  }
+  ch.reset();
+  const PerfCounters* logger = store->get_perf_counters();
+  uint64_t misses = logger->get(l_bluestore_onode_misses);
+  r = store->umount();
+  ASSERT_EQ(0, r);
+  r = store->mount();
+  ASSERT_EQ(0, r);
+  ch = store->open_collection(cid);
+
+  // the prefetch runs in the background; each onode it loads is a miss
+  for (int i = 0;
+       i < 100 && logger->get(l_bluestore_onode_misses) < misses + num_objects;
+       ++i) {
+    usleep(100000);
+  }
+  misses = logger->get(l_bluestore_onode_misses);
+  for (auto& hoid : oids) {
+    struct stat st;
+    r = store->stat(ch, hoid, &st);
+    ASSERT_EQ(0, r);
+    ASSERT_EQ(8192, st.st_size);
+  }
+  ASSERT_EQ(misses, logger->get(l_bluestore_onode_misses));
+
+  {
+    ObjectStore::Transaction t;
+    for (auto& hoid : oids) {
+      t.remove(cid, hoid);
+    }
+    t.remove_collection(cid);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+}
+
+TEST_P(StoreTestSpecificAUSize, ReadvScatteredMatchesRead) {
+
+  if (string(GetParam()) != "bluestore")
+    return;
+
+  size_t block_size = 4096;
+  StartDeferred(block_size);
+
+  int r;
+  coll_t cid;
+  ghobject_t hoid(hobject_t("test", "", CEPH_NOSNAP, 0, -1, ""));
+
+  auto ch = store->create_new_collection(cid);
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  // separate small writes give separate blobs, mostly adjacent on disk,
+  // with a few holes left in between
+  for (size_t i = 0; i < 64; i++) {
+    if (i % 7 == 3) {
+      continue;
+    }
+    ObjectStore::Transaction t;
+    bufferlist bl;
+    bl.append(std::string(block_size, 'a' + i % 26));
+    t.write(cid, hoid, i * block_size, bl.length(), bl,
+            CEPH_OSD_OP_FLAG_FADVISE_DONTNEED);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  ch.reset();
+  store->umount();
+  store->mount();
+  ch = store->open_collection(cid);
+  {
+    bufferlist whole;
+    r = store->read(ch, hoid, 0, 64 * block_size, whole,
+                    CEPH_OSD_OP_FLAG_FADVISE_DONTNEED);
+    ASSERT_EQ(r, 64 * block_size);
+
+    interval_set<uint64_t> im;
+    bufferlist expected;
+    for (size_t i = 0; i < 64; i += 3) {
+      uint64_t off = i * block_size + 100;
+      uint64_t len = block_size + 200;
+      im.insert(off, len);
+      bufferlist t;
+      t.substr_of(whole, off, len);
+      expected.claim_append(t);
+    }
+    bufferlist bl;
+    r = store->readv(ch, hoid, im, bl, CEPH_OSD_OP_FLAG_FADVISE_DONTNEED);
+    ASSERT_EQ(r, (int)expected.length());
+    ASSERT_TRUE(bl_eq(expected, bl));
+  }
+  {
+    ObjectStore::Transaction t;
+    t.remove(cid, hoid);
+    t.remove_collection(cid);
+    cerr << "Cleaning" << std::endl;
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+}
+
 TEST_P(StoreTestSpecificAUSize, ZeroBlockDetectionSmallAppend) {
   CephContext *cct = (new CephContext(CEPH_ENTITY_TYPE_CLIENT))->get();
   if (string(GetParam()) != "bluestore" || !cct->_conf->bluestore_zero_block_detection) {
@@ -10721,6 +11110,68 @@ TEST_P(StoreTestSpecificAUSize, BluestoreRepairTest) {
   cerr << "Completing" << std::endl;
 }
 
+TEST_P(StoreTestSpecificAUSize, BluestoreThreadedFsckTest) {
+  if (string(GetParam()) != "bluestore")
+    return;
+  const size_t offs_base = 65536 / 2;
+  const size_t repeats = 16;
+  const size_t num_objects = 600; // more than a single fsck batch
+
+  SetVal(g_conf(), "bluestore_fsck_on_mount", "false");
+  SetVal(g_conf(), "bluestore_fsck_on_umount", "false");
+  SetVal(g_conf(), "bluestore_max_blob_size",
+    stringify(2 * offs_base).c_str());
+  SetVal(g_conf(), "bluestore_extent_map_shard_max_size", "12000");
+
+  StartDeferred(0x10000);
+
+  BlueStore* bstore = dynamic_cast<BlueStore*> (store.get());
+
+  const uint64_t pool = 555;
+  coll_t cid(spg_t(pg_t(0, pool), shard_id_t::NO_SHARD));
+  ghobject_t hoid = make_object("Object 1", pool);
+  ghobject_t hoid_dup = make_object("Object 1(dup)", pool);
+  bufferlist bl;
+  bl.append("1234512345");
+  {
+    auto ch = store->create_new_collection(cid);
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    for (auto i = 0ul; i < repeats; ++i) {
+      t.write(cid, hoid, i * offs_base, bl.length(), bl);
+      t.write(cid, hoid_dup, i * offs_base, bl.length(), bl);
+    }
+    int r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+    for (size_t i = 0; i < num_objects; ++i) {
+      ObjectStore::Transaction t;
+      ghobject_t o = make_object(("obj_" + stringify(i)).c_str(), pool);
+      t.write(cid, o, (i % repeats) * offs_base, bl.length(), bl);
+      r = queue_transaction(store, ch, std::move(t));
+      ASSERT_EQ(r, 0);
+    }
+  }
+
+  bstore->umount();
+  for (auto threads : {"0", "4"}) {
+    SetVal(g_conf(), "bluestore_fsck_threads", threads);
+    ASSERT_EQ(bstore->fsck(false), 0);
+    ASSERT_EQ(bstore->fsck(true), 0);
+  }
+
+  bstore->mount();
+  bstore->inject_misreference(cid, hoid, cid, hoid_dup, 0);
+  bstore->inject_misreference(cid, hoid, cid, hoid_dup, offs_base * (repeats - 1));
+  int expected_errors = bstore->has_null_manager() ? 2 : 4;
+  bstore->umount();
+  SetVal(g_conf(), "bluestore_fsck_threads", "0");
+  ASSERT_EQ(bstore->fsck(false), expected_errors);
+  SetVal(g_conf(), "bluestore_fsck_threads", "4");
+  ASSERT_EQ(bstore->fsck(false), expected_errors);
+  ASSERT_EQ(bstore->repair(false), 0);
+  ASSERT_EQ(bstore->fsck(true), 0);
+}
+
 TEST_P(StoreTestSpecificAUSize, BluestoreBrokenZombieRepairTest) {
   if (string(GetParam()) != "bluestore")
     return;
@@ -0,0 +1,207 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:nil -*-
+// vim: ts=8 sw=2 sts=2 expandtab
+
+#include <atomic>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "global/global_context.h"
+#include "kv/rocksdb_cache/BinnedLRUCache.h"
+
+using namespace rocksdb_cache;
+
+static std::atomic<uint64_t> freed = 0;
+
+static void count_free(rocksdb::Cache::ObjectPtr, rocksdb::MemoryAllocator*)
+{
+  ++freed;
+}
+
+static const rocksdb::Cache::CacheItemHelper helper{
+  rocksdb::CacheEntryRole::kMisc, &count_free};
+
+static std::string key_of(uint32_t k)
+{
+  return "key" + std::to_string(k);
+}
+
+static rocksdb::Cache::ObjectPtr value_of(uint32_t k)
+{
+  return reinterpret_cast<rocksdb::Cache::ObjectPtr>(uintptr_t(k) + 1);
+}
+
+static rocksdb::Status insert(BinnedLRUCacheShard& shard, uint32_t k,
+                              size_t charge,
+                              rocksdb::Cache::Handle** handle = nullptr)
+{
+  return shard.Insert(key_of(k), k, value_of(k), &helper, charge, handle,
+                      rocksdb::Cache::Priority::LOW);
+}
+
+static rocksdb::Cache::Handle* lookup(BinnedLRUCacheShard& shard, uint32_t k)
+{
+  return shard.Lookup(key_of(k), k);
+}
+
+TEST(BinnedLRUCache, pinned_on_lru)
+{
+  BinnedLRUCacheShard shard(g_ceph_context, 1000, false, 0.0);
+  ASSERT_TRUE(insert(shard, 1, 100).ok());
+  ASSERT_TRUE(insert(shard, 2, 100).ok());
+  ASSERT_EQ(2u, shard.TEST_GetLRUSize());
+  ASSERT_EQ(0u, shard.GetPinnedUsage());
+
+  // looked up in the current age bin, it stays on the list
+  auto h = lookup(shard, 1);
+  ASSERT_NE(nullptr, h);
+  auto e = static_cast<BinnedLRUHandle*>(h);
+  ASSERT_EQ(value_of(1), e->value);
+  ASSERT_TRUE(e->HasHit());
+  ASSERT_EQ(2u, shard.TEST_GetLRUSize());
+  ASSERT_EQ(100u, shard.GetPinnedUsage());
+  ASSERT_EQ(100u, shard.GetStats()[l_pinned]);
+
+  ASSERT_TRUE(shard.Ref(h));
+  ASSERT_EQ(100u, shard.GetPinnedUsage());
+  ASSERT_FALSE(shard.Release(h));
+  ASSERT_EQ(100u, shard.GetPinnedUsage());
+  ASSERT_FALSE(shard.Release(h));
+  ASSERT_EQ(0u, shard.GetPinnedUsage());
+  ASSERT_EQ(2u, shard.TEST_GetLRUSize());
+
+  // once in an older bin the lookup takes it off the list
+  shard.shift_bins();
+  h = lookup(shard, 2);
+  ASSERT_NE(nullptr, h);
+  ASSERT_EQ(1u, shard.TEST_GetLRUSize());
+  ASSERT_EQ(100u, shard.GetPinnedUsage());
+  ASSERT_FALSE(shard.Release(h));
+  ASSERT_EQ(2u, shard.TEST_GetLRUSize());
+  ASSERT_EQ(0u, shard.GetPinnedUsage());
+}
+
+TEST(BinnedLRUCache, evict_pinned_on_lru)
+{
+  BinnedLRUCacheShard shard(g_ceph_context, 300, false, 0.0);
+  for (uint32_t k = 0; k < 3; k++) {
+    ASSERT_TRUE(insert(shard, k, 100).ok());
+  }
+  auto h = lookup(shard, 0);
+  ASSERT_NE(nullptr, h);
+  ASSERT_EQ(100u, shard.GetPinnedUsage());
+
+  // the eviction passes over the pinned entry and takes it off the list
+  ASSERT_TRUE(insert(shard, 3, 100).ok());
+  ASSERT_EQ(300u, shard.GetUsage());
+  ASSERT_EQ(100u, shard.GetPinnedUsage());
+  ASSERT_EQ(2u, shard.TEST_GetLRUSize());
+
+  // erased while pinned, freed on the last release
+  uint64_t before = freed;
+  shard.Erase(key_of(0), 0);
+  ASSERT_EQ(nullptr, lookup(shard, 0));
+  ASSERT_EQ(before, freed);
+  ASSERT_TRUE(shard.Release(h));
+  ASSERT_EQ(before + 1, freed);
+  ASSERT_EQ(0u, shard.GetPinnedUsage());
+  ASSERT_EQ(200u, shard.GetUsage());
+}
+
+TEST(BinnedLRUCache, concurrent_pinned)
+{
+  constexpr uint32_t num_keys = 256;
+  constexpr size_t charge = 100;
+  constexpr int num_threads = 8;
+  constexpr int num_ops = 20000;
+  // a quarter of the keys fit, so inserts keep evicting
+  BinnedLRUCacheShard shard(g_ceph_context, num_keys / 4 * charge, false, 0.0);
+  std::atomic<uint64_t> inserted = 0;
+  uint64_t freed_before = freed;
+  std::atomic<bool> stop = false;
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < num_threads; t++) {
+    threads.emplace_back([&, t] {
+      std::mt19937 rng(t);
+      std::vector<rocksdb::Cache::Handle*> held;
+      for (int i = 0; i < num_ops; i++) {
+        uint32_t k = rng() % num_keys;
+        switch (rng() % 8) {
+        case 0:
+        case 1:
+        case 2:
+          // pin it for a while
+          if (auto h = lookup(shard, k); h != nullptr) {
+            auto e = static_cast<BinnedLRUHandle*>(h);
+            ASSERT_EQ(value_of(e->hash), e->value);
+            ASSERT_EQ(key_of(e->hash), e->key().ToString());
+            held.push_back(h);
+          }
+          break;
+        case 3:
+          if (!held.empty()) {
+            auto h = held[rng() % held.size()];
+            ASSERT_TRUE(shard.Ref(h));
+            held.push_back(h);
+          }
+          break;
+        case 4:
+          ++inserted;
+          ASSERT_TRUE(insert(shard, k, charge).ok());
+          break;
+        case 5:
+          {
+            rocksdb::Cache::Handle* h = nullptr;
+            ++inserted;
+            ASSERT_TRUE(insert(shard, k, charge, &h).ok());
+            ASSERT_NE(nullptr, h);
+            held.push_back(h);
+          }
+          break;
+        case 6:
+          shard.Erase(key_of(k), k);
+          break;
+        case 7:
+          if (auto h = lookup(shard, k); h != nullptr) {
+            // dropped right away, the cache may take the chance to free it
+            shard.Release(h, rng() % 16 == 0);
+          }
+          break;
+        }
+        while (held.size() > 4) {
+          auto p = held.begin() + rng() % held.size();
+          shard.Release(*p);
+          held.erase(p);
+        }
+        ASSERT_LE(shard.GetPinnedUsage(), shard.GetUsage());
+      }
+      for (auto h : held) {
+        shard.Release(h);
+      }
+    });
+  }
+  // entries fall out of the current age bin now and then, so lookups take
+  // the exclusive path as well
+  std::thread binner([&] {
+    while (!stop) {
+      shard.shift_bins();
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  });
+  for (auto& t : threads) {
+    t.join();
+  }
+  stop = true;
+  binner.join();
+
+  ASSERT_EQ(0u, shard.GetPinnedUsage());
+  ASSERT_LE(shard.GetUsage(), num_keys / 4 * charge);
+  ASSERT_EQ(shard.GetUsage(), shard.TEST_GetLRUSize() * charge);
+  shard.EraseUnRefEntries();
+  ASSERT_EQ(0u, shard.GetUsage());
+  ASSERT_EQ(0u, shard.TEST_GetLRUSize());
+  ASSERT_EQ(inserted, freed - freed_before);
+}
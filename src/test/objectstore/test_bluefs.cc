@@ -158,6 +158,68 @@ TEST(BlueFS, write_read) {
   fs.umount();
 }
 
+static void do_read_random_batch(const char* buffered) {
+  uint64_t size = 1048576 * 128;
+  TempBdev bdev{size};
+  ConfSaver conf(g_ceph_context->_conf);
+  conf.SetVal("bluefs_alloc_size", "65536");
+  conf.SetVal("bluefs_buffered_io", buffered);
+  conf.ApplyChanges();
+
+  BlueFS fs(g_ceph_context);
+  ASSERT_EQ(0, fs.add_block_device(BlueFS::BDEV_DB, bdev.path, false));
+  uuid_d fsid;
+  ASSERT_EQ(0, fs.mkfs(fsid, { BlueFS::BDEV_DB, false, false }));
+  ASSERT_EQ(0, fs.mount());
+  const uint64_t file_size = 1048576 * 3 + 1234;
+  auto data = gen_buffer(file_size);
+  {
+    BlueFS::FileWriter *h;
+    ASSERT_EQ(0, fs.mkdir("dir"));
+    ASSERT_EQ(0, fs.open_for_write("dir", "file", &h, false));
+    // several appends + fsyncs, so the file spans several extents
+    for (uint64_t pos = 0; pos < file_size; pos += 100000) {
+      uint64_t l = std::min<uint64_t>(100000, file_size - pos);
+      h->append(data.get() + pos, l);
+      fs.fsync(h);
+    }
+    fs.close_writer(h);
+  }
+  {
+    BlueFS::FileReader *h;
+    ASSERT_EQ(0, fs.open_for_read("dir", "file", &h, true));
+    std::mt19937 rng(7);
+    for (unsigned round = 0; round < 20; round++) {
+      std::vector<BlueFS::read_random_req_t> reqs(16);
+      std::vector<std::unique_ptr<char[]>> bufs;
+      for (auto& r : reqs) {
+        // unaligned, some crossing extents, some past eof
+        r.offset = rng() % (file_size + 4096);
+        r.len = 1 + rng() % 200000;
+        bufs.emplace_back(new char[r.len]);
+        r.out = bufs.back().get();
+      }
+      fs.read_random_batch(h, reqs.data(), reqs.size());
+      for (auto& r : reqs) {
+        uint64_t expect = r.offset >= file_size ? 0 :
+          std::min(r.len, file_size - r.offset);
+        ASSERT_EQ(int64_t(expect), r.ret);
+        ASSERT_EQ(0, memcmp(data.get() + r.offset, r.out, expect));
+      }
+    }
+    delete h;
+  }
+  fs.umount();
+}
+
+TEST(BlueFS, read_random_batch) {
+  do_read_random_batch("false");
+}
+
+TEST(BlueFS, read_random_batch_buffered) {
+  do_read_random_batch("true");
+}
+
 TEST(BlueFS, small_appends) {
   uint64_t size = 1048576 * 128;
   TempBdev bdev{size};
@@ -2148,6 +2210,157 @@ TEST(BlueFS, test_concurrent_dir_link_and_compact_log_56210) {
   }
 }
 
+TEST(BlueFS, bench_fsync_latency_during_compact_log) {
+  // Small appends with an fsync each, as RocksDB WAL does, while
+  // another thread keeps compacting a log that describes many files.
+  // Reports how long the appenders got stuck behind compaction.
+  uint64_t size = 1048576 * 512;
+  TempBdev bdev{size};
+  ConfSaver conf(g_ceph_context->_conf);
+  conf.SetVal("bluefs_alloc_size", "65536");
+  conf.SetVal("bluefs_compact_log_sync", "false");
+  conf.ApplyChanges();
+
+  const unsigned num_files = 20000;
+  const unsigned num_fsyncs = 5000;
+
+  BlueFS fs(g_ceph_context);
+  ASSERT_EQ(0, fs.add_block_device(BlueFS::BDEV_DB, bdev.path, false));
+  uuid_d fsid;
+  ASSERT_EQ(0, fs.mkfs(fsid, { BlueFS::BDEV_DB, false, false }));
+  ASSERT_EQ(0, fs.mount());
+  ASSERT_EQ(0, fs.mkdir("db"));
+  for (unsigned i = 0; i < num_files; i++) {
+    BlueFS::FileWriter *h;
+    ASSERT_EQ(0, fs.open_for_write("db", "meta." + to_string(i), &h, false));
+    h->append("x", 1);
+    fs.fsync(h);
+    fs.close_writer(h);
+  }
+
+  const char buf[128] = {0};
+  auto run_fsyncs = [&](const std::string& name) {
+    std::vector<uint64_t> lat_us;
+    lat_us.reserve(num_fsyncs);
+    BlueFS::FileWriter *h;
+    EXPECT_EQ(0, fs.open_for_write("db", name, &h, false));
+    for (unsigned i = 0; i < num_fsyncs; i++) {
+      auto t0 = mono_clock::now();
+      h->append(buf, sizeof(buf));
+      fs.fsync(h);
+      lat_us.push_back(
+        std::chrono::duration_cast<std::chrono::microseconds>(
+          mono_clock::now() - t0).count());
+    }
+    fs.close_writer(h);
+    std::sort(lat_us.begin(), lat_us.end());
+    return lat_us;
+  };
+  auto report = [&](const char* what, const std::vector<uint64_t>& lat_us) {
+    std::cout << what << ": " << num_fsyncs << " fsyncs, "
+              << "p50 " << lat_us[lat_us.size() / 2] << "us "
+              << "p99 " << lat_us[lat_us.size() * 99 / 100] << "us "
+              << "max " << lat_us.back() << "us" << std::endl;
+  };
+
+  // baseline, nothing compacts the log but the fsyncs themselves
+  auto baseline_us = run_fsyncs("wal.baseline");
+
+  atomic_bool stop_compacting{false};
+  uint64_t compactions = 0;
+  std::thread compact_thread([&] {
+    while (!stop_compacting) {
+      fs.compact_log();
+      ++compactions;
+    }
+  });
+  auto lat_us = run_fsyncs("wal");
+  stop_compacting = true;
+  do_join(compact_thread);
+
+  auto [lock_ns, lock_count] =
+    fs.get_perf_counters()->get_tavg_ns(l_bluefs_compaction_lock_lat);
+  report("baseline", baseline_us);
+  report("compacting", lat_us);
+  std::cout << compactions << " compactions of " << num_files << " files, "
+            << "avg compaction lock "
+            << (lock_count ? lock_ns / lock_count / 1000 : 0) << "us"
+            << std::endl;
+  ASSERT_GT(compactions, 0u);
+  fs.umount();
+
+  // everything written during the compactions must survive replay
+  ASSERT_EQ(0, fs.mount());
+  uint64_t wal_size;
+  utime_t mtime;
+  ASSERT_EQ(0, fs.stat("db", "wal", &wal_size, &mtime));
+  ASSERT_EQ(uint64_t(num_fsyncs) * sizeof(buf), wal_size);
+  ASSERT_EQ(0, fs.stat("db", "wal.baseline", &wal_size, &mtime));
+  ASSERT_EQ(uint64_t(num_fsyncs) * sizeof(buf), wal_size);
+  ASSERT_EQ(0, fs.stat("db", "meta." + to_string(num_files - 1),
+                       &wal_size, &mtime));
+  fs.umount();
+}
+
+TEST(BlueFS, test_truncate_during_compact_log) {
+  // truncates rewrite extents async compaction captured but may not have
+  // encoded yet, the compacted log must still replay
+  uint64_t size = 1048576 * 128;
+  TempBdev bdev{size};
+  ConfSaver conf(g_ceph_context->_conf);
+  conf.SetVal("bluefs_alloc_size", "65536");
+  conf.SetVal("bluefs_compact_log_sync", "false");
+  conf.ApplyChanges();
+
+  BlueFS fs(g_ceph_context);
+  ASSERT_EQ(0, fs.add_block_device(BlueFS::BDEV_DB, bdev.path, false));
+  uuid_d fsid;
+  ASSERT_EQ(0, fs.mkfs(fsid, { BlueFS::BDEV_DB, false, false }));
+  ASSERT_EQ(0, fs.mount());
+  ASSERT_EQ(0, fs.mkdir("db"));
+  for (unsigned i = 0; i < 1000; i++) {
+    BlueFS::FileWriter *h;
+    ASSERT_EQ(0, fs.open_for_write("db", "meta." + to_string(i), &h, false));
+    h->append("x", 1);
+    fs.fsync(h);
+    fs.close_writer(h);
+  }
+
+  atomic_bool stop_compacting{false};
+  std::thread compact_thread([&] {
+    while (!stop_compacting) {
+      fs.compact_log();
+    }
+  });
+  const unsigned num_files = 8;
+  std::vector<uint64_t> sizes(num_files);
+  std::string data(200000, 'a');
+  for (unsigned round = 0; round < 50; round++) {
+    for (unsigned i = 0; i < num_files; i++) {
+      BlueFS::FileWriter *h;
+      ASSERT_EQ(0, fs.open_for_write("db", "trunc." + to_string(i), &h, false));
+      h->append(data.c_str(), data.size());
+      fs.fsync(h);
+      sizes[i] = (round + i) % 3 * 70000;
+      fs.truncate(h, sizes[i]);
+      fs.fsync(h);
+      fs.close_writer(h);
+    }
+  }
+  stop_compacting = true;
+  do_join(compact_thread);
+  fs.umount(true);
+
+  ASSERT_EQ(0, fs.mount());
+  for (unsigned i = 0; i < num_files; i++) {
+    uint64_t file_size;
+    utime_t mtime;
+    ASSERT_EQ(0, fs.stat("db", "trunc." + to_string(i), &file_size, &mtime));
+    ASSERT_EQ(sizes[i], file_size);
+  }
+  fs.umount();
+}
+
 TEST(BlueFS, truncate_drops_allocations) {
   constexpr uint64_t K = 1024;
   constexpr uint64_t M = 1024 * K;
@@ -420,6 +420,112 @@ TEST(bluestore_blob_t, csum_bench) {
   }
 }
 
+template <class Alg>
+static void csum_per_block(size_t block_size, const bufferlist& bl,
+                           std::vector<typename Alg::init_value_t>* out)
+{
+  typename Alg::state_t state;
+  Alg::init(&state);
+  auto p = bl.begin();
+  for (size_t i = 0; i < bl.length() / block_size; ++i) {
+    out->push_back(Alg::calc(state, -1, block_size, p));
+  }
+  Alg::fini(&state);
+}
+
+template <class Alg>
+static void csum_blocks_check(size_t block_size, const bufferlist& bl)
+{
+  std::vector<typename Alg::init_value_t> expected;
+  csum_per_block<Alg>(block_size, bl, &expected);
+  size_t blocks = bl.length() / block_size;
+  bufferptr csum_data(blocks * sizeof(typename Alg::value_t));
+  Checksummer::calculate<Alg>(block_size, 0, blocks * block_size, bl,
+                              &csum_data);
+  auto pv = reinterpret_cast<const typename Alg::value_t*>(csum_data.c_str());
+  for (size_t i = 0; i < blocks; ++i) {
+    ASSERT_EQ(expected[i], (typename Alg::init_value_t)pv[i]) << "block " << i;
+  }
+  ASSERT_EQ(-1, Checksummer::verify<Alg>(block_size, 0, blocks * block_size,
+                                         bl, csum_data));
+}
+
+TEST(Checksummer, blocks_match_per_block) {
+  // buffers of odd sizes, so that some blocks straddle two of them
+  bufferlist bl;
+  unsigned seed = 1;
+  for (size_t len : {4096 * 9, 4096 * 2 + 1000, 77, 4096 * 5 - 77 - 1000,
+                     4096 * 16}) {
+    bufferptr bp(len);
+    for (size_t i = 0; i < len; ++i) {
+      seed = seed * 1103515245 + 12345;
+      bp.c_str()[i] = seed >> 16;
+    }
+    bl.append(bp);
+  }
+  for (const char* impl : {"scalar", "sse42", "avx2"}) {
+    if (!Checksummer::set_blocks_impl(impl)) {
+      cout << impl << " not supported, skipping" << std::endl;
+      continue;
+    }
+    cout << "impl " << Checksummer::get_blocks_impl() << std::endl;
+    for (size_t block_size : {8, 512, 4096, 65536}) {
+      csum_blocks_check<Checksummer::crc32c>(block_size, bl);
+      csum_blocks_check<Checksummer::crc32c_16>(block_size, bl);
+      csum_blocks_check<Checksummer::crc32c_8>(block_size, bl);
+      csum_blocks_check<Checksummer::xxhash32>(block_size, bl);
+      csum_blocks_check<Checksummer::xxhash64>(block_size, bl);
+    }
+  }
+  ASSERT_TRUE(Checksummer::set_blocks_impl("auto"));
+}
+
+TEST(Checksummer, blocks_bench) {
+  bufferlist bl;
+  bufferptr bp(4 * 1024 * 1024);
+  for (char *a = bp.c_str(); a < bp.c_str() + bp.length(); ++a)
+    *a = (unsigned long)a & 0xff;
+  bl.append(bp);
+  const size_t block_size = 4096;
+  const size_t blocks = bl.length() / block_size;
+  const int count = 64;
+  auto report = [&](const char* what, auto f) {
+    auto start = ceph::mono_clock::now();
+    for (int i = 0; i < count; ++i) {
+      f();
+    }
+    auto dur = ceph::mono_clock::now() - start;
+    double mbsec = (double)count * bl.length() / 1000000.0 /
+                   ceph::to_seconds<double>(dur);
+    cout << what << ": " << mbsec << " MB/sec" << std::endl;
+  };
+  bufferptr csum_data(blocks * 8);
+  std::vector<uint32_t> crcs;
+  std::vector<uint64_t> xxhs;
+  report("crc32c per block", [&] {
+    crcs.clear();
+    csum_per_block<Checksummer::crc32c>(block_size, bl, &crcs);
+  });
+  report("xxhash64 per block", [&] {
+    xxhs.clear();
+    csum_per_block<Checksummer::xxhash64>(block_size, bl, &xxhs);
+  });
+  for (const char* impl : {"scalar", "sse42", "avx2"}) {
+    if (!Checksummer::set_blocks_impl(impl)) {
+      continue;
+    }
+    report((std::string("crc32c blocks ") + impl).c_str(), [&] {
+      Checksummer::calculate<Checksummer::crc32c>(
+        block_size, 0, bl.length(), bl, &csum_data);
+    });
+    report((std::string("xxhash64 blocks ") + impl).c_str(), [&] {
+      Checksummer::calculate<Checksummer::xxhash64>(
+        block_size, 0, bl.length(), bl, &csum_data);
+    });
+  }
+  ASSERT_TRUE(Checksummer::set_blocks_impl("auto"));
+}
+
 TEST(Blob, put_ref) {
   {
     BlueStore store(g_ceph_context, "", 4096);
@@ -1452,6 +1558,54 @@ TEST(Blob, legacy_decode) {
   }
 }
 
+TEST(SharedBlobSet, lookup_add_remove) {
+  BlueStore store(g_ceph_context, "", 4096);
+  std::unique_ptr<BlueStore::OnodeCacheShard> oc(
+    BlueStore::OnodeCacheShard::create(g_ceph_context, "lru", NULL));
+  std::unique_ptr<BlueStore::BufferCacheShard> bc(
+    BlueStore::BufferCacheShard::create(&store, "lru", NULL));
+  auto coll = ceph::make_ref<BlueStore::Collection>(&store, oc.get(), bc.get(), coll_t());
+  auto& set = coll->shared_blob_set;
+
+  // enough to go through several rehashes
+  std::vector<BlueStore::SharedBlobRef> sbs;
+  for (uint64_t sbid = 1; sbid <= 1000; ++sbid) {
+    sbs.emplace_back(new BlueStore::SharedBlob(sbid, coll.get()));
+    set.add(coll.get(), sbs.back().get());
+  }
+  for (uint64_t sbid = 1; sbid <= 1000; ++sbid) {
+    ASSERT_EQ(sbs[sbid - 1], set.lookup(sbid));
+  }
+  ASSERT_FALSE(set.lookup(1001));
+
+  // dropping the last reference takes a blob out of the set
+  for (uint64_t sbid = 1; sbid <= 1000; sbid += 2) {
+    sbs[sbid - 1].reset();
+  }
+  for (uint64_t sbid = 1; sbid <= 1000; ++sbid) {
+    ASSERT_EQ(sbid % 2 == 0, (bool)set.lookup(sbid));
+  }
+  // a replaced entry is left alone when the old blob goes
+  {
+    BlueStore::SharedBlobRef sb2(new BlueStore::SharedBlob(2, coll.get()));
+    set.add(coll.get(), sb2.get());
+    ASSERT_EQ(sb2, set.lookup(2));
+    sbs[1].reset();
+    ASSERT_EQ(sb2, set.lookup(2));
+    sbs[1] = sb2;
+  }
+  // tombstones get reused and purged
+  for (uint64_t sbid = 1; sbid <= 1000; sbid += 2) {
+    sbs[sbid - 1] = new BlueStore::SharedBlob(sbid, coll.get());
+    set.add(coll.get(), sbs[sbid - 1].get());
+  }
+  for (uint64_t sbid = 1; sbid <= 1000; ++sbid) {
+    ASSERT_EQ(sbs[sbid - 1], set.lookup(sbid));
+  }
+  sbs.clear();
+  ASSERT_TRUE(set.empty());
+}
+
 TEST(ExtentMap, seek_lextent) {
   BlueStore store(g_ceph_context, "", 4096);
   std::unique_ptr<BlueStore::OnodeCacheShard> oc{
@@ -2104,6 +2258,72 @@ class PunchHoleFixture : public BlueStoreFixture
 };
 
 
+TEST(ExtentMap, columnar_encoding) {
+  BlueStore store(g_ceph_context, "", 4096);
+  std::unique_ptr<BlueStore::OnodeCacheShard> oc(
+    BlueStore::OnodeCacheShard::create(g_ceph_context, "lru", NULL));
+  std::unique_ptr<BlueStore::BufferCacheShard> bc(
+    BlueStore::BufferCacheShard::create(&store, "lru", NULL));
+  auto coll = ceph::make_ref<BlueStore::Collection>(&store, oc.get(), bc.get(), coll_t());
+  BlueStore::Onode onode(coll.get(), ghobject_t(), "");
+  BlueStore::ExtentMap& em = onode.extent_map;
+
+  // holes, odd lengths, blobs referenced by two extents and blobs in
+  // the fast tier address window
+  uint32_t pos = 0;
+  for (unsigned i = 0; i < 200; ++i) {
+    BlueStore::BlobRef b(coll->new_blob());
+    uint64_t disk = 0x100000 + i * 0x3000;
+    if (i % 7 == 0) {
+      disk += BLUESTORE_FAST_TIER_BASE;
+    }
+    b->dirty_blob().allocated_test(bluestore_pextent_t(disk, 0x2000));
+    b->dirty_blob().init_csum(Checksummer::CSUM_CRC32C, 12, 0x2000);
+    if (i % 3 == 0) {
+      pos += 0x1000;
+    }
+    uint32_t len = i % 11 == 0 ? 0x200 : 0x1000;
+    em.set_lextent(coll, pos, 0, len, b, nullptr);
+    pos += len;
+    if (i % 2 == 0) {
+      em.set_lextent(coll, pos, 0x1000, 0x1000, b, nullptr);
+      pos += 0x1000;
+    }
+  }
+
+  bufferlist v2, v3;
+  unsigned n2 = 0, n3 = 0;
+  store.debug_set_extent_map_columnar(false);
+  ASSERT_FALSE(em.encode_some(0, BlueStore::OBJECT_MAX_SIZE, v2, &n2, true, false));
+  store.debug_set_extent_map_columnar(true);
+  ASSERT_FALSE(em.encode_some(0, BlueStore::OBJECT_MAX_SIZE, v3, &n3, true, false));
+  ASSERT_EQ(em.extent_map.size(), n2);
+  ASSERT_EQ(n2, n3);
+  std::cout << n2 << " extents: v2 " << v2.length() << " bytes, v3 "
+            << v3.length() << " bytes" << std::endl;
+
+  for (auto* bl : {&v2, &v3}) {
+    BlueStore::Onode loaded(coll.get(), ghobject_t(), "");
+    bl->rebuild();
+    ASSERT_EQ(n2, loaded.extent_map.decode_some(*bl));
+    ASSERT_EQ(em.extent_map.size(), loaded.extent_map.extent_map.size());
+    auto a = em.extent_map.begin();
+    auto b = loaded.extent_map.extent_map.begin();
+    BlueStore::Blob* prev_a = nullptr;
+    BlueStore::Blob* prev_b = nullptr;
+    for (; a != em.extent_map.end(); ++a, ++b) {
+      ASSERT_EQ(a->logical_offset, b->logical_offset);
+      ASSERT_EQ(a->blob_offset, b->blob_offset);
+      ASSERT_EQ(a->length, b->length);
+      ASSERT_EQ(a->blob->get_blob().get_extents(),
+                b->blob->get_blob().get_extents());
+      ASSERT_EQ(a->blob.get() == prev_a, b->blob.get() == prev_b);
+      prev_a = a->blob.get();
+      prev_b = b->blob.get();
+    }
+  }
+}
+
 class ExtentMapFixture : virtual public ::testing::Test {
 
 public:
@@ -4583,6 +4803,54 @@ TEST(bluestore_blob_use_tracker_t, mempool_stats_test) {
   }
 }
 
+TEST(DeferredPolicy, steps) {
+  using namespace std::chrono_literals;
+  DeferredPolicy dp;
+  DeferredPolicy::params_t p;
+  p.max_level = 2;
+  dp.set_base(0x10000);
+  uint64_t size;
+  auto feed = [&](ceph::timespan direct, ceph::timespan commit) {
+    for (uint64_t i = 0; i < p.min_samples; i++) {
+      dp.note_direct(direct);
+      dp.note_commit(commit);
+    }
+  };
+
+  // no samples, nothing to go by
+  ASSERT_EQ(DeferredPolicy::HOLD, dp.update(0, p, &size));
+  ASSERT_EQ(0x10000u, size);
+
+  // slow main device: defer more, up to base << max_level
+  for (unsigned i = 0; i < 4; i++) {
+    feed(10ms, 1ms);
+    ASSERT_EQ(DeferredPolicy::RAISE, dp.update(0, p, &size));
+  }
+  ASSERT_EQ(0x40000u, size);
+
+  // deferred writes pile up: lower regardless of latencies
+  feed(10ms, 1ms);
+  ASSERT_EQ(DeferredPolicy::LOWER_BACKLOG, dp.update(0.9, p, &size));
+  ASSERT_EQ(0x20000u, size);
+  // half way through the backlog allowance, neither raise nor lower
+  feed(10ms, 1ms);
+  ASSERT_EQ(DeferredPolicy::HOLD, dp.update(0.3, p, &size));
+  ASSERT_EQ(0x20000u, size);
+
+  // fast main device: down to not deferring at all
+  for (unsigned i = 0; i < 10; i++) {
+    feed(100us, 1ms);
+    ASSERT_EQ(DeferredPolicy::LOWER_FAST_DEVICE, dp.update(0, p, &size));
+  }
+  ASSERT_EQ(0u, size);
+
+  uint64_t base;
+  ASSERT_TRUE(dp.reset(&base));
+  ASSERT_EQ(0x10000u, base);
+  ASSERT_EQ(0x10000u, dp.get_effective());
+  ASSERT_FALSE(dp.reset(&base));
+}
+
 int main(int argc, char **argv) {
   auto args = argv_to_vec(argc, argv);
   auto cct =
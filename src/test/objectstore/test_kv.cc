@@ -564,6 +564,48 @@ TEST_P(KVTest, RocksDBShardingIteratorTest) {
   fini();
 }
 
+TEST_P(KVTest, RocksDBShardingPrefetchIteratorTest) {
+  if(string(GetParam()) != "rocksdb")
+    return;
+
+  std::string cfs("A(6)");
+  ASSERT_EQ(0, db->init(g_conf()->bluestore_rocksdb_options));
+  cout << "creating one column family and opening it" << std::endl;
+  ASSERT_EQ(0, db->create_and_open(cout, cfs));
+  {
+    KeyValueDB::Transaction t = db->get_transaction();
+    for (int v = 100; v <= 999; v++) {
+      std::string str = to_string(v);
+      bufferlist val;
+      val.append(str);
+      t->set("A", str, val);
+    }
+    ASSERT_EQ(0, db->submit_transaction_sync(t));
+  }
+  {
+    KeyValueDB::Iterator it =
+      db->get_iterator("A", KeyValueDB::ITERATOR_PREFETCH);
+    ASSERT_EQ(it->seek_to_first(), 0);
+    for (int pos = 100; pos <= 999; pos++) {
+      ASSERT_EQ(it->valid(), true);
+      ASSERT_EQ(it->key(), to_string(pos));
+      ASSERT_EQ(it->value().to_str(), to_string(pos));
+      it->next();
+    }
+    ASSERT_EQ(it->valid(), false);
+    ASSERT_EQ(it->upper_bound("500"), 0);
+    ASSERT_EQ(it->valid(), true);
+    ASSERT_EQ(it->key(), "501");
+    ASSERT_EQ(it->lower_bound("500"), 0);
+    ASSERT_EQ(it->valid(), true);
+    ASSERT_EQ(it->key(), "500");
+    ASSERT_EQ(it->seek_to_last(), 0);
+    ASSERT_EQ(it->valid(), true);
+    ASSERT_EQ(it->key(), "999");
+  }
+  fini();
+}
+
 TEST_P(KVTest, RocksDBCFMerge) {
   if(string(GetParam()) != "rocksdb")
     return;
@@ -12,6 +12,8 @@
  * Foundation. See file COPYING.
  *
  */
+#include <atomic>
+#include <thread>
 #include <boost/intrusive_ptr.hpp>
 #include "global/global_init.h"
 #include "common/ceph_argparse.h"
@@ -184,6 +186,166 @@ TEST_F(MemStoreClone, CloneRangeHoleEnd)
   ASSERT_EQ(expected, result);
 }
 
+class MemStoreArena : public MemStoreClone {
+public:
+  void SetUp() override {
+    SetVal(g_conf(), "memstore_page_set", "true");
+    SetVal(g_conf(), "memstore_page_arena", "true");
+    SetVal(g_conf(), "memstore_page_arena_size", "4096");
+    MemStoreClone::SetUp();
+  }
+};
+
+// src 11[11 __ __ 11]11
+// dst 22 22 22 22 22 22
+// res 22 11 00 00 11 22
+TEST_F(MemStoreArena, CloneRangeHoleMiddle)
+{
+  ASSERT_TRUE(store);
+
+  const auto src = make_ghobject("src4");
+  const auto dst = make_ghobject("dst4");
+
+  bufferlist srcbl, dstbl, result, expected;
+  srcbl.append("1111");
+  dstbl.append("222222222222");
+  expected.append("2211\000\000\000\0001122", 12);
+
+  ObjectStore::Transaction t;
+  t.write(cid, src, 0, 4, srcbl);
+  t.write(cid, src, 8, 4, srcbl);
+  t.write(cid, dst, 0, 12, dstbl);
+  t.clone_range(cid, src, dst, 2, 8, 2);
+  ASSERT_EQ(0, store->queue_transaction(ch, std::move(t)));
+  ASSERT_EQ(12, store->read(ch, dst, 0, 12, result));
+  ASSERT_EQ(expected, result);
+}
+
+// pages of one write are read back as a single buffer, which keeps its
+// contents when the object is overwritten
+TEST_F(MemStoreArena, ReadContiguous)
+{
+  ASSERT_TRUE(store);
+
+  const auto oid = make_ghobject("obj");
+
+  bufferlist bl, result, result2, expected;
+  bl.append(std::string(64, 'a'));
+  {
+    ObjectStore::Transaction t;
+    t.write(cid, oid, 0, bl.length(), bl);
+    ASSERT_EQ(0, store->queue_transaction(ch, std::move(t)));
+  }
+  ASSERT_EQ(64, store->read(ch, oid, 0, 64, result));
+  ASSERT_EQ(1u, result.get_num_buffers());
+  ASSERT_EQ(bl, result);
+
+  bufferlist bl2;
+  bl2.append(std::string(10, 'b'));
+  {
+    ObjectStore::Transaction t;
+    t.write(cid, oid, 5, bl2.length(), bl2);
+    ASSERT_EQ(0, store->queue_transaction(ch, std::move(t)));
+  }
+  ASSERT_EQ(bl, result);
+  expected.append(std::string(5, 'a'));
+  expected.append(std::string(10, 'b'));
+  expected.append(std::string(49, 'a'));
+  ASSERT_EQ(64, store->read(ch, oid, 0, 64, result2));
+  ASSERT_EQ(expected, result2);
+}
+
+// whole pages are shared by clone_range and copied when either side is
+// written
+TEST_F(MemStoreArena, CloneRangeShared)
+{
+  ASSERT_TRUE(store);
+
+  const auto src = make_ghobject("src5");
+  const auto dst = make_ghobject("dst5");
+
+  bufferlist srcbl, bl, result, expected;
+  srcbl.append("111111111111");
+  bl.append("33");
+
+  ObjectStore::Transaction t;
+  t.write(cid, src, 0, 12, srcbl);
+  t.clone_range(cid, src, dst, 0, 12, 4);
+  t.write(cid, src, 4, 2, bl);
+  ASSERT_EQ(0, store->queue_transaction(ch, std::move(t)));
+  expected.append("\000\000\000\000111111111111", 16);
+  ASSERT_EQ(16, store->read(ch, dst, 0, 16, result));
+  ASSERT_EQ(expected, result);
+}
+
+TEST_F(MemStoreArena, TruncateAndReload)
+{
+  ASSERT_TRUE(store);
+
+  const auto oid = make_ghobject("obj2");
+
+  bufferlist bl, result, expected;
+  bl.append("111111111111");
+  {
+    ObjectStore::Transaction t;
+    t.write(cid, oid, 0, 12, bl);
+    t.truncate(cid, oid, 6);
+    t.truncate(cid, oid, 12);
+    ASSERT_EQ(0, store->queue_transaction(ch, std::move(t)));
+  }
+  CloseAndReopen();
+  ch = store->open_collection(cid);
+  ASSERT_TRUE(ch);
+  expected.append("111111\000\000\000\000\000\000", 12);
+  ASSERT_EQ(12, store->read(ch, oid, 0, 12, result));
+  ASSERT_EQ(expected, result);
+}
+
+// reads run alongside transactions and must never see a write (or the
+// pages it replaces) half way through
+TEST_F(MemStoreArena, ConcurrentReadWrite)
+{
+  ASSERT_TRUE(store);
+
+  const auto oid = make_ghobject("obj3");
+  const auto src = make_ghobject("src6");
+  constexpr unsigned len = 64;
+  constexpr unsigned rounds = 2000;
+  {
+    bufferlist bl;
+    bl.append(std::string(len, 'a'));
+    ObjectStore::Transaction t;
+    t.write(cid, oid, 0, len, bl);
+    ASSERT_EQ(0, store->queue_transaction(ch, std::move(t)));
+  }
+
+  std::atomic<bool> done = false;
+  std::thread writer([&] {
+    for (unsigned i = 0; i < rounds; i++) {
+      bufferlist bl;
+      bl.append(std::string(len, 'a' + i % 26));
+      ObjectStore::Transaction t;
+      if (i % 3 == 0) {
+        t.write(cid, src, 0, len, bl);
+        t.clone_range(cid, src, oid, 0, len, 0);
+      } else {
+        t.write(cid, oid, 0, len, bl);
+      }
+      store->queue_transaction(ch, std::move(t));
+    }
+    done = true;
+  });
+  while (!done) {
+    bufferlist result;
+    EXPECT_EQ((int)len, store->read(ch, oid, 0, len, result));
+    std::string s = result.to_str();
+    EXPECT_EQ(std::string(len, s[0]), s);
+    if (HasFailure())
+      break;
+  }
+  writer.join();
+}
+
 int main(int argc, char** argv)
 {
   // default to memstore